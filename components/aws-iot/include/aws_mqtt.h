@@ -15,8 +15,10 @@
 
 #include "core_mqtt.h"
 #include "tls_freertos.h"
+#include "mqtt_transport.h"
 
-MQTTStatus_t connect_to_broker(MQTTContext_t* mqtt_context, NetworkContext_t* network_context, MQTTEventCallback_t event_callback, MQTTFixedBuffer_t* mqtt_buffer, const char* mqtt_url, const int mqtt_port, const char* root_ca, char* cert, char* key, char* serial_number);
+MQTTStatus_t connect_to_broker(MQTTContext_t* mqtt_context, NetworkContext_t* network_context, const mqtt_transport* transport, MQTTEventCallback_t event_callback, MQTTFixedBuffer_t* mqtt_buffer, const char* mqtt_url, const int mqtt_port, const char* root_ca, char* cert, char* key, char* serial_number, uint16_t keep_alive_s, uint32_t timeout_ms);
 void disconnect_from_broker(MQTTContext_t* mqtt_context, NetworkContext_t* network_context);
-MQTTStatus_t publish_message(MQTTContext_t* mqtt_context, const char* topic, const char* payload, MQTTQoS_t qos);
+MQTTStatus_t publish_message(MQTTContext_t* mqtt_context, const char* topic, const void* payload, size_t payload_length, MQTTQoS_t qos, uint16_t* packet_id);
+MQTTStatus_t republish_message(MQTTContext_t* mqtt_context, const char* topic, const void* payload, size_t payload_length, MQTTQoS_t qos, uint16_t packet_id);
 MQTTStatus_t subscribe_to_topic(MQTTContext_t* mqtt_context, char *topics[], int topics_count, MQTTQoS_t qos);
\ No newline at end of file
@@ -0,0 +1,53 @@
+#ifndef LOOPBACK_TRANSPORT_H
+#define LOOPBACK_TRANSPORT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define LOOPBACK_BUFFER_SIZE 2048
+#define LOOPBACK_MAX_RESPONSES 16
+#define LOOPBACK_MAX_RESPONSE 16
+
+// Link conditions applied to every packet, the latency applies in each
+// direction. Zero means no fault of that kind.
+typedef struct {
+  uint32_t latency_ms;
+  uint32_t bytes_per_second;
+  uint16_t loss_per_mille;
+  uint32_t disconnect_after;
+} loopback_faults;
+
+typedef struct {
+  uint32_t due_ms;
+  uint8_t len;
+  uint8_t data[LOOPBACK_MAX_RESPONSE];
+} loopback_response;
+
+// In-memory stand-in for a broker. It answers CONNECT, PUBLISH, SUBSCRIBE,
+// UNSUBSCRIBE and PINGREQ the way a broker would, after the configured
+// latency and serialization delay, so the MQTT client can be exercised
+// without a network. Incoming publishes are acknowledged, not delivered.
+typedef struct loopback_link {
+  loopback_faults faults;
+  uint32_t (*now_ms)(void);
+  uint32_t seed;
+  bool connected;
+  uint32_t busy_until_ms;
+  uint32_t packets;
+  uint32_t dropped;
+  size_t in_len;
+  uint8_t in[LOOPBACK_BUFFER_SIZE];
+  size_t out_head;
+  size_t out_count;
+  size_t out_pos;
+  loopback_response out[LOOPBACK_MAX_RESPONSES];
+} loopback_link;
+
+void loopback_open(loopback_link *link, const loopback_faults *faults,
+                   uint32_t (*now_ms)(void), uint32_t seed);
+void loopback_close(loopback_link *link);
+int32_t loopback_send(loopback_link *link, const void *buf, size_t len);
+int32_t loopback_recv(loopback_link *link, void *buf, size_t len);
+
+#endif
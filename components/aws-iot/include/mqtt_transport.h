@@ -0,0 +1,29 @@
+#ifndef MQTT_TRANSPORT_H
+#define MQTT_TRANSPORT_H
+
+#include "loopback_transport.h"
+#include "tls_freertos.h"
+
+// Backend carrying the MQTT connection. All of them share the TLS transport
+// status codes so connect_to_broker can retry any of them the same way.
+typedef struct mqtt_transport {
+  const char *name;
+  TlsTransportStatus_t (*connect)(NetworkContext_t *network_context,
+                                  const char *host, uint16_t port,
+                                  const NetworkCredentials_t *credentials,
+                                  uint32_t receive_timeout_ms,
+                                  uint32_t send_timeout_ms);
+  void (*disconnect)(NetworkContext_t *network_context);
+  TransportSend_t send;
+  TransportRecv_t recv;
+} mqtt_transport;
+
+extern const mqtt_transport mqtt_transport_tls;
+extern const mqtt_transport mqtt_transport_tcp;
+extern const mqtt_transport mqtt_transport_loopback;
+
+// NULL selects TLS, an unknown name returns NULL.
+const mqtt_transport *mqtt_transport_find(const char *name);
+void mqtt_transport_set_faults(const loopback_faults *faults);
+
+#endif
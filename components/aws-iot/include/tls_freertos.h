@@ -75,6 +75,8 @@ struct NetworkContext
     esp_transport_handle_t transport;
     uint32_t receiveTimeoutMs;
     uint32_t sendTimeoutMs;
+    const struct mqtt_transport * backend;
+    struct loopback_link * loopback;
 };
 
 /**
@@ -9,6 +9,8 @@
 #define RETRY_MAX_ATTEMPTS (5U)
 #define RETRY_MAX_BACKOFF_DELAY_MS (5000U)
 #define RETRY_BACKOFF_BASE_MS (500U)
+#define RETRY_ATTEMPT_TIMEOUT_MS (5000U)
+#define CONNACK_TIMEOUT_MS (10000U)
 
 #define MILLISECONDS_PER_SECOND (1000U)
 #define MILLISECONDS_PER_TICK (MILLISECONDS_PER_SECOND / configTICK_RATE_HZ)
@@ -17,18 +19,22 @@ static uint32_t get_time_in_ms(void);
 static TlsTransportStatus_t
 connect_to_broker_with_backoff(NetworkCredentials_t *network_credentials,
                                NetworkContext_t *network_context,
-                               const char *mqtt_url, const int mqtt_port);
+                               const mqtt_transport *transport,
+                               const char *mqtt_url, const int mqtt_port,
+                               uint32_t deadline_ms);
 static uint32_t ulGlobalEntryTimeMs;
 
 MQTTStatus_t connect_to_broker(MQTTContext_t *mqtt_context,
                                NetworkContext_t *network_context,
+                               const mqtt_transport *transport,
                                MQTTEventCallback_t event_callback,
                                MQTTFixedBuffer_t *mqtt_buffer,
                                const char *mqtt_url, const int mqtt_port,
                                const char *root_ca, char *cert, char *key,
-                               char *thing_name) {
-  LogInfo(("Connecting to AWS MQTT Broker [%s:%d] with name [%s]", mqtt_url,
-           mqtt_port, thing_name));
+                               char *thing_name, uint16_t keep_alive_s,
+                               uint32_t timeout_ms) {
+  LogInfo(("Connecting to AWS MQTT Broker [%s:%d] over %s with name [%s]",
+           mqtt_url, mqtt_port, transport->name, thing_name));
 
   MQTTStatus_t ret = MQTTIllegalState;
   TlsTransportStatus_t network_status;
@@ -36,24 +42,28 @@ MQTTStatus_t connect_to_broker(MQTTContext_t *mqtt_context,
   NetworkCredentials_t network_credentials = {0};
   MQTTConnectInfo_t mqtt_connection_info = {0};
   bool mqtt_session_present;
+  uint32_t deadline_ms = get_time_in_ms() + timeout_ms;
 
+  // Only TLS needs the credentials, the other transports may run without.
   network_credentials.pRootCa = root_ca;
-  network_credentials.rootCaSize = strlen(root_ca);
+  network_credentials.rootCaSize = root_ca ? strlen(root_ca) : 0;
   network_credentials.pClientCert = cert;
-  network_credentials.clientCertSize = strlen(cert);
+  network_credentials.clientCertSize = cert ? strlen(cert) : 0;
   network_credentials.pPrivateKey = key;
-  network_credentials.privateKeySize = strlen(key);
+  network_credentials.privateKeySize = key ? strlen(key) : 0;
 
   LogDebug(("client cert %s", network_credentials.pClientCert));
 
+  network_context->backend = transport;
   network_transport.pNetworkContext = network_context;
-  network_transport.send = TLS_FreeRTOS_send;
-  network_transport.recv = TLS_FreeRTOS_recv;
+  network_transport.send = transport->send;
+  network_transport.recv = transport->recv;
 
   network_status = connect_to_broker_with_backoff(
-      &network_credentials, network_context, mqtt_url, mqtt_port);
+      &network_credentials, network_context, transport, mqtt_url, mqtt_port,
+      deadline_ms);
   if (network_status != TLS_TRANSPORT_SUCCESS) {
-    LogError(("TLS Connection failed failed [%d]", network_status));
+    LogError(("%s connection failed [%d]", transport->name, network_status));
     return ret;
   }
 
@@ -61,18 +71,27 @@ MQTTStatus_t connect_to_broker(MQTTContext_t *mqtt_context,
                   event_callback, mqtt_buffer);
   if (ret != MQTTSuccess) {
     LogError(("MQTT_Init failed [%d]", ret));
+    transport->disconnect(network_context);
     return ret;
   }
 
   mqtt_connection_info.cleanSession = true;
   mqtt_connection_info.pClientIdentifier = thing_name;
   mqtt_connection_info.clientIdentifierLength = (uint16_t)strlen(thing_name);
-  mqtt_connection_info.keepAliveSeconds = 20;
+  mqtt_connection_info.keepAliveSeconds = keep_alive_s;
+
+  uint32_t now_ms = get_time_in_ms();
+  uint32_t connack_timeout_ms =
+      deadline_ms > now_ms ? deadline_ms - now_ms : 0;
+  if (connack_timeout_ms > CONNACK_TIMEOUT_MS) {
+    connack_timeout_ms = CONNACK_TIMEOUT_MS;
+  }
 
-  ret = MQTT_Connect(mqtt_context, &mqtt_connection_info, NULL, 10000,
-                     &mqtt_session_present);
+  ret = MQTT_Connect(mqtt_context, &mqtt_connection_info, NULL,
+                     connack_timeout_ms, &mqtt_session_present);
   if (ret != MQTTSuccess) {
     LogError(("MQTT_Connect failed [%d]", ret));
+    transport->disconnect(network_context);
     return ret;
   }
 
@@ -80,24 +99,26 @@ MQTTStatus_t connect_to_broker(MQTTContext_t *mqtt_context,
   return ret;
 }
 
-MQTTStatus_t publish_message(MQTTContext_t *mqtt_context, const char *topic,
-                             const char *payload, MQTTQoS_t qos) {
+static MQTTStatus_t send_publish(MQTTContext_t *mqtt_context,
+                                 const char *topic, const void *payload,
+                                 size_t payload_length, MQTTQoS_t qos,
+                                 uint16_t packet_id, bool dup) {
   LogInfo(("Publishing to %s.", topic));
 
   MQTTPublishInfo_t mqtt_publish_info;
   (void)memset((void *)&mqtt_publish_info, 0x00, sizeof(mqtt_publish_info));
 
-  uint16_t package_id = MQTT_GetPacketId(mqtt_context);
   mqtt_publish_info.qos = qos;
   mqtt_publish_info.retain = false;
+  mqtt_publish_info.dup = dup;
   mqtt_publish_info.pTopicName = topic;
   mqtt_publish_info.topicNameLength = (uint16_t)strlen(topic);
   mqtt_publish_info.pPayload = payload;
-  mqtt_publish_info.payloadLength = strlen(payload);
+  mqtt_publish_info.payloadLength = payload_length;
 
   LogInfo(("Sending %d bytes.", mqtt_publish_info.payloadLength));
 
-  MQTTStatus_t ret = MQTT_Publish(mqtt_context, &mqtt_publish_info, package_id);
+  MQTTStatus_t ret = MQTT_Publish(mqtt_context, &mqtt_publish_info, packet_id);
 
   if (ret != MQTTSuccess) {
     LogError(("MQTT_Publish failed. Error %d.", ret));
@@ -106,6 +127,28 @@ MQTTStatus_t publish_message(MQTTContext_t *mqtt_context, const char *topic,
   return ret;
 }
 
+MQTTStatus_t publish_message(MQTTContext_t *mqtt_context, const char *topic,
+                             const void *payload, size_t payload_length,
+                             MQTTQoS_t qos, uint16_t *packet_id) {
+  uint16_t package_id = MQTT_GetPacketId(mqtt_context);
+
+  MQTTStatus_t ret = send_publish(mqtt_context, topic, payload,
+                                  payload_length, qos, package_id, false);
+  if (ret == MQTTSuccess && packet_id != NULL) {
+    *packet_id = package_id;
+  }
+
+  return ret;
+}
+
+// coreMQTT accepts a DUP publish for a packet id still waiting for its ack.
+MQTTStatus_t republish_message(MQTTContext_t *mqtt_context, const char *topic,
+                               const void *payload, size_t payload_length,
+                               MQTTQoS_t qos, uint16_t packet_id) {
+  return send_publish(mqtt_context, topic, payload, payload_length, qos,
+                      packet_id, true);
+}
+
 MQTTStatus_t subscribe_to_topic(MQTTContext_t *mqtt_context, char *topics[],
                                 int topics_count, MQTTQoS_t qos) {
   LogInfo(("Subscribing to %d topics.", topics_count));
@@ -136,14 +179,16 @@ void disconnect_from_broker(MQTTContext_t *mqtt_context,
                             NetworkContext_t *network_context) {
   LogInfo(("Disconnecting from broker"));
   MQTT_Disconnect(mqtt_context);
-  TLS_FreeRTOS_Disconnect(network_context);
+  network_context->backend->disconnect(network_context);
 }
 
 static TlsTransportStatus_t
 connect_to_broker_with_backoff(NetworkCredentials_t *network_credentials,
                                NetworkContext_t *network_context,
-                               const char *mqtt_url, const int mqtt_port) {
-  TlsTransportStatus_t network_status;
+                               const mqtt_transport *transport,
+                               const char *mqtt_url, const int mqtt_port,
+                               uint32_t deadline_ms) {
+  TlsTransportStatus_t network_status = TLS_TRANSPORT_CONNECT_FAILURE;
   BackoffAlgorithmStatus_t retry_status = BackoffAlgorithmSuccess;
   BackoffAlgorithmContext_t retry_params;
   uint16_t next_retry_backoff = 0;
@@ -152,14 +197,31 @@ connect_to_broker_with_backoff(NetworkCredentials_t *network_credentials,
                                     RETRY_MAX_BACKOFF_DELAY_MS,
                                     RETRY_MAX_ATTEMPTS);
   do {
-    network_status = TLS_FreeRTOS_Connect(network_context, mqtt_url, mqtt_port,
-                                          network_credentials, 5000, 5000);
+    uint32_t now_ms = get_time_in_ms();
+    if (now_ms >= deadline_ms) {
+      LogWarn(("Connection deadline reached, giving up."));
+      break;
+    }
+
+    uint32_t attempt_timeout_ms = deadline_ms - now_ms;
+    if (attempt_timeout_ms > RETRY_ATTEMPT_TIMEOUT_MS) {
+      attempt_timeout_ms = RETRY_ATTEMPT_TIMEOUT_MS;
+    }
+
+    network_status =
+        transport->connect(network_context, mqtt_url, mqtt_port,
+                           network_credentials, attempt_timeout_ms,
+                           RETRY_ATTEMPT_TIMEOUT_MS);
 
     if (network_status != TLS_TRANSPORT_SUCCESS) {
       LogWarn(("Connection to the broker failed. Retrying connection with "
                "backoff and jitter."));
       retry_status = BackoffAlgorithm_GetNextBackoff(&retry_params, rand(),
                                                      &next_retry_backoff);
+      if (get_time_in_ms() + next_retry_backoff >= deadline_ms) {
+        LogWarn(("Next retry would miss the connection deadline."));
+        break;
+      }
       (void)usleep(next_retry_backoff * 1000U);
     }
 
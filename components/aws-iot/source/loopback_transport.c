@@ -0,0 +1,230 @@
+#include <string.h>
+
+#include "loopback_transport.h"
+
+#define PACKET_CONNECT 0x10
+#define PACKET_PUBLISH 0x30
+#define PACKET_PUBREL 0x60
+#define PACKET_SUBSCRIBE 0x80
+#define PACKET_UNSUBSCRIBE 0xa0
+#define PACKET_PINGREQ 0xc0
+#define PACKET_DISCONNECT 0xe0
+
+static uint32_t next_random(loopback_link *link) {
+  // xorshift32, good enough to decide which packets get lost.
+  link->seed ^= link->seed << 13;
+  link->seed ^= link->seed >> 17;
+  link->seed ^= link->seed << 5;
+  return link->seed;
+}
+
+// Time the link needs to carry len bytes, packets queue up behind each
+// other when a bandwidth limit is set.
+static uint32_t transfer_done_ms(loopback_link *link, size_t len) {
+  uint32_t now = link->now_ms();
+  uint32_t start = (int32_t)(link->busy_until_ms - now) > 0
+                       ? link->busy_until_ms
+                       : now;
+
+  if (link->faults.bytes_per_second > 0) {
+    start += (uint32_t)((uint64_t)len * 1000 / link->faults.bytes_per_second);
+  }
+  link->busy_until_ms = start;
+
+  return start + link->faults.latency_ms;
+}
+
+static void respond(loopback_link *link, uint32_t due_ms, const uint8_t *data,
+                    uint8_t len) {
+  if (link->out_count == LOOPBACK_MAX_RESPONSES) {
+    link->dropped++;
+    return;
+  }
+
+  loopback_response *response =
+      &link->out[(link->out_head + link->out_count) % LOOPBACK_MAX_RESPONSES];
+  response->due_ms = due_ms + link->faults.latency_ms;
+  response->len = len;
+  memcpy(response->data, data, len);
+  link->out_count++;
+}
+
+static void respond_id(loopback_link *link, uint32_t due_ms, uint8_t type,
+                       const uint8_t *id) {
+  uint8_t packet[] = {type, 2, id[0], id[1]};
+  respond(link, due_ms, packet, sizeof(packet));
+}
+
+static void handle_subscribe(loopback_link *link, uint32_t due_ms,
+                             const uint8_t *body, size_t len) {
+  uint8_t packet[LOOPBACK_MAX_RESPONSE] = {0x90, 2, body[0], body[1]};
+  size_t pos = 2;
+
+  while (pos + 3 <= len && (size_t)packet[1] + 2 < sizeof(packet)) {
+    size_t topic_len = (body[pos] << 8) | body[pos + 1];
+    pos += 2 + topic_len;
+    if (pos >= len) {
+      break;
+    }
+    uint8_t qos = body[pos++] & 3;
+    packet[2 + packet[1]++] = qos > 1 ? 1 : qos;
+  }
+
+  respond(link, due_ms, packet, packet[1] + 2);
+}
+
+static void handle_packet(loopback_link *link, const uint8_t *packet,
+                          size_t header_len, size_t len) {
+  const uint8_t *body = packet + header_len;
+  size_t body_len = len - header_len;
+  uint32_t due_ms = transfer_done_ms(link, len);
+
+  link->packets++;
+  if (link->faults.loss_per_mille > 0 &&
+      next_random(link) % 1000 < link->faults.loss_per_mille) {
+    link->dropped++;
+    return;
+  }
+
+  uint8_t type = packet[0] & 0xf0;
+  if (type != PACKET_CONNECT && type != PACKET_PINGREQ &&
+      type != PACKET_DISCONNECT && body_len < 2) {
+    return;
+  }
+
+  switch (type) {
+  case PACKET_CONNECT: {
+    static const uint8_t connack[] = {0x20, 2, 0, 0};
+    respond(link, due_ms, connack, sizeof(connack));
+    break;
+  }
+  case PACKET_PUBLISH: {
+    uint8_t qos = (packet[0] >> 1) & 3;
+    size_t topic_len = (body[0] << 8) | body[1];
+    if (qos > 0 && 2 + topic_len + 2 <= body_len) {
+      respond_id(link, due_ms, qos == 1 ? 0x40 : 0x50, body + 2 + topic_len);
+    }
+    break;
+  }
+  case PACKET_PUBREL:
+    respond_id(link, due_ms, 0x70, body);
+    break;
+  case PACKET_SUBSCRIBE:
+    handle_subscribe(link, due_ms, body, body_len);
+    break;
+  case PACKET_UNSUBSCRIBE:
+    respond_id(link, due_ms, 0xb0, body);
+    break;
+  case PACKET_PINGREQ: {
+    static const uint8_t pingresp[] = {0xd0, 0};
+    respond(link, due_ms, pingresp, sizeof(pingresp));
+    break;
+  }
+  case PACKET_DISCONNECT:
+    link->connected = false;
+    break;
+  default:
+    break;
+  }
+
+  if (link->faults.disconnect_after > 0 &&
+      link->packets >= link->faults.disconnect_after) {
+    link->connected = false;
+  }
+}
+
+// Returns the size of the fixed header once the remaining length is known,
+// 0 while more bytes are needed and -1 for a malformed length.
+static int fixed_header_len(const uint8_t *buf, size_t len,
+                            size_t *remaining) {
+  *remaining = 0;
+
+  for (size_t i = 1; i < 5; i++) {
+    if (i >= len) {
+      return 0;
+    }
+    *remaining |= (size_t)(buf[i] & 0x7f) << (7 * (i - 1));
+    if ((buf[i] & 0x80) == 0) {
+      return (int)i + 1;
+    }
+  }
+
+  return -1;
+}
+
+void loopback_open(loopback_link *link, const loopback_faults *faults,
+                   uint32_t (*now_ms)(void), uint32_t seed) {
+  memset(link, 0, sizeof(*link));
+  if (faults != NULL) {
+    link->faults = *faults;
+  }
+  link->now_ms = now_ms;
+  link->seed = seed ? seed : 1;
+  link->connected = true;
+}
+
+void loopback_close(loopback_link *link) { link->connected = false; }
+
+int32_t loopback_send(loopback_link *link, const void *buf, size_t len) {
+  if (!link->connected) {
+    return -1;
+  }
+
+  if (len > sizeof(link->in) - link->in_len) {
+    len = sizeof(link->in) - link->in_len;
+  }
+  memcpy(link->in + link->in_len, buf, len);
+  link->in_len += len;
+
+  for (;;) {
+    size_t remaining;
+    int header_len = fixed_header_len(link->in, link->in_len, &remaining);
+
+    if (header_len < 0 || header_len + remaining > sizeof(link->in)) {
+      link->connected = false;
+      return -1;
+    }
+    if (header_len == 0 || header_len + remaining > link->in_len) {
+      break;
+    }
+
+    size_t packet_len = header_len + remaining;
+    handle_packet(link, link->in, header_len, packet_len);
+    memmove(link->in, link->in + packet_len, link->in_len - packet_len);
+    link->in_len -= packet_len;
+  }
+
+  return (int32_t)len;
+}
+
+int32_t loopback_recv(loopback_link *link, void *buf, size_t len) {
+  size_t copied = 0;
+
+  while (copied < len && link->out_count > 0) {
+    loopback_response *response = &link->out[link->out_head];
+
+    if ((int32_t)(link->now_ms() - response->due_ms) < 0) {
+      break;
+    }
+
+    size_t chunk = response->len - link->out_pos;
+    if (chunk > len - copied) {
+      chunk = len - copied;
+    }
+    memcpy((uint8_t *)buf + copied, response->data + link->out_pos, chunk);
+    copied += chunk;
+    link->out_pos += chunk;
+
+    if (link->out_pos == response->len) {
+      link->out_pos = 0;
+      link->out_head = (link->out_head + 1) % LOOPBACK_MAX_RESPONSES;
+      link->out_count--;
+    }
+  }
+
+  if (copied == 0 && !link->connected) {
+    return -1;
+  }
+
+  return (int32_t)copied;
+}
@@ -0,0 +1,130 @@
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp_log.h"
+#include "esp_system.h"
+
+#include "mqtt_transport.h"
+
+static const char *TAG = "mqtt_transport";
+
+static loopback_link loopback;
+static loopback_faults faults;
+
+static TlsTransportStatus_t tcp_connect(NetworkContext_t *network_context,
+                                        const char *host, uint16_t port,
+                                        const NetworkCredentials_t *credentials,
+                                        uint32_t receive_timeout_ms,
+                                        uint32_t send_timeout_ms) {
+  network_context->transport = esp_transport_tcp_init();
+  network_context->receiveTimeoutMs = receive_timeout_ms;
+  network_context->sendTimeoutMs = send_timeout_ms;
+
+  if (network_context->transport == NULL) {
+    return TLS_TRANSPORT_INSUFFICIENT_MEMORY;
+  }
+
+  if (esp_transport_connect(network_context->transport, host, port,
+                            receive_timeout_ms) < 0) {
+    ESP_LOGW(TAG, "TCP connection to %s:%u failed", host, port);
+    esp_transport_close(network_context->transport);
+    esp_transport_destroy(network_context->transport);
+    return TLS_TRANSPORT_CONNECT_FAILURE;
+  }
+
+  return TLS_TRANSPORT_SUCCESS;
+}
+
+static uint32_t loopback_now_ms(void) {
+  return xTaskGetTickCount() * portTICK_PERIOD_MS;
+}
+
+static TlsTransportStatus_t
+loopback_connect(NetworkContext_t *network_context, const char *host,
+                 uint16_t port, const NetworkCredentials_t *credentials,
+                 uint32_t receive_timeout_ms, uint32_t send_timeout_ms) {
+  ESP_LOGI(TAG,
+           "Loopback link, latency %ums, %uB/s, loss %u/1000, disconnect "
+           "after %u packets",
+           faults.latency_ms, faults.bytes_per_second, faults.loss_per_mille,
+           faults.disconnect_after);
+
+  loopback_open(&loopback, &faults, loopback_now_ms, esp_random());
+  network_context->loopback = &loopback;
+  network_context->receiveTimeoutMs = receive_timeout_ms;
+  network_context->sendTimeoutMs = send_timeout_ms;
+
+  return TLS_TRANSPORT_SUCCESS;
+}
+
+static void loopback_disconnect(NetworkContext_t *network_context) {
+  loopback_close(network_context->loopback);
+}
+
+static int32_t loopback_transport_send(NetworkContext_t *network_context,
+                                       const void *buffer,
+                                       size_t bytes_to_send) {
+  return loopback_send(network_context->loopback, buffer, bytes_to_send);
+}
+
+static int32_t loopback_transport_recv(NetworkContext_t *network_context,
+                                       void *buffer, size_t bytes_to_recv) {
+  int32_t ret = loopback_recv(network_context->loopback, buffer,
+                              bytes_to_recv);
+
+  // coreMQTT polls until its own timeout, give the other tasks a chance.
+  if (ret == 0) {
+    vTaskDelay(1);
+  }
+
+  return ret;
+}
+
+const mqtt_transport mqtt_transport_tls = {
+    .name = "tls",
+    .connect = TLS_FreeRTOS_Connect,
+    .disconnect = TLS_FreeRTOS_Disconnect,
+    .send = TLS_FreeRTOS_send,
+    .recv = TLS_FreeRTOS_recv,
+};
+
+// esp_transport reads and writes the same way for plain TCP, only the
+// connection setup differs.
+const mqtt_transport mqtt_transport_tcp = {
+    .name = "tcp",
+    .connect = tcp_connect,
+    .disconnect = TLS_FreeRTOS_Disconnect,
+    .send = TLS_FreeRTOS_send,
+    .recv = TLS_FreeRTOS_recv,
+};
+
+const mqtt_transport mqtt_transport_loopback = {
+    .name = "loopback",
+    .connect = loopback_connect,
+    .disconnect = loopback_disconnect,
+    .send = loopback_transport_send,
+    .recv = loopback_transport_recv,
+};
+
+const mqtt_transport *mqtt_transport_find(const char *name) {
+  static const mqtt_transport *transports[] = {
+      &mqtt_transport_tls, &mqtt_transport_tcp, &mqtt_transport_loopback};
+
+  if (name == NULL) {
+    return &mqtt_transport_tls;
+  }
+
+  for (size_t i = 0; i < sizeof(transports) / sizeof(transports[0]); i++) {
+    if (strcmp(transports[i]->name, name) == 0) {
+      return transports[i];
+    }
+  }
+
+  return NULL;
+}
+
+void mqtt_transport_set_faults(const loopback_faults *link_faults) {
+  faults = *link_faults;
+}
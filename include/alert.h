@@ -0,0 +1,87 @@
+#ifndef ALERT_H
+#define ALERT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "device_config.h"
+#include "reading.h"
+
+#define ALERT_QUEUE_SIZE 8
+// A raised alert clears once the value is this much back under the threshold.
+#define ALERT_CLEAR_RATIO 0.9f
+
+typedef enum {
+  ALERT_RULE_CO2,
+  ALERT_RULE_CO2_RISE,
+  ALERT_RULE_GAS,
+  ALERT_RULE_COUNT,
+} alert_rule_id;
+
+typedef enum {
+  ALERT_ABOVE,
+  // Rise per minute between successive readings.
+  ALERT_RISE,
+} alert_kind;
+
+// A rule with a zero threshold is disabled. The condition has to hold for
+// hold_ms before the alert is raised, and an alert is not raised again
+// within holdoff_ms of the previous one.
+typedef struct {
+  const char *name;
+  alert_kind kind;
+  float threshold;
+  uint32_t hold_ms;
+  uint32_t holdoff_ms;
+} alert_rule;
+
+typedef enum {
+  ALERT_NONE,
+  ALERT_RAISED,
+  ALERT_CLEARED,
+} alert_event;
+
+typedef struct {
+  bool active;
+  bool breached;
+  bool raised_once;
+  bool has_last;
+  int64_t breach_ms;
+  int64_t raised_ms;
+  int64_t last_ms;
+  float last_value;
+} alert_state;
+
+typedef struct {
+  uint8_t rule;
+  uint8_t event;
+  float value;
+  int64_t detected_ms;
+} alert_record;
+
+// Rule state and the events not yet delivered. Times are on a clock that
+// keeps running through deep sleep, so all of this can live in RTC memory.
+typedef struct {
+  alert_state states[ALERT_RULE_COUNT];
+  alert_record queue[ALERT_QUEUE_SIZE];
+  uint32_t queued;
+  uint32_t dropped;
+  uint32_t suppressed;
+  uint32_t last_latency_ms;
+} alert_monitor;
+
+void alert_rules_load(const device_config *config, alert_rule *rules);
+void alert_values(const reading *value, float *values);
+
+alert_event alert_evaluate(const alert_rule *rule, alert_state *state,
+                           float value, int64_t now_ms);
+// Evaluates every rule and queues its events, the oldest event is dropped
+// when the queue is full. Returns the number of events queued.
+int alert_monitor_update(alert_monitor *monitor, const alert_rule *rules,
+                         const float *values, int64_t now_ms);
+// Time until a breach that is being held may be raised, -1 if none is.
+int64_t alert_monitor_next_ms(const alert_monitor *monitor,
+                              const alert_rule *rules, int64_t now_ms);
+void alert_monitor_pop(alert_monitor *monitor);
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef BATTERY_POLICY_H
+#define BATTERY_POLICY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "device_config.h"
+
+#define BATTERY_SENSOR(sensor) (1u << (sensor))
+#define BATTERY_ALL_SENSORS ((1u << SENSOR_COUNT) - 1)
+
+// Ordered from the fullest battery down.
+typedef enum {
+  BATTERY_PROFILE_NORMAL,
+  BATTERY_PROFILE_SAVING,
+  BATTERY_PROFILE_LOW,
+  BATTERY_PROFILE_BROWNOUT,
+  BATTERY_PROFILE_COUNT,
+} battery_profile;
+
+// What a profile changes. The sleep interval and the aggregation window are
+// multiplied by their factors; sensors is a mask of BATTERY_SENSOR bits.
+typedef struct {
+  uint32_t sleep_factor;
+  uint32_t batch_factor;
+  uint32_t sensors;
+  bool uploads;
+  bool diagnostics;
+} battery_settings;
+
+// Kept in RTC memory. A profile is entered once the supply drops below its
+// threshold and only left once it is hysteresis above it again. Entering
+// the brownout profile first flushes what is buffered, see flush_pending.
+typedef struct {
+  battery_profile profile;
+  bool flush_pending;
+  uint32_t changes;
+} battery_state;
+
+// Returns true when the profile changed. supply_mv is the power reading.
+bool battery_policy_update(battery_state *state, const device_config *config,
+                           uint32_t supply_mv);
+const battery_settings *battery_policy_settings(battery_profile profile);
+// The aggregation window in cycles for aggregate_cycles under the settings.
+uint32_t battery_policy_window(const battery_settings *settings,
+                               uint32_t aggregate_cycles);
+const char *battery_profile_name(battery_profile profile);
+
+#endif
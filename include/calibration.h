@@ -0,0 +1,29 @@
+#ifndef CALIBRATION_H
+#define CALIBRATION_H
+
+#include <stdint.h>
+
+#define CALIBRATION_UNIT 1000
+#define CALIBRATION_MAX_PPM 100000
+#define CALIBRATION_MAX_LUX 100000
+// Conditions the gas curve was taken at, used when the DHT reading is missing.
+#define CALIBRATION_REFERENCE_T 20
+#define CALIBRATION_REFERENCE_RH 33
+
+// Converts raw ADC readings with the tables from tools/gen_calibration.py.
+// The curves are for a nominal sensor; each device scales them by its own
+// reference resistance when the calibration is set up.
+typedef struct {
+  float gas_scale;
+  float ldr_scale;
+} calibration;
+
+// gas_r0 is the MQ sensor resistance in clean air and ldr_r10 the LDR
+// resistance at 10 lux, both in CALIBRATION_UNIT parts of the resistor they
+// are divided against.
+void calibration_init(calibration *cal, uint32_t gas_r0, uint32_t ldr_r10);
+int calibration_gas_ppm(const calibration *cal, int raw, int temperature,
+                        int humidity);
+int calibration_ldr_lux(const calibration *cal, int raw);
+
+#endif
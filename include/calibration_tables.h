@@ -0,0 +1,362 @@
+// Generated by tools/gen_calibration.py, do not edit.
+#ifndef CALIBRATION_TABLES_H
+#define CALIBRATION_TABLES_H
+
+#include <stdint.h>
+
+typedef struct {
+  uint16_t raw;
+  float value;
+} calibration_point;
+
+#define CALIBRATION_GAS_B -2.769034857f
+#define CALIBRATION_LDR_GAMMA 0.7f
+#define CALIBRATION_COMP_T0 -10
+#define CALIBRATION_COMP_T_STEP 5
+#define CALIBRATION_COMP_T_COUNT 13
+#define CALIBRATION_COMP_RH0 0
+#define CALIBRATION_COMP_RH_STEP 10
+#define CALIBRATION_COMP_RH_COUNT 11
+
+// ppm with R0 equal to the load resistor, at 20C and 33% RH.
+static const calibration_point gas_ppm_curve[] = {
+    {1, 1.160227e-08f},
+    {2, 7.914059e-08f},
+    {3, 2.433862e-07f},
+    {4, 5.401938e-07f},
+    {5, 1.002746e-06f},
+    {6, 1.662419e-06f},
+    {7, 2.549251e-06f},
+    {8, 3.692229e-06f},
+    {9, 5.119482e-06f},
+    {10, 6.858425e-06f},
+    {11, 8.935866e-06f},
+    {12, 1.137808e-05f},
+    {13, 1.421088e-05f},
+    {14, 1.745968e-05f},
+    {15, 2.11495e-05f},
+    {16, 2.530506e-05f},
+    {17, 2.995077e-05f},
+    {18, 3.511077e-05f},
+    {19, 4.080894e-05f},
+    {20, 4.706894e-05f},
+    {21, 5.391424e-05f},
+    {22, 6.136809e-05f},
+    {24, 7.819358e-05f},
+    {26, 9.772812e-05f},
+    {28, 0.0001201521f},
+    {30, 0.0001456438f},
+    {32, 0.0001743799f},
+    {35, 0.0002239495f},
+    {38, 0.0002817972f},
+    {41, 0.0003485019f},
+    {44, 0.0004246376f},
+    {48, 0.0005418066f},
+    {52, 0.0006780956f},
+    {56, 0.0008348373f},
+    {61, 0.001061545f},
+    {66, 0.00132486f},
+    {72, 0.001692778f},
+    {78, 0.002121546f},
+    {85, 0.002704594f},
+    {92, 0.003383545f},
+    {100, 0.004285983f},
+    {109, 0.005475175f},
+    {118, 0.006863171f},
+    {128, 0.008657188f},
+    {139, 0.01096127f},
+    {151, 0.01390256f},
+    {164, 0.01763526f},
+    {178, 0.02234519f},
+    {193, 0.02825495f},
+    {209, 0.03562984f},
+    {227, 0.04536792f},
+    {246, 0.05745602f},
+    {266, 0.07237686f},
+    {288, 0.09164125f},
+    {312, 0.1164002f},
+    {337, 0.1467647f},
+    {364, 0.1853432f},
+    {393, 0.2341773f},
+    {424, 0.2957751f},
+    {457, 0.3732106f},
+    {492, 0.470245f},
+    {529, 0.5914745f},
+    {568, 0.7425119f},
+    {610, 0.9351875f},
+    {654, 1.174725f},
+    {700, 1.47185f},
+    {749, 1.84804f},
+    {800, 2.314192f},
+    {853, 2.890964f},
+    {908, 3.603811f},
+    {966, 4.501032f},
+    {1026, 5.611285f},
+    {1088, 6.984974f},
+    {1152, 8.685078f},
+    {1217, 10.75574f},
+    {1284, 13.31727f},
+    {1353, 16.49113f},
+    {1423, 20.37093f},
+    {1494, 25.11603f},
+    {1566, 30.92517f},
+    {1639, 38.04757f},
+    {1712, 46.66773f},
+    {1786, 57.25867f},
+    {1860, 70.11894f},
+    {1934, 85.75185f},
+    {2008, 104.7854f},
+    {2081, 127.662f},
+    {2154, 155.5688f},
+    {2226, 189.1995f},
+    {2297, 229.7482f},
+    {2367, 278.681f},
+    {2436, 337.8056f},
+    {2504, 409.3614f},
+    {2570, 494.7033f},
+    {2635, 598.086f},
+    {2698, 721.477f},
+    {2760, 871.2381f},
+    {2820, 1050.269f},
+    {2878, 1264.073f},
+    {2934, 1519.137f},
+    {2988, 1823.079f},
+    {3041, 2192.548f},
+    {3092, 2633.869f},
+    {3141, 3160.356f},
+    {3188, 3787.502f},
+    {3233, 4533.2f},
+    {3276, 5417.905f},
+    {3317, 6464.723f},
+    {3357, 7734.645f},
+    {3395, 9237.385f},
+    {3431, 11008.49f},
+    {3466, 13153.88f},
+    {3499, 15676.78f},
+    {3531, 18731.43f},
+    {3561, 22308.79f},
+    {3590, 26630.46f},
+    {3617, 31656.88f},
+    {3643, 37699.88f},
+    {3667, 44652.72f},
+    {3690, 52941.07f},
+    {3712, 62821.41f},
+    {3733, 74594.38f},
+    {3753, 88609.13f},
+    {3772, 105266.1f},
+    {3790, 125017.3f},
+    {3807, 148361.6f},
+    {3823, 175833.8f},
+    {3838, 207983.6f},
+    {3852, 245340.7f},
+    {3865, 288364.3f},
+    {3878, 341938.4f},
+    {3890, 403714.9f},
+    {3901, 474018.1f},
+    {3912, 561536.4f},
+    {3922, 660733.5f},
+    {3932, 784678.5f},
+    {3941, 924154.7f},
+    {3950, 1098767.0f},
+    {3958, 1292970.0f},
+    {3966, 1535939.0f},
+    {3973, 1801308.0f},
+    {3980, 2131885.0f},
+    {3986, 2483216.0f},
+    {3992, 2916835.0f},
+    {3998, 3458552.0f},
+    {4003, 4018284.0f},
+    {4008, 4706979.0f},
+    {4013, 5564430.0f},
+    {4017, 6408555.0f},
+    {4021, 7434729.0f},
+    {4025, 8695366.0f},
+    {4029, 1.026225e+07f},
+    {4032, 1.169719e+07f},
+    {4035, 1.341683e+07f},
+    {4038, 1.549629e+07f},
+    {4041, 1.803603e+07f},
+    {4044, 2.117243e+07f},
+    {4047, 2.50939e+07f},
+    {4050, 3.006574e+07f},
+    {4052, 3.414582e+07f},
+    {4054, 3.901282e+07f},
+    {4056, 4.486853e+07f},
+    {4058, 5.198079e+07f},
+    {4060, 6.07103e+07f},
+    {4062, 7.155086e+07f},
+    {4063, 7.796795e+07f},
+    {4064, 8.519073e+07f},
+    {4065, 9.335132e+07f},
+    {4066, 1.02609e+08f},
+    {4067, 1.131569e+08f},
+    {4068, 1.25231e+08f},
+    {4069, 1.391211e+08f},
+    {4070, 1.551867e+08f},
+    {4071, 1.738767e+08f},
+    {4072, 1.957573e+08f},
+    {4073, 2.21549e+08f},
+    {4074, 2.52179e+08f},
+    {4075, 2.888538e+08f},
+    {4076, 3.331634e+08f},
+    {4077, 3.872329e+08f},
+    {4078, 4.539463e+08f},
+    {4079, 5.372855e+08f},
+    {4080, 6.428541e+08f},
+    {4081, 7.78711e+08f},
+    {4082, 9.567346e+08f},
+    {4083, 1.194933e+09f},
+    {4084, 1.521514e+09f},
+    {4085, 1.982385e+09f},
+    {4086, 2.655746e+09f},
+    {4087, 3.68234e+09f},
+    {4088, 5.333347e+09f},
+    {4089, 8.178469e+09f},
+    {4090, 1.355881e+10f},
+    {4091, 2.516882e+10f},
+    {4092, 5.5862e+10f},
+    {4093, 1.717961e+11f},
+    {4094, 1.171843e+12f},
+};
+
+// lux with R10 equal to the fixed resistor.
+static const calibration_point ldr_lux_curve[] = {
+    {1, 6.914946e-05f},
+    {2, 0.0001862015f},
+    {3, 0.0003324251f},
+    {4, 0.0005015674f},
+    {5, 0.0006901188f},
+    {6, 0.0008957599f},
+    {7, 0.001116816f},
+    {9, 0.001600317f},
+    {11, 0.002133094f},
+    {14, 0.003013615f},
+    {18, 0.004321324f},
+    {23, 0.006144085f},
+    {29, 0.008574062f},
+    {37, 0.01217746f},
+    {47, 0.01719929f},
+    {60, 0.02449125f},
+    {76, 0.03452523f},
+    {96, 0.04854798f},
+    {121, 0.06817946f},
+    {152, 0.09550454f},
+    {190, 0.1331911f},
+    {236, 0.1846456f},
+    {291, 0.2542248f},
+    {355, 0.346004f},
+    {430, 0.4683425f},
+    {515, 0.6266638f},
+    {611, 0.8316627f},
+    {718, 1.095013f},
+    {834, 1.425679f},
+    {959, 1.840424f},
+    {1092, 2.357121f},
+    {1231, 2.993102f},
+    {1374, 3.767759f},
+    {1520, 4.709252f},
+    {1668, 5.852255f},
+    {1815, 7.219186f},
+    {1961, 8.862319f},
+    {2104, 10.82055f},
+    {2243, 13.14742f},
+    {2377, 15.90147f},
+    {2506, 19.17137f},
+    {2629, 23.03385f},
+    {2745, 27.56119f},
+    {2855, 32.91594f},
+    {2958, 39.19194f},
+    {3054, 46.53079f},
+    {3144, 55.18995f},
+    {3227, 65.26564f},
+    {3304, 77.08111f},
+    {3375, 90.88402f},
+    {3441, 107.1896f},
+    {3501, 126.0606f},
+    {3556, 148.0924f},
+    {3606, 173.6183f},
+    {3652, 203.5883f},
+    {3694, 238.5868f},
+    {3732, 279.1029f},
+    {3767, 326.9337f},
+    {3798, 381.1893f},
+    {3827, 446.2778f},
+    {3853, 521.3381f},
+    {3876, 606.4164f},
+    {3897, 705.7723f},
+    {3916, 820.8635f},
+    {3933, 952.5108f},
+    {3949, 1111.491f},
+    {3963, 1290.158f},
+    {3976, 1503.139f},
+    {3987, 1733.362f},
+    {3997, 1998.6f},
+    {4006, 2300.843f},
+    {4014, 2639.736f},
+    {4022, 3071.236f},
+    {4029, 3555.767f},
+    {4035, 4083.09f},
+    {4041, 4756.404f},
+    {4046, 5474.296f},
+    {4051, 6395.446f},
+    {4055, 7338.639f},
+    {4059, 8542.698f},
+    {4062, 9683.606f},
+    {4065, 11107.79f},
+    {4068, 12925.67f},
+    {4070, 14437.98f},
+    {4072, 16275.82f},
+    {4074, 18547.62f},
+    {4076, 21413.44f},
+    {4077, 23141.05f},
+    {4078, 25118.72f},
+    {4079, 27400.75f},
+    {4080, 30057.69f},
+    {4081, 33182.74f},
+    {4082, 36901.36f},
+    {4083, 41386.1f},
+    {4084, 46880.27f},
+    {4085, 53737.12f},
+    {4086, 62487.63f},
+    {4087, 73964.09f},
+    {4088, 89540.26f},
+    {4089, 111637.1f},
+    {4090, 144902.6f},
+    {4091, 199375.0f},
+    {4092, 300819.7f},
+    {4093, 537052.6f},
+    {4094, 1446143.0f},
+};
+
+// ppm multiplier by temperature (rows) and relative humidity.
+static const float
+    gas_compensation[CALIBRATION_COMP_T_COUNT][CALIBRATION_COMP_RH_COUNT] = {
+    {4.796365f, 4.661879f, 4.529826f, 4.400188f, 4.272945f, 4.148078f,
+     4.025567f, 3.905392f, 3.787534f, 3.671974f, 3.558692f},
+    {3.671021f, 3.557757f, 3.446751f, 3.337984f, 3.231434f, 3.127083f,
+     3.02491f, 2.924895f, 2.827019f, 2.73126f, 2.6376f},
+    {2.823524f, 2.727842f, 2.634257f, 2.542749f, 2.453297f, 2.365883f,
+     2.280484f, 2.19708f, 2.115652f, 2.036177f, 1.958637f},
+    {2.191819f, 2.110516f, 2.031166f, 1.953748f, 1.878242f, 1.804626f,
+     1.73288f, 1.662984f, 1.594915f, 1.528653f, 1.464177f},
+    {1.726397f, 1.656668f, 1.588766f, 1.522669f, 1.458355f, 1.395804f,
+     1.334994f, 1.275903f, 1.218511f, 1.162796f, 1.108735f},
+    {1.388449f, 1.327846f, 1.268959f, 1.211769f, 1.156252f, 1.102388f,
+     1.050154f, 0.9995293f, 0.9504915f, 0.9030185f, 0.8570883f},
+    {1.148219f, 1.094596f, 1.042601f, 0.9922108f, 0.9434047f, 0.8961603f,
+     0.8504553f, 0.8062677f, 0.7635751f, 0.722355f, 0.6825849f},
+    {0.983556f, 0.9350248f, 0.8880514f, 0.8426136f, 0.7986892f, 0.7562559f,
+     0.7152912f, 0.6757725f, 0.6376773f, 0.6009828f, 0.5656661f},
+    {0.8787142f, 0.8335851f, 0.7899649f, 0.7478312f, 0.7071615f, 0.6679334f,
+     0.630124f, 0.5937108f, 0.5586707f, 0.5249807f, 0.4926178f},
+    {0.8233952f, 0.7801197f, 0.7383255f, 0.6979902f, 0.6590912f, 0.6216058f,
+     0.5855111f, 0.5507843f, 0.5174024f, 0.4853422f, 0.4545803f},
+    {0.8120725f, 0.7691818f, 0.7277667f, 0.6878046f, 0.6492729f, 0.612149f,
+     0.5764099f, 0.5420328f, 0.5089945f, 0.4772719f, 0.4468417f},
+    {0.8436068f, 0.799649f, 0.7571828f, 0.7161857f, 0.6766352f, 0.6385086f,
+     0.6017832f, 0.5664361f, 0.5324444f, 0.499785f, 0.4684345f},
+    {0.9211643f, 0.8746411f, 0.829647f, 0.7861598f, 0.7441571f, 0.7036165f,
+     0.6645154f, 0.6268311f, 0.5905408f, 0.5556217f, 0.5220506f},
+};
+
+#endif
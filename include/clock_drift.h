@@ -0,0 +1,36 @@
+#ifndef CLOCK_DRIFT_H
+#define CLOCK_DRIFT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define CLOCK_SYNC_ERROR_US 50000
+#define CLOCK_DEFAULT_PPM 1000.0f
+// Covers what the drift does between syncs without being seen, mostly the
+// RC oscillator following the room temperature through the day.
+#define CLOCK_MIN_PPM 50.0f
+#define CLOCK_MIN_INTERVAL_US (60LL * 1000000)
+#define CLOCK_DRIFT_GAIN 0.3f
+// Per sync, slower than the estimate settles after an outlier.
+#define CLOCK_SPREAD_DECAY 0.8f
+
+// Estimates the drift of the RTC from successive time syncs. The system
+// clock is only stepped at a sync; in between timestamps are corrected by
+// the estimated drift and carry an uncertainty that grows with the time
+// since the last sync.
+typedef struct {
+  bool synced;
+  int64_t sync_us;
+  uint32_t samples;
+  float drift_ppm;
+  // Largest recent change of the drift between syncs, decaying.
+  float spread_ppm;
+  // How far the sync errors alone may have moved drift_ppm.
+  float error_ppm;
+} clock_drift;
+
+void clock_drift_sync(clock_drift *clock, int64_t local_us, int64_t true_us);
+bool clock_drift_correct(const clock_drift *clock, int64_t local_us,
+                         int64_t *true_us, uint32_t *uncertainty_us);
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Standard reflected CRC-32 (IEEE 802.3). Start with crc = 0 and feed the
+// previous result back in to checksum data split across several buffers.
+uint32_t crc32_update(uint32_t crc, const void *data, size_t len);
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef CYCLE_BUDGET_H
+#define CYCLE_BUDGET_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define CYCLE_WIFI_MS 10000
+#define CYCLE_SENSORS_MS 5000
+#define CYCLE_CONNECT_MS 15000
+#define CYCLE_PUBLISH_MS 15000
+
+typedef enum {
+  CYCLE_PHASE_WIFI,
+  CYCLE_PHASE_SENSORS,
+  CYCLE_PHASE_CONNECT,
+  CYCLE_PHASE_PUBLISH,
+  CYCLE_PHASE_COUNT,
+} cycle_phase;
+
+// Deadlines for one wake cycle. Each phase gets its own limit but never
+// past the end of the awake budget; phases may run in parallel. A phase
+// that is cut short or still running when the cycle ends counts as overrun.
+typedef struct {
+  int64_t end_ms;
+  int64_t deadline_ms[CYCLE_PHASE_COUNT];
+  uint32_t open;
+  uint32_t overrun;
+} cycle_budget;
+
+// Kept across cycles for the telemetry.
+typedef struct {
+  uint32_t awake_ms;
+  uint32_t overrun;
+  uint32_t overrun_cycles;
+} cycle_history;
+
+void cycle_budget_start(cycle_budget *cycle, uint32_t budget_ms,
+                        int64_t now_ms);
+// Returns the time the phase may take.
+uint32_t cycle_phase_begin(cycle_budget *cycle, cycle_phase phase,
+                           int64_t now_ms);
+uint32_t cycle_phase_left(const cycle_budget *cycle, cycle_phase phase,
+                          int64_t now_ms);
+void cycle_phase_end(cycle_budget *cycle, cycle_phase phase, bool completed,
+                     int64_t now_ms);
+uint32_t cycle_budget_left(const cycle_budget *cycle, int64_t now_ms);
+void cycle_budget_finish(cycle_budget *cycle, cycle_history *history,
+                         int64_t start_ms, int64_t now_ms);
+const char *cycle_phase_name(cycle_phase phase);
+
+#endif
@@ -0,0 +1,107 @@
+#ifndef DEVICE_CONFIG_H
+#define DEVICE_CONFIG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sensor_schedule.h"
+
+#define DEFAULT_SLEEP_SECONDS 15
+#define DEFAULT_READ_SAMPLES 10
+#define DEFAULT_CO2_THRESHOLD_PPM 2000
+#define DEFAULT_BACKLOG_DRAIN 20
+#define DEFAULT_AGGREGATE_CYCLES 20
+#define DEFAULT_POWER_SAVE 1
+#define DEFAULT_GAS_R0 1000
+#define DEFAULT_LDR_R10 1000
+#define DEFAULT_ALERT_HOLDOFF_S 300
+#define DEFAULT_AWAKE_BUDGET_MS 30000
+#define DEFAULT_SENSOR_PROBE_CYCLES 10
+#define DEFAULT_ESPNOW_BATCH_MS 5000
+#define DEFAULT_SENSOR_PERIOD 1
+// The DHT22 gives a new value every 2 s at most.
+#define DEFAULT_DHT_SAMPLES 1
+#define DEFAULT_BATTERY_HYSTERESIS_MV 100
+#define DEFAULT_GAS_COOL_S 120
+
+#define RUN_MODE_CYCLE 0
+#define RUN_MODE_CONNECTED 1
+
+#define PAYLOAD_FORMAT_JSON 0
+#define PAYLOAD_FORMAT_BINARY 1
+
+#define DEVICE_COMMAND_CALIBRATE_CO2_ZERO (1u << 0)
+#define DEVICE_COMMAND_FLUSH_BACKLOG (1u << 1)
+
+// Runtime settings, persisted in NVS and updated from the retained message on
+// device/<thing>/config. A message is only applied when its "version" is
+// newer than the stored one, so re-delivering the retained message on every
+// wake is a no-op. A "command" runs once, with a "command_id" newer than the
+// last one run.
+//
+// NVS holds the settings by name, so a build that adds or drops one keeps
+// the rest.
+typedef struct {
+  uint32_t version;
+  uint32_t sleep_seconds;
+  uint32_t read_samples;
+  uint32_t co2_threshold_ppm;
+  uint32_t backlog_drain;
+  uint32_t aggregate_cycles;
+  uint32_t compress;
+  uint32_t wake_stagger;
+  uint32_t wake_jitter_ms;
+  uint32_t power_save;
+  uint32_t run_mode;
+  uint32_t stub_cycles;
+  uint32_t stub_gas_threshold;
+  uint32_t payload_format;
+  uint32_t gas_r0;
+  uint32_t ldr_r10;
+  uint32_t alert_co2_rise;
+  uint32_t alert_gas_ppm;
+  uint32_t alert_hold_s;
+  uint32_t alert_holdoff_s;
+  uint32_t awake_budget_ms;
+  uint32_t sensor_probe_cycles;
+  uint32_t espnow_batch_ms;
+  uint32_t metrics_port;
+  sensor_schedule schedule[SENSOR_COUNT];
+  uint32_t battery_saving_mv;
+  uint32_t battery_low_mv;
+  uint32_t battery_brownout_mv;
+  uint32_t battery_hysteresis_mv;
+  uint32_t gas_preheat_s;
+  uint32_t gas_cool_s;
+  uint32_t command_id;
+  uint32_t pending_commands;
+  uint32_t ota_build;
+  uint32_t ota_size;
+  uint8_t ota_sha256[32];
+  uint8_t ota_signature[72];
+  uint32_t ota_signature_len;
+} device_config;
+
+typedef enum {
+  DEVICE_CONFIG_UPDATED,
+  DEVICE_CONFIG_UNCHANGED,
+  DEVICE_CONFIG_INVALID,
+} device_config_status;
+
+void device_config_defaults(device_config *config);
+device_config_status device_config_parse(const char *json, size_t len,
+                                         const device_config *current,
+                                         device_config *updated,
+                                         uint32_t *commands);
+// Returns 0 if the buffer is too small. Decoding starts from the settings
+// already in config, it fails on a malformed buffer.
+size_t device_config_encode(const device_config *config, uint8_t *buf,
+                            size_t len);
+bool device_config_decode(const uint8_t *buf, size_t len,
+                          device_config *config);
+bool device_config_load(device_config *config);
+bool device_config_save(const device_config *config);
+void device_config_clear_commands(uint32_t commands);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef ESPNOW_BATCH_H
+#define ESPNOW_BATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "espnow_frame.h"
+#include "record_log.h"
+
+#define ESPNOW_BATCH_VERSION 1
+#define ESPNOW_BATCH_MAX RECORD_LOG_MAX_RECORD
+#define ESPNOW_BATCH_HEADER_SIZE 2
+
+// Node readings collected by the gateway into one publish:
+//   version, count, then per reading the node MAC, the payload length and
+//   the payload as the node sent it.
+typedef struct {
+  uint8_t buf[ESPNOW_BATCH_MAX];
+  size_t len;
+  uint32_t count;
+  int64_t first_ms;
+} espnow_batch;
+
+void espnow_batch_reset(espnow_batch *batch);
+bool espnow_batch_fits(const espnow_batch *batch, size_t len);
+// Returns false when the reading no longer fits.
+bool espnow_batch_add(espnow_batch *batch, const uint8_t *mac,
+                      const uint8_t *payload, size_t len, int64_t now_ms);
+// Due once the oldest reading has waited max_age_ms, or when the batch has
+// no room left for another full frame.
+bool espnow_batch_due(const espnow_batch *batch, uint32_t max_age_ms,
+                      int64_t now_ms);
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef ESPNOW_FRAME_H
+#define ESPNOW_FRAME_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define ESPNOW_FRAME_VERSION 1
+#define ESPNOW_FRAME_MAX 250
+#define ESPNOW_MAC_SIZE 6
+#define ESPNOW_KEY_SIZE 16
+#define ESPNOW_TAG_SIZE 8
+#define ESPNOW_HEADER_SIZE 5
+#define ESPNOW_PAYLOAD_MAX                                                     \
+  (ESPNOW_FRAME_MAX - ESPNOW_HEADER_SIZE - ESPNOW_TAG_SIZE)
+#define ESPNOW_MAX_PEERS 20
+// Sequence numbers a node may advance before the gateway stores its table
+// again.
+#define ESPNOW_REPLAY_LEASE 64
+
+// A reading sent from a node to its gateway over ESP-NOW:
+//   version, sequence number (u32 LE), payload, tag.
+// The tag is a truncated HMAC-SHA256 with the shared key over the sender
+// MAC, header and payload, so a frame can't be replayed as another node's.
+typedef enum {
+  ESPNOW_FRAME_OK = 0,
+  ESPNOW_FRAME_MALFORMED = -1,
+  ESPNOW_FRAME_FORGED = -2,
+  ESPNOW_FRAME_REPLAYED = -3,
+  ESPNOW_FRAME_UNKNOWN = -4,
+} espnow_frame_status;
+
+// Highest sequence number accepted from each node, on the gateway. The
+// table has to outlive a restart, or every frame captured before it could
+// be replayed once. Each node is given a lease of sequence numbers up to
+// saved_seq: going past it sets dirty, and the table must be stored before
+// the frame is used. A restarted gateway resumes every node at its
+// saved_seq, so a frame it accepted before never passes again, at the cost
+// of up to a lease of new ones. A full table refuses new nodes instead of
+// forgetting one.
+typedef struct {
+  uint8_t mac[ESPNOW_MAC_SIZE];
+  uint32_t last_seq;
+  uint32_t saved_seq;
+} espnow_peer;
+
+typedef struct {
+  espnow_peer peers[ESPNOW_MAX_PEERS];
+  uint32_t count;
+  bool dirty;
+} espnow_replay;
+
+// Returns the frame length, or ESPNOW_FRAME_MALFORMED when the payload is
+// too long.
+int espnow_frame_encode(const uint8_t *key, const uint8_t *mac, uint32_t seq,
+                        const void *payload, size_t len, uint8_t *frame);
+// Checks the tag and returns the payload length, or a negative status.
+int espnow_frame_decode(const uint8_t *key, const uint8_t *mac,
+                        const uint8_t *frame, size_t len, uint32_t *seq,
+                        const uint8_t **payload);
+
+void espnow_replay_init(espnow_replay *replay);
+// Continues from the first count peers as they were stored.
+void espnow_replay_resume(espnow_replay *replay, uint32_t count);
+// Accepts only sequence numbers above the last one seen from the node.
+// ESPNOW_FRAME_UNKNOWN when the node is new and the table full.
+espnow_frame_status espnow_replay_check(espnow_replay *replay,
+                                        const uint8_t *mac, uint32_t seq);
+
+#endif
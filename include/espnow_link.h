@@ -0,0 +1,45 @@
+#ifndef ESPNOW_LINK_H
+#define ESPNOW_LINK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "espnow_batch.h"
+#include "espnow_frame.h"
+
+typedef enum {
+  ESPNOW_ROLE_NONE,
+  ESPNOW_ROLE_NODE,
+  ESPNOW_ROLE_GATEWAY,
+} espnow_role;
+
+// Battery nodes send their readings to a mains powered gateway over
+// ESP-NOW, without association or TLS. The gateway forwards them in batches
+// over its own MQTT connection.
+typedef struct {
+  espnow_role role;
+  uint8_t key[ESPNOW_KEY_SIZE];
+  uint8_t gateway[ESPNOW_MAC_SIZE];
+  uint8_t channel;
+} espnow_link;
+
+typedef struct {
+  uint32_t accepted;
+  uint32_t invalid;
+  uint32_t replayed;
+  uint32_t dropped;
+} espnow_stats;
+
+// role is "node" or "gateway", key 32 hex digits and gateway the gateway's
+// station MAC. Incomplete settings leave the link at ESPNOW_ROLE_NONE.
+bool espnow_link_parse(espnow_link *link, const char *role, const char *key,
+                       const char *gateway);
+// Wi-Fi has to be started, on the gateway's channel for a node.
+bool espnow_link_start(const espnow_link *link);
+bool espnow_link_send(const void *payload, size_t len);
+// Moves verified frames into the batch until it is full, returns how many.
+int espnow_link_collect(espnow_batch *batch, int64_t now_ms);
+const espnow_stats *espnow_link_stats(void);
+
+#endif
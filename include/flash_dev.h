@@ -0,0 +1,21 @@
+#ifndef FLASH_DEV_H
+#define FLASH_DEV_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Minimal NOR flash interface used by the storage modules. Writes may only
+// clear bits, erases set a whole sector back to 0xff. Every callback returns 0
+// on success so the same code can run on top of a partition or a file.
+typedef struct {
+  void *ctx;
+  uint32_t size;
+  uint32_t sector_size;
+  int (*read)(void *ctx, uint32_t addr, void *buf, uint32_t len);
+  int (*write)(void *ctx, uint32_t addr, const void *buf, uint32_t len);
+  int (*erase)(void *ctx, uint32_t addr, uint32_t len);
+} flash_dev;
+
+bool flash_partition_open(const char *label, flash_dev *dev);
+
+#endif
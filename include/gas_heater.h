@@ -0,0 +1,51 @@
+#ifndef GAS_HEATER_H
+#define GAS_HEATER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "device_config.h"
+
+// Warmth the element has to reach before a reading is trusted, 1 being the
+// operating temperature.
+#define GAS_HEATER_STABLE 0.95f
+#define GAS_HEATER_HOUR_MS 3600000u
+
+// Thermal model of the MQ heater element: preheat_ms takes it from cold to
+// stable, and it cools with a time constant of cool_ms while off.
+typedef struct {
+  uint32_t preheat_ms;
+  uint32_t cool_ms;
+} gas_heater_params;
+
+// Kept in RTC memory, on tracks the heater GPIO.
+typedef struct {
+  bool on;
+  float warmth;
+  int64_t updated_ms;
+  uint32_t hour_ms;
+  uint32_t hour_on_ms;
+  uint32_t on_per_hour_ms;
+  uint32_t hours;
+} gas_heater_state;
+
+void gas_heater_params_load(const device_config *config,
+                            gas_heater_params *params);
+// Brings the model up to now_ms, call it before any of the functions below.
+void gas_heater_update(gas_heater_state *state,
+                       const gas_heater_params *params, int64_t now_ms);
+void gas_heater_switch(gas_heater_state *state, bool on);
+bool gas_heater_stable(const gas_heater_state *state);
+// Time the heater still needs to be on to be stable.
+uint32_t gas_heater_preheat_ms(const gas_heater_state *state,
+                               const gas_heater_params *params);
+// Whether the heater has to be on from now for a reading read_ms ahead. The
+// next chance to switch is next_ms ahead, and up to wait_ms of preheat can
+// be waited out at the reading itself.
+bool gas_heater_plan(const gas_heater_state *state,
+                     const gas_heater_params *params, uint32_t read_ms,
+                     uint32_t next_ms, uint32_t wait_ms);
+// On-time over the last full hour, or so far when there was none yet.
+uint32_t gas_heater_on_per_hour_ms(const gas_heater_state *state);
+
+#endif
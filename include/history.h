@@ -0,0 +1,128 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "flash_dev.h"
+
+#define HISTORY_VALUES 9
+#define HISTORY_MISSING INT16_MIN
+#define HISTORY_MAX_SECTORS 32
+// A point this far behind the last one of its tier means the clock was wrong
+// and has been set back. The points filed since then are dropped instead of
+// refusing everything until the clock catches up with them.
+#define HISTORY_RESYNC_S 3600
+
+// Minute points for a day, compacted into quarter hour points kept for 30
+// days.
+#define HISTORY_TIER_MINUTES 0
+#define HISTORY_TIER_QUARTERS 1
+#define HISTORY_TIER_COUNT 2
+
+// Requests and response frames are little endian. A request is the magic,
+// the version, the tier, a zero byte and then the id, from and to (unix
+// seconds, inclusive) as u32. Every frame starts with the magic, the
+// version, the tier, the flags, the request id (u32), the frame number and
+// the point count (u16), followed by the points: the timestamp as u32 and
+// HISTORY_VALUES i16 values each. From version 2 on, lux and gas ppm are in
+// units of 4.
+#define HISTORY_FRAME_MAGIC 0xb6
+#define HISTORY_FRAME_VERSION 2
+#define HISTORY_REQUEST_SIZE 16
+#define HISTORY_FRAME_HEADER_SIZE 12
+#define HISTORY_FRAME_POINT_SIZE (4 + 2 * HISTORY_VALUES)
+#define HISTORY_FRAME_POINTS 40
+#define HISTORY_FRAME_MAX                                                      \
+  (HISTORY_FRAME_HEADER_SIZE + HISTORY_FRAME_POINTS * HISTORY_FRAME_POINT_SIZE)
+// The last frame of a response. When it is also truncated the device ran
+// out of time, the rest is fetched with a new request from after the last
+// point.
+#define HISTORY_FRAME_LAST (1u << 0)
+#define HISTORY_FRAME_TRUNCATED (1u << 1)
+
+// Downsampled time series on a flash_dev. Each tier is a ring of sectors
+// holding fixed size points in time order, so the first timestamp of every
+// sector is all the index a time range lookup needs: it picks the sector and
+// a binary search finds the point. The index is rebuilt from the sector
+// headers on mount. Points are CRC checked; a torn write loses one point.
+typedef struct {
+  uint32_t ts;
+  int16_t values[HISTORY_VALUES];
+} history_point;
+
+typedef struct {
+  uint32_t resolution_s;
+  uint32_t first_sector;
+  uint32_t sectors;
+  uint32_t head_sector;
+  uint32_t head_slot;
+  uint32_t next_seq;
+  uint32_t last_ts;
+  // First timestamp of each sector, 0 for a sector not in use.
+  uint32_t first_ts[HISTORY_MAX_SECTORS];
+} history_tier;
+
+typedef struct {
+  const flash_dev *dev;
+  uint32_t slots;
+  history_tier tiers[HISTORY_TIER_COUNT];
+} history;
+
+// Samples of the minute being collected, kept in RTC memory.
+typedef struct {
+  uint32_t start;
+  int32_t sum[HISTORY_VALUES];
+  uint16_t count[HISTORY_VALUES];
+} history_bucket;
+
+typedef struct {
+  uint32_t id;
+  uint32_t tier;
+  uint32_t from;
+  uint32_t to;
+} history_request;
+
+typedef struct {
+  uint8_t buf[HISTORY_FRAME_MAX];
+  size_t len;
+  uint16_t count;
+} history_frame;
+
+typedef enum {
+  HISTORY_OK = 0,
+  // Not newer than the last point of the tier, by less than
+  // HISTORY_RESYNC_S.
+  HISTORY_STALE,
+  HISTORY_INVALID,
+  HISTORY_IO_ERROR,
+} history_status;
+
+// Called for each point of a query, any value but 0 stops it.
+typedef int (*history_sink)(const history_point *point, void *arg);
+
+history_status history_mount(history *store, const flash_dev *dev);
+// Appends a minute point. Once it starts a new quarter hour, the minutes
+// of the previous one are compacted first.
+history_status history_append(history *store, const history_point *point);
+history_status history_compact(history *store, uint32_t start);
+// Adds a sample taken at ts, values with their bit clear in present are
+// left out. A minute is appended once a sample of a later one comes in.
+history_status history_record(history *store, history_bucket *bucket,
+                              uint32_t ts, const int32_t *values,
+                              uint32_t present);
+// Passes the points of the tier within [from, to] to sink, oldest first.
+// Returns the number of points passed.
+uint32_t history_query(const history *store, uint32_t tier, uint32_t from,
+                       uint32_t to, history_sink sink, void *arg);
+
+bool history_request_decode(const uint8_t *buf, size_t len,
+                            history_request *request);
+void history_frame_start(history_frame *frame, const history_request *request,
+                         uint16_t number);
+// Returns false once the frame is full.
+bool history_frame_add(history_frame *frame, const history_point *point);
+void history_frame_finish(history_frame *frame, uint8_t flags);
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef LZ_CODEC_H
+#define LZ_CODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define LZ_WINDOW_BITS 9
+#define LZ_LENGTH_BITS 4
+#define LZ_WINDOW (1 << LZ_WINDOW_BITS)
+#define LZ_MIN_MATCH 3
+#define LZ_MAX_MATCH (LZ_MIN_MATCH + (1 << LZ_LENGTH_BITS) - 1)
+#define LZ_MAX_INPUT 4096
+#define LZ_HASH_SIZE 256
+
+#define LZ_MAGIC 0xa7
+#define LZ_DICT_VERSION 1
+#define LZ_HEADER_SIZE 4
+
+// Small-window LZSS in the spirit of heatshrink. The window starts out
+// filled with a dictionary of the keys used by our payloads, so even a
+// single message compresses well. A compressed message starts with
+// LZ_MAGIC, which can never be the first byte of a JSON payload, followed by
+// the dictionary version and the original length.
+//
+// The encoder state is a fixed ~1.5 KB hash chain index; the decoder needs
+// nothing but the output buffer. Both sides are plain C so the backend can
+// build the same file.
+typedef struct {
+  int16_t head[LZ_HASH_SIZE];
+  int16_t prev[LZ_WINDOW];
+} lz_encoder;
+
+int lz_compress(lz_encoder *encoder, const uint8_t *in, size_t in_len,
+                uint8_t *out, size_t out_len);
+int lz_decompress(const uint8_t *in, size_t in_len, uint8_t *out,
+                  size_t out_len);
+
+#endif
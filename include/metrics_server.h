@@ -0,0 +1,21 @@
+#ifndef METRICS_SERVER_H
+#define METRICS_SERVER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define METRICS_SERVER_MAX 6144
+
+// Serves the last rendered metrics on GET /metrics. There are two buffers:
+// scrapes read the front one while the next sample is rendered into the
+// back one, so neither side ever waits for the other.
+bool metrics_server_start(uint16_t port);
+void metrics_server_stop(void);
+// Returns the back buffer to render into, or NULL while a slow scrape still
+// reads it. metrics_server_commit makes it the front buffer, a negative
+// length keeps the previous one.
+char *metrics_server_begin(size_t *len);
+void metrics_server_commit(int len);
+
+#endif
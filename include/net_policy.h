@@ -0,0 +1,23 @@
+#ifndef NET_POLICY_H
+#define NET_POLICY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define NET_POLICY_FREE_FAILURES 2
+#define NET_POLICY_MAX_SKIP 32
+
+// Connectivity backoff that survives deep sleep. After a few failed cycles
+// the device stops trying to reach the network for 1, 2, 4... cycles (up to
+// NET_POLICY_MAX_SKIP) and only samples and stores readings meanwhile.
+typedef struct {
+  uint32_t failures;
+  uint32_t skip_remaining;
+  uint32_t skipped_total;
+  uint32_t failed_total;
+} net_policy_state;
+
+bool net_policy_should_connect(net_policy_state *state);
+void net_policy_report(net_policy_state *state, bool success);
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef OTA_CHUNK_H
+#define OTA_CHUNK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define OTA_CHUNK_SIZE 512
+#define OTA_CHUNK_HEADER_SIZE 8
+
+// Images are pulled one chunk at a time: the device asks for
+// {"build", "offset", "length"} and the backend answers with a frame made of
+// <build:u32le><offset:u32le><data>. Only the chunk at the current offset is
+// accepted, so a resumed download never leaves a gap in the image.
+typedef struct {
+  uint32_t build;
+  uint32_t size;
+  uint32_t offset;
+} ota_progress;
+
+typedef enum {
+  OTA_CHUNK_ACCEPTED,
+  OTA_CHUNK_STALE,
+  OTA_CHUNK_REJECTED,
+} ota_chunk_status;
+
+ota_chunk_status ota_chunk_parse(const ota_progress *progress,
+                                 const uint8_t *frame, size_t len,
+                                 const uint8_t **data, size_t *data_len);
+size_t ota_chunk_request(const ota_progress *progress, char *buf, size_t len);
+bool ota_progress_complete(const ota_progress *progress);
+
+#endif
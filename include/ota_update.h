@@ -0,0 +1,25 @@
+#ifndef OTA_UPDATE_H
+#define OTA_UPDATE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "device_config.h"
+#include "ota_chunk.h"
+
+// Set by tools/gen_build.py, increasing with every build.
+#ifndef FIRMWARE_BUILD
+#error "FIRMWARE_BUILD is not set, see tools/gen_build.py"
+#endif
+
+bool ota_update_begin(const device_config *config);
+const ota_progress *ota_update_progress(void);
+size_t ota_update_request(char *buf, size_t len);
+ota_chunk_status ota_update_write_chunk(const void *frame, size_t len);
+bool ota_update_finish(const char *public_key_pem);
+void ota_update_suspend(void);
+void ota_update_confirm(void);
+// Drops a download resumed from RTC memory.
+void ota_update_reset(void);
+
+#endif
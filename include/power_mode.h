@@ -0,0 +1,40 @@
+#ifndef POWER_MODE_H
+#define POWER_MODE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// The maximum stays at the default clock: at 240 MHz the PLL cannot give the
+// 80 MHz an APB lock asks for, sensing would run at 240 MHz as well.
+#define POWER_MAX_FREQ_MHZ 160
+#define POWER_APB_FREQ_MHZ 80
+#define POWER_MIN_FREQ_MHZ 40
+
+// Nominal supply and draw per phase, only meant to compare configurations.
+#define POWER_SUPPLY_MV 3300
+#define POWER_IDLE_MA 15
+#define POWER_SENSE_MA 30
+#define POWER_NETWORK_MA 130
+
+// What the awake window is doing. Each phase holds the power management lock
+// it needs; while none is held the CPU drops to POWER_MIN_FREQ_MHZ and the
+// idle task may enter light sleep.
+typedef enum {
+  POWER_PHASE_IDLE,
+  POWER_PHASE_SENSE,
+  POWER_PHASE_NETWORK,
+  POWER_PHASE_COUNT,
+} power_phase;
+
+void power_mode_init(bool power_save);
+void power_phase_begin(power_phase phase);
+void power_phase_end(power_phase phase);
+void power_mode_times(uint32_t ms[POWER_PHASE_COUNT]);
+// The phase times summed per CPU clock, fastest first. Returns how many
+// clocks were filled in. The idle clock includes the time in light sleep.
+int power_mode_clock_times(const uint32_t ms[POWER_PHASE_COUNT],
+                           uint32_t mhz[POWER_PHASE_COUNT],
+                           uint32_t clock_ms[POWER_PHASE_COUNT]);
+uint32_t power_mode_energy_mj(const uint32_t ms[POWER_PHASE_COUNT]);
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef PROMETHEUS_H
+#define PROMETHEUS_H
+
+#include <stddef.h>
+
+#include "reading.h"
+#include "stats.h"
+
+// Prometheus text exposition of the latest reading and of the statistics of
+// the current aggregation window. Every reading field becomes a gauge named
+// aq_<group>_<key>, groups without data are left out. The window statistics
+// share one gauge, labelled by metric and stat. Returns the length, or -1
+// when buf is too small.
+int prometheus_write(const reading *value, const metric_stats *metrics,
+                     const char **names, int count, char *buf, size_t len);
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef PUBLISH_WINDOW_H
+#define PUBLISH_WINDOW_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// coreMQTT keeps a state record per QoS1 publish in flight, 10 by default.
+// This leaves room for the publishes that wait for their own PUBACK.
+#define PUBLISH_WINDOW_MAX 8
+#define PUBLISH_WINDOW_INITIAL 2
+#define PUBLISH_WINDOW_MIN_RTO_MS 200
+#define PUBLISH_WINDOW_MAX_RTO_MS 5000
+#define PUBLISH_WINDOW_INITIAL_RTO_MS 1000
+// PUBACKs are only seen at the next poll of the connection, every 10 ms in
+// the MQTT task. The timeout keeps at least this over the round trip.
+#define PUBLISH_WINDOW_GRANULARITY_MS 20
+// Sends of one message before the connection is given up on.
+#define PUBLISH_WINDOW_ATTEMPTS 3
+
+// QoS1 publishes in flight, oldest first. PUBACKs may come in any order, but
+// messages leave the window in send order so the caller can consume stored
+// records in order. ref is the caller's handle to send a message again.
+//
+// The retransmit timeout follows the smoothed round trip like TCP's (RFC
+// 6298), retransmitted messages are not sampled. Every round trip the
+// window grows by one while the round trip stays near the lowest seen, and
+// shrinks by one once it is twice that: the link is queueing and more in
+// flight only adds delay. A timeout halves it. With one in flight and still
+// twice as slow, the lowest round trip is taken to have changed.
+typedef struct {
+  uint32_t ref;
+  uint32_t sent_ms;
+  uint16_t packet_id;
+  uint8_t attempts;
+  bool acked;
+} publish_slot;
+
+typedef struct {
+  publish_slot slots[PUBLISH_WINDOW_MAX];
+  uint8_t head;
+  uint8_t count;
+  uint8_t size;
+  uint8_t round_acks;
+  // Zero before the first sample.
+  uint32_t srtt_ms;
+  uint32_t rttvar_ms;
+  uint32_t min_rtt_ms;
+  uint32_t rto_ms;
+  uint32_t retransmits;
+} publish_window;
+
+void publish_window_init(publish_window *window);
+// Forgets what is in flight and the retransmit count for a new connection,
+// the size and round trip estimates are kept.
+void publish_window_clear(publish_window *window);
+bool publish_window_open(const publish_window *window);
+void publish_window_sent(publish_window *window, uint32_t ref,
+                         uint16_t packet_id, uint32_t now_ms);
+// A message with nothing to wait for, it leaves in order like the rest.
+void publish_window_skip(publish_window *window, uint32_t ref);
+// Returns false for a packet id that is not in flight.
+bool publish_window_ack(publish_window *window, uint16_t packet_id,
+                        uint32_t now_ms);
+// Removes the oldest message once it is acknowledged.
+bool publish_window_pop(publish_window *window, uint32_t *ref);
+// Oldest unacknowledged message past the timeout, NULL if there is none.
+publish_slot *publish_window_expired(publish_window *window, uint32_t now_ms);
+void publish_window_resent(publish_window *window, publish_slot *slot,
+                           uint32_t now_ms);
+
+#endif
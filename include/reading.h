@@ -0,0 +1,81 @@
+#ifndef READING_H
+#define READING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define READING_FORMAT_VERSION 4
+#define READING_BINARY_MAGIC 0xb5
+// Magic and version, the missing groups, then a zigzag varint per field of
+// the groups present.
+#define READING_BINARY_MAX (2 + 5 + 5 * READING_FIELD_COUNT)
+
+// The one definition of a reading. Every group becomes a struct named by its
+// second column, every field an int member serialized under its JSON key.
+// The binary encoding follows the order below. Adding, removing or moving a
+// field needs a new READING_FORMAT_VERSION.
+#define DHT_LEVEL_FIELDS(X)                                                    \
+  X(temperature, "temperature")                                                \
+  X(humidity, "humidity")
+#define GAS_LEVEL_FIELDS(X)                                                    \
+  X(level, "level")                                                            \
+  X(ppm, "ppm")                                                                \
+  X(stable, "stable")
+#define LDR_LEVEL_FIELDS(X)                                                    \
+  X(light, "intensity")                                                        \
+  X(lux, "lux")
+#define CO2_LEVEL_FIELDS(X)                                                    \
+  X(ppm, "ppm")                                                                \
+  X(temperature, "temperature")
+#define POWER_LEVEL_FIELDS(X) X(volts, "volts")
+#define NET_COUNTERS_FIELDS(X)                                                 \
+  X(skipped, "skipped")                                                        \
+  X(failures, "failures")
+
+#define READING_GROUPS(X)                                                      \
+  X(dht, dht_level, DHT_LEVEL_FIELDS)                                          \
+  X(gas, gas_level, GAS_LEVEL_FIELDS)                                          \
+  X(ldr, ldr_level, LDR_LEVEL_FIELDS)                                          \
+  X(co2, co2_level, CO2_LEVEL_FIELDS)                                          \
+  X(power, power_level, POWER_LEVEL_FIELDS)                                    \
+  X(net, net_counters, NET_COUNTERS_FIELDS)
+
+#define READING_SCALARS(X) X(uptime, "uptime")
+
+#define READING_DECLARE_FIELD(name, key) int name;
+#define READING_DECLARE_GROUP(group, type, fields)                             \
+  typedef struct {                                                             \
+    fields(READING_DECLARE_FIELD)                                              \
+  } type;
+READING_GROUPS(READING_DECLARE_GROUP)
+
+#define READING_DECLARE_INDEX(group, type, fields) READING_GROUP_##group,
+enum { READING_GROUPS(READING_DECLARE_INDEX) READING_GROUP_COUNT };
+#define READING_MISSING(group) (1u << READING_GROUP_##group)
+
+#define READING_DECLARE_MEMBER(group, type, fields) type group;
+typedef struct {
+  READING_GROUPS(READING_DECLARE_MEMBER)
+  READING_SCALARS(READING_DECLARE_FIELD)
+  // READING_MISSING bits of the groups without data, they are published as
+  // null. Groups that were not scheduled are in omitted as well and are left
+  // out altogether.
+  uint32_t missing;
+  uint32_t omitted;
+} reading;
+
+#define READING_COUNT_FIELD(name, key) +1
+#define READING_COUNT_GROUP(group, type, fields) fields(READING_COUNT_FIELD)
+#define READING_FIELD_COUNT                                                    \
+  (0 READING_GROUPS(READING_COUNT_GROUP) READING_SCALARS(READING_COUNT_FIELD))
+
+// extra is inserted verbatim before the closing brace, it must be empty or
+// start with a comma. Both writers return the length or -1 when buf is too
+// small.
+int reading_write_json(const reading *value, const char *extra, char *buf,
+                       size_t len);
+int reading_encode(const reading *value, uint8_t *buf, size_t len);
+// Only decodes READING_FORMAT_VERSION. Returns the length read or -1.
+int reading_decode(const uint8_t *buf, size_t len, reading *value);
+
+#endif
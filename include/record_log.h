@@ -0,0 +1,57 @@
+#ifndef RECORD_LOG_H
+#define RECORD_LOG_H
+
+#include <stdint.h>
+
+#include "flash_dev.h"
+
+#define RECORD_LOG_MAX_RECORD 2048
+
+// Append-only record log on top of a flash_dev. Sectors are used as a ring so
+// every sector is erased equally often; when the ring is full the oldest
+// sector is recycled and its unread records are counted as dropped.
+//
+// Nothing but the flash contents is needed to recover the head and tail:
+// records are CRC protected and consumption is recorded by clearing bits of
+// the record state, so a power cut at any point loses at most the record
+// that was being written.
+typedef enum {
+  RECORD_LOG_OK = 0,
+  RECORD_LOG_EMPTY,
+  RECORD_LOG_INVALID,
+  RECORD_LOG_CORRUPT,
+  RECORD_LOG_IO_ERROR,
+} record_log_status;
+
+typedef struct {
+  const flash_dev *dev;
+  uint32_t sectors;
+  uint32_t head_sector;
+  uint32_t head_offset;
+  uint32_t tail_sector;
+  uint32_t tail_offset;
+  uint32_t next_seq;
+  uint32_t next_sector_seq;
+  uint32_t pending;
+  uint32_t dropped;
+} record_log;
+
+// Called for each drained record, must return 0 once the record is delivered
+// so it can be consumed. Any other value stops the drain.
+typedef int (*record_log_sink)(const void *data, uint16_t len, void *arg);
+
+record_log_status record_log_mount(record_log *log, const flash_dev *dev);
+record_log_status record_log_append(record_log *log, const void *data,
+                                    uint16_t len);
+record_log_status record_log_peek(record_log *log, void *buf, uint16_t *len);
+record_log_status record_log_consume(record_log *log);
+// Reads ahead of the tail without consuming. pos starts at record_log_tail()
+// and next is set to the record after it, RECORD_LOG_EMPTY once the head is
+// reached. A record can be read again by its pos until it is consumed.
+uint32_t record_log_tail(const record_log *log);
+record_log_status record_log_read(const record_log *log, uint32_t pos,
+                                  void *buf, uint16_t *len, uint32_t *next);
+uint32_t record_log_drain(record_log *log, uint32_t max_records,
+                          record_log_sink sink, void *arg);
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef SENSOR_HEALTH_H
+#define SENSOR_HEALTH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SENSOR_HEALTH_TRIP_FAILURES 3
+
+// Circuit breaker for one sensor, kept in RTC memory across wake cycles.
+// After SENSOR_HEALTH_TRIP_FAILURES failed cycles in a row the sensor is
+// only tried again every probe_cycles cycles, until a probe succeeds.
+typedef struct {
+  uint32_t failures;
+  uint32_t skip_remaining;
+  uint32_t attempts;
+  uint32_t successes;
+  uint32_t lost_ms;
+} sensor_health;
+
+bool sensor_health_should_read(sensor_health *health);
+void sensor_health_report(sensor_health *health, bool success,
+                          uint32_t elapsed_ms, uint32_t probe_cycles);
+bool sensor_health_open(const sensor_health *health);
+uint32_t sensor_health_success_percent(const sensor_health *health);
+
+#endif
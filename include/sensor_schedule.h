@@ -0,0 +1,30 @@
+#ifndef SENSOR_SCHEDULE_H
+#define SENSOR_SCHEDULE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum {
+  SENSOR_CO2,
+  SENSOR_DHT,
+  SENSOR_GAS,
+  SENSOR_LDR,
+  SENSOR_POWER,
+  SENSOR_COUNT,
+} sensor_id;
+
+// A sensor is read on the cycles where cycle % period == phase, a period of
+// 0 turns it off. samples is the number of readings averaged per read, 0
+// uses read_samples; CO2 and power take one reading of their own. The DHT
+// takes no more than fit in the sensor phase, one every 2 s.
+typedef struct {
+  uint32_t period;
+  uint32_t phase;
+  uint32_t samples;
+} sensor_schedule;
+
+bool sensor_schedule_due(const sensor_schedule *schedule, uint32_t cycle);
+uint32_t sensor_schedule_samples(const sensor_schedule *schedule,
+                                 uint32_t read_samples);
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_DIGEST_SIZE 32
+
+// Plain software SHA-256. Unlike the hardware backed mbedtls context the
+// state is an ordinary struct, so a running hash can be kept in RTC memory
+// across deep sleep.
+typedef struct {
+  uint32_t state[8];
+  uint64_t length;
+  uint8_t block[64];
+  uint32_t block_len;
+} sha256_context;
+
+void sha256_init(sha256_context *ctx);
+void sha256_update(sha256_context *ctx, const void *data, size_t len);
+void sha256_final(sha256_context *ctx, uint8_t digest[SHA256_DIGEST_SIZE]);
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define STATS_EWMA_ALPHA 0.1f
+
+// Quantile sketch after KLL (Karnin, Lang & Liberty): samples are kept in
+// levels, one in level h standing for 2^h samples. Once the sketch is full,
+// the lowest level over its capacity is sorted and every other sample moves
+// up a level, the odd and the even ones in turn. Capacities shrink by 2/3 a
+// level down from the top. Up to STATS_SKETCH_SIZE samples nothing is
+// dropped and the quantiles are exact.
+#define STATS_SKETCH_SIZE 39
+// Over 600000 samples, any after that are left out.
+#define STATS_SKETCH_LEVELS 16
+
+typedef struct {
+  float items[STATS_SKETCH_SIZE];
+  // Level h is items[begin[h]] up to begin[h - 1], level 0 up to size.
+  uint8_t begin[STATS_SKETCH_LEVELS];
+  uint8_t levels;
+  uint8_t size;
+  // Whether the next compaction of a level keeps the odd samples.
+  uint16_t odd;
+} quantile_sketch;
+
+// Incremental summary of one metric over an aggregation window. Everything
+// is fixed size so a set of these can live in RTC memory across deep sleep.
+// The EWMA is carried over between windows, the rest restarts.
+typedef struct {
+  uint32_t count;
+  float mean;
+  float m2;
+  float min;
+  float max;
+  float ewma;
+  bool ewma_ready;
+  quantile_sketch sketch;
+} metric_stats;
+
+void sketch_init(quantile_sketch *sketch);
+void sketch_add(quantile_sketch *sketch, float x);
+// The sample with about a share p of the samples below it, 0 when empty.
+float sketch_value(const quantile_sketch *sketch, float p);
+
+void stats_init(metric_stats *stats);
+void stats_reset_window(metric_stats *stats);
+void stats_add(metric_stats *stats, float x);
+float stats_variance(const metric_stats *stats);
+float stats_p50(const metric_stats *stats);
+float stats_p90(const metric_stats *stats);
+
+#endif
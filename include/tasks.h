@@ -3,15 +3,25 @@
 
 #include "esp_event.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 
 #include "driver/adc.h"
 #include "driver/gpio.h"
 
+#include "alert.h"
+#include "battery_policy.h"
+#include "cycle_budget.h"
+#include "device_config.h"
+#include "espnow_link.h"
+#include "gas_heater.h"
+#include "net_policy.h"
+#include "reading.h"
+#include "sensor_health.h"
+#include "stats.h"
+
 #define US_TO_MS 1000000
 
 #define READ_DELAY_IN_MS 50
-#define READ_SAMPLES 10
-#define SLEE_TIME (US_TO_MS * 15)
 
 #define DHT_PIN GPIO_NUM_4
 #define LDR_PIN ADC1_CHANNEL_7
@@ -19,43 +29,71 @@
 #define POWER_PIN ADC1_CHANNEL_6
 #define CO2_TX_PIN GPIO_NUM_22
 #define CO2_RX_PIN GPIO_NUM_25
+// Drives the MQ heater switch, only used when gas_preheat_s is set.
+#define GAS_HEATER_PIN GPIO_NUM_27
 
-#define CO2_TASK_BIT BIT0
-#define DHT_TASK_BIT BIT1
-#define GAS_TASK_BIT BIT2
-#define LDR_TASK_BIT BIT3
-#define POWER_TASK_BIT BIT4
-#define MQTT_TASK_BIT BIT5
-
-typedef struct {
-  int ppm;
-  int temperature;
-} co2_level;
+// Preheat the gas task waits out before reading anyway, within the sensor
+// phase.
+#define GAS_PREHEAT_WAIT_MS 3000
 
-typedef struct {
-  int level;
-} gas_level;
+// Each sensor task signals the bit of its sensor_id.
+#define SENSOR_TASK_BIT(sensor) (1u << (sensor))
+#define CO2_TASK_BIT SENSOR_TASK_BIT(SENSOR_CO2)
+#define DHT_TASK_BIT SENSOR_TASK_BIT(SENSOR_DHT)
+#define GAS_TASK_BIT SENSOR_TASK_BIT(SENSOR_GAS)
+#define LDR_TASK_BIT SENSOR_TASK_BIT(SENSOR_LDR)
+#define POWER_TASK_BIT SENSOR_TASK_BIT(SENSOR_POWER)
+#define MQTT_TASK_BIT BIT5
 
-typedef struct {
-  int volts;
-} power_level;
+typedef enum {
+  METRIC_DHT_TEMPERATURE,
+  METRIC_DHT_HUMIDITY,
+  METRIC_GAS_LEVEL,
+  METRIC_GAS_PPM,
+  METRIC_LDR_LIGHT,
+  METRIC_LDR_LUX,
+  METRIC_CO2_PPM,
+  METRIC_CO2_TEMPERATURE,
+  METRIC_POWER_VOLTS,
+  METRIC_COUNT,
+} metric_id;
 
 typedef struct {
-  int light;
-} ldr_level;
+  bool ready;
+  uint32_t cycles;
+  metric_stats metrics[METRIC_COUNT];
+} stats_window;
 
+// One sensor task run. A sensor that is due is still not started while its
+// circuit breaker is open, or while the task of an earlier run that timed
+// out has not finished (stuck).
 typedef struct {
-  int temperature;
-  int humidity;
-} dht_level;
+  bool due;
+  bool started;
+  bool stuck;
+  bool success;
+  uint32_t elapsed_ms;
+  volatile bool running;
+} sensor_run;
 
 typedef struct {
-  power_level power;
-  ldr_level ldr;
-  dht_level dht;
-  gas_level gas;
-  co2_level co2;
-  int uptime;
+  reading reading;
+  sensor_run sensors[SENSOR_COUNT];
+  int64_t sensors_started_us;
+  sensor_health *health;
+  // The battery state and the settings of the profile in use.
+  const battery_state *battery;
+  const battery_settings *profile;
+  gas_heater_state *heater;
+  uint32_t stub_cycles;
+  uint32_t stub_us;
+  const device_config *config;
+  uint32_t executed_commands;
+  stats_window *window;
+  alert_monitor *alerts;
+  bool alert_wake;
+  cycle_budget *cycle;
+  cycle_history *history;
   EventGroupHandle_t tasks_event;
 } task_results;
 
@@ -66,7 +104,14 @@ typedef struct {
   char *thing_name;
   char *mqtt_host;
   char *root_ca;
+  char *transport;
+  char *ota_public_key;
   int mqtt_port;
+  bool publish_due;
+  bool online;
+  bool flush_backlog;
+  net_policy_state *net_state;
+  const espnow_link *espnow;
 } mqtt_params;
 
 void co2_task(void *param);
@@ -75,6 +120,18 @@ void ldr_task(void *param);
 void gas_task(void *param);
 void power_task(void *param);
 void mqtt_task(void *param);
+void mqtt_connected_task(void *param);
+// Clears what the MQTT tasks keep in RTC memory.
+void mqtt_reset_state(void);
+void espnow_node_task(void *param);
+void start_sensor_tasks(task_results *results);
+// Switches the MQ heater and holds the pin through deep sleep.
+void gas_heater_set(bool on);
+// Waits for the sensor tasks until the sensor phase deadline, then fills in
+// the missing groups and the calibrated values.
+void wait_for_sensors(task_results *results);
+void finish_sensor_task(task_results *results, sensor_id sensor, bool success,
+                        int64_t started_us);
 
 int udp_logging_init(const char *ipaddr, unsigned long port,
                      vprintf_like_t func);
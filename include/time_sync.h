@@ -0,0 +1,22 @@
+#ifndef TIME_SYNC_H
+#define TIME_SYNC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TIME_SYNC_SERVER "pool.ntp.org"
+#define TIME_SYNC_MAX_UNCERTAINTY_MS 2000
+#define TIME_SYNC_MAX_AGE_S (24 * 3600)
+
+void time_sync_init(void);
+// Forgets the learnt drift and the uptime origin, before time_sync_init.
+void time_sync_reset(void);
+bool time_sync_due(void);
+void time_sync_start(void);
+bool time_sync_wait(uint32_t timeout_ms);
+void time_sync_stop(void);
+bool time_sync_now(int64_t *unix_ms, uint32_t *uncertainty_ms);
+uint32_t time_sync_uptime(void);
+int64_t time_sync_uptime_ms(void);
+
+#endif
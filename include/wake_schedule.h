@@ -0,0 +1,18 @@
+#ifndef WAKE_SCHEDULE_H
+#define WAKE_SCHEDULE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define WAKE_MIN_SLEEP_MS 1000
+
+// Spreads the wake-ups of a fleet over the reporting period. With staggering
+// each device wakes at its own offset into the period, derived from its
+// name, instead of whenever it happened to boot; jitter adds a random delay
+// on top so devices that share an offset don't reconnect in lockstep.
+uint32_t wake_schedule_phase(const char *device_id, uint32_t period_ms);
+uint32_t wake_schedule_delay(int64_t now_ms, bool aligned, uint32_t period_ms,
+                             uint32_t phase_ms, uint32_t jitter_ms,
+                             uint32_t random);
+
+#endif
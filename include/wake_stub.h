@@ -0,0 +1,26 @@
+#ifndef WAKE_STUB_H
+#define WAKE_STUB_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define WAKE_STUB_MAX_SAMPLES 32
+
+// What the wake stub did since the last full boot: the number of wakes it
+// handled without booting, the time those took and the gas readings taken,
+// including the one of the wake that booted.
+typedef struct {
+  uint32_t cycles;
+  uint32_t samples;
+  uint16_t values[WAKE_STUB_MAX_SAMPLES];
+  uint32_t awake_us;
+  bool threshold_hit;
+} wake_stub_report;
+
+void wake_stub_arm(uint32_t period_ms, uint32_t max_cycles,
+                   uint16_t gas_threshold);
+void wake_stub_collect(wake_stub_report *report);
+// Disarms the stub and drops what it collected.
+void wake_stub_reset(void);
+
+#endif
@@ -0,0 +1,143 @@
+#include <math.h>
+#include <string.h>
+
+#include "alert.h"
+
+void alert_rules_load(const device_config *config, alert_rule *rules) {
+  uint32_t hold_ms = config->alert_hold_s * 1000;
+  uint32_t holdoff_ms = config->alert_holdoff_s * 1000;
+
+  rules[ALERT_RULE_CO2] = (alert_rule){
+      "co2", ALERT_ABOVE, config->co2_threshold_ppm, hold_ms, holdoff_ms};
+  rules[ALERT_RULE_CO2_RISE] = (alert_rule){
+      "co2_rise", ALERT_RISE, config->alert_co2_rise, hold_ms, holdoff_ms};
+  rules[ALERT_RULE_GAS] = (alert_rule){
+      "gas", ALERT_ABOVE, config->alert_gas_ppm, hold_ms, holdoff_ms};
+}
+
+void alert_values(const reading *value, float *values) {
+  bool co2 = !(value->missing & READING_MISSING(co2));
+  // Gas read before the heater settled reads high, it must not raise one.
+  bool gas = !(value->missing & READING_MISSING(gas)) && value->gas.stable;
+
+  values[ALERT_RULE_CO2] = co2 ? value->co2.ppm : NAN;
+  values[ALERT_RULE_CO2_RISE] = co2 ? value->co2.ppm : NAN;
+  values[ALERT_RULE_GAS] = gas ? value->gas.ppm : NAN;
+}
+
+alert_event alert_evaluate(const alert_rule *rule, alert_state *state,
+                           float value, int64_t now_ms) {
+  float measured = value;
+
+  if (rule->kind == ALERT_RISE) {
+    bool rate_known = state->has_last && now_ms > state->last_ms;
+
+    measured = rate_known ? (value - state->last_value) * 60000 /
+                                (float)(now_ms - state->last_ms)
+                          : 0;
+    state->has_last = true;
+    state->last_value = value;
+    state->last_ms = now_ms;
+  }
+
+  // Hysteresis keeps a value hovering around the threshold from flapping.
+  bool breach = rule->threshold > 0 &&
+                measured >= (state->active ? rule->threshold * ALERT_CLEAR_RATIO
+                                           : rule->threshold);
+
+  if (!breach) {
+    state->breached = false;
+    if (state->active) {
+      state->active = false;
+      return ALERT_CLEARED;
+    }
+    return ALERT_NONE;
+  }
+
+  if (!state->breached) {
+    state->breached = true;
+    state->breach_ms = now_ms;
+  }
+
+  if (state->active || now_ms - state->breach_ms < rule->hold_ms ||
+      (state->raised_once && now_ms - state->raised_ms < rule->holdoff_ms)) {
+    return ALERT_NONE;
+  }
+
+  state->active = true;
+  state->raised_once = true;
+  state->raised_ms = now_ms;
+  return ALERT_RAISED;
+}
+
+int alert_monitor_update(alert_monitor *monitor, const alert_rule *rules,
+                         const float *values, int64_t now_ms) {
+  int queued = 0;
+
+  for (int i = 0; i < ALERT_RULE_COUNT; i++) {
+    // A missing reading neither raises nor clears an alert.
+    if (isnan(values[i])) {
+      continue;
+    }
+
+    const alert_state *state = &monitor->states[i];
+    alert_event event =
+        alert_evaluate(&rules[i], &monitor->states[i], values[i], now_ms);
+
+    if (event == ALERT_NONE) {
+      // Breaches that are only kept back by the rate limit.
+      monitor->suppressed += state->breached && !state->active &&
+                             now_ms - state->breach_ms >= rules[i].hold_ms;
+      continue;
+    }
+
+    if (monitor->queued == ALERT_QUEUE_SIZE) {
+      alert_monitor_pop(monitor);
+      monitor->dropped++;
+    }
+
+    monitor->queue[monitor->queued++] = (alert_record){
+        .rule = i,
+        .event = event,
+        .value = values[i],
+        .detected_ms = now_ms,
+    };
+    queued++;
+  }
+
+  return queued;
+}
+
+int64_t alert_monitor_next_ms(const alert_monitor *monitor,
+                              const alert_rule *rules, int64_t now_ms) {
+  int64_t next = -1;
+
+  for (int i = 0; i < ALERT_RULE_COUNT; i++) {
+    const alert_state *state = &monitor->states[i];
+    if (!state->breached || state->active) {
+      continue;
+    }
+
+    int64_t at = state->breach_ms + rules[i].hold_ms;
+    if (state->raised_once && state->raised_ms + rules[i].holdoff_ms > at) {
+      at = state->raised_ms + rules[i].holdoff_ms;
+    }
+
+    int64_t wait = at > now_ms ? at - now_ms : 0;
+    if (next < 0 || wait < next) {
+      next = wait;
+    }
+  }
+
+  return next;
+}
+
+void alert_monitor_pop(alert_monitor *monitor) {
+  if (monitor->queued == 0) {
+    return;
+  }
+
+  monitor->queued--;
+  memmove(&monitor->queue[0], &monitor->queue[1],
+          monitor->queued * sizeof(monitor->queue[0]));
+}
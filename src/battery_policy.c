@@ -0,0 +1,81 @@
+#include "battery_policy.h"
+
+// CO2 and gas sensors draw the most, the supply is always measured to
+// notice when the battery recovers.
+static const battery_settings profiles[BATTERY_PROFILE_COUNT] = {
+    [BATTERY_PROFILE_NORMAL] = {1, 1, BATTERY_ALL_SENSORS, true, true},
+    [BATTERY_PROFILE_SAVING] = {2, 2, BATTERY_ALL_SENSORS, true, false},
+    [BATTERY_PROFILE_LOW] = {4, 4,
+                             BATTERY_ALL_SENSORS &
+                                 ~(BATTERY_SENSOR(SENSOR_CO2) |
+                                   BATTERY_SENSOR(SENSOR_GAS)),
+                             true, false},
+    [BATTERY_PROFILE_BROWNOUT] = {8, 1, BATTERY_SENSOR(SENSOR_POWER), false,
+                                  false},
+};
+
+static const char *profile_names[BATTERY_PROFILE_COUNT] = {
+    [BATTERY_PROFILE_NORMAL] = "normal",
+    [BATTERY_PROFILE_SAVING] = "saving",
+    [BATTERY_PROFILE_LOW] = "low",
+    [BATTERY_PROFILE_BROWNOUT] = "brownout",
+};
+
+// A threshold of 0 leaves its profile out.
+static battery_profile classify(const device_config *config,
+                                uint32_t supply_mv) {
+  if (supply_mv < config->battery_brownout_mv) {
+    return BATTERY_PROFILE_BROWNOUT;
+  }
+  if (supply_mv < config->battery_low_mv) {
+    return BATTERY_PROFILE_LOW;
+  }
+  if (supply_mv < config->battery_saving_mv) {
+    return BATTERY_PROFILE_SAVING;
+  }
+  return BATTERY_PROFILE_NORMAL;
+}
+
+bool battery_policy_update(battery_state *state, const device_config *config,
+                           uint32_t supply_mv) {
+  battery_profile profile = classify(config, supply_mv);
+
+  // Recovering takes hysteresis on top of the threshold, a profile may be
+  // skipped on the way up as well as on the way down.
+  if (profile < state->profile) {
+    uint32_t hysteresis = config->battery_hysteresis_mv;
+    profile = classify(config, supply_mv > hysteresis ? supply_mv - hysteresis
+                                                      : 0);
+    if (profile > state->profile) {
+      profile = state->profile;
+    }
+  }
+
+  if (profile == state->profile) {
+    return false;
+  }
+
+  // Uploads resume anyway once the battery recovers.
+  state->flush_pending = profile == BATTERY_PROFILE_BROWNOUT;
+  state->profile = profile;
+  state->changes++;
+  return true;
+}
+
+const battery_settings *battery_policy_settings(battery_profile profile) {
+  return &profiles[profile];
+}
+
+uint32_t battery_policy_window(const battery_settings *settings,
+                               uint32_t aggregate_cycles) {
+  if (settings->batch_factor <= 1) {
+    return aggregate_cycles;
+  }
+
+  return (aggregate_cycles > 0 ? aggregate_cycles : 1) *
+         settings->batch_factor;
+}
+
+const char *battery_profile_name(battery_profile profile) {
+  return profile_names[profile];
+}
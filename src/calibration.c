@@ -0,0 +1,80 @@
+#include <math.h>
+
+#include "calibration.h"
+#include "calibration_tables.h"
+
+#define COUNT(table) (sizeof(table) / sizeof(table[0]))
+
+static float interpolate(const calibration_point *curve, int count, int raw) {
+  if (raw <= curve[0].raw) {
+    return curve[0].value;
+  }
+  if (raw >= curve[count - 1].raw) {
+    return curve[count - 1].value;
+  }
+
+  int low = 0;
+  int high = count - 1;
+  while (high - low > 1) {
+    int mid = (low + high) / 2;
+    if (curve[mid].raw <= raw) {
+      low = mid;
+    } else {
+      high = mid;
+    }
+  }
+
+  const calibration_point *a = &curve[low];
+  const calibration_point *b = &curve[high];
+  return a->value +
+         (b->value - a->value) * (raw - a->raw) / (float)(b->raw - a->raw);
+}
+
+// Bilinear over the grid, conditions outside it use the nearest edge.
+static float compensation(int temperature, int humidity) {
+  float t = (temperature - CALIBRATION_COMP_T0) /
+            (float)CALIBRATION_COMP_T_STEP;
+  float h = (humidity - CALIBRATION_COMP_RH0) / (float)CALIBRATION_COMP_RH_STEP;
+
+  t = fminf(fmaxf(t, 0), CALIBRATION_COMP_T_COUNT - 1);
+  h = fminf(fmaxf(h, 0), CALIBRATION_COMP_RH_COUNT - 1);
+
+  int row = t < CALIBRATION_COMP_T_COUNT - 1 ? (int)t
+                                             : CALIBRATION_COMP_T_COUNT - 2;
+  int col = h < CALIBRATION_COMP_RH_COUNT - 1 ? (int)h
+                                              : CALIBRATION_COMP_RH_COUNT - 2;
+  t -= row;
+  h -= col;
+
+  float top = gas_compensation[row][col] +
+              (gas_compensation[row][col + 1] - gas_compensation[row][col]) * h;
+  float bottom =
+      gas_compensation[row + 1][col] +
+      (gas_compensation[row + 1][col + 1] - gas_compensation[row + 1][col]) *
+          h;
+  return top + (bottom - top) * t;
+}
+
+static int clamp(float value, int max) {
+  return value >= max ? max : (int)(value + 0.5f);
+}
+
+void calibration_init(calibration *cal, uint32_t gas_r0, uint32_t ldr_r10) {
+  // ppm goes with (Rs / R0)^B and lux with (R / R10)^(-1 / gamma), the
+  // tables are for R0 and R10 equal to the divider resistor.
+  cal->gas_scale = powf((float)gas_r0 / CALIBRATION_UNIT, -CALIBRATION_GAS_B);
+  cal->ldr_scale =
+      powf((float)ldr_r10 / CALIBRATION_UNIT, 1 / CALIBRATION_LDR_GAMMA);
+}
+
+int calibration_gas_ppm(const calibration *cal, int raw, int temperature,
+                        int humidity) {
+  float ppm = interpolate(gas_ppm_curve, COUNT(gas_ppm_curve), raw);
+  return clamp(ppm * cal->gas_scale * compensation(temperature, humidity),
+               CALIBRATION_MAX_PPM);
+}
+
+int calibration_ldr_lux(const calibration *cal, int raw) {
+  float lux = interpolate(ldr_lux_curve, COUNT(ldr_lux_curve), raw);
+  return clamp(lux * cal->ldr_scale, CALIBRATION_MAX_LUX);
+}
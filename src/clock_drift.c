@@ -0,0 +1,51 @@
+#include <math.h>
+
+#include "clock_drift.h"
+
+void clock_drift_sync(clock_drift *clock, int64_t local_us, int64_t true_us) {
+  int64_t elapsed = true_us - clock->sync_us;
+
+  // Short intervals are dominated by the sync error itself.
+  if (clock->synced && elapsed >= CLOCK_MIN_INTERVAL_US) {
+    float ppm = (float)(local_us - true_us) * 1e6f / (float)elapsed;
+    // Both ends of the interval carry a sync error.
+    float error_ppm = 2.0f * CLOCK_SYNC_ERROR_US * 1e6f / (float)elapsed;
+
+    if (clock->samples == 0) {
+      clock->drift_ppm = ppm;
+      clock->error_ppm = error_ppm;
+      clock->spread_ppm = 0;
+    } else {
+      float change = fabsf(ppm - clock->drift_ppm);
+      clock->drift_ppm += CLOCK_DRIFT_GAIN * (ppm - clock->drift_ppm);
+      // The estimate is a weighted mean, so is the bound of its error.
+      clock->error_ppm += CLOCK_DRIFT_GAIN * (error_ppm - clock->error_ppm);
+      clock->spread_ppm = fmaxf(change, clock->spread_ppm * CLOCK_SPREAD_DECAY);
+    }
+    clock->samples++;
+  }
+
+  clock->synced = true;
+  clock->sync_us = true_us;
+}
+
+bool clock_drift_correct(const clock_drift *clock, int64_t local_us,
+                         int64_t *true_us, uint32_t *uncertainty_us) {
+  if (!clock->synced) {
+    return false;
+  }
+
+  int64_t elapsed = local_us - clock->sync_us;
+  float ppm = CLOCK_DEFAULT_PPM;
+  if (clock->samples > 0) {
+    ppm = fmaxf(clock->spread_ppm, CLOCK_MIN_PPM) + clock->error_ppm;
+  }
+
+  *true_us = local_us - (int64_t)(elapsed * (double)clock->drift_ppm / 1e6);
+
+  float uncertainty =
+      CLOCK_SYNC_ERROR_US + fabsf((float)elapsed) * ppm / 1e6f;
+  *uncertainty_us = uncertainty > UINT32_MAX ? UINT32_MAX
+                                              : (uint32_t)uncertainty;
+  return true;
+}
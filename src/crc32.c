@@ -0,0 +1,17 @@
+#include "crc32.h"
+
+#define CRC32_POLY 0xEDB88320
+
+uint32_t crc32_update(uint32_t crc, const void *data, size_t len) {
+  const uint8_t *p = (const uint8_t *)data;
+
+  crc = ~crc;
+  while (len--) {
+    crc ^= *p++;
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ (CRC32_POLY & -(crc & 1));
+    }
+  }
+
+  return ~crc;
+}
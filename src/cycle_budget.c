@@ -0,0 +1,76 @@
+#include "cycle_budget.h"
+
+static const uint32_t phase_limits_ms[CYCLE_PHASE_COUNT] = {
+    [CYCLE_PHASE_WIFI] = CYCLE_WIFI_MS,
+    [CYCLE_PHASE_SENSORS] = CYCLE_SENSORS_MS,
+    [CYCLE_PHASE_CONNECT] = CYCLE_CONNECT_MS,
+    [CYCLE_PHASE_PUBLISH] = CYCLE_PUBLISH_MS,
+};
+
+static const char *phase_names[CYCLE_PHASE_COUNT] = {
+    [CYCLE_PHASE_WIFI] = "wifi",
+    [CYCLE_PHASE_SENSORS] = "sensors",
+    [CYCLE_PHASE_CONNECT] = "connect",
+    [CYCLE_PHASE_PUBLISH] = "publish",
+};
+
+static uint32_t until(int64_t deadline_ms, int64_t now_ms) {
+  return deadline_ms > now_ms ? (uint32_t)(deadline_ms - now_ms) : 0;
+}
+
+void cycle_budget_start(cycle_budget *cycle, uint32_t budget_ms,
+                        int64_t now_ms) {
+  cycle->end_ms = now_ms + budget_ms;
+  cycle->open = 0;
+  cycle->overrun = 0;
+
+  for (int i = 0; i < CYCLE_PHASE_COUNT; i++) {
+    cycle->deadline_ms[i] = cycle->end_ms;
+  }
+}
+
+uint32_t cycle_phase_begin(cycle_budget *cycle, cycle_phase phase,
+                           int64_t now_ms) {
+  int64_t deadline_ms = now_ms + phase_limits_ms[phase];
+
+  cycle->deadline_ms[phase] =
+      deadline_ms < cycle->end_ms ? deadline_ms : cycle->end_ms;
+  cycle->open |= 1u << phase;
+
+  return until(cycle->deadline_ms[phase], now_ms);
+}
+
+uint32_t cycle_phase_left(const cycle_budget *cycle, cycle_phase phase,
+                          int64_t now_ms) {
+  return until(cycle->deadline_ms[phase], now_ms);
+}
+
+void cycle_phase_end(cycle_budget *cycle, cycle_phase phase, bool completed,
+                     int64_t now_ms) {
+  if (!(cycle->open & (1u << phase))) {
+    return;
+  }
+
+  cycle->open &= ~(1u << phase);
+  if (!completed || now_ms >= cycle->deadline_ms[phase]) {
+    cycle->overrun |= 1u << phase;
+  }
+}
+
+uint32_t cycle_budget_left(const cycle_budget *cycle, int64_t now_ms) {
+  return until(cycle->end_ms, now_ms);
+}
+
+void cycle_budget_finish(cycle_budget *cycle, cycle_history *history,
+                         int64_t start_ms, int64_t now_ms) {
+  cycle->overrun |= cycle->open;
+  cycle->open = 0;
+
+  history->awake_ms = (uint32_t)(now_ms - start_ms);
+  history->overrun = cycle->overrun;
+  history->overrun_cycles += cycle->overrun != 0;
+}
+
+const char *cycle_phase_name(cycle_phase phase) {
+  return phase_names[phase];
+}
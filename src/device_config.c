@@ -0,0 +1,109 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "nvs.h"
+
+#include "device_config.h"
+
+#define CONFIG_NAMESPACE "config"
+#define CONFIG_KEY "settings"
+// Enough for every setting with its name.
+#define CONFIG_STORED_MAX 2048
+
+static const char *TAG = "CONFIG";
+
+void device_config_defaults(device_config *config) {
+  memset(config, 0, sizeof(*config));
+  config->sleep_seconds = DEFAULT_SLEEP_SECONDS;
+  config->read_samples = DEFAULT_READ_SAMPLES;
+  config->co2_threshold_ppm = DEFAULT_CO2_THRESHOLD_PPM;
+  config->backlog_drain = DEFAULT_BACKLOG_DRAIN;
+  config->aggregate_cycles = DEFAULT_AGGREGATE_CYCLES;
+  config->power_save = DEFAULT_POWER_SAVE;
+  config->gas_r0 = DEFAULT_GAS_R0;
+  config->ldr_r10 = DEFAULT_LDR_R10;
+  config->alert_holdoff_s = DEFAULT_ALERT_HOLDOFF_S;
+  config->awake_budget_ms = DEFAULT_AWAKE_BUDGET_MS;
+  config->sensor_probe_cycles = DEFAULT_SENSOR_PROBE_CYCLES;
+  config->espnow_batch_ms = DEFAULT_ESPNOW_BATCH_MS;
+  for (int i = 0; i < SENSOR_COUNT; i++) {
+    config->schedule[i].period = DEFAULT_SENSOR_PERIOD;
+  }
+  config->schedule[SENSOR_DHT].samples = DEFAULT_DHT_SAMPLES;
+  config->battery_hysteresis_mv = DEFAULT_BATTERY_HYSTERESIS_MV;
+  config->gas_cool_s = DEFAULT_GAS_COOL_S;
+}
+
+bool device_config_load(device_config *config) {
+  nvs_handle_t handle;
+  size_t size = CONFIG_STORED_MAX;
+
+  device_config_defaults(config);
+
+  uint8_t *stored = malloc(CONFIG_STORED_MAX);
+  if (stored == NULL) {
+    return false;
+  }
+  if (nvs_open(CONFIG_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+    free(stored);
+    return false;
+  }
+
+  esp_err_t err = nvs_get_blob(handle, CONFIG_KEY, stored, &size);
+  nvs_close(handle);
+
+  bool loaded = err == ESP_OK && device_config_decode(stored, size, config);
+  free(stored);
+  if (!loaded) {
+    ESP_LOGW(TAG, "No usable stored configuration, using defaults");
+    device_config_defaults(config);
+    return false;
+  }
+
+  ESP_LOGI(TAG, "Loaded configuration version %u", config->version);
+  return true;
+}
+
+bool device_config_save(const device_config *config) {
+  nvs_handle_t handle;
+  size_t size;
+
+  uint8_t *stored = malloc(CONFIG_STORED_MAX);
+  if (stored == NULL) {
+    return false;
+  }
+  size = device_config_encode(config, stored, CONFIG_STORED_MAX);
+  if (size == 0) {
+    ESP_LOGE(TAG, "Configuration does not fit %d bytes", CONFIG_STORED_MAX);
+    free(stored);
+    return false;
+  }
+
+  esp_err_t err = nvs_open(CONFIG_NAMESPACE, NVS_READWRITE, &handle);
+  if (err == ESP_OK) {
+    err = nvs_set_blob(handle, CONFIG_KEY, stored, size);
+    if (err == ESP_OK) {
+      err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+  }
+  free(stored);
+
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to save configuration: %s", esp_err_to_name(err));
+    return false;
+  }
+
+  return true;
+}
+
+// Loads the stored configuration rather than using the running one, a newer
+// version may have been received since.
+void device_config_clear_commands(uint32_t commands) {
+  device_config stored;
+
+  device_config_load(&stored);
+  stored.pending_commands &= ~commands;
+  device_config_save(&stored);
+}
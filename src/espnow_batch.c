@@ -0,0 +1,48 @@
+#include <string.h>
+
+#include "espnow_batch.h"
+
+#define ENTRY_OVERHEAD (ESPNOW_MAC_SIZE + 1)
+
+void espnow_batch_reset(espnow_batch *batch) {
+  batch->buf[0] = ESPNOW_BATCH_VERSION;
+  batch->buf[1] = 0;
+  batch->len = ESPNOW_BATCH_HEADER_SIZE;
+  batch->count = 0;
+  batch->first_ms = 0;
+}
+
+bool espnow_batch_fits(const espnow_batch *batch, size_t len) {
+  return len <= ESPNOW_PAYLOAD_MAX && batch->count < UINT8_MAX &&
+         batch->len + ENTRY_OVERHEAD + len <= ESPNOW_BATCH_MAX;
+}
+
+bool espnow_batch_add(espnow_batch *batch, const uint8_t *mac,
+                      const uint8_t *payload, size_t len, int64_t now_ms) {
+  if (!espnow_batch_fits(batch, len)) {
+    return false;
+  }
+
+  uint8_t *entry = batch->buf + batch->len;
+  memcpy(entry, mac, ESPNOW_MAC_SIZE);
+  entry[ESPNOW_MAC_SIZE] = len;
+  memcpy(entry + ENTRY_OVERHEAD, payload, len);
+
+  batch->len += ENTRY_OVERHEAD + len;
+  if (batch->count++ == 0) {
+    batch->first_ms = now_ms;
+  }
+  batch->buf[1] = batch->count;
+
+  return true;
+}
+
+bool espnow_batch_due(const espnow_batch *batch, uint32_t max_age_ms,
+                      int64_t now_ms) {
+  if (batch->count == 0) {
+    return false;
+  }
+
+  return now_ms - batch->first_ms >= max_age_ms ||
+         !espnow_batch_fits(batch, ESPNOW_PAYLOAD_MAX);
+}
@@ -0,0 +1,129 @@
+#include <string.h>
+
+#include "espnow_frame.h"
+#include "sha256.h"
+
+#define HMAC_BLOCK_SIZE 64
+
+static void hmac_tag(const uint8_t *key, const uint8_t *mac,
+                     const uint8_t *data, size_t len,
+                     uint8_t tag[SHA256_DIGEST_SIZE]) {
+  uint8_t pad[HMAC_BLOCK_SIZE];
+  sha256_context ctx;
+
+  memset(pad, 0x36, sizeof(pad));
+  for (int i = 0; i < ESPNOW_KEY_SIZE; i++) {
+    pad[i] ^= key[i];
+  }
+  sha256_init(&ctx);
+  sha256_update(&ctx, pad, sizeof(pad));
+  sha256_update(&ctx, mac, ESPNOW_MAC_SIZE);
+  sha256_update(&ctx, data, len);
+  sha256_final(&ctx, tag);
+
+  memset(pad, 0x5c, sizeof(pad));
+  for (int i = 0; i < ESPNOW_KEY_SIZE; i++) {
+    pad[i] ^= key[i];
+  }
+  sha256_init(&ctx);
+  sha256_update(&ctx, pad, sizeof(pad));
+  sha256_update(&ctx, tag, SHA256_DIGEST_SIZE);
+  sha256_final(&ctx, tag);
+}
+
+int espnow_frame_encode(const uint8_t *key, const uint8_t *mac, uint32_t seq,
+                        const void *payload, size_t len, uint8_t *frame) {
+  uint8_t tag[SHA256_DIGEST_SIZE];
+
+  if (len > ESPNOW_PAYLOAD_MAX) {
+    return ESPNOW_FRAME_MALFORMED;
+  }
+
+  frame[0] = ESPNOW_FRAME_VERSION;
+  for (int i = 0; i < 4; i++) {
+    frame[1 + i] = seq >> (8 * i);
+  }
+  memcpy(frame + ESPNOW_HEADER_SIZE, payload, len);
+
+  hmac_tag(key, mac, frame, ESPNOW_HEADER_SIZE + len, tag);
+  memcpy(frame + ESPNOW_HEADER_SIZE + len, tag, ESPNOW_TAG_SIZE);
+
+  return ESPNOW_HEADER_SIZE + len + ESPNOW_TAG_SIZE;
+}
+
+int espnow_frame_decode(const uint8_t *key, const uint8_t *mac,
+                        const uint8_t *frame, size_t len, uint32_t *seq,
+                        const uint8_t **payload) {
+  uint8_t tag[SHA256_DIGEST_SIZE];
+  uint8_t diff = 0;
+
+  if (len < ESPNOW_HEADER_SIZE + ESPNOW_TAG_SIZE || len > ESPNOW_FRAME_MAX ||
+      frame[0] != ESPNOW_FRAME_VERSION) {
+    return ESPNOW_FRAME_MALFORMED;
+  }
+
+  size_t signed_len = len - ESPNOW_TAG_SIZE;
+  hmac_tag(key, mac, frame, signed_len, tag);
+  // Constant time, so the tag can't be guessed byte by byte.
+  for (int i = 0; i < ESPNOW_TAG_SIZE; i++) {
+    diff |= tag[i] ^ frame[signed_len + i];
+  }
+  if (diff != 0) {
+    return ESPNOW_FRAME_FORGED;
+  }
+
+  *seq = 0;
+  for (int i = 0; i < 4; i++) {
+    *seq |= (uint32_t)frame[1 + i] << (8 * i);
+  }
+  *payload = frame + ESPNOW_HEADER_SIZE;
+
+  return signed_len - ESPNOW_HEADER_SIZE;
+}
+
+void espnow_replay_init(espnow_replay *replay) {
+  memset(replay, 0, sizeof(*replay));
+}
+
+void espnow_replay_resume(espnow_replay *replay, uint32_t count) {
+  replay->count = count < ESPNOW_MAX_PEERS ? count : ESPNOW_MAX_PEERS;
+  replay->dirty = false;
+  for (uint32_t i = 0; i < replay->count; i++) {
+    replay->peers[i].last_seq = replay->peers[i].saved_seq;
+  }
+}
+
+espnow_frame_status espnow_replay_check(espnow_replay *replay,
+                                        const uint8_t *mac, uint32_t seq) {
+  espnow_peer *peer = NULL;
+
+  for (uint32_t i = 0; i < replay->count; i++) {
+    if (memcmp(replay->peers[i].mac, mac, ESPNOW_MAC_SIZE) == 0) {
+      peer = &replay->peers[i];
+      break;
+    }
+  }
+
+  if (peer != NULL && seq <= peer->last_seq) {
+    return ESPNOW_FRAME_REPLAYED;
+  }
+
+  if (peer == NULL) {
+    if (replay->count == ESPNOW_MAX_PEERS) {
+      return ESPNOW_FRAME_UNKNOWN;
+    }
+    peer = &replay->peers[replay->count++];
+    memcpy(peer->mac, mac, ESPNOW_MAC_SIZE);
+    peer->saved_seq = 0;
+  }
+
+  peer->last_seq = seq;
+  if (seq > peer->saved_seq) {
+    peer->saved_seq = seq < UINT32_MAX - ESPNOW_REPLAY_LEASE
+                          ? seq + ESPNOW_REPLAY_LEASE
+                          : UINT32_MAX;
+    replay->dirty = true;
+  }
+
+  return ESPNOW_FRAME_OK;
+}
@@ -0,0 +1,280 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/queue.h"
+
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_now.h"
+#include "esp_wifi.h"
+#include "nvs.h"
+
+#include "espnow_link.h"
+
+#define ESPNOW_NAMESPACE "espnow"
+#define ESPNOW_EPOCH_KEY "epoch"
+#define ESPNOW_PEERS_KEY "peers"
+#define ESPNOW_QUEUE_LENGTH 16
+#define ESPNOW_SEND_ATTEMPTS 3
+#define ESPNOW_SEND_TIMEOUT_MS 100
+#define ESPNOW_SENT_BIT BIT0
+#define ESPNOW_FAILED_BIT BIT1
+
+static const char *TAG = "ESPNOW";
+
+typedef struct {
+  uint8_t mac[ESPNOW_MAC_SIZE];
+  uint8_t len;
+  uint8_t data[ESPNOW_FRAME_MAX];
+} received_frame;
+
+static const espnow_link *active;
+static EventGroupHandle_t send_event;
+static QueueHandle_t received;
+static espnow_replay replay;
+static espnow_stats stats;
+
+// The low 16 bits count frames, the high 16 bits are an epoch kept in NVS
+// and bumped on every cold boot, so the gateway never sees a number again.
+static RTC_DATA_ATTR uint32_t sequence;
+
+static void save_epoch(uint32_t epoch) {
+  nvs_handle_t handle;
+
+  if (nvs_open(ESPNOW_NAMESPACE, NVS_READWRITE, &handle) == ESP_OK) {
+    nvs_set_u32(handle, ESPNOW_EPOCH_KEY, epoch);
+    nvs_commit(handle);
+    nvs_close(handle);
+  }
+}
+
+static uint32_t next_sequence(void) {
+  if (sequence == 0) {
+    nvs_handle_t handle;
+    uint32_t epoch = 0;
+
+    if (nvs_open(ESPNOW_NAMESPACE, NVS_READONLY, &handle) == ESP_OK) {
+      nvs_get_u32(handle, ESPNOW_EPOCH_KEY, &epoch);
+      nvs_close(handle);
+    }
+    save_epoch(++epoch);
+    sequence = epoch << 16;
+  }
+
+  if ((++sequence & 0xffff) == 0) {
+    save_epoch(sequence >> 16);
+  }
+
+  return sequence;
+}
+
+static void load_replay(void) {
+  nvs_handle_t handle;
+  size_t size = sizeof(replay.peers);
+
+  espnow_replay_init(&replay);
+  if (nvs_open(ESPNOW_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+    return;
+  }
+  if (nvs_get_blob(handle, ESPNOW_PEERS_KEY, replay.peers, &size) == ESP_OK) {
+    espnow_replay_resume(&replay, size / sizeof(espnow_peer));
+    ESP_LOGI(TAG, "Resuming %u nodes", replay.count);
+  }
+  nvs_close(handle);
+}
+
+// A frame may only be used once the lease it took is stored. If that fails
+// it is used anyway and the store is tried again with the next frame.
+static void save_replay(void) {
+  nvs_handle_t handle;
+  esp_err_t err = nvs_open(ESPNOW_NAMESPACE, NVS_READWRITE, &handle);
+
+  if (err == ESP_OK) {
+    err = nvs_set_blob(handle, ESPNOW_PEERS_KEY, replay.peers,
+                       replay.count * sizeof(espnow_peer));
+    if (err == ESP_OK) {
+      err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+  }
+
+  if (err == ESP_OK) {
+    replay.dirty = false;
+  } else {
+    ESP_LOGE(TAG, "Failed to store the node sequences: %s",
+             esp_err_to_name(err));
+  }
+}
+
+static void on_sent(const uint8_t *mac, esp_now_send_status_t status) {
+  xEventGroupSetBits(send_event, status == ESP_NOW_SEND_SUCCESS
+                                     ? ESPNOW_SENT_BIT
+                                     : ESPNOW_FAILED_BIT);
+}
+
+// Runs in the Wi-Fi task, the frame is only checked when collected.
+static void on_received(const uint8_t *mac, const uint8_t *data, int len) {
+  received_frame frame;
+
+  if (len <= 0 || len > ESPNOW_FRAME_MAX) {
+    stats.dropped++;
+    return;
+  }
+
+  memcpy(frame.mac, mac, ESPNOW_MAC_SIZE);
+  frame.len = len;
+  memcpy(frame.data, data, len);
+  if (xQueueSend(received, &frame, 0) != pdTRUE) {
+    stats.dropped++;
+  }
+}
+
+static bool parse_hex(const char *hex, uint8_t *out, size_t len) {
+  if (strlen(hex) != len * 2) {
+    return false;
+  }
+
+  for (size_t i = 0; i < len; i++) {
+    if (sscanf(hex + 2 * i, "%2hhx", &out[i]) != 1) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool espnow_link_parse(espnow_link *link, const char *role, const char *key,
+                       const char *gateway) {
+  memset(link, 0, sizeof(*link));
+
+  if (role == NULL) {
+    return true;
+  }
+
+  if (key == NULL || !parse_hex(key, link->key, ESPNOW_KEY_SIZE)) {
+    ESP_LOGE(TAG, "espnow_key must be %d hex digits", ESPNOW_KEY_SIZE * 2);
+    return false;
+  }
+
+  if (strcmp(role, "gateway") == 0) {
+    link->role = ESPNOW_ROLE_GATEWAY;
+  } else if (strcmp(role, "node") == 0 && gateway != NULL &&
+             sscanf(gateway, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx",
+                    &link->gateway[0], &link->gateway[1], &link->gateway[2],
+                    &link->gateway[3], &link->gateway[4],
+                    &link->gateway[5]) == ESPNOW_MAC_SIZE) {
+    link->role = ESPNOW_ROLE_NODE;
+  } else {
+    ESP_LOGE(TAG, "Unknown espnow_role [%s] or missing espnow_gateway", role);
+    return false;
+  }
+
+  return true;
+}
+
+bool espnow_link_start(const espnow_link *link) {
+  active = link;
+
+  if (esp_now_init() != ESP_OK) {
+    ESP_LOGE(TAG, "ESP-NOW init failed");
+    return false;
+  }
+
+  if (link->role == ESPNOW_ROLE_GATEWAY) {
+    load_replay();
+    received = xQueueCreate(ESPNOW_QUEUE_LENGTH, sizeof(received_frame));
+    return received != NULL && esp_now_register_recv_cb(on_received) == ESP_OK;
+  }
+
+  esp_now_peer_info_t peer = {
+      .channel = link->channel,
+      .ifidx = ESP_IF_WIFI_STA,
+      .encrypt = false,
+  };
+  memcpy(peer.peer_addr, link->gateway, ESPNOW_MAC_SIZE);
+
+  send_event = xEventGroupCreate();
+  return send_event != NULL && esp_now_register_send_cb(on_sent) == ESP_OK &&
+         esp_now_add_peer(&peer) == ESP_OK;
+}
+
+// A retry after a lost acknowledgement reaches the gateway as a replay and
+// is dropped there.
+bool espnow_link_send(const void *payload, size_t len) {
+  uint8_t mac[ESPNOW_MAC_SIZE];
+  uint8_t frame[ESPNOW_FRAME_MAX];
+
+  esp_wifi_get_mac(ESP_IF_WIFI_STA, mac);
+  int frame_len = espnow_frame_encode(active->key, mac, next_sequence(),
+                                      payload, len, frame);
+  if (frame_len < 0) {
+    ESP_LOGE(TAG, "Reading of %u bytes does not fit a frame", len);
+    return false;
+  }
+
+  for (int attempt = 0; attempt < ESPNOW_SEND_ATTEMPTS; attempt++) {
+    xEventGroupClearBits(send_event, ESPNOW_SENT_BIT | ESPNOW_FAILED_BIT);
+    if (esp_now_send(active->gateway, frame, frame_len) != ESP_OK) {
+      continue;
+    }
+
+    EventBits_t bits = xEventGroupWaitBits(
+        send_event, ESPNOW_SENT_BIT | ESPNOW_FAILED_BIT, pdTRUE, pdFALSE,
+        ESPNOW_SEND_TIMEOUT_MS / portTICK_PERIOD_MS);
+    if (bits & ESPNOW_SENT_BIT) {
+      ESP_LOGI(TAG, "Sent %d byte frame to the gateway", frame_len);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+int espnow_link_collect(espnow_batch *batch, int64_t now_ms) {
+  received_frame frame;
+  int collected = 0;
+
+  while (xQueuePeek(received, &frame, 0) == pdTRUE) {
+    const uint8_t *payload;
+    uint32_t seq;
+    int len = espnow_frame_decode(active->key, frame.mac, frame.data, frame.len,
+                                  &seq, &payload);
+
+    // Stays queued for the next batch.
+    if (len >= 0 && !espnow_batch_fits(batch, len)) {
+      break;
+    }
+
+    espnow_frame_status status =
+        len < 0 ? (espnow_frame_status)len
+                : espnow_replay_check(&replay, frame.mac, seq);
+    switch (status) {
+    case ESPNOW_FRAME_OK:
+      if (replay.dirty) {
+        save_replay();
+      }
+      espnow_batch_add(batch, frame.mac, payload, len, now_ms);
+      stats.accepted++;
+      collected++;
+      break;
+    case ESPNOW_FRAME_REPLAYED:
+      stats.replayed++;
+      break;
+    case ESPNOW_FRAME_UNKNOWN:
+      ESP_LOGW(TAG, "No room for another node, dropping its frame");
+      stats.dropped++;
+      break;
+    default:
+      stats.invalid++;
+      break;
+    }
+
+    xQueueReceive(received, &frame, 0);
+  }
+
+  return collected;
+}
+
+const espnow_stats *espnow_link_stats(void) { return &stats; }
@@ -0,0 +1,47 @@
+#include "esp_log.h"
+#include "esp_partition.h"
+
+#include "flash_dev.h"
+
+static const char *TAG = "FLASH";
+
+static int partition_read(void *ctx, uint32_t addr, void *buf, uint32_t len) {
+  return esp_partition_read((const esp_partition_t *)ctx, addr, buf, len) ==
+                 ESP_OK
+             ? 0
+             : -1;
+}
+
+static int partition_write(void *ctx, uint32_t addr, const void *buf,
+                           uint32_t len) {
+  return esp_partition_write((const esp_partition_t *)ctx, addr, buf, len) ==
+                 ESP_OK
+             ? 0
+             : -1;
+}
+
+static int partition_erase(void *ctx, uint32_t addr, uint32_t len) {
+  return esp_partition_erase_range((const esp_partition_t *)ctx, addr, len) ==
+                 ESP_OK
+             ? 0
+             : -1;
+}
+
+bool flash_partition_open(const char *label, flash_dev *dev) {
+  const esp_partition_t *partition = esp_partition_find_first(
+      ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+
+  if (partition == NULL) {
+    ESP_LOGE(TAG, "Partition [%s] not found", label);
+    return false;
+  }
+
+  dev->ctx = (void *)partition;
+  dev->size = partition->size;
+  dev->sector_size = SPI_FLASH_SEC_SIZE;
+  dev->read = partition_read;
+  dev->write = partition_write;
+  dev->erase = partition_erase;
+
+  return true;
+}
@@ -0,0 +1,95 @@
+#include <math.h>
+
+#include "gas_heater.h"
+
+// Heating approaches the operating temperature exponentially, so reaching
+// GAS_HEATER_STABLE from cold takes this many time constants.
+static float heat_constant_ms(const gas_heater_params *params) {
+  return params->preheat_ms / logf(1 / (1 - GAS_HEATER_STABLE));
+}
+
+static float cooled(float warmth, const gas_heater_params *params,
+                    uint32_t off_ms) {
+  return params->cool_ms > 0 ? warmth * expf(-(float)off_ms / params->cool_ms)
+                             : 0;
+}
+
+static uint32_t preheat_from(float warmth, const gas_heater_params *params) {
+  if (warmth >= GAS_HEATER_STABLE) {
+    return 0;
+  }
+
+  // Rounded up, waiting this long has to be enough.
+  return (uint32_t)ceilf(heat_constant_ms(params) *
+                         logf((1 - warmth) / (1 - GAS_HEATER_STABLE)));
+}
+
+void gas_heater_params_load(const device_config *config,
+                            gas_heater_params *params) {
+  params->preheat_ms = config->gas_preheat_s * 1000;
+  params->cool_ms = config->gas_cool_s * 1000;
+}
+
+void gas_heater_update(gas_heater_state *state,
+                       const gas_heater_params *params, int64_t now_ms) {
+  if (now_ms <= state->updated_ms) {
+    return;
+  }
+
+  uint32_t elapsed_ms = (uint32_t)(now_ms - state->updated_ms);
+  state->updated_ms = now_ms;
+
+  if (state->on) {
+    float constant_ms = heat_constant_ms(params);
+    state->warmth =
+        constant_ms > 0
+            ? 1 - (1 - state->warmth) * expf(-(float)elapsed_ms / constant_ms)
+            : 1;
+    state->hour_on_ms += elapsed_ms;
+  } else {
+    state->warmth = cooled(state->warmth, params, elapsed_ms);
+  }
+
+  state->hour_ms += elapsed_ms;
+  if (state->hour_ms >= GAS_HEATER_HOUR_MS) {
+    state->on_per_hour_ms = (uint32_t)((uint64_t)state->hour_on_ms *
+                                       GAS_HEATER_HOUR_MS / state->hour_ms);
+    state->hour_ms = 0;
+    state->hour_on_ms = 0;
+    state->hours++;
+  }
+}
+
+void gas_heater_switch(gas_heater_state *state, bool on) { state->on = on; }
+
+bool gas_heater_stable(const gas_heater_state *state) {
+  return state->warmth >= GAS_HEATER_STABLE;
+}
+
+uint32_t gas_heater_preheat_ms(const gas_heater_state *state,
+                               const gas_heater_params *params) {
+  return preheat_from(state->warmth, params);
+}
+
+bool gas_heater_plan(const gas_heater_state *state,
+                     const gas_heater_params *params, uint32_t read_ms,
+                     uint32_t next_ms, uint32_t wait_ms) {
+  if (next_ms > read_ms) {
+    next_ms = read_ms;
+  }
+
+  // Left off until the next chance, it would still have to make it from
+  // there.
+  float warmth = cooled(state->warmth, params, next_ms);
+
+  return preheat_from(warmth, params) > read_ms - next_ms + wait_ms;
+}
+
+uint32_t gas_heater_on_per_hour_ms(const gas_heater_state *state) {
+  if (state->hours > 0 || state->hour_ms == 0) {
+    return state->on_per_hour_ms;
+  }
+
+  return (uint32_t)((uint64_t)state->hour_on_ms * GAS_HEATER_HOUR_MS /
+                    state->hour_ms);
+}
@@ -0,0 +1,491 @@
+#include <stddef.h>
+#include <string.h>
+
+#include "crc32.h"
+#include "history.h"
+
+#define SECTOR_MAGIC 0x54534948
+#define ERASED_TS 0xffffffff
+// Slots read at once while walking a range.
+#define READ_SLOTS 8
+
+static const struct {
+  uint32_t resolution_s;
+  uint32_t retention_s;
+} tier_specs[HISTORY_TIER_COUNT] = {
+    [HISTORY_TIER_MINUTES] = {60, 24 * 3600},
+    [HISTORY_TIER_QUARTERS] = {900, 30 * 24 * 3600},
+};
+
+typedef struct {
+  uint32_t magic;
+  uint32_t seq;
+  uint32_t first_ts;
+  uint32_t crc;
+} sector_header;
+
+typedef struct {
+  uint32_t ts;
+  int16_t values[HISTORY_VALUES];
+  uint16_t check;
+} slot;
+
+static uint16_t slot_check(const slot *point) {
+  return (uint16_t)crc32_update(0, point, offsetof(slot, check));
+}
+
+static uint32_t slot_addr(const history *store, const history_tier *tier,
+                          uint32_t sector, uint32_t index) {
+  return (tier->first_sector + sector) * store->dev->sector_size +
+         sizeof(sector_header) + index * sizeof(slot);
+}
+
+static bool read_header(const history *store, uint32_t sector,
+                        sector_header *header) {
+  const flash_dev *dev = store->dev;
+
+  if (dev->read(dev->ctx, sector * dev->sector_size, header,
+                sizeof(*header))) {
+    return false;
+  }
+
+  return header->magic == SECTOR_MAGIC &&
+         header->crc == crc32_update(0, header, offsetof(sector_header, crc));
+}
+
+static bool read_ts(const history *store, const history_tier *tier,
+                    uint32_t sector, uint32_t index, uint32_t *ts) {
+  const flash_dev *dev = store->dev;
+
+  return dev->read(dev->ctx, slot_addr(store, tier, sector, index), ts,
+                   sizeof(*ts)) == 0;
+}
+
+// First slot of the sector whose timestamp is at least ts. Erased slots
+// read as the largest timestamp, so this also finds the end of the data.
+static uint32_t search_slot(const history *store, const history_tier *tier,
+                            uint32_t sector, uint32_t count, uint32_t ts) {
+  uint32_t low = 0, high = count;
+
+  while (low < high) {
+    uint32_t mid = low + (high - low) / 2;
+    uint32_t found;
+    if (!read_ts(store, tier, sector, mid, &found) || found < ts) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+
+  return low;
+}
+
+static void mount_tier(history *store, history_tier *tier) {
+  bool found = false;
+  uint32_t newest = 0, newest_seq = 0;
+
+  for (uint32_t i = 0; i < tier->sectors; i++) {
+    sector_header header;
+    tier->first_ts[i] = 0;
+    if (!read_header(store, tier->first_sector + i, &header)) {
+      continue;
+    }
+    tier->first_ts[i] = header.first_ts;
+    if (!found || header.seq > newest_seq) {
+      newest = i;
+      newest_seq = header.seq;
+    }
+    found = true;
+  }
+
+  if (!found) {
+    // The first append opens sector 0.
+    tier->head_sector = tier->sectors - 1;
+    tier->head_slot = store->slots;
+    return;
+  }
+
+  tier->head_sector = newest;
+  tier->head_slot = search_slot(store, tier, newest, store->slots, ERASED_TS);
+  tier->next_seq = newest_seq + 1;
+  tier->last_ts = tier->first_ts[newest];
+  if (tier->head_slot > 0) {
+    read_ts(store, tier, newest, tier->head_slot - 1, &tier->last_ts);
+  }
+}
+
+history_status history_mount(history *store, const flash_dev *dev) {
+  uint32_t sector = 0;
+
+  memset(store, 0, sizeof(*store));
+  store->dev = dev;
+
+  if (dev->sector_size <= sizeof(sector_header) + sizeof(slot)) {
+    return HISTORY_INVALID;
+  }
+  store->slots = (dev->sector_size - sizeof(sector_header)) / sizeof(slot);
+
+  // One sector more than the retention, the oldest is erased to make room.
+  for (int i = 0; i < HISTORY_TIER_COUNT; i++) {
+    history_tier *tier = &store->tiers[i];
+    uint32_t points = tier_specs[i].retention_s / tier_specs[i].resolution_s;
+
+    tier->resolution_s = tier_specs[i].resolution_s;
+    tier->first_sector = sector;
+    tier->sectors = (points + store->slots - 1) / store->slots + 1;
+    if (tier->sectors > HISTORY_MAX_SECTORS) {
+      return HISTORY_INVALID;
+    }
+    sector += tier->sectors;
+  }
+
+  if (sector * dev->sector_size > dev->size) {
+    return HISTORY_INVALID;
+  }
+
+  for (int i = 0; i < HISTORY_TIER_COUNT; i++) {
+    mount_tier(store, &store->tiers[i]);
+  }
+
+  return HISTORY_OK;
+}
+
+static history_status open_sector(history *store, history_tier *tier,
+                                  uint32_t first_ts) {
+  const flash_dev *dev = store->dev;
+  uint32_t next = (tier->head_sector + 1) % tier->sectors;
+  uint32_t addr = (tier->first_sector + next) * dev->sector_size;
+
+  tier->first_ts[next] = 0;
+  if (dev->erase(dev->ctx, addr, dev->sector_size)) {
+    return HISTORY_IO_ERROR;
+  }
+
+  sector_header header = {
+      .magic = SECTOR_MAGIC,
+      .seq = tier->next_seq,
+      .first_ts = first_ts,
+  };
+  header.crc = crc32_update(0, &header, offsetof(sector_header, crc));
+
+  if (dev->write(dev->ctx, addr, &header, sizeof(header))) {
+    return HISTORY_IO_ERROR;
+  }
+
+  tier->next_seq++;
+  tier->head_sector = next;
+  tier->head_slot = 0;
+  tier->first_ts[next] = first_ts;
+  return HISTORY_OK;
+}
+
+// Drops the sectors from the newest back that start at ts or later, the next
+// point opens a new sector. Points from ts on left in the sector before it
+// are past where the new one starts, which is where queries stop reading it.
+static history_status resync(history *store, history_tier *tier,
+                             uint32_t ts) {
+  const flash_dev *dev = store->dev;
+
+  for (uint32_t i = 0;
+       i < tier->sectors && tier->first_ts[tier->head_sector] >= ts; i++) {
+    uint32_t addr = (tier->first_sector + tier->head_sector) * dev->sector_size;
+
+    tier->first_ts[tier->head_sector] = 0;
+    if (dev->erase(dev->ctx, addr, dev->sector_size)) {
+      return HISTORY_IO_ERROR;
+    }
+    tier->head_sector = (tier->head_sector + tier->sectors - 1) % tier->sectors;
+  }
+
+  tier->head_slot = store->slots;
+  tier->last_ts = 0;
+  return HISTORY_OK;
+}
+
+static history_status append_point(history *store, history_tier *tier,
+                                   const history_point *point) {
+  const flash_dev *dev = store->dev;
+
+  if (point->ts == ERASED_TS ||
+      (point->ts <= tier->last_ts &&
+       tier->last_ts - point->ts < HISTORY_RESYNC_S)) {
+    return HISTORY_STALE;
+  }
+
+  if (point->ts <= tier->last_ts) {
+    history_status ret = resync(store, tier, point->ts);
+    if (ret != HISTORY_OK) {
+      return ret;
+    }
+  }
+
+  if (tier->head_slot >= store->slots) {
+    history_status ret = open_sector(store, tier, point->ts);
+    if (ret != HISTORY_OK) {
+      return ret;
+    }
+  }
+
+  slot data = {.ts = point->ts};
+  memcpy(data.values, point->values, sizeof(data.values));
+  data.check = slot_check(&data);
+
+  uint32_t addr = slot_addr(store, tier, tier->head_sector, tier->head_slot);
+  tier->head_slot++;
+  if (dev->write(dev->ctx, addr, &data, sizeof(data))) {
+    return HISTORY_IO_ERROR;
+  }
+
+  tier->last_ts = point->ts;
+  return HISTORY_OK;
+}
+
+history_status history_append(history *store, const history_point *point) {
+  history_tier *minutes = &store->tiers[HISTORY_TIER_MINUTES];
+  uint32_t quarter = store->tiers[HISTORY_TIER_QUARTERS].resolution_s;
+
+  if (minutes->last_ts > 0 && point->ts > minutes->last_ts &&
+      minutes->last_ts / quarter != point->ts / quarter) {
+    history_status ret =
+        history_compact(store, minutes->last_ts - minutes->last_ts % quarter);
+    if (ret == HISTORY_IO_ERROR) {
+      return ret;
+    }
+  }
+
+  return append_point(store, minutes, point);
+}
+
+typedef struct {
+  int32_t sum[HISTORY_VALUES];
+  uint16_t count[HISTORY_VALUES];
+} accumulator;
+
+static void accumulate(accumulator *acc, const int16_t *values) {
+  for (int i = 0; i < HISTORY_VALUES; i++) {
+    if (values[i] != HISTORY_MISSING) {
+      acc->sum[i] += values[i];
+      acc->count[i]++;
+    }
+  }
+}
+
+// Means are clamped to what a point holds, HISTORY_MISSING excluded.
+static bool average(const accumulator *acc, int16_t *values) {
+  bool any = false;
+
+  for (int i = 0; i < HISTORY_VALUES; i++) {
+    int32_t mean = acc->count[i] > 0 ? acc->sum[i] / acc->count[i] : 0;
+
+    if (acc->count[i] == 0) {
+      values[i] = HISTORY_MISSING;
+    } else if (mean <= HISTORY_MISSING) {
+      values[i] = HISTORY_MISSING + 1;
+    } else {
+      values[i] = mean > INT16_MAX ? INT16_MAX : (int16_t)mean;
+    }
+    any |= acc->count[i] > 0;
+  }
+
+  return any;
+}
+
+static int add_to_accumulator(const history_point *point, void *arg) {
+  accumulate((accumulator *)arg, point->values);
+  return 0;
+}
+
+history_status history_compact(history *store, uint32_t start) {
+  history_tier *quarters = &store->tiers[HISTORY_TIER_QUARTERS];
+  accumulator acc = {0};
+  history_point point = {.ts = start};
+
+  history_query(store, HISTORY_TIER_MINUTES, start,
+                start + quarters->resolution_s - 1, add_to_accumulator, &acc);
+  if (!average(&acc, point.values)) {
+    return HISTORY_OK;
+  }
+
+  return append_point(store, quarters, &point);
+}
+
+history_status history_record(history *store, history_bucket *bucket,
+                              uint32_t ts, const int32_t *values,
+                              uint32_t present) {
+  uint32_t resolution = store->tiers[HISTORY_TIER_MINUTES].resolution_s;
+  uint32_t start = ts - ts % resolution;
+  history_status ret = HISTORY_OK;
+
+  if (bucket->start != start) {
+    accumulator acc;
+    history_point point = {.ts = bucket->start};
+
+    memcpy(acc.sum, bucket->sum, sizeof(acc.sum));
+    memcpy(acc.count, bucket->count, sizeof(acc.count));
+    if (bucket->start > 0 && average(&acc, point.values)) {
+      ret = history_append(store, &point);
+    }
+
+    memset(bucket, 0, sizeof(*bucket));
+    bucket->start = start;
+  }
+
+  for (int i = 0; i < HISTORY_VALUES; i++) {
+    if (present & (1u << i)) {
+      bucket->sum[i] += values[i];
+      bucket->count[i]++;
+    }
+  }
+
+  return ret;
+}
+
+// Walks the sector from index on until a point is past to or the sink stops,
+// returns false in both cases. The sector ends at an erased slot or at a
+// point from end on, where the next sector starts.
+static bool walk_sector(const history *store, const history_tier *tier,
+                        uint32_t sector, uint32_t index, uint32_t count,
+                        uint32_t end, uint32_t to, history_sink sink,
+                        void *arg, uint32_t *passed) {
+  const flash_dev *dev = store->dev;
+  slot batch[READ_SLOTS];
+
+  while (index < count) {
+    uint32_t n = count - index < READ_SLOTS ? count - index : READ_SLOTS;
+    if (dev->read(dev->ctx, slot_addr(store, tier, sector, index), batch,
+                  n * sizeof(slot))) {
+      return false;
+    }
+
+    for (uint32_t i = 0; i < n; i++) {
+      const slot *data = &batch[i];
+      if (data->ts == ERASED_TS || data->ts >= end) {
+        return true;
+      }
+      if (data->ts > to) {
+        return false;
+      }
+      if (data->check != slot_check(data)) {
+        continue;
+      }
+
+      history_point point = {.ts = data->ts};
+      memcpy(point.values, data->values, sizeof(point.values));
+      if (sink(&point, arg) != 0) {
+        return false;
+      }
+      (*passed)++;
+    }
+    index += n;
+  }
+
+  return true;
+}
+
+uint32_t history_query(const history *store, uint32_t tier_id, uint32_t from,
+                       uint32_t to, history_sink sink, void *arg) {
+  uint32_t passed = 0;
+
+  if (tier_id >= HISTORY_TIER_COUNT || from > to) {
+    return 0;
+  }
+  const history_tier *tier = &store->tiers[tier_id];
+
+  // Oldest sector first, a sector ends where the next one in use starts.
+  for (uint32_t i = 1; i <= tier->sectors; i++) {
+    uint32_t sector = (tier->head_sector + i) % tier->sectors;
+    if (tier->first_ts[sector] == 0) {
+      continue;
+    }
+    if (tier->first_ts[sector] > to) {
+      break;
+    }
+
+    uint32_t end = UINT32_MAX;
+    for (uint32_t j = i + 1; j <= tier->sectors; j++) {
+      uint32_t next = (tier->head_sector + j) % tier->sectors;
+      if (tier->first_ts[next] != 0) {
+        end = tier->first_ts[next];
+        break;
+      }
+    }
+    if (end <= from) {
+      continue;
+    }
+
+    uint32_t count =
+        sector == tier->head_sector ? tier->head_slot : store->slots;
+    uint32_t index = tier->first_ts[sector] < from
+                         ? search_slot(store, tier, sector, count, from)
+                         : 0;
+    if (!walk_sector(store, tier, sector, index, count, end, to, sink, arg,
+                     &passed)) {
+      break;
+    }
+  }
+
+  return passed;
+}
+
+static uint32_t get_u32(const uint8_t *buf) {
+  return buf[0] | buf[1] << 8 | buf[2] << 16 | (uint32_t)buf[3] << 24;
+}
+
+static void put_u32(uint8_t *buf, uint32_t value) {
+  buf[0] = value;
+  buf[1] = value >> 8;
+  buf[2] = value >> 16;
+  buf[3] = value >> 24;
+}
+
+static void put_u16(uint8_t *buf, uint16_t value) {
+  buf[0] = value;
+  buf[1] = value >> 8;
+}
+
+bool history_request_decode(const uint8_t *buf, size_t len,
+                            history_request *request) {
+  if (len < HISTORY_REQUEST_SIZE || buf[0] != HISTORY_FRAME_MAGIC ||
+      buf[1] != HISTORY_FRAME_VERSION || buf[2] >= HISTORY_TIER_COUNT) {
+    return false;
+  }
+
+  request->tier = buf[2];
+  request->id = get_u32(buf + 4);
+  request->from = get_u32(buf + 8);
+  request->to = get_u32(buf + 12);
+  return request->from <= request->to;
+}
+
+void history_frame_start(history_frame *frame, const history_request *request,
+                         uint16_t number) {
+  frame->buf[0] = HISTORY_FRAME_MAGIC;
+  frame->buf[1] = HISTORY_FRAME_VERSION;
+  frame->buf[2] = request->tier;
+  frame->buf[3] = 0;
+  put_u32(frame->buf + 4, request->id);
+  put_u16(frame->buf + 8, number);
+  frame->len = HISTORY_FRAME_HEADER_SIZE;
+  frame->count = 0;
+}
+
+bool history_frame_add(history_frame *frame, const history_point *point) {
+  if (frame->count >= HISTORY_FRAME_POINTS) {
+    return false;
+  }
+
+  uint8_t *buf = frame->buf + frame->len;
+  put_u32(buf, point->ts);
+  for (int i = 0; i < HISTORY_VALUES; i++) {
+    put_u16(buf + 4 + 2 * i, (uint16_t)point->values[i]);
+  }
+
+  frame->len += HISTORY_FRAME_POINT_SIZE;
+  frame->count++;
+  return true;
+}
+
+void history_frame_finish(history_frame *frame, uint8_t flags) {
+  frame->buf[3] = flags;
+  put_u16(frame->buf + 10, frame->count);
+}
@@ -0,0 +1,210 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "lz_codec.h"
+
+#define MAX_CHAIN 32
+
+// Keys and fragments of the reading and summary payloads. Changing this
+// breaks every decoder in the field, so bump LZ_DICT_VERSION with it.
+static const char dictionary[] =
+    "\"},\"net\":{\"skipped\":0,\"failures\":0},\"window\":{\"cycles\":"
+    "\"power\":{\"volts\":\"ldr\":{\"intensity\":\"gas\":{\"level\":"
+    "\"co2\":{\"ppm\":\"dht\":{\"temperature\":\"humidity\":"
+    ",\"dht.temperature\":{\"n\":,\"dht.humidity\":{\"n\":"
+    ",\"gas.level\":{\"n\":,\"ldr.intensity\":{\"n\":,\"co2.ppm\":{\"n\":"
+    ",\"co2.temperature\":{\"n\":,\"power.volts\":{\"n\":"
+    ",\"mean\":,\"sd\":0.,\"min\":,\"max\":,\"ewma\":,\"p50\":,\"p90\":.00}";
+
+#define DICT_LEN ((int)sizeof(dictionary) - 1)
+
+typedef struct {
+  uint8_t *buf;
+  size_t len;
+  size_t pos;
+  uint32_t bits;
+  int count;
+} bit_writer;
+
+typedef struct {
+  const uint8_t *buf;
+  size_t len;
+  size_t pos;
+  uint32_t bits;
+  int count;
+} bit_reader;
+
+static bool put_bits(bit_writer *w, uint32_t value, int bits) {
+  w->bits = (w->bits << bits) | (value & ((1u << bits) - 1));
+  w->count += bits;
+
+  while (w->count >= 8) {
+    if (w->pos >= w->len) {
+      return false;
+    }
+    w->count -= 8;
+    w->buf[w->pos++] = (uint8_t)(w->bits >> w->count);
+  }
+
+  return true;
+}
+
+static bool flush_bits(bit_writer *w) {
+  return w->count == 0 || put_bits(w, 0, 8 - w->count);
+}
+
+static bool get_bits(bit_reader *r, int bits, uint32_t *value) {
+  while (r->count < bits) {
+    if (r->pos >= r->len) {
+      return false;
+    }
+    r->bits = (r->bits << 8) | r->buf[r->pos++];
+    r->count += 8;
+  }
+
+  r->count -= bits;
+  *value = (r->bits >> r->count) & ((1u << bits) - 1);
+  return true;
+}
+
+// Positions address the dictionary followed by the input.
+static uint8_t byte_at(const uint8_t *in, int pos) {
+  return pos < DICT_LEN ? (uint8_t)dictionary[pos] : in[pos - DICT_LEN];
+}
+
+static uint8_t hash(const uint8_t *in, int pos) {
+  return (uint8_t)((byte_at(in, pos) * 33 + byte_at(in, pos + 1)) * 33 +
+                   byte_at(in, pos + 2));
+}
+
+static void insert(lz_encoder *encoder, const uint8_t *in, int pos) {
+  uint8_t h = hash(in, pos);
+  encoder->prev[pos % LZ_WINDOW] = encoder->head[h];
+  encoder->head[h] = (int16_t)pos;
+}
+
+int lz_compress(lz_encoder *encoder, const uint8_t *in, size_t in_len,
+                uint8_t *out, size_t out_len) {
+  bit_writer w = {out, out_len, 0, 0, 0};
+  int end = DICT_LEN + (int)in_len;
+
+  if (in_len == 0 || in_len > LZ_MAX_INPUT || out_len < LZ_HEADER_SIZE) {
+    return -1;
+  }
+
+  out[0] = LZ_MAGIC;
+  out[1] = LZ_DICT_VERSION;
+  out[2] = (uint8_t)in_len;
+  out[3] = (uint8_t)(in_len >> 8);
+  w.pos = LZ_HEADER_SIZE;
+
+  memset(encoder->head, 0xff, sizeof(encoder->head));
+  for (int pos = 0; pos + LZ_MIN_MATCH <= DICT_LEN; pos++) {
+    insert(encoder, in, pos);
+  }
+
+  int pos = DICT_LEN;
+  while (pos < end) {
+    int best_len = 0;
+    int best_dist = 0;
+
+    if (pos + LZ_MIN_MATCH <= end) {
+      int max_len = end - pos < LZ_MAX_MATCH ? end - pos : LZ_MAX_MATCH;
+      int candidate = encoder->head[hash(in, pos)];
+
+      for (int chain = 0; chain < MAX_CHAIN && candidate >= 0 &&
+                          pos - candidate <= LZ_WINDOW;
+           chain++) {
+        int len = 0;
+        while (len < max_len &&
+               byte_at(in, candidate + len) == byte_at(in, pos + len)) {
+          len++;
+        }
+
+        if (len > best_len) {
+          best_len = len;
+          best_dist = pos - candidate;
+          if (len == max_len) {
+            break;
+          }
+        }
+
+        int next = encoder->prev[candidate % LZ_WINDOW];
+        if (next >= candidate) {
+          break;
+        }
+        candidate = next;
+      }
+    }
+
+    if (best_len >= LZ_MIN_MATCH) {
+      if (!put_bits(&w, 0, 1) ||
+          !put_bits(&w, best_dist - 1, LZ_WINDOW_BITS) ||
+          !put_bits(&w, best_len - LZ_MIN_MATCH, LZ_LENGTH_BITS)) {
+        return -1;
+      }
+    } else {
+      best_len = 1;
+      if (!put_bits(&w, 1, 1) || !put_bits(&w, byte_at(in, pos), 8)) {
+        return -1;
+      }
+    }
+
+    for (int i = 0; i < best_len; i++, pos++) {
+      if (pos + LZ_MIN_MATCH <= end) {
+        insert(encoder, in, pos);
+      }
+    }
+  }
+
+  return flush_bits(&w) ? (int)w.pos : -1;
+}
+
+int lz_decompress(const uint8_t *in, size_t in_len, uint8_t *out,
+                  size_t out_len) {
+  bit_reader r = {in, in_len, LZ_HEADER_SIZE, 0, 0};
+
+  if (in_len < LZ_HEADER_SIZE || in[0] != LZ_MAGIC ||
+      in[1] != LZ_DICT_VERSION) {
+    return -1;
+  }
+
+  int len = in[2] | (in[3] << 8);
+  if (len > (int)out_len) {
+    return -1;
+  }
+
+  int pos = 0;
+  while (pos < len) {
+    uint32_t literal, value, match;
+
+    if (!get_bits(&r, 1, &literal)) {
+      return -1;
+    }
+
+    if (literal) {
+      if (!get_bits(&r, 8, &value)) {
+        return -1;
+      }
+      out[pos++] = (uint8_t)value;
+      continue;
+    }
+
+    if (!get_bits(&r, LZ_WINDOW_BITS, &value) ||
+        !get_bits(&r, LZ_LENGTH_BITS, &match)) {
+      return -1;
+    }
+
+    int src = pos - (int)value - 1;
+    int count = (int)match + LZ_MIN_MATCH;
+    if (src < -DICT_LEN || pos + count > len) {
+      return -1;
+    }
+
+    for (int i = 0; i < count; i++, src++) {
+      out[pos++] = src < 0 ? (uint8_t)dictionary[DICT_LEN + src] : out[src];
+    }
+  }
+
+  return len;
+}
@@ -2,18 +2,29 @@
 #include <freertos/event_groups.h>
 #include <string.h>
 
+#include "esp_attr.h"
 #include "esp_event.h"
 #include "esp_log.h"
 #include "esp_sleep.h"
 #include "esp_system.h"
+#include "esp_timer.h"
 #include "esp_wifi.h"
 
+#include "mqtt_transport.h"
 #include "nvs_flash.h"
 
+#include "ota_update.h"
+#include "power_mode.h"
 #include "tasks.h"
+#include "time_sync.h"
+#include "wake_schedule.h"
+#include "wake_stub.h"
 
 #define WIFI_CONNECTED_BIT BIT0
 #define WIFI_FAIL_BIT BIT1
+#define WIFI_MAX_RETRIES 3
+#define WIFI_LISTEN_INTERVAL 3
+#define ALERT_WAKE_MS 100
 
 static const char *TAG = "AQ";
 static const bool enable_upd_logging = true;
@@ -22,6 +33,53 @@ static const int udp_logging_port = 1337;
 
 static EventGroupHandle_t wifi_event_group;
 static EventGroupHandle_t tasks_event_group;
+static int wifi_retries = 0;
+static bool wifi_stay_connected = false;
+
+static RTC_DATA_ATTR net_policy_state net_state;
+static RTC_DATA_ATTR stats_window window;
+static RTC_DATA_ATTR alert_monitor alerts;
+static RTC_DATA_ATTR bool alert_wake;
+static RTC_DATA_ATTR cycle_history history;
+static RTC_DATA_ATTR sensor_health health[SENSOR_COUNT];
+// Sampling cycles, for the sensor schedules.
+static RTC_DATA_ATTR uint32_t sensor_cycle;
+static RTC_DATA_ATTR battery_state battery;
+static RTC_DATA_ATTR gas_heater_state heater;
+// Build that wrote the RTC state, see check_rtc_build.
+static RTC_DATA_ATTR uint32_t rtc_build;
+static cycle_budget cycle;
+
+static int64_t now_ms(void) { return esp_timer_get_time() / 1000; }
+
+// Deep sleep keeps RTC memory across the switch to an OTA image, which may
+// lay out its state differently. State from another build is dropped, the
+// ESP-NOW sequence excepted: it is a plain counter and the gateway would
+// reject a restarted one.
+static void check_rtc_build(void) {
+  if (rtc_build == FIRMWARE_BUILD) {
+    return;
+  }
+
+  if (rtc_build != 0) {
+    ESP_LOGW(TAG, "RTC state from build %u, resetting it for build %u",
+             rtc_build, FIRMWARE_BUILD);
+  }
+  memset(&net_state, 0, sizeof(net_state));
+  memset(&window, 0, sizeof(window));
+  memset(&alerts, 0, sizeof(alerts));
+  alert_wake = false;
+  memset(&history, 0, sizeof(history));
+  memset(health, 0, sizeof(health));
+  sensor_cycle = 0;
+  memset(&battery, 0, sizeof(battery));
+  memset(&heater, 0, sizeof(heater));
+  time_sync_reset();
+  wake_stub_reset();
+  ota_update_reset();
+  mqtt_reset_state();
+  rtc_build = FIRMWARE_BUILD;
+}
 
 static void init_system(void) {
   esp_err_t ret = nvs_flash_init();
@@ -40,9 +98,13 @@ static void event_handler(void *arg, esp_event_base_t event_base,
     ESP_LOGI(TAG, "Wifi started");
   } else if (event_base == WIFI_EVENT &&
              event_id == WIFI_EVENT_STA_DISCONNECTED) {
-    ESP_LOGW(TAG, "Wifi disconnected");
-    xEventGroupSetBits(wifi_event_group, WIFI_FAIL_BIT);
-    esp_wifi_connect();
+    if (wifi_stay_connected || wifi_retries++ < WIFI_MAX_RETRIES) {
+      ESP_LOGW(TAG, "Wifi disconnected, retrying");
+      esp_wifi_connect();
+    } else {
+      ESP_LOGW(TAG, "Wifi disconnected, giving up");
+      xEventGroupSetBits(wifi_event_group, WIFI_FAIL_BIT);
+    }
   } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
     ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
     ESP_LOGI(TAG, "got ip:" IPSTR, IP2STR(&event->ip_info.ip));
@@ -53,7 +115,8 @@ static void event_handler(void *arg, esp_event_base_t event_base,
 }
 
 static void init_wifi(const char *ssid, const char *ssid_pass,
-                      const char *hostname) {
+                      const char *hostname, bool stay_connected) {
+  wifi_stay_connected = stay_connected;
   wifi_event_group = xEventGroupCreate();
 
   ESP_LOGI(TAG, "Connecting wifi at %s", ssid);
@@ -74,11 +137,133 @@ static void init_wifi(const char *ssid, const char *ssid_pass,
   wifi_config_t wifi_config = {};
   strcpy((char *)wifi_config.sta.ssid, ssid);
   strcpy((char *)wifi_config.sta.password, ssid_pass);
+  if (stay_connected) {
+    // Only wake up for every third DTIM beacon between readings.
+    wifi_config.sta.listen_interval = WIFI_LISTEN_INTERVAL;
+  }
 
   ESP_LOGI(TAG, "Setting WiFi configuration SSID %s...", wifi_config.sta.ssid);
   ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
   ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_config));
   ESP_ERROR_CHECK(esp_wifi_start());
+
+  if (stay_connected) {
+    ESP_ERROR_CHECK(esp_wifi_set_ps(WIFI_PS_MAX_MODEM));
+  }
+}
+
+// Only the radio, for a node that sends to its gateway over ESP-NOW.
+static void init_radio(uint8_t channel) {
+  ESP_ERROR_CHECK(esp_event_loop_create_default());
+
+  wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+  ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+  ESP_ERROR_CHECK(esp_wifi_set_storage(WIFI_STORAGE_RAM));
+  ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
+  ESP_ERROR_CHECK(esp_wifi_start());
+  ESP_ERROR_CHECK(esp_wifi_set_channel(channel, WIFI_SECOND_CHAN_NONE));
+}
+
+static const struct {
+  TaskFunction_t task;
+  const char *name;
+} sensor_tasks[SENSOR_COUNT] = {
+    [SENSOR_POWER] = {&power_task, "power_task"},
+    [SENSOR_CO2] = {&co2_task, "co2_task"},
+    [SENSOR_DHT] = {&dht_task, "dht_task"},
+    [SENSOR_LDR] = {&ldr_task, "ldr_task"},
+    [SENSOR_GAS] = {&gas_task, "gas_task"},
+};
+
+// Sensors that are not due, or behind an open circuit breaker, are reported
+// done right away. So is a sensor whose task from an earlier run is still
+// going: a second one would share its driver and its part of the reading.
+void start_sensor_tasks(task_results *results) {
+  results->sensors_started_us = esp_timer_get_time();
+
+  for (int i = 0; i < SENSOR_COUNT; i++) {
+    sensor_run *run = &results->sensors[i];
+
+    run->due =
+        (results->profile->sensors & BATTERY_SENSOR(i)) &&
+        sensor_schedule_due(&results->config->schedule[i], sensor_cycle);
+    run->stuck = run->due && run->running;
+    run->started = run->due && !run->stuck &&
+                   sensor_health_should_read(&results->health[i]);
+    run->success = false;
+    run->elapsed_ms = 0;
+
+    if (run->started) {
+      // The earlier task may have finished after its bit was cleared.
+      xEventGroupClearBits(results->tasks_event, SENSOR_TASK_BIT(i));
+      run->running = true;
+      xTaskCreate(sensor_tasks[i].task, sensor_tasks[i].name, 2000,
+                  (void *)results, 4, NULL);
+    } else {
+      if (run->stuck) {
+        ESP_LOGW(TAG, "Skipping %s, still running", sensor_tasks[i].name);
+      } else if (run->due) {
+        ESP_LOGW(TAG, "Skipping %s, circuit breaker open",
+                 sensor_tasks[i].name);
+      }
+      xEventGroupSetBits(results->tasks_event, SENSOR_TASK_BIT(i));
+    }
+  }
+  sensor_cycle++;
+}
+
+void finish_sensor_task(task_results *results, sensor_id sensor, bool success,
+                        int64_t started_us) {
+  results->sensors[sensor].success = success;
+  results->sensors[sensor].elapsed_ms =
+      (uint32_t)((esp_timer_get_time() - started_us) / 1000);
+
+  xEventGroupSetBits(results->tasks_event, SENSOR_TASK_BIT(sensor));
+  // Last, a new run may clear the bit and start over from here on.
+  results->sensors[sensor].running = false;
+  vTaskDelete(NULL);
+}
+
+// Before deep sleep: keeps the MQ heater on when the next gas reading is
+// too close to let it cool, and off otherwise. It can be switched again at
+// the end of the next cycle, or by the gas task for a reading on the next
+// wake. The wake stub samples gas on every wake, so it needs the heater on
+// throughout. The reading comes read_after_ms into the wake, as far into it
+// as this cycle's, and the heater keeps cooling until then.
+static void plan_gas_heater(const device_config *config,
+                            const battery_settings *profile, uint32_t sleep_ms,
+                            uint32_t period_ms, uint32_t read_after_ms) {
+  gas_heater_params params;
+  const sensor_schedule *schedule = &config->schedule[SENSOR_GAS];
+
+  gas_heater_params_load(config, &params);
+  if (params.preheat_ms == 0) {
+    return;
+  }
+  gas_heater_update(&heater, &params, time_sync_uptime_ms());
+
+  bool on = false;
+  if ((profile->sensors & BATTERY_SENSOR(SENSOR_GAS)) && schedule->period) {
+    on = config->stub_cycles > 1;
+    for (uint32_t k = 0; !on && k < schedule->period; k++) {
+      if (sensor_schedule_due(schedule, sensor_cycle + k)) {
+        uint64_t read_ms = sleep_ms + (uint64_t)k * period_ms + read_after_ms;
+        uint64_t next_ms = k > 0 ? sleep_ms + history.awake_ms : read_ms;
+        on = gas_heater_plan(&heater, &params,
+                             read_ms < UINT32_MAX ? read_ms : UINT32_MAX,
+                             next_ms < UINT32_MAX ? next_ms : UINT32_MAX,
+                             GAS_PREHEAT_WAIT_MS);
+        break;
+      }
+    }
+  }
+
+  if (on != heater.on) {
+    gas_heater_set(on);
+    gas_heater_switch(&heater, on);
+  }
+  ESP_LOGI(TAG, "Gas heater %s, on %us in the last hour", on ? "on" : "off",
+           gas_heater_on_per_hour_ms(&heater) / 1000);
 }
 
 char *get_key_string_value(nvs_handle_t nvs_handler, const char *key) {
@@ -101,6 +286,7 @@ char *get_key_string_value(nvs_handle_t nvs_handler, const char *key) {
 
 void app_main() {
   init_system();
+  check_rtc_build();
 
   nvs_handle_t creds_handle;
 
@@ -127,18 +313,144 @@ void app_main() {
   char *root_ca = get_key_string_value(creds_handle, "root_ca");
   char *thing_name = get_key_string_value(creds_handle, "thing_name");
   char *mqtt_host_url = get_key_string_value(creds_handle, "mqtt_url");
+  char *ota_public_key = get_key_string_value(creds_handle, "ota_public_key");
+  char *mqtt_transport = get_key_string_value(creds_handle, "mqtt_transport");
   nvs_get_u16(creds_handle, "mqtt_port", &mqtt_port);
 
-  init_wifi(ssid, ssid_pass, serial_number);
-  xEventGroupWaitBits(wifi_event_group, WIFI_CONNECTED_BIT, pdFALSE, pdFALSE,
-                      portMAX_DELAY);
+  espnow_link espnow;
+  char *espnow_role = get_key_string_value(creds_handle, "espnow_role");
+  char *espnow_key = get_key_string_value(creds_handle, "espnow_key");
+  char *espnow_gateway = get_key_string_value(creds_handle, "espnow_gateway");
+  espnow_link_parse(&espnow, espnow_role, espnow_key, espnow_gateway);
+  espnow.channel = 1;
+  nvs_get_u8(creds_handle, "espnow_channel", &espnow.channel);
+  free(espnow_role);
+  free(espnow_key);
+  free(espnow_gateway);
+
+  // Link faults for the loopback transport, used to benchmark the MQTT
+  // timeouts and retries without a broker.
+  loopback_faults faults = {0};
+  nvs_get_u32(creds_handle, "lb_latency_ms", &faults.latency_ms);
+  nvs_get_u32(creds_handle, "lb_bytes_per_s", &faults.bytes_per_second);
+  nvs_get_u16(creds_handle, "lb_loss", &faults.loss_per_mille);
+  nvs_get_u32(creds_handle, "lb_disconnect", &faults.disconnect_after);
+  mqtt_transport_set_faults(&faults);
+
+  time_sync_init();
+
+  device_config config;
+  device_config_load(&config);
+  power_mode_init(config.power_save);
+
+  // esp_timer starts at boot, so the budget covers the boot as well.
+  cycle_budget_start(&cycle, config.awake_budget_ms, 0);
+
+  if (!window.ready) {
+    for (int i = 0; i < METRIC_COUNT; i++) {
+      stats_init(&window.metrics[i]);
+    }
+    window.ready = true;
+  }
+
+  // Wakes the stub handled count towards the window, a threshold crossing it
+  // saw makes this cycle publish.
+  wake_stub_report stub_report;
+  wake_stub_collect(&stub_report);
+  for (uint32_t i = 0; i < stub_report.samples; i++) {
+    stats_add(&window.metrics[METRIC_GAS_LEVEL], stub_report.values[i]);
+  }
+  window.cycles += 1 + stub_report.cycles;
+
+  // Mains powered units may stay associated and keep one MQTT connection
+  // open instead of going through deep sleep. A gateway always does.
+  bool node = espnow.role == ESPNOW_ROLE_NODE;
+  bool always_connected = config.run_mode == RUN_MODE_CONNECTED ||
+                          espnow.role == ESPNOW_ROLE_GATEWAY;
+
+  // The battery profile only applies to the deep sleep cycle. Entering the
+  // brownout profile sends what is buffered once, then uploads stop.
+  const battery_settings *profile = battery_policy_settings(
+      always_connected ? BATTERY_PROFILE_NORMAL : battery.profile);
+  bool flush = !always_connected && battery.flush_pending;
+  uint32_t aggregate_cycles =
+      battery_policy_window(profile, config.aggregate_cycles);
+
+  // With aggregation enabled the network is only needed once per window.
+  bool publish_due =
+      flush || (profile->uploads &&
+                (aggregate_cycles == 0 || window.cycles >= aggregate_cycles ||
+                 stub_report.threshold_hit));
+
+  // A new alert that could not be sent brings the network up straight
+  // away, regardless of aggregation and backoff.
+  bool online =
+      !node &&
+      (always_connected || alert_wake ||
+       (publish_due && (flush || net_policy_should_connect(&net_state))));
+  if (node) {
+    // Every reading goes to the gateway, the node never associates.
+    init_radio(espnow.channel);
+    if (!espnow_link_start(&espnow)) {
+      ESP_LOGE(TAG, "ESP-NOW not started, readings are lost");
+    }
+  } else if (online) {
+    uint32_t wifi_ms = cycle_phase_begin(&cycle, CYCLE_PHASE_WIFI, now_ms());
+    init_wifi(ssid, ssid_pass, serial_number, always_connected);
+    if (espnow.role == ESPNOW_ROLE_GATEWAY) {
+      // Modem sleep would miss node frames between beacons.
+      ESP_ERROR_CHECK(esp_wifi_set_ps(WIFI_PS_NONE));
+      if (!espnow_link_start(&espnow)) {
+        ESP_LOGE(TAG, "ESP-NOW not started, not forwarding node readings");
+      }
+    }
+    EventBits_t bits = xEventGroupWaitBits(
+        wifi_event_group, WIFI_CONNECTED_BIT | WIFI_FAIL_BIT, pdFALSE, pdFALSE,
+        wifi_ms / portTICK_PERIOD_MS);
+    online = (bits & WIFI_CONNECTED_BIT) != 0;
+    cycle_phase_end(&cycle, CYCLE_PHASE_WIFI, bits != 0, now_ms());
+
+    if (online && (always_connected || time_sync_due())) {
+      time_sync_start();
+    } else if (always_connected) {
+      ESP_LOGW(TAG, "Wifi not connected after %ums, retrying in background",
+               wifi_ms);
+    } else if (!online) {
+      ESP_LOGW(TAG, "Wifi not connected after %ums, storing readings only",
+               wifi_ms);
+      net_policy_report(&net_state, false);
+      esp_wifi_stop();
+    }
+  } else if (publish_due) {
+    ESP_LOGW(TAG, "Skipping network this cycle, %u skips left",
+             net_state.skip_remaining);
+  } else if (!profile->uploads) {
+    ESP_LOGW(TAG, "Not uploading, battery profile %s",
+             battery_profile_name(battery.profile));
+  } else {
+    ESP_LOGI(TAG, "Aggregating cycle %u/%u", window.cycles, aggregate_cycles);
+  }
 
-  if (enable_upd_logging) {
+  if (online && enable_upd_logging) {
     ESP_ERROR_CHECK(udp_logging_init(udp_logging_address, udp_logging_port,
                                      udp_logging_vprintf));
   }
 
   task_results *results = (task_results *)pvPortMalloc(sizeof(task_results));
+  memset(results, 0, sizeof(*results));
+  results->config = &config;
+  results->window = &window;
+  results->alerts = &alerts;
+  results->cycle = &cycle;
+  results->history = &history;
+  results->health = health;
+  results->battery = &battery;
+  results->profile = profile;
+  results->heater = &heater;
+  results->reading.uptime = time_sync_uptime();
+  results->stub_cycles = stub_report.cycles;
+  results->stub_us =
+      stub_report.cycles ? stub_report.awake_us / stub_report.cycles : 0;
   mqtt_params p = {
       .results = results,
       .cert = cert_content,
@@ -147,27 +459,108 @@ void app_main() {
       .mqtt_host = mqtt_host_url,
       .mqtt_port = mqtt_port,
       .root_ca = root_ca,
+      .transport = mqtt_transport,
+      .ota_public_key = ota_public_key,
+      .publish_due = publish_due,
+      .online = online,
+      .flush_backlog = flush,
+      .net_state = &net_state,
+      .espnow = &espnow,
   };
 
   tasks_event_group = xEventGroupCreate();
   results->tasks_event = tasks_event_group;
 
   ESP_LOGI(TAG, "Starting tasks...");
-  xTaskCreate(&power_task, "power_task", 2000, (void *)results, 4, NULL);
-  xTaskCreate(&co2_task, "co2_task", 2000, (void *)results, 4, NULL);
-  xTaskCreate(&dht_task, "dht_task", 2000, (void *)results, 4, NULL);
-  xTaskCreate(&ldr_task, "ldr_task", 2000, (void *)results, 4, NULL);
-  xTaskCreate(&gas_task, "gas_task", 2000, (void *)results, 4, NULL);
-  xTaskCreate(&mqtt_task, "mqtt_task", 5000, (void *)&p, 4, NULL);
+  if (always_connected) {
+    xTaskCreate(&mqtt_connected_task, "mqtt_task", 8000, (void *)&p, 4, NULL);
+  } else if (node) {
+    cycle_phase_begin(&cycle, CYCLE_PHASE_SENSORS, now_ms());
+    start_sensor_tasks(results);
+    xTaskCreate(&espnow_node_task, "node_task", 3000, (void *)&p, 4, NULL);
+  } else {
+    cycle_phase_begin(&cycle, CYCLE_PHASE_SENSORS, now_ms());
+    start_sensor_tasks(results);
+    xTaskCreate(&mqtt_task, "mqtt_task", 7000, (void *)&p, 4, NULL);
+  }
   ESP_LOGI(TAG, "Waiting for tasks to finish");
 
-  xEventGroupWaitBits(tasks_event_group, MQTT_TASK_BIT, pdTRUE, pdFALSE,
-                      portMAX_DELAY);
+  // Whatever is still running when the awake budget is spent is abandoned,
+  // the cycle always ends in deep sleep.
+  TickType_t wait =
+      always_connected
+          ? portMAX_DELAY
+          : cycle_budget_left(&cycle, now_ms()) / portTICK_PERIOD_MS;
+  bool finished = xEventGroupWaitBits(tasks_event_group, MQTT_TASK_BIT, pdTRUE,
+                                      pdFALSE, wait) &
+                  MQTT_TASK_BIT;
+  if (!finished) {
+    ESP_LOGE(TAG, "Awake budget of %ums spent, going to sleep",
+             config.awake_budget_ms);
+  }
+  if (!always_connected) {
+    cycle_budget_finish(&cycle, &history, 0, now_ms());
+  }
+  time_sync_stop();
+
+  if (results->executed_commands) {
+    device_config_clear_commands(results->executed_commands);
+  }
+
+  // A cycle that got through keeps a new image, it need not have published.
+  if (finished) {
+    ota_update_confirm();
+  }
+
+  // An abandoned cycle may not have a complete reading. The new profile
+  // applies from this sleep on.
+  if (flush && online) {
+    battery.flush_pending = false;
+  }
+  if (finished && !always_connected &&
+      !(results->reading.missing & READING_MISSING(power)) &&
+      battery_policy_update(&battery, &config, results->reading.power.volts)) {
+    ESP_LOGW(TAG, "Supply at %dmV, switching to the %s battery profile",
+             results->reading.power.volts,
+             battery_profile_name(battery.profile));
+    profile = battery_policy_settings(battery.profile);
+  }
+
+  int64_t unix_ms = 0;
+  uint32_t uncertainty_ms;
+  bool synced = time_sync_now(&unix_ms, &uncertainty_ms);
+  // The flush is not put off by the longer sleep.
+  uint32_t period_ms =
+      config.sleep_seconds * 1000 *
+      (battery.flush_pending ? 1 : profile->sleep_factor);
+  uint32_t sleep_ms = wake_schedule_delay(
+      unix_ms, config.wake_stagger && synced, period_ms,
+      wake_schedule_phase(thing_name ? thing_name : "", period_ms),
+      config.wake_jitter_ms, esp_random());
+
+  // Wake up again as soon as possible for an alert still to be sent, or when
+  // a breach has been held long enough to be raised.
+  alert_rule rules[ALERT_RULE_COUNT];
+  alert_rules_load(&config, rules);
+  int64_t alert_ms = results->alert_wake
+                         ? ALERT_WAKE_MS
+                         : alert_monitor_next_ms(&alerts, rules,
+                                                 time_sync_uptime_ms());
+  if (alert_ms >= 0 && alert_ms < sleep_ms) {
+    sleep_ms = alert_ms < ALERT_WAKE_MS ? ALERT_WAKE_MS : (uint32_t)alert_ms;
+  }
+  alert_wake = results->alert_wake;
+  uint32_t sensors_at_ms = (uint32_t)(results->sensors_started_us / 1000);
+
+  ESP_LOGI(TAG, "Sleeping for %ums", sleep_ms);
+  // An abandoned task may still be using the results.
+  if (finished) {
+    vPortFree(results);
+  }
 
-  ESP_LOGI(TAG, "All tasks are finished, sleeping for %ds",
-           SLEE_TIME / US_TO_MS);
-  vPortFree(results);
+  wake_stub_arm(period_ms, config.stub_cycles, config.stub_gas_threshold);
+  plan_gas_heater(&config, profile, sleep_ms, period_ms, sensors_at_ms);
 
-  esp_sleep_enable_timer_wakeup(SLEE_TIME);
+  esp_sleep_enable_timer_wakeup((uint64_t)sleep_ms * 1000);
   esp_deep_sleep_start();
 }
\ No newline at end of file
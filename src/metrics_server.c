@@ -0,0 +1,111 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "esp_http_server.h"
+#include "esp_log.h"
+
+#include "metrics_server.h"
+
+#define CONTENT_TYPE "text/plain; version=0.0.4"
+
+static const char *TAG = "METRICS";
+
+typedef struct {
+  char text[METRICS_SERVER_MAX];
+  size_t len;
+  uint32_t readers;
+} metrics_buffer;
+
+static metrics_buffer buffers[2];
+static int front;
+static SemaphoreHandle_t lock;
+static httpd_handle_t server;
+static uint16_t server_port;
+
+static esp_err_t handle_metrics(httpd_req_t *req) {
+  xSemaphoreTake(lock, portMAX_DELAY);
+  metrics_buffer *buffer = &buffers[front];
+  buffer->readers++;
+  xSemaphoreGive(lock);
+
+  httpd_resp_set_type(req, CONTENT_TYPE);
+  esp_err_t err = httpd_resp_send(req, buffer->text, buffer->len);
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  buffer->readers--;
+  xSemaphoreGive(lock);
+
+  return err;
+}
+
+bool metrics_server_start(uint16_t port) {
+  if (server != NULL && port == server_port) {
+    return true;
+  }
+  metrics_server_stop();
+
+  if (lock == NULL && (lock = xSemaphoreCreateMutex()) == NULL) {
+    return false;
+  }
+
+  httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+  config.server_port = port;
+  if (httpd_start(&server, &config) != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to listen on port %u", port);
+    server = NULL;
+    return false;
+  }
+
+  httpd_uri_t uri = {
+      .uri = "/metrics",
+      .method = HTTP_GET,
+      .handler = handle_metrics,
+  };
+  httpd_register_uri_handler(server, &uri);
+  server_port = port;
+
+  ESP_LOGI(TAG, "Serving metrics on port %u", port);
+  return true;
+}
+
+void metrics_server_stop(void) {
+  if (server != NULL) {
+    httpd_stop(server);
+    server = NULL;
+  }
+}
+
+char *metrics_server_begin(size_t *len) {
+  metrics_buffer *back = &buffers[1 - front];
+  bool busy;
+
+  if (server == NULL) {
+    return NULL;
+  }
+
+  // Scrapes only ever take the front buffer, so once the back one is free
+  // it stays free until the commit.
+  xSemaphoreTake(lock, portMAX_DELAY);
+  busy = back->readers > 0;
+  xSemaphoreGive(lock);
+
+  if (busy) {
+    ESP_LOGW(TAG, "Scrape still running, keeping the previous metrics");
+    return NULL;
+  }
+
+  *len = sizeof(back->text);
+  return back->text;
+}
+
+void metrics_server_commit(int len) {
+  if (len < 0) {
+    ESP_LOGE(TAG, "Metrics do not fit %d bytes", METRICS_SERVER_MAX);
+    return;
+  }
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  buffers[1 - front].len = len;
+  front = 1 - front;
+  xSemaphoreGive(lock);
+}
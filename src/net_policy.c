@@ -0,0 +1,31 @@
+#include "net_policy.h"
+
+bool net_policy_should_connect(net_policy_state *state) {
+  if (state->skip_remaining == 0) {
+    return true;
+  }
+
+  state->skip_remaining--;
+  state->skipped_total++;
+  return false;
+}
+
+void net_policy_report(net_policy_state *state, bool success) {
+  if (success) {
+    state->failures = 0;
+    state->skip_remaining = 0;
+    return;
+  }
+
+  state->failures++;
+  state->failed_total++;
+
+  if (state->failures > NET_POLICY_FREE_FAILURES) {
+    uint32_t skip = 1;
+    for (uint32_t i = NET_POLICY_FREE_FAILURES + 1;
+         i < state->failures && skip < NET_POLICY_MAX_SKIP; i++) {
+      skip <<= 1;
+    }
+    state->skip_remaining = skip;
+  }
+}
@@ -0,0 +1,51 @@
+#include <stdio.h>
+
+#include "ota_chunk.h"
+
+static uint32_t read_u32le(const uint8_t *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+ota_chunk_status ota_chunk_parse(const ota_progress *progress,
+                                 const uint8_t *frame, size_t len,
+                                 const uint8_t **data, size_t *data_len) {
+  if (len <= OTA_CHUNK_HEADER_SIZE) {
+    return OTA_CHUNK_REJECTED;
+  }
+
+  uint32_t build = read_u32le(frame);
+  uint32_t offset = read_u32le(frame + 4);
+
+  // Replies to requests made before a reboot or for an older build.
+  if (build != progress->build || offset < progress->offset) {
+    return OTA_CHUNK_STALE;
+  }
+
+  *data = frame + OTA_CHUNK_HEADER_SIZE;
+  *data_len = len - OTA_CHUNK_HEADER_SIZE;
+
+  if (offset != progress->offset || *data_len > OTA_CHUNK_SIZE ||
+      offset + *data_len > progress->size) {
+    return OTA_CHUNK_REJECTED;
+  }
+
+  return OTA_CHUNK_ACCEPTED;
+}
+
+size_t ota_chunk_request(const ota_progress *progress, char *buf, size_t len) {
+  uint32_t length = progress->size - progress->offset;
+  if (length > OTA_CHUNK_SIZE) {
+    length = OTA_CHUNK_SIZE;
+  }
+
+  int written =
+      snprintf(buf, len, "{\"build\": %u, \"offset\": %u, \"length\": %u}",
+               (unsigned)progress->build, (unsigned)progress->offset,
+               (unsigned)length);
+
+  return written > 0 && (size_t)written < len ? (size_t)written : 0;
+}
+
+bool ota_progress_complete(const ota_progress *progress) {
+  return progress->size > 0 && progress->offset >= progress->size;
+}
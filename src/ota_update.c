@@ -0,0 +1,270 @@
+#include <string.h>
+
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "mbedtls/pk.h"
+#include "nvs.h"
+
+#include "ota_update.h"
+#include "sha256.h"
+
+#define OTA_NAMESPACE "ota"
+#define OTA_PROGRESS_KEY "progress"
+// The last build whose signature did not verify.
+#define OTA_REJECTED_KEY "rejected"
+
+#define ALIGN_UP(x, a) (((x) + (a)-1) / (a) * (a))
+
+static const char *TAG = "OTA";
+
+typedef struct {
+  ota_progress progress;
+  sha256_context sha;
+  bool valid;
+} ota_state;
+
+// Survives deep sleep, so a resumed download only has to rehash the image
+// after a power loss.
+static RTC_DATA_ATTR ota_state state;
+
+static const esp_partition_t *target;
+static const device_config *manifest;
+
+static void save_progress(const ota_progress *progress) {
+  nvs_handle_t handle;
+
+  if (nvs_open(OTA_NAMESPACE, NVS_READWRITE, &handle) == ESP_OK) {
+    nvs_set_blob(handle, OTA_PROGRESS_KEY, progress, sizeof(*progress));
+    nvs_commit(handle);
+    nvs_close(handle);
+  }
+}
+
+static bool load_progress(ota_progress *progress) {
+  nvs_handle_t handle;
+  size_t size = sizeof(*progress);
+
+  if (nvs_open(OTA_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+    return false;
+  }
+
+  esp_err_t err = nvs_get_blob(handle, OTA_PROGRESS_KEY, progress, &size);
+  nvs_close(handle);
+
+  return err == ESP_OK && size == sizeof(*progress);
+}
+
+static void save_rejected(uint32_t build) {
+  nvs_handle_t handle;
+
+  if (nvs_open(OTA_NAMESPACE, NVS_READWRITE, &handle) == ESP_OK) {
+    nvs_set_u32(handle, OTA_REJECTED_KEY, build);
+    nvs_commit(handle);
+    nvs_close(handle);
+  }
+}
+
+static bool rejected(uint32_t build) {
+  nvs_handle_t handle;
+  uint32_t stored = 0;
+
+  if (nvs_open(OTA_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+    return false;
+  }
+  esp_err_t err = nvs_get_u32(handle, OTA_REJECTED_KEY, &stored);
+  nvs_close(handle);
+
+  return err == ESP_OK && stored == build;
+}
+
+static bool rehash(void) {
+  uint8_t block[OTA_CHUNK_SIZE];
+
+  sha256_init(&state.sha);
+  for (uint32_t offset = 0; offset < state.progress.offset;
+       offset += sizeof(block)) {
+    uint32_t len = state.progress.offset - offset;
+    if (len > sizeof(block)) {
+      len = sizeof(block);
+    }
+
+    if (esp_partition_read(target, offset, block, len) != ESP_OK) {
+      return false;
+    }
+    sha256_update(&state.sha, block, len);
+  }
+
+  return true;
+}
+
+bool ota_update_begin(const device_config *config) {
+  if (config->ota_build <= FIRMWARE_BUILD || config->ota_size == 0 ||
+      config->ota_signature_len == 0) {
+    return false;
+  }
+  // Downloading it again would only get the same image.
+  if (rejected(config->ota_build)) {
+    return false;
+  }
+
+  target = esp_ota_get_next_update_partition(NULL);
+  if (target == NULL || config->ota_size > target->size) {
+    ESP_LOGE(TAG, "No slot for build %u (%u bytes)", config->ota_build,
+             config->ota_size);
+    target = NULL;
+    return false;
+  }
+
+  manifest = config;
+
+  if (!state.valid || state.progress.build != config->ota_build ||
+      state.progress.size != config->ota_size) {
+    ota_progress stored;
+    if (!load_progress(&stored) || stored.build != config->ota_build ||
+        stored.size != config->ota_size) {
+      stored.build = config->ota_build;
+      stored.size = config->ota_size;
+      stored.offset = 0;
+    }
+
+    state.progress = stored;
+    state.valid = rehash();
+    if (!state.valid) {
+      target = NULL;
+      return false;
+    }
+  }
+
+  ESP_LOGI(TAG, "Downloading build %u into %s, %u/%u bytes",
+           state.progress.build, target->label, state.progress.offset,
+           state.progress.size);
+  return true;
+}
+
+const ota_progress *ota_update_progress(void) { return &state.progress; }
+
+size_t ota_update_request(char *buf, size_t len) {
+  return ota_chunk_request(&state.progress, buf, len);
+}
+
+ota_chunk_status ota_update_write_chunk(const void *frame, size_t len) {
+  const uint8_t *data;
+  size_t data_len;
+
+  if (target == NULL) {
+    return OTA_CHUNK_REJECTED;
+  }
+
+  ota_chunk_status ret =
+      ota_chunk_parse(&state.progress, frame, len, &data, &data_len);
+  if (ret != OTA_CHUNK_ACCEPTED) {
+    return ret;
+  }
+
+  // Everything below the current offset rounded up to a sector has already
+  // been erased by an earlier chunk.
+  uint32_t offset = state.progress.offset;
+  uint32_t erased_until = ALIGN_UP(offset, SPI_FLASH_SEC_SIZE);
+  uint32_t end = offset + data_len;
+
+  if (end > erased_until &&
+      esp_partition_erase_range(target, erased_until,
+                                ALIGN_UP(end, SPI_FLASH_SEC_SIZE) -
+                                    erased_until) != ESP_OK) {
+    return OTA_CHUNK_REJECTED;
+  }
+
+  if (esp_partition_write(target, offset, data, data_len) != ESP_OK) {
+    return OTA_CHUNK_REJECTED;
+  }
+
+  sha256_update(&state.sha, data, data_len);
+  state.progress.offset = end;
+
+  return OTA_CHUNK_ACCEPTED;
+}
+
+static bool verify_signature(const uint8_t *digest,
+                             const char *public_key_pem) {
+  mbedtls_pk_context pk;
+  bool verified = false;
+
+  if (public_key_pem == NULL) {
+    ESP_LOGE(TAG, "No public key to verify the image with");
+    return false;
+  }
+
+  mbedtls_pk_init(&pk);
+  if (mbedtls_pk_parse_public_key(&pk, (const unsigned char *)public_key_pem,
+                                  strlen(public_key_pem) + 1) == 0) {
+    verified = mbedtls_pk_verify(&pk, MBEDTLS_MD_SHA256, digest,
+                                 SHA256_DIGEST_SIZE, manifest->ota_signature,
+                                 manifest->ota_signature_len) == 0;
+  }
+  mbedtls_pk_free(&pk);
+
+  return verified;
+}
+
+bool ota_update_finish(const char *public_key_pem) {
+  uint8_t digest[SHA256_DIGEST_SIZE];
+  sha256_context sha = state.sha;
+
+  if (target == NULL || !ota_progress_complete(&state.progress)) {
+    return false;
+  }
+
+  sha256_final(&sha, digest);
+
+  if (memcmp(digest, manifest->ota_sha256, sizeof(digest)) != 0) {
+    ESP_LOGE(TAG, "Image hash mismatch, restarting download");
+    state.progress.offset = 0;
+    sha256_init(&state.sha);
+    save_progress(&state.progress);
+    return false;
+  }
+
+  if (!verify_signature(digest, public_key_pem)) {
+    ESP_LOGE(TAG, "Image signature rejected, skipping build %u",
+             state.progress.build);
+    save_rejected(state.progress.build);
+    state.progress.offset = 0;
+    save_progress(&state.progress);
+    state.valid = false;
+    target = NULL;
+    return false;
+  }
+
+  // Also validates the image headers and segment checksums.
+  esp_err_t err = esp_ota_set_boot_partition(target);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to activate image: %s", esp_err_to_name(err));
+    return false;
+  }
+
+  ESP_LOGI(TAG, "Build %u verified, booting it on next wake",
+           state.progress.build);
+  state.valid = false;
+  return true;
+}
+
+void ota_update_suspend(void) {
+  if (target != NULL) {
+    save_progress(&state.progress);
+  }
+}
+
+void ota_update_confirm(void) {
+  esp_ota_img_states_t img_state;
+  const esp_partition_t *running = esp_ota_get_running_partition();
+
+  if (esp_ota_get_state_partition(running, &img_state) == ESP_OK &&
+      img_state == ESP_OTA_IMG_PENDING_VERIFY) {
+    ESP_LOGI(TAG, "Build %u is working, cancelling rollback", FIRMWARE_BUILD);
+    esp_ota_mark_app_valid_cancel_rollback();
+  }
+}
+
+void ota_update_reset(void) { memset(&state, 0, sizeof(state)); }
@@ -0,0 +1,117 @@
+#include <freertos/FreeRTOS.h>
+
+#include "esp32/pm.h"
+#include "esp_log.h"
+#include "esp_pm.h"
+#include "esp_timer.h"
+
+#include "power_mode.h"
+
+static const char *TAG = "POWER";
+
+static esp_pm_lock_handle_t locks[POWER_PHASE_COUNT];
+static uint32_t phase_mhz[POWER_PHASE_COUNT] = {
+    POWER_MAX_FREQ_MHZ, POWER_MAX_FREQ_MHZ, POWER_MAX_FREQ_MHZ};
+static uint32_t holders[POWER_PHASE_COUNT];
+static int64_t spent_us[POWER_PHASE_COUNT];
+static power_phase current = POWER_PHASE_IDLE;
+static int64_t since_us;
+static portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+
+static void account(void) {
+  int64_t now = esp_timer_get_time();
+  power_phase phase = POWER_PHASE_IDLE;
+
+  for (int i = POWER_PHASE_COUNT - 1; i > POWER_PHASE_IDLE; i--) {
+    if (holders[i] > 0) {
+      phase = i;
+      break;
+    }
+  }
+
+  spent_us[current] += now - since_us;
+  current = phase;
+  since_us = now;
+}
+
+void power_mode_init(bool power_save) {
+  esp_pm_config_esp32_t config = {
+      .max_freq_mhz = POWER_MAX_FREQ_MHZ,
+      .min_freq_mhz = power_save ? POWER_MIN_FREQ_MHZ : POWER_MAX_FREQ_MHZ,
+      .light_sleep_enable = power_save,
+  };
+
+  esp_err_t err = esp_pm_configure(&config);
+  if (err != ESP_OK) {
+    ESP_LOGW(TAG, "Power management not available: %s",
+             esp_err_to_name(err));
+  } else if (power_save) {
+    phase_mhz[POWER_PHASE_IDLE] = POWER_MIN_FREQ_MHZ;
+    phase_mhz[POWER_PHASE_SENSE] = POWER_APB_FREQ_MHZ;
+  }
+
+  // Sensing only needs a stable APB clock for the ADC, UART and the DHT bit
+  // timing, the TLS handshake is the one place that needs the fast CPU.
+  esp_pm_lock_create(ESP_PM_APB_FREQ_MAX, 0, "sense",
+                     &locks[POWER_PHASE_SENSE]);
+  esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "network",
+                     &locks[POWER_PHASE_NETWORK]);
+  since_us = esp_timer_get_time();
+}
+
+void power_phase_begin(power_phase phase) {
+  if (locks[phase] != NULL) {
+    esp_pm_lock_acquire(locks[phase]);
+  }
+
+  portENTER_CRITICAL(&mux);
+  holders[phase]++;
+  account();
+  portEXIT_CRITICAL(&mux);
+}
+
+void power_phase_end(power_phase phase) {
+  portENTER_CRITICAL(&mux);
+  holders[phase]--;
+  account();
+  portEXIT_CRITICAL(&mux);
+
+  if (locks[phase] != NULL) {
+    esp_pm_lock_release(locks[phase]);
+  }
+}
+
+void power_mode_times(uint32_t ms[POWER_PHASE_COUNT]) {
+  portENTER_CRITICAL(&mux);
+  account();
+  for (int i = 0; i < POWER_PHASE_COUNT; i++) {
+    ms[i] = (uint32_t)(spent_us[i] / 1000);
+  }
+  portEXIT_CRITICAL(&mux);
+}
+
+int power_mode_clock_times(const uint32_t ms[POWER_PHASE_COUNT],
+                           uint32_t mhz[POWER_PHASE_COUNT],
+                           uint32_t clock_ms[POWER_PHASE_COUNT]) {
+  int count = 0;
+
+  // Phases go from the slowest clock to the fastest.
+  for (int i = POWER_PHASE_COUNT - 1; i >= 0; i--) {
+    if (count > 0 && mhz[count - 1] == phase_mhz[i]) {
+      clock_ms[count - 1] += ms[i];
+      continue;
+    }
+    mhz[count] = phase_mhz[i];
+    clock_ms[count++] = ms[i];
+  }
+  return count;
+}
+
+uint32_t power_mode_energy_mj(const uint32_t ms[POWER_PHASE_COUNT]) {
+  uint64_t charge = (uint64_t)ms[POWER_PHASE_IDLE] * POWER_IDLE_MA +
+                    (uint64_t)ms[POWER_PHASE_SENSE] * POWER_SENSE_MA +
+                    (uint64_t)ms[POWER_PHASE_NETWORK] * POWER_NETWORK_MA;
+
+  // mA * ms * mV = nJ
+  return (uint32_t)(charge * POWER_SUPPLY_MV / 1000000);
+}
@@ -0,0 +1,91 @@
+#include <math.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "prometheus.h"
+
+typedef struct {
+  char *buf;
+  size_t len;
+  size_t pos;
+  bool failed;
+} text_writer;
+
+static void append(text_writer *w, const char *format, ...) {
+  va_list args;
+
+  if (w->failed) {
+    return;
+  }
+
+  va_start(args, format);
+  int n = vsnprintf(w->buf + w->pos, w->len - w->pos, format, args);
+  va_end(args);
+
+  if (n < 0 || w->pos + n >= w->len) {
+    w->failed = true;
+    return;
+  }
+  w->pos += n;
+}
+
+// Metric names are written as group.key, Prometheus wants group_key.
+static void append_metric_name(text_writer *w, const char *name) {
+  for (; *name && !w->failed; name++) {
+    if (w->pos + 1 >= w->len) {
+      w->failed = true;
+      return;
+    }
+    w->buf[w->pos++] = *name == '.' ? '_' : *name;
+  }
+}
+
+static void append_stat(text_writer *w, const char *name, const char *stat,
+                        float value) {
+  append(w, "aq_window{metric=\"");
+  append_metric_name(w, name);
+  append(w, "\",stat=\"%s\"} %g\n", stat, value);
+}
+
+int prometheus_write(const reading *value, const metric_stats *metrics,
+                     const char **names, int count, char *buf, size_t len) {
+  text_writer w = {buf, len, 0, len == 0};
+
+#define WRITE_FIELD(name, key)                                                 \
+  append(&w, "# TYPE aq_%s_" key " gauge\naq_%s_" key " %d\n", group_name,     \
+         group_name, group->name);
+#define WRITE_GROUP(name, type, fields)                                        \
+  if (!(value->missing & READING_MISSING(name))) {                             \
+    const char *group_name = #name;                                            \
+    const type *group = &value->name;                                          \
+    fields(WRITE_FIELD)                                                        \
+  }
+  READING_GROUPS(WRITE_GROUP)
+#undef WRITE_GROUP
+#undef WRITE_FIELD
+
+#define WRITE_SCALAR(name, key)                                                \
+  append(&w, "# TYPE aq_" key " gauge\naq_" key " %d\n", value->name);
+  READING_SCALARS(WRITE_SCALAR)
+#undef WRITE_SCALAR
+
+  append(&w, "# TYPE aq_window gauge\n");
+  for (int i = 0; i < count; i++) {
+    const metric_stats *stats = &metrics[i];
+    if (stats->count == 0) {
+      continue;
+    }
+
+    append_stat(&w, names[i], "n", stats->count);
+    append_stat(&w, names[i], "mean", stats->mean);
+    append_stat(&w, names[i], "sd", sqrtf(stats_variance(stats)));
+    append_stat(&w, names[i], "min", stats->min);
+    append_stat(&w, names[i], "max", stats->max);
+    append_stat(&w, names[i], "ewma", stats->ewma);
+    append_stat(&w, names[i], "p50", stats_p50(stats));
+    append_stat(&w, names[i], "p90", stats_p90(stats));
+  }
+
+  return w.failed ? -1 : (int)w.pos;
+}
@@ -0,0 +1,144 @@
+#include <string.h>
+
+#include "publish_window.h"
+
+static publish_slot *slot_at(publish_window *window, uint8_t i) {
+  return &window->slots[(window->head + i) % PUBLISH_WINDOW_MAX];
+}
+
+static uint32_t clamp_rto(uint32_t rto_ms) {
+  if (rto_ms < PUBLISH_WINDOW_MIN_RTO_MS) {
+    return PUBLISH_WINDOW_MIN_RTO_MS;
+  }
+  return rto_ms > PUBLISH_WINDOW_MAX_RTO_MS ? PUBLISH_WINDOW_MAX_RTO_MS
+                                            : rto_ms;
+}
+
+void publish_window_init(publish_window *window) {
+  memset(window, 0, sizeof(*window));
+  window->size = PUBLISH_WINDOW_INITIAL;
+  window->rto_ms = PUBLISH_WINDOW_INITIAL_RTO_MS;
+}
+
+void publish_window_clear(publish_window *window) {
+  window->head = 0;
+  window->count = 0;
+  window->round_acks = 0;
+  window->retransmits = 0;
+}
+
+bool publish_window_open(const publish_window *window) {
+  return window->count < window->size;
+}
+
+static publish_slot *push(publish_window *window, uint32_t ref) {
+  publish_slot *slot = slot_at(window, window->count++);
+
+  memset(slot, 0, sizeof(*slot));
+  slot->ref = ref;
+  return slot;
+}
+
+void publish_window_sent(publish_window *window, uint32_t ref,
+                         uint16_t packet_id, uint32_t now_ms) {
+  publish_slot *slot = push(window, ref);
+
+  slot->packet_id = packet_id;
+  slot->sent_ms = now_ms;
+  slot->attempts = 1;
+}
+
+void publish_window_skip(publish_window *window, uint32_t ref) {
+  push(window, ref)->acked = true;
+}
+
+static void sample_rtt(publish_window *window, uint32_t rtt_ms) {
+  if (window->srtt_ms == 0) {
+    window->srtt_ms = rtt_ms > 0 ? rtt_ms : 1;
+    window->rttvar_ms = rtt_ms / 2;
+  } else {
+    uint32_t delta = rtt_ms > window->srtt_ms ? rtt_ms - window->srtt_ms
+                                              : window->srtt_ms - rtt_ms;
+    window->rttvar_ms = (3 * window->rttvar_ms + delta) / 4;
+    window->srtt_ms = (7 * window->srtt_ms + rtt_ms + 7) / 8;
+  }
+  uint32_t margin = 4 * window->rttvar_ms;
+  if (margin < PUBLISH_WINDOW_GRANULARITY_MS) {
+    margin = PUBLISH_WINDOW_GRANULARITY_MS;
+  }
+  window->rto_ms = clamp_rto(window->srtt_ms + margin);
+
+  if (window->min_rtt_ms == 0 || rtt_ms < window->min_rtt_ms) {
+    window->min_rtt_ms = rtt_ms > 0 ? rtt_ms : 1;
+  }
+
+  if (++window->round_acks < window->size) {
+    return;
+  }
+  window->round_acks = 0;
+  if (window->srtt_ms <= window->min_rtt_ms + window->min_rtt_ms / 2) {
+    if (window->size < PUBLISH_WINDOW_MAX) {
+      window->size++;
+    }
+  } else if (window->srtt_ms >= 2 * window->min_rtt_ms) {
+    // Slow even with one in flight, the link itself got slower.
+    if (window->size > 1) {
+      window->size--;
+    } else {
+      window->min_rtt_ms = window->srtt_ms;
+    }
+  }
+}
+
+bool publish_window_ack(publish_window *window, uint16_t packet_id,
+                        uint32_t now_ms) {
+  for (uint8_t i = 0; i < window->count; i++) {
+    publish_slot *slot = slot_at(window, i);
+    if (slot->acked || slot->packet_id != packet_id) {
+      continue;
+    }
+
+    slot->acked = true;
+    // An ack for a retransmitted message could be for either send.
+    if (slot->attempts == 1) {
+      sample_rtt(window, now_ms - slot->sent_ms);
+    }
+    return true;
+  }
+
+  return false;
+}
+
+bool publish_window_pop(publish_window *window, uint32_t *ref) {
+  if (window->count == 0 || !slot_at(window, 0)->acked) {
+    return false;
+  }
+
+  if (ref != NULL) {
+    *ref = slot_at(window, 0)->ref;
+  }
+  window->head = (window->head + 1) % PUBLISH_WINDOW_MAX;
+  window->count--;
+  return true;
+}
+
+publish_slot *publish_window_expired(publish_window *window, uint32_t now_ms) {
+  for (uint8_t i = 0; i < window->count; i++) {
+    publish_slot *slot = slot_at(window, i);
+    if (!slot->acked && now_ms - slot->sent_ms >= window->rto_ms) {
+      return slot;
+    }
+  }
+
+  return NULL;
+}
+
+void publish_window_resent(publish_window *window, publish_slot *slot,
+                           uint32_t now_ms) {
+  slot->sent_ms = now_ms;
+  slot->attempts++;
+  window->retransmits++;
+  window->rto_ms = clamp_rto(window->rto_ms * 2);
+  window->size = window->size > 1 ? window->size / 2 : 1;
+  window->round_acks = 0;
+}
@@ -0,0 +1,180 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "reading.h"
+
+typedef struct {
+  char *buf;
+  size_t len;
+  size_t pos;
+  bool failed;
+} json_writer;
+
+static void append(json_writer *w, const char *text) {
+  size_t n = strlen(text);
+
+  if (w->failed || w->pos + n >= w->len) {
+    w->failed = true;
+    return;
+  }
+
+  memcpy(w->buf + w->pos, text, n + 1);
+  w->pos += n;
+}
+
+static void append_field(json_writer *w, const char *key, int value,
+                         bool first) {
+  char number[12];
+
+  snprintf(number, sizeof(number), "%d", value);
+  append(w, first ? "\"" : ",\"");
+  append(w, key);
+  append(w, "\":");
+  append(w, number);
+}
+
+int reading_write_json(const reading *value, const char *extra, char *buf,
+                       size_t len) {
+  json_writer w = {buf, len, 0, len == 0};
+  bool first_group = true;
+
+  append(&w, "{");
+
+#define WRITE_FIELD(name, key)                                                 \
+  append_field(&w, key, group->name, first);                                   \
+  first = false;
+#define WRITE_GROUP(name, type, fields)                                        \
+  if (value->omitted & READING_MISSING(name)) {                                \
+  } else if (value->missing & READING_MISSING(name)) {                         \
+    append(&w, first_group ? "\"" #name "\":null" : ",\"" #name "\":null");    \
+    first_group = false;                                                       \
+  } else {                                                                     \
+    const type *group = &value->name;                                          \
+    bool first = true;                                                         \
+    append(&w, first_group ? "\"" #name "\":{" : ",\"" #name "\":{");          \
+    fields(WRITE_FIELD) append(&w, "}");                                       \
+    first_group = false;                                                       \
+  }
+  READING_GROUPS(WRITE_GROUP)
+#undef WRITE_GROUP
+#undef WRITE_FIELD
+
+#define WRITE_SCALAR(name, key)                                                \
+  append_field(&w, key, value->name, first_group);                             \
+  first_group = false;
+  READING_SCALARS(WRITE_SCALAR)
+#undef WRITE_SCALAR
+
+  append(&w, extra);
+  append(&w, "}");
+
+  return w.failed ? -1 : (int)w.pos;
+}
+
+static bool put_varint(uint8_t *buf, size_t len, size_t *pos, int value) {
+  uint32_t zigzag = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+
+  do {
+    if (*pos >= len) {
+      return false;
+    }
+    buf[(*pos)++] = (uint8_t)(zigzag & 0x7f) | (zigzag > 0x7f ? 0x80 : 0);
+    zigzag >>= 7;
+  } while (zigzag);
+
+  return true;
+}
+
+static bool get_varint(const uint8_t *buf, size_t len, size_t *pos,
+                       int *value) {
+  uint32_t zigzag = 0;
+
+  for (int shift = 0; shift < 35; shift += 7) {
+    if (*pos >= len) {
+      return false;
+    }
+    uint8_t byte = buf[(*pos)++];
+    zigzag |= (uint32_t)(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      *value = (int)(zigzag >> 1) ^ -(int)(zigzag & 1);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+int reading_encode(const reading *value, uint8_t *buf, size_t len) {
+  size_t pos = 2;
+
+  if (len < pos) {
+    return -1;
+  }
+  buf[0] = READING_BINARY_MAGIC;
+  buf[1] = READING_FORMAT_VERSION;
+
+  if (!put_varint(buf, len, &pos, (int)value->missing)) {
+    return -1;
+  }
+
+#define ENCODE_FIELD(name, key)                                                \
+  if (!put_varint(buf, len, &pos, group->name)) {                              \
+    return -1;                                                                 \
+  }
+#define ENCODE_GROUP(name, type, fields)                                       \
+  if (!(value->missing & READING_MISSING(name))) {                             \
+    const type *group = &value->name;                                          \
+    fields(ENCODE_FIELD)                                                       \
+  }
+  READING_GROUPS(ENCODE_GROUP)
+#undef ENCODE_GROUP
+#undef ENCODE_FIELD
+
+#define ENCODE_SCALAR(name, key)                                               \
+  if (!put_varint(buf, len, &pos, value->name)) {                              \
+    return -1;                                                                 \
+  }
+  READING_SCALARS(ENCODE_SCALAR)
+#undef ENCODE_SCALAR
+
+  return (int)pos;
+}
+
+int reading_decode(const uint8_t *buf, size_t len, reading *value) {
+  size_t pos = 2;
+  int missing;
+
+  if (len < pos || buf[0] != READING_BINARY_MAGIC ||
+      buf[1] != READING_FORMAT_VERSION) {
+    return -1;
+  }
+  memset(value, 0, sizeof(*value));
+
+  if (!get_varint(buf, len, &pos, &missing)) {
+    return -1;
+  }
+  value->missing = (uint32_t)missing;
+
+#define DECODE_FIELD(name, key)                                                \
+  if (!get_varint(buf, len, &pos, &group->name)) {                             \
+    return -1;                                                                 \
+  }
+#define DECODE_GROUP(name, type, fields)                                       \
+  if (!(value->missing & READING_MISSING(name))) {                             \
+    type *group = &value->name;                                                \
+    fields(DECODE_FIELD)                                                       \
+  }
+  READING_GROUPS(DECODE_GROUP)
+#undef DECODE_GROUP
+#undef DECODE_FIELD
+
+#define DECODE_SCALAR(name, key)                                               \
+  if (!get_varint(buf, len, &pos, &value->name)) {                             \
+    return -1;                                                                 \
+  }
+  READING_SCALARS(DECODE_SCALAR)
+#undef DECODE_SCALAR
+
+  return (int)pos;
+}
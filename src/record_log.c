@@ -0,0 +1,444 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "crc32.h"
+#include "record_log.h"
+
+#define SECTOR_MAGIC 0x474f4c52
+#define SECTOR_HEADER_SIZE sizeof(sector_header)
+#define RECORD_HEADER_SIZE sizeof(record_header)
+
+#define STATE_ERASED 0xffffffff
+#define STATE_COMMITTED 0xaaaaaaaa
+#define STATE_CONSUMED 0x00000000
+
+#define ALIGN4(x) (((x) + 3) & ~3u)
+
+typedef struct {
+  uint32_t magic;
+  uint32_t seq;
+  uint32_t reserved;
+  uint32_t crc;
+} sector_header;
+
+typedef struct {
+  uint32_t state;
+  uint32_t seq;
+  uint16_t len;
+  uint16_t len_check;
+  uint32_t crc;
+} record_header;
+
+typedef enum {
+  SLOT_END,
+  SLOT_BROKEN,
+  SLOT_RECORD,
+} slot_kind;
+
+static uint32_t record_size(uint16_t len) {
+  return ALIGN4(RECORD_HEADER_SIZE + len);
+}
+
+static uint32_t record_crc(const record_header *header, const void *data) {
+  uint32_t crc = crc32_update(0, &header->seq, sizeof(header->seq));
+  crc = crc32_update(crc, &header->len, sizeof(header->len));
+  return crc32_update(crc, data, header->len);
+}
+
+static uint32_t addr_of(const record_log *log, uint32_t sector,
+                        uint32_t offset) {
+  return sector * log->dev->sector_size + offset;
+}
+
+static bool read_sector_seq(const record_log *log, uint32_t sector,
+                            uint32_t *seq) {
+  sector_header header;
+  const flash_dev *dev = log->dev;
+
+  if (dev->read(dev->ctx, addr_of(log, sector, 0), &header, sizeof(header))) {
+    return false;
+  }
+
+  if (header.magic != SECTOR_MAGIC ||
+      header.crc != crc32_update(0, &header, offsetof(sector_header, crc))) {
+    return false;
+  }
+
+  *seq = header.seq;
+  return true;
+}
+
+static slot_kind read_slot(const record_log *log, uint32_t sector,
+                           uint32_t offset, record_header *header) {
+  const flash_dev *dev = log->dev;
+
+  if (offset + RECORD_HEADER_SIZE > dev->sector_size) {
+    return SLOT_END;
+  }
+
+  if (dev->read(dev->ctx, addr_of(log, sector, offset), header,
+                sizeof(*header))) {
+    return SLOT_BROKEN;
+  }
+
+  if (header->state == STATE_ERASED && header->seq == 0xffffffff &&
+      header->len == 0xffff && header->len_check == 0xffff) {
+    return SLOT_END;
+  }
+
+  if ((uint16_t)(header->len ^ header->len_check) != 0xffff ||
+      header->len > RECORD_LOG_MAX_RECORD ||
+      offset + record_size(header->len) > dev->sector_size) {
+    return SLOT_BROKEN;
+  }
+
+  return SLOT_RECORD;
+}
+
+static uint32_t first_offset(const record_log *log, uint32_t sector) {
+  uint32_t seq;
+  return read_sector_seq(log, sector, &seq) ? SECTOR_HEADER_SIZE
+                                            : log->dev->sector_size;
+}
+
+// Moves (sector, offset) forward to the next committed record, returns false
+// once the head is reached.
+static bool seek_committed(const record_log *log, uint32_t *sector,
+                           uint32_t *offset) {
+  record_header header;
+
+  for (;;) {
+    if (*sector == log->head_sector && *offset >= log->head_offset) {
+      return false;
+    }
+
+    if (read_slot(log, *sector, *offset, &header) == SLOT_RECORD) {
+      if (header.state == STATE_COMMITTED) {
+        return true;
+      }
+      *offset += record_size(header.len);
+      continue;
+    }
+
+    if (*sector == log->head_sector) {
+      return false;
+    }
+
+    *sector = (*sector + 1) % log->sectors;
+    *offset = first_offset(log, *sector);
+  }
+}
+
+static void reset_tail(record_log *log) {
+  if (log->pending == 0 ||
+      !seek_committed(log, &log->tail_sector, &log->tail_offset)) {
+    log->tail_sector = log->head_sector;
+    log->tail_offset = log->head_offset;
+  }
+}
+
+static uint32_t count_committed(const record_log *log, uint32_t sector,
+                                uint32_t offset) {
+  record_header header;
+  uint32_t count = 0;
+
+  while (read_slot(log, sector, offset, &header) == SLOT_RECORD) {
+    if (header.state == STATE_COMMITTED) {
+      count++;
+    }
+    offset += record_size(header.len);
+  }
+
+  return count;
+}
+
+static record_log_status open_next_sector(record_log *log) {
+  const flash_dev *dev = log->dev;
+  uint32_t next = (log->head_sector + 1) % log->sectors;
+
+  if (log->pending > 0 && log->tail_sector == next) {
+    uint32_t lost = count_committed(log, next, log->tail_offset);
+    log->pending -= lost;
+    log->dropped += lost;
+    log->tail_sector = (next + 1) % log->sectors;
+    log->tail_offset = first_offset(log, log->tail_sector);
+  }
+
+  if (dev->erase(dev->ctx, addr_of(log, next, 0), dev->sector_size)) {
+    return RECORD_LOG_IO_ERROR;
+  }
+
+  sector_header header = {
+      .magic = SECTOR_MAGIC,
+      .seq = log->next_sector_seq,
+      .reserved = 0xffffffff,
+  };
+  header.crc = crc32_update(0, &header, offsetof(sector_header, crc));
+
+  if (dev->write(dev->ctx, addr_of(log, next, 0), &header, sizeof(header))) {
+    return RECORD_LOG_IO_ERROR;
+  }
+
+  log->next_sector_seq++;
+  log->head_sector = next;
+  log->head_offset = SECTOR_HEADER_SIZE;
+  reset_tail(log);
+
+  return RECORD_LOG_OK;
+}
+
+record_log_status record_log_mount(record_log *log, const flash_dev *dev) {
+  memset(log, 0, sizeof(*log));
+  log->dev = dev;
+
+  if (dev->sector_size <= SECTOR_HEADER_SIZE + RECORD_HEADER_SIZE) {
+    return RECORD_LOG_INVALID;
+  }
+
+  log->sectors = dev->size / dev->sector_size;
+  if (log->sectors < 2) {
+    return RECORD_LOG_INVALID;
+  }
+
+  bool found = false;
+  uint32_t oldest = 0, oldest_seq = 0, newest = 0, newest_seq = 0;
+
+  for (uint32_t sector = 0; sector < log->sectors; sector++) {
+    uint32_t seq;
+    if (!read_sector_seq(log, sector, &seq)) {
+      continue;
+    }
+    if (!found || seq < oldest_seq) {
+      oldest = sector;
+      oldest_seq = seq;
+    }
+    if (!found || seq > newest_seq) {
+      newest = sector;
+      newest_seq = seq;
+    }
+    found = true;
+  }
+
+  if (!found) {
+    // Fresh partition, the first append opens sector 0.
+    log->head_sector = log->sectors - 1;
+    log->head_offset = dev->sector_size;
+    log->tail_sector = log->head_sector;
+    log->tail_offset = log->head_offset;
+    return RECORD_LOG_OK;
+  }
+
+  record_header header;
+  uint32_t offset = SECTOR_HEADER_SIZE;
+  slot_kind kind;
+
+  while ((kind = read_slot(log, newest, offset, &header)) == SLOT_RECORD) {
+    log->next_seq = header.seq + 1;
+    offset += record_size(header.len);
+  }
+
+  // A torn write leaves a header that can't be trusted to skip over, so the
+  // rest of that sector is given up.
+  log->head_sector = newest;
+  log->head_offset = kind == SLOT_BROKEN ? dev->sector_size : offset;
+  log->next_sector_seq = newest_seq + 1;
+
+  uint32_t sector = oldest;
+  offset = SECTOR_HEADER_SIZE;
+  while (seek_committed(log, &sector, &offset)) {
+    if (log->pending == 0) {
+      log->tail_sector = sector;
+      log->tail_offset = offset;
+    }
+    log->pending++;
+
+    read_slot(log, sector, offset, &header);
+    offset += record_size(header.len);
+  }
+
+  if (log->pending == 0) {
+    log->tail_sector = log->head_sector;
+    log->tail_offset = log->head_offset;
+  }
+
+  return RECORD_LOG_OK;
+}
+
+record_log_status record_log_append(record_log *log, const void *data,
+                                    uint16_t len) {
+  const flash_dev *dev = log->dev;
+  uint32_t size = record_size(len);
+
+  if (len == 0 || len > RECORD_LOG_MAX_RECORD ||
+      size > dev->sector_size - SECTOR_HEADER_SIZE) {
+    return RECORD_LOG_INVALID;
+  }
+
+  if (log->head_offset + size > dev->sector_size) {
+    record_log_status ret = open_next_sector(log);
+    if (ret != RECORD_LOG_OK) {
+      return ret;
+    }
+  }
+
+  uint8_t buf[RECORD_HEADER_SIZE + RECORD_LOG_MAX_RECORD + 3];
+  record_header header = {
+      .state = STATE_COMMITTED,
+      .seq = log->next_seq,
+      .len = len,
+      .len_check = (uint16_t)~len,
+  };
+  header.crc = record_crc(&header, data);
+
+  memset(buf, 0xff, size);
+  memcpy(buf, &header, sizeof(header));
+  memcpy(buf + sizeof(header), data, len);
+
+  uint32_t offset = log->head_offset;
+  if (dev->write(dev->ctx, addr_of(log, log->head_sector, offset), buf,
+                 size)) {
+    log->head_offset = dev->sector_size;
+    return RECORD_LOG_IO_ERROR;
+  }
+
+  log->head_offset += size;
+  log->next_seq++;
+
+  if (log->pending++ == 0) {
+    log->tail_sector = log->head_sector;
+    log->tail_offset = offset;
+  }
+
+  return RECORD_LOG_OK;
+}
+
+record_log_status record_log_peek(record_log *log, void *buf, uint16_t *len) {
+  const flash_dev *dev = log->dev;
+  record_header header;
+
+  if (log->pending == 0) {
+    return RECORD_LOG_EMPTY;
+  }
+
+  if (read_slot(log, log->tail_sector, log->tail_offset, &header) !=
+      SLOT_RECORD) {
+    return RECORD_LOG_CORRUPT;
+  }
+
+  if (dev->read(dev->ctx,
+                addr_of(log, log->tail_sector,
+                        log->tail_offset + RECORD_HEADER_SIZE),
+                buf, header.len)) {
+    return RECORD_LOG_IO_ERROR;
+  }
+
+  if (header.crc != record_crc(&header, buf)) {
+    return RECORD_LOG_CORRUPT;
+  }
+
+  *len = header.len;
+  return RECORD_LOG_OK;
+}
+
+uint32_t record_log_tail(const record_log *log) {
+  return addr_of(log, log->tail_sector, log->tail_offset);
+}
+
+// Positions are addresses. The head may be at the very end of its sector,
+// which no record can be, so it is compared before splitting pos up.
+record_log_status record_log_read(const record_log *log, uint32_t pos,
+                                  void *buf, uint16_t *len, uint32_t *next) {
+  const flash_dev *dev = log->dev;
+  uint32_t sector = pos / dev->sector_size;
+  uint32_t offset = pos % dev->sector_size;
+  record_header header;
+
+  if (log->pending == 0 ||
+      pos == addr_of(log, log->head_sector, log->head_offset)) {
+    return RECORD_LOG_EMPTY;
+  }
+
+  if (sector >= log->sectors ||
+      read_slot(log, sector, offset, &header) != SLOT_RECORD) {
+    // Like consuming it, the rest of the sector is given up.
+    offset = dev->sector_size;
+    if (!seek_committed(log, &sector, &offset)) {
+      sector = log->head_sector;
+      offset = log->head_offset;
+    }
+    *next = addr_of(log, sector, offset);
+    return RECORD_LOG_CORRUPT;
+  }
+
+  offset += record_size(header.len);
+  if (!seek_committed(log, &sector, &offset)) {
+    sector = log->head_sector;
+    offset = log->head_offset;
+  }
+  *next = addr_of(log, sector, offset);
+
+  if (dev->read(dev->ctx, pos + RECORD_HEADER_SIZE, buf, header.len)) {
+    return RECORD_LOG_IO_ERROR;
+  }
+
+  if (header.crc != record_crc(&header, buf)) {
+    return RECORD_LOG_CORRUPT;
+  }
+
+  *len = header.len;
+  return RECORD_LOG_OK;
+}
+
+record_log_status record_log_consume(record_log *log) {
+  const flash_dev *dev = log->dev;
+  record_header header;
+  uint32_t state = STATE_CONSUMED;
+
+  if (log->pending == 0) {
+    return RECORD_LOG_EMPTY;
+  }
+
+  uint32_t addr = addr_of(log, log->tail_sector, log->tail_offset);
+  if (read_slot(log, log->tail_sector, log->tail_offset, &header) ==
+      SLOT_RECORD) {
+    if (dev->write(dev->ctx, addr, &state, sizeof(state))) {
+      return RECORD_LOG_IO_ERROR;
+    }
+    log->tail_offset += record_size(header.len);
+  } else {
+    log->tail_offset = dev->sector_size;
+  }
+
+  log->pending--;
+  reset_tail(log);
+
+  return RECORD_LOG_OK;
+}
+
+uint32_t record_log_drain(record_log *log, uint32_t max_records,
+                          record_log_sink sink, void *arg) {
+  uint8_t buf[RECORD_LOG_MAX_RECORD];
+  uint32_t drained = 0;
+  uint16_t len;
+
+  while (drained < max_records) {
+    record_log_status ret = record_log_peek(log, buf, &len);
+
+    if (ret == RECORD_LOG_CORRUPT) {
+      if (record_log_consume(log) != RECORD_LOG_OK) {
+        break;
+      }
+      continue;
+    }
+
+    if (ret != RECORD_LOG_OK || sink(buf, len, arg) != 0 ||
+        record_log_consume(log) != RECORD_LOG_OK) {
+      break;
+    }
+
+    drained++;
+  }
+
+  return drained;
+}
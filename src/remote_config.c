@@ -0,0 +1,367 @@
+#include <string.h>
+
+#include "core_json.h"
+#include "device_config.h"
+
+#define QUERY(key) key, sizeof(key) - 1
+// Sensor schedules are set as <sensor>_period, _phase and _samples.
+#define SCHEDULE_FIELD(name, sensor, member, min, max)                         \
+  {QUERY(name "_" #member),                                                    \
+   offsetof(device_config, schedule[sensor].member), min, max}
+
+typedef struct {
+  const char *key;
+  size_t key_len;
+  size_t offset;
+  uint32_t min;
+  uint32_t max;
+} config_field;
+
+static const config_field config_fields[] = {
+    {QUERY("sleep_seconds"), offsetof(device_config, sleep_seconds), 5, 3600},
+    {QUERY("read_samples"), offsetof(device_config, read_samples), 1, 50},
+    {QUERY("co2_threshold_ppm"), offsetof(device_config, co2_threshold_ppm),
+     400, 10000},
+    {QUERY("backlog_drain"), offsetof(device_config, backlog_drain), 1, 200},
+    {QUERY("aggregate_cycles"), offsetof(device_config, aggregate_cycles), 0,
+     240},
+    {QUERY("compress"), offsetof(device_config, compress), 0, 1},
+    {QUERY("wake_stagger"), offsetof(device_config, wake_stagger), 0, 1},
+    {QUERY("wake_jitter_ms"), offsetof(device_config, wake_jitter_ms), 0,
+     60000},
+    {QUERY("power_save"), offsetof(device_config, power_save), 0, 1},
+    {QUERY("run_mode"), offsetof(device_config, run_mode), RUN_MODE_CYCLE,
+     RUN_MODE_CONNECTED},
+    {QUERY("stub_cycles"), offsetof(device_config, stub_cycles), 0, 240},
+    {QUERY("stub_gas_threshold"), offsetof(device_config, stub_gas_threshold),
+     0, 4095},
+    {QUERY("payload_format"), offsetof(device_config, payload_format),
+     PAYLOAD_FORMAT_JSON, PAYLOAD_FORMAT_BINARY},
+    {QUERY("gas_r0"), offsetof(device_config, gas_r0), 10, 100000},
+    {QUERY("ldr_r10"), offsetof(device_config, ldr_r10), 10, 100000},
+    {QUERY("alert_co2_rise"), offsetof(device_config, alert_co2_rise), 0,
+     10000},
+    {QUERY("alert_gas_ppm"), offsetof(device_config, alert_gas_ppm), 0,
+     100000},
+    {QUERY("alert_hold_s"), offsetof(device_config, alert_hold_s), 0, 3600},
+    {QUERY("alert_holdoff_s"), offsetof(device_config, alert_holdoff_s), 0,
+     86400},
+    {QUERY("awake_budget_ms"), offsetof(device_config, awake_budget_ms), 5000,
+     300000},
+    {QUERY("sensor_probe_cycles"), offsetof(device_config, sensor_probe_cycles),
+     1, 1000},
+    {QUERY("espnow_batch_ms"), offsetof(device_config, espnow_batch_ms), 100,
+     600000},
+    {QUERY("metrics_port"), offsetof(device_config, metrics_port), 0, 65535},
+    SCHEDULE_FIELD("co2", SENSOR_CO2, period, 0, 1000),
+    SCHEDULE_FIELD("co2", SENSOR_CO2, phase, 0, 999),
+    SCHEDULE_FIELD("dht", SENSOR_DHT, period, 0, 1000),
+    SCHEDULE_FIELD("dht", SENSOR_DHT, phase, 0, 999),
+    SCHEDULE_FIELD("dht", SENSOR_DHT, samples, 0, 2),
+    SCHEDULE_FIELD("gas", SENSOR_GAS, period, 0, 1000),
+    SCHEDULE_FIELD("gas", SENSOR_GAS, phase, 0, 999),
+    SCHEDULE_FIELD("gas", SENSOR_GAS, samples, 0, 50),
+    SCHEDULE_FIELD("ldr", SENSOR_LDR, period, 0, 1000),
+    SCHEDULE_FIELD("ldr", SENSOR_LDR, phase, 0, 999),
+    SCHEDULE_FIELD("ldr", SENSOR_LDR, samples, 0, 50),
+    SCHEDULE_FIELD("power", SENSOR_POWER, period, 0, 1000),
+    SCHEDULE_FIELD("power", SENSOR_POWER, phase, 0, 999),
+    {QUERY("battery_saving_mv"), offsetof(device_config, battery_saving_mv), 0,
+     30000},
+    {QUERY("battery_low_mv"), offsetof(device_config, battery_low_mv), 0,
+     30000},
+    {QUERY("battery_brownout_mv"), offsetof(device_config, battery_brownout_mv),
+     0, 30000},
+    {QUERY("battery_hysteresis_mv"),
+     offsetof(device_config, battery_hysteresis_mv), 0, 5000},
+    {QUERY("gas_preheat_s"), offsetof(device_config, gas_preheat_s), 0, 3600},
+    {QUERY("gas_cool_s"), offsetof(device_config, gas_cool_s), 1, 86400},
+    {QUERY("ota_build"), offsetof(device_config, ota_build), 1, UINT32_MAX},
+    {QUERY("ota_size"), offsetof(device_config, ota_size), 1, 0x100000},
+};
+
+// Kept in NVS next to the settings above, but not set by name.
+static const struct {
+  const char *key;
+  size_t key_len;
+  size_t offset;
+  size_t size;
+} stored_fields[] = {
+    {QUERY("version"), offsetof(device_config, version), 4},
+    {QUERY("command_id"), offsetof(device_config, command_id), 4},
+    {QUERY("pending_commands"), offsetof(device_config, pending_commands), 4},
+    {QUERY("ota_sha256"), offsetof(device_config, ota_sha256), 32},
+};
+
+static const uint8_t stored_magic[] = {'C', 'F', 'G', 1};
+
+static const struct {
+  const char *name;
+  size_t name_len;
+  uint32_t command;
+} config_commands[] = {
+    {QUERY("calibrate_co2_zero"), DEVICE_COMMAND_CALIBRATE_CO2_ZERO},
+    {QUERY("flush_backlog"), DEVICE_COMMAND_FLUSH_BACKLOG},
+};
+
+// coreJSON hands back slices of the original buffer, so numbers are parsed
+// without a terminator.
+static bool parse_uint(const char *value, size_t len, uint32_t *out) {
+  uint64_t result = 0;
+
+  if (len == 0 || len > 10) {
+    return false;
+  }
+
+  for (size_t i = 0; i < len; i++) {
+    if (value[i] < '0' || value[i] > '9') {
+      return false;
+    }
+    result = result * 10 + (value[i] - '0');
+  }
+
+  if (result > UINT32_MAX) {
+    return false;
+  }
+
+  *out = (uint32_t)result;
+  return true;
+}
+
+static size_t parse_hex(const char *value, size_t len, uint8_t *out,
+                        size_t max) {
+  if (len == 0 || len % 2 != 0 || len / 2 > max) {
+    return 0;
+  }
+
+  for (size_t i = 0; i < len; i++) {
+    char c = value[i];
+    uint8_t nibble;
+
+    if (c >= '0' && c <= '9') {
+      nibble = c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      nibble = c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+      nibble = c - 'A' + 10;
+    } else {
+      return 0;
+    }
+
+    out[i / 2] = (i % 2) ? (out[i / 2] | nibble) : (uint8_t)(nibble << 4);
+  }
+
+  return len / 2;
+}
+
+static bool parse_command(const char *value, size_t len, uint32_t *command) {
+  for (size_t i = 0; i < sizeof(config_commands) / sizeof(config_commands[0]);
+       i++) {
+    if (len == config_commands[i].name_len &&
+        memcmp(value, config_commands[i].name, len) == 0) {
+      *command = config_commands[i].command;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+device_config_status device_config_parse(const char *json, size_t len,
+                                         const device_config *current,
+                                         device_config *updated,
+                                         uint32_t *commands) {
+  char *buf = (char *)json;
+  char *value;
+  size_t value_len;
+  uint32_t number;
+
+  *commands = 0;
+
+  if (JSON_Validate(buf, len) != JSONSuccess) {
+    return DEVICE_CONFIG_INVALID;
+  }
+
+  if (JSON_Search(buf, len, QUERY("version"), &value, &value_len) !=
+          JSONSuccess ||
+      !parse_uint(value, value_len, &number)) {
+    return DEVICE_CONFIG_INVALID;
+  }
+
+  if (number <= current->version) {
+    return DEVICE_CONFIG_UNCHANGED;
+  }
+
+  *updated = *current;
+  updated->version = number;
+
+  for (size_t i = 0; i < sizeof(config_fields) / sizeof(config_fields[0]);
+       i++) {
+    const config_field *field = &config_fields[i];
+
+    if (JSON_Search(buf, len, field->key, field->key_len, &value,
+                    &value_len) != JSONSuccess) {
+      continue;
+    }
+
+    if (!parse_uint(value, value_len, &number) || number < field->min ||
+        number > field->max) {
+      return DEVICE_CONFIG_INVALID;
+    }
+
+    *(uint32_t *)((uint8_t *)updated + field->offset) = number;
+  }
+
+  if (JSON_Search(buf, len, QUERY("ota_sha256"), &value, &value_len) ==
+          JSONSuccess &&
+      parse_hex(value, value_len, updated->ota_sha256,
+                sizeof(updated->ota_sha256)) != sizeof(updated->ota_sha256)) {
+    return DEVICE_CONFIG_INVALID;
+  }
+
+  if (JSON_Search(buf, len, QUERY("ota_signature"), &value, &value_len) ==
+      JSONSuccess) {
+    updated->ota_signature_len =
+        parse_hex(value, value_len, updated->ota_signature,
+                  sizeof(updated->ota_signature));
+    if (updated->ota_signature_len == 0) {
+      return DEVICE_CONFIG_INVALID;
+    }
+  }
+
+  // The message is retained, a command only runs for a new command_id so
+  // that a new version or a reset config does not run it again.
+  if (JSON_Search(buf, len, QUERY("command"), &value, &value_len) ==
+      JSONSuccess) {
+    char *id;
+    size_t id_len;
+    uint32_t command;
+
+    if (!parse_command(value, value_len, &command) ||
+        JSON_Search(buf, len, QUERY("command_id"), &id, &id_len) !=
+            JSONSuccess ||
+        !parse_uint(id, id_len, &number)) {
+      return DEVICE_CONFIG_INVALID;
+    }
+    if (number > current->command_id) {
+      updated->command_id = number;
+      *commands = command;
+    }
+  }
+
+  return DEVICE_CONFIG_UPDATED;
+}
+
+static size_t put_entry(uint8_t *buf, size_t pos, size_t len, const char *key,
+                        size_t key_len, const void *value, size_t size) {
+  if (pos == 0 || pos + 2 + key_len + size > len) {
+    return 0;
+  }
+
+  buf[pos++] = (uint8_t)key_len;
+  memcpy(buf + pos, key, key_len);
+  pos += key_len;
+  buf[pos++] = (uint8_t)size;
+  memcpy(buf + pos, value, size);
+  return pos + size;
+}
+
+size_t device_config_encode(const device_config *config, uint8_t *buf,
+                            size_t len) {
+  const uint8_t *base = (const uint8_t *)config;
+  size_t pos = sizeof(stored_magic);
+
+  if (len < pos) {
+    return 0;
+  }
+  memcpy(buf, stored_magic, pos);
+
+  for (size_t i = 0; i < sizeof(config_fields) / sizeof(config_fields[0]);
+       i++) {
+    const config_field *field = &config_fields[i];
+    pos = put_entry(buf, pos, len, field->key, field->key_len,
+                    base + field->offset, sizeof(uint32_t));
+  }
+
+  for (size_t i = 0; i < sizeof(stored_fields) / sizeof(stored_fields[0]);
+       i++) {
+    pos = put_entry(buf, pos, len, stored_fields[i].key,
+                    stored_fields[i].key_len, base + stored_fields[i].offset,
+                    stored_fields[i].size);
+  }
+
+  return put_entry(buf, pos, len, QUERY("ota_signature"),
+                   config->ota_signature, config->ota_signature_len);
+}
+
+static bool key_is(const uint8_t *key, size_t key_len, const char *name,
+                   size_t name_len) {
+  return key_len == name_len && memcmp(key, name, key_len) == 0;
+}
+
+static void decode_entry(const uint8_t *key, size_t key_len,
+                         const uint8_t *value, size_t size,
+                         device_config *config) {
+  uint8_t *base = (uint8_t *)config;
+
+  for (size_t i = 0; i < sizeof(config_fields) / sizeof(config_fields[0]);
+       i++) {
+    const config_field *field = &config_fields[i];
+    uint32_t number;
+
+    if (!key_is(key, key_len, field->key, field->key_len)) {
+      continue;
+    }
+    // A value out of the range of this build keeps the default.
+    if (size != sizeof(number)) {
+      return;
+    }
+    memcpy(&number, value, sizeof(number));
+    if (number >= field->min && number <= field->max) {
+      memcpy(base + field->offset, &number, sizeof(number));
+    }
+    return;
+  }
+
+  for (size_t i = 0; i < sizeof(stored_fields) / sizeof(stored_fields[0]);
+       i++) {
+    if (key_is(key, key_len, stored_fields[i].key, stored_fields[i].key_len)) {
+      if (size == stored_fields[i].size) {
+        memcpy(base + stored_fields[i].offset, value, size);
+      }
+      return;
+    }
+  }
+
+  if (key_is(key, key_len, QUERY("ota_signature")) &&
+      size <= sizeof(config->ota_signature)) {
+    memcpy(config->ota_signature, value, size);
+    config->ota_signature_len = size;
+  }
+}
+
+bool device_config_decode(const uint8_t *buf, size_t len,
+                          device_config *config) {
+  size_t pos = sizeof(stored_magic);
+
+  if (len < pos || memcmp(buf, stored_magic, pos) != 0) {
+    return false;
+  }
+
+  while (pos < len) {
+    size_t key_len = buf[pos];
+    if (pos + 1 + key_len + 1 > len) {
+      return false;
+    }
+    const uint8_t *key = buf + pos + 1;
+    size_t size = buf[pos + 1 + key_len];
+    const uint8_t *value = key + key_len + 1;
+    pos += 2 + key_len + size;
+    if (pos > len) {
+      return false;
+    }
+    decode_entry(key, key_len, value, size, config);
+  }
+
+  return true;
+}
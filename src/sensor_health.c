@@ -0,0 +1,35 @@
+#include "sensor_health.h"
+
+bool sensor_health_should_read(sensor_health *health) {
+  if (health->skip_remaining > 0) {
+    health->skip_remaining--;
+    return false;
+  }
+
+  return true;
+}
+
+void sensor_health_report(sensor_health *health, bool success,
+                          uint32_t elapsed_ms, uint32_t probe_cycles) {
+  health->attempts++;
+
+  if (success) {
+    health->successes++;
+    health->failures = 0;
+    return;
+  }
+
+  health->lost_ms += elapsed_ms;
+  if (++health->failures >= SENSOR_HEALTH_TRIP_FAILURES) {
+    health->skip_remaining = probe_cycles > 0 ? probe_cycles - 1 : 0;
+  }
+}
+
+bool sensor_health_open(const sensor_health *health) {
+  return health->failures >= SENSOR_HEALTH_TRIP_FAILURES;
+}
+
+uint32_t sensor_health_success_percent(const sensor_health *health) {
+  return health->attempts > 0 ? health->successes * 100 / health->attempts
+                              : 100;
+}
@@ -0,0 +1,14 @@
+#include "sensor_schedule.h"
+
+bool sensor_schedule_due(const sensor_schedule *schedule, uint32_t cycle) {
+  if (schedule->period == 0) {
+    return false;
+  }
+
+  return cycle % schedule->period == schedule->phase % schedule->period;
+}
+
+uint32_t sensor_schedule_samples(const sensor_schedule *schedule,
+                                 uint32_t read_samples) {
+  return schedule->samples > 0 ? schedule->samples : read_samples;
+}
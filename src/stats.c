@@ -0,0 +1,167 @@
+#include <math.h>
+#include <string.h>
+
+#include "stats.h"
+
+static void sort(float *values, uint32_t count) {
+  for (uint32_t i = 1; i < count; i++) {
+    float value = values[i];
+    uint32_t j = i;
+    for (; j > 0 && values[j - 1] > value; j--) {
+      values[j] = values[j - 1];
+    }
+    values[j] = value;
+  }
+}
+
+void sketch_init(quantile_sketch *sketch) {
+  memset(sketch, 0, sizeof(*sketch));
+  sketch->levels = 1;
+}
+
+static uint32_t level_end(const quantile_sketch *sketch, int h) {
+  return h > 0 ? sketch->begin[h - 1] : sketch->size;
+}
+
+static uint32_t capacity(const quantile_sketch *sketch, int h) {
+  uint32_t capacity = STATS_SKETCH_SIZE / 3;
+
+  for (int i = h + 1; i < sketch->levels; i++) {
+    capacity = capacity * 2 / 3;
+  }
+  return capacity > 2 ? capacity : 2;
+}
+
+// Returns false when only the top level can be compacted and it is the
+// last. The capacities leave a level at capacity whenever the sketch is
+// full.
+static bool compact(quantile_sketch *sketch) {
+  for (int h = 0; h < sketch->levels; h++) {
+    uint32_t begin = sketch->begin[h];
+    uint32_t count = level_end(sketch, h) - begin;
+
+    if (count < capacity(sketch, h)) {
+      continue;
+    }
+    if (h == sketch->levels - 1) {
+      if (sketch->levels == STATS_SKETCH_LEVELS) {
+        return false;
+      }
+      sketch->begin[sketch->levels++] = begin;
+    }
+
+    float *level = &sketch->items[begin];
+    uint32_t pairs = count / 2;
+    uint32_t odd = (sketch->odd >> h) & 1;
+
+    sort(level, count);
+    sketch->odd ^= 1u << h;
+    for (uint32_t i = 0; i < pairs; i++) {
+      level[i] = level[2 * i + odd];
+    }
+    // The kept ones now end the level above. The largest sample of an odd
+    // count and the levels below close up behind them.
+    memmove(&level[pairs], &level[2 * pairs],
+            (sketch->size - begin - 2 * pairs) * sizeof(float));
+    sketch->begin[h] += pairs;
+    for (int i = 0; i < h; i++) {
+      sketch->begin[i] -= pairs;
+    }
+    sketch->size -= pairs;
+    return true;
+  }
+
+  return false;
+}
+
+void sketch_add(quantile_sketch *sketch, float x) {
+  if (sketch->size == STATS_SKETCH_SIZE && !compact(sketch)) {
+    return;
+  }
+  sketch->items[sketch->size++] = x;
+}
+
+float sketch_value(const quantile_sketch *sketch, float p) {
+  float values[STATS_SKETCH_SIZE];
+  uint32_t weights[STATS_SKETCH_SIZE];
+  uint32_t count = 0, total = 0;
+
+  if (sketch->size == 0) {
+    return 0;
+  }
+
+  // Every sample by value, with the weight of its level.
+  for (int h = 0; h < sketch->levels; h++) {
+    for (uint32_t i = sketch->begin[h]; i < level_end(sketch, h); i++) {
+      float value = sketch->items[i];
+      uint32_t j = count++;
+      for (; j > 0 && values[j - 1] > value; j--) {
+        values[j] = values[j - 1];
+        weights[j] = weights[j - 1];
+      }
+      values[j] = value;
+      weights[j] = 1u << h;
+      total += 1u << h;
+    }
+  }
+
+  float rank = p * total;
+  uint32_t below = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    below += weights[i];
+    if (below > rank) {
+      return values[i];
+    }
+  }
+  return values[count - 1];
+}
+
+void stats_init(metric_stats *stats) {
+  memset(stats, 0, sizeof(*stats));
+  stats_reset_window(stats);
+}
+
+void stats_reset_window(metric_stats *stats) {
+  stats->count = 0;
+  stats->mean = 0;
+  stats->m2 = 0;
+  stats->min = INFINITY;
+  stats->max = -INFINITY;
+  sketch_init(&stats->sketch);
+}
+
+void stats_add(metric_stats *stats, float x) {
+  stats->count++;
+
+  float delta = x - stats->mean;
+  stats->mean += delta / stats->count;
+  stats->m2 += delta * (x - stats->mean);
+
+  if (x < stats->min) {
+    stats->min = x;
+  }
+  if (x > stats->max) {
+    stats->max = x;
+  }
+
+  if (stats->ewma_ready) {
+    stats->ewma += STATS_EWMA_ALPHA * (x - stats->ewma);
+  } else {
+    stats->ewma = x;
+    stats->ewma_ready = true;
+  }
+
+  sketch_add(&stats->sketch, x);
+}
+
+float stats_variance(const metric_stats *stats) {
+  return stats->count > 1 ? stats->m2 / (stats->count - 1) : 0;
+}
+
+float stats_p50(const metric_stats *stats) {
+  return sketch_value(&stats->sketch, 0.5f);
+}
+
+float stats_p90(const metric_stats *stats) {
+  return sketch_value(&stats->sketch, 0.9f);
+}
@@ -1,4 +1,5 @@
 #include "driver/uart.h"
+#include "power_mode.h"
 #include "tasks.h"
 #include <string.h>
 
@@ -7,11 +8,14 @@
 // #define QUEUE_SIZE 10
 
 #define START_CMD_LEN 9
+#define CO2_MAX_ATTEMPTS 5
 
 #define MHZ19_START_BYTE 0xff
 #define MHZ19_SENSOR_NUM 0x01
 #define MHZ19_READ_CMD 0x86
 #define MHZ19_CHECKSUM_READ 0x79
+#define MHZ19_ZERO_CMD 0x87
+#define MHZ19_CHECKSUM_ZERO 0x78
 
 #define MHZ19_START_CMD_LEN 9
 #define MHZ19_START_CMD                                                        \
@@ -20,10 +24,17 @@
         0x00, 0x00, MHZ19_CHECKSUM_READ                                        \
   }
 
+#define MHZ19_ZERO_CALIBRATION_CMD                                             \
+  {                                                                            \
+    MHZ19_START_BYTE, MHZ19_SENSOR_NUM, MHZ19_ZERO_CMD, 0x00, 0x00, 0x00,      \
+        0x00, 0x00, MHZ19_CHECKSUM_ZERO                                        \
+  }
+
 static const char *TAG = "CO2";
 
 void co2_task(void *param) {
   task_results *results = (task_results *)param;
+  int64_t started_us = esp_timer_get_time();
 
   uart_config_t uart_config = {
       .baud_rate = 9600,
@@ -44,11 +55,24 @@ void co2_task(void *param) {
 
   const uint8_t start[START_CMD_LEN] = MHZ19_START_CMD;
 
-  for (;;) {
+  if (results->config->pending_commands & DEVICE_COMMAND_CALIBRATE_CO2_ZERO) {
+    const uint8_t zero[MHZ19_START_CMD_LEN] = MHZ19_ZERO_CALIBRATION_CMD;
+
+    ESP_LOGW(TAG, "Calibrating sensor zero point (400ppm)");
+    uart_write_bytes(PORT_NUM, (const char *)zero, MHZ19_START_CMD_LEN);
+    results->executed_commands |= DEVICE_COMMAND_CALIBRATE_CO2_ZERO;
+  }
+
+  int attempt;
+  for (attempt = 0; attempt < CO2_MAX_ATTEMPTS; attempt++) {
+    // The UART runs from the APB clock, it has to stay put until the
+    // response is in.
+    power_phase_begin(POWER_PHASE_SENSE);
     uart_write_bytes(PORT_NUM, (const char *)start, START_CMD_LEN);
 
     const int rx_bytes =
         uart_read_bytes(PORT_NUM, dtmp, BUF_SIZE, 200 / portTICK_RATE_MS);
+    power_phase_end(POWER_PHASE_SENSE);
 
     if (rx_bytes > 0 && dtmp[0] == MHZ19_START_BYTE) {
       dtmp[rx_bytes] = 0;
@@ -56,8 +80,10 @@ void co2_task(void *param) {
       int co2 = dtmp[2] * 256 + dtmp[3];
       int temperature = dtmp[4] - 40;
 
-      results->co2.ppm = co2;
-      results->co2.temperature = temperature;
+      results->reading.co2.ppm = co2;
+      results->reading.co2.temperature = temperature;
+      stats_add(&results->window->metrics[METRIC_CO2_PPM], co2);
+      stats_add(&results->window->metrics[METRIC_CO2_TEMPERATURE], temperature);
 
       break;
     } else {
@@ -65,9 +91,15 @@ void co2_task(void *param) {
     }
   }
 
+  if (attempt == CO2_MAX_ATTEMPTS) {
+    ESP_LOGE(TAG, "No response after %d attempts", CO2_MAX_ATTEMPTS);
+  }
+
   free(dtmp);
   dtmp = NULL;
+  // Installed again by the next run in the always-connected mode.
+  uart_driver_delete(PORT_NUM);
 
-  xEventGroupSetBits(results->tasks_event, CO2_TASK_BIT);
-  vTaskDelete(NULL);
+  finish_sensor_task(results, SENSOR_CO2, attempt < CO2_MAX_ATTEMPTS,
+                     started_us);
 }
@@ -1,32 +1,64 @@
+#include "power_mode.h"
 #include "tasks.h"
 
 #include "DHT.h"
 
+// Failed reads are retried, but a disconnected sensor must not stall the
+// cycle.
+#define DHT_ATTEMPTS_PER_SAMPLE 3
+// The sensor has no new value before this.
+#define DHT_INTERVAL_MS 2000
+// What fits in the sensor phase, whatever read_samples is.
+#define DHT_MAX_SAMPLES (CYCLE_SENSORS_MS / DHT_INTERVAL_MS)
+
+static const char *TAG = "DHT";
+
 void dht_task(void *param) {
   task_results *results = (task_results *)param;
+  int64_t started_us = esp_timer_get_time();
 
   setDHTgpio(DHT_PIN);
 
+  int samples = sensor_schedule_samples(&results->config->schedule[SENSOR_DHT],
+                                        results->config->read_samples);
+  if (samples > DHT_MAX_SAMPLES) {
+    samples = DHT_MAX_SAMPLES;
+  }
   int count = 0;
-  int temp = 0;
-  int humi = 0;
-  for (;;) {
+  int temperature = 0;
+  int humidity = 0;
+  for (int attempt = 0; attempt < samples * DHT_ATTEMPTS_PER_SAMPLE;
+       attempt++) {
+    power_phase_begin(POWER_PHASE_SENSE);
     int status = readDHT();
+    power_phase_end(POWER_PHASE_SENSE);
     if (status == DHT_OK) {
-      temp += getHumidity();
-      humi += getTemperature();
+      stats_add(&results->window->metrics[METRIC_DHT_TEMPERATURE],
+                getTemperature());
+      stats_add(&results->window->metrics[METRIC_DHT_HUMIDITY], getHumidity());
+      temperature += getTemperature();
+      humidity += getHumidity();
       count++;
 
-      if (count >= READ_SAMPLES) {
-        results->dht.humidity = temp / READ_SAMPLES;
-        results->dht.temperature = humi / READ_SAMPLES;
+      int64_t elapsed_ms = (esp_timer_get_time() - started_us) / 1000;
+      if (count >= samples ||
+          elapsed_ms + DHT_INTERVAL_MS >= CYCLE_SENSORS_MS) {
         break;
       }
+      vTaskDelay(DHT_INTERVAL_MS / portTICK_RATE_MS);
+      continue;
     }
 
     vTaskDelay(READ_DELAY_IN_MS / portTICK_RATE_MS);
   }
 
-  xEventGroupSetBits(results->tasks_event, DHT_TASK_BIT);
-  vTaskDelete(NULL);
+  if (count > 0) {
+    results->reading.dht.temperature = temperature / count;
+    results->reading.dht.humidity = humidity / count;
+  }
+  if (count < samples) {
+    ESP_LOGE(TAG, "Only %d of %d readings succeeded", count, samples);
+  }
+
+  finish_sensor_task(results, SENSOR_DHT, count > 0, started_us);
 }
\ No newline at end of file
@@ -0,0 +1,25 @@
+#include "power_mode.h"
+#include "tasks.h"
+
+static const char *TAG = "NODE";
+
+// Runs in place of mqtt_task on a node: the reading goes to the gateway as
+// one binary frame, there is no backlog or remote config on this path.
+void espnow_node_task(void *param) {
+  mqtt_params *params = (mqtt_params *)param;
+  task_results *results = params->results;
+  uint8_t payload[READING_BINARY_MAX];
+
+  wait_for_sensors(results);
+
+  int len = reading_encode(&results->reading, payload, sizeof(payload));
+  power_phase_begin(POWER_PHASE_NETWORK);
+  bool sent = len > 0 && espnow_link_send(payload, len);
+  power_phase_end(POWER_PHASE_NETWORK);
+  if (!sent) {
+    ESP_LOGW(TAG, "Reading not delivered to the gateway");
+  }
+
+  xEventGroupSetBits(results->tasks_event, MQTT_TASK_BIT);
+  vTaskDelete(NULL);
+}
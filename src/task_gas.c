@@ -1,20 +1,80 @@
+#include "power_mode.h"
 #include "tasks.h"
+#include "time_sync.h"
+
+static const char *TAG = "GAS";
+
+void gas_heater_set(bool on) {
+  gpio_hold_dis(GAS_HEATER_PIN);
+  gpio_set_direction(GAS_HEATER_PIN, GPIO_MODE_OUTPUT);
+  gpio_set_level(GAS_HEATER_PIN, on);
+  gpio_hold_en(GAS_HEATER_PIN);
+  gpio_deep_sleep_hold_en();
+}
+
+// Switches the heater on if it was planned off, and waits for it as long as
+// the sensor phase allows. Returns whether the element is stable.
+static bool preheat(task_results *results) {
+  gas_heater_params params;
+  gas_heater_state *heater = results->heater;
+
+  gas_heater_params_load(results->config, &params);
+  if (params.preheat_ms == 0) {
+    return true;
+  }
+
+  gas_heater_update(heater, &params, time_sync_uptime_ms());
+  if (!heater->on) {
+    gas_heater_set(true);
+    gas_heater_switch(heater, true);
+  }
+
+  uint32_t wait_ms = gas_heater_preheat_ms(heater, &params);
+  if (wait_ms > 0) {
+    ESP_LOGI(TAG, "Preheating for %ums", wait_ms);
+    if (wait_ms > GAS_PREHEAT_WAIT_MS) {
+      wait_ms = GAS_PREHEAT_WAIT_MS;
+    }
+    vTaskDelay(wait_ms / portTICK_PERIOD_MS);
+    gas_heater_update(heater, &params, time_sync_uptime_ms());
+  }
+
+  if (!gas_heater_stable(heater)) {
+    ESP_LOGW(TAG, "Reading before the heater is stable, at %d%%",
+             (int)(heater->warmth * 100));
+    return false;
+  }
+  return true;
+}
 
 void gas_task(void *param) {
   task_results *results = (task_results *)param;
+  int64_t started_us = esp_timer_get_time();
+
+  bool stable = preheat(results);
 
   adc1_config_width(ADC_WIDTH_12Bit);
   adc1_config_channel_atten(GAS_A_PIN, ADC_ATTEN_11db);
 
+  int samples = sensor_schedule_samples(&results->config->schedule[SENSOR_GAS],
+                                        results->config->read_samples);
   int gas_pin_level = 0;
-  for (int i = 0; i < READ_SAMPLES; i++) {
-    gas_pin_level += adc1_get_raw(GAS_A_PIN);
+  power_phase_begin(POWER_PHASE_SENSE);
+  for (int i = 0; i < samples; i++) {
+    int raw = adc1_get_raw(GAS_A_PIN);
+    if (stable) {
+      stats_add(&results->window->metrics[METRIC_GAS_LEVEL], raw);
+    }
+    gas_pin_level += raw;
   }
+  power_phase_end(POWER_PHASE_SENSE);
 
-  gas_pin_level = gas_pin_level / READ_SAMPLES;
+  gas_pin_level = gas_pin_level / samples;
 
-  results->gas.level = gas_pin_level;
+  // Flagged readings are published but kept out of the window.
+  results->reading.gas.level = gas_pin_level;
+  results->reading.gas.stable = stable;
 
-  xEventGroupSetBits(results->tasks_event, GAS_TASK_BIT);
-  vTaskDelete(NULL);
+  // The heater keeps a connected MQ sensor well above zero.
+  finish_sensor_task(results, SENSOR_GAS, gas_pin_level > 0, started_us);
 }
\ No newline at end of file
@@ -1,20 +1,28 @@
+#include "power_mode.h"
 #include "tasks.h"
 
 void ldr_task(void *param) {
   task_results *results = (task_results *)param;
+  int64_t started_us = esp_timer_get_time();
 
   adc1_config_width(ADC_WIDTH_12Bit);
   adc1_config_channel_atten(LDR_PIN, ADC_ATTEN_11db);
 
+  int samples = sensor_schedule_samples(&results->config->schedule[SENSOR_LDR],
+                                        results->config->read_samples);
   int sum = 0;
-  for (int i = 0; i < READ_SAMPLES; i++) {
-    sum += adc1_get_raw(LDR_PIN);
+  for (int i = 0; i < samples; i++) {
+    power_phase_begin(POWER_PHASE_SENSE);
+    int raw = adc1_get_raw(LDR_PIN);
+    power_phase_end(POWER_PHASE_SENSE);
+    stats_add(&results->window->metrics[METRIC_LDR_LIGHT], raw);
+    sum += raw;
 
     vTaskDelay(READ_DELAY_IN_MS / portTICK_PERIOD_MS);
   }
 
-  results->ldr.light = sum / READ_SAMPLES;
+  results->reading.ldr.light = sum / samples;
 
-  xEventGroupSetBits(results->tasks_event, LDR_TASK_BIT);
-  vTaskDelete(NULL);
+  // Zero is a dark room as much as a broken divider, so it always counts.
+  finish_sensor_task(results, SENSOR_LDR, true, started_us);
 }
\ No newline at end of file
@@ -1,17 +1,106 @@
 #include <math.h>
+#include <stdarg.h>
+
+#include "esp_attr.h"
+#include "esp_system.h"
+#include "esp_timer.h"
 
 #include "aws_mqtt.h"
+#include "calibration.h"
+#include "history.h"
+#include "lz_codec.h"
+#include "metrics_server.h"
+#include "ota_update.h"
+#include "power_mode.h"
+#include "prometheus.h"
+#include "publish_window.h"
+#include "record_log.h"
 #include "tasks.h"
+#include "time_sync.h"
 
 #define NETWORK_BUFFER_SIZE 1024
 #define TOPIC_TEMPLATE "device/%s/data"
-#define PAYLOAD_TEMPLATE                                                       \
-  "{\"dht\": { \"temperature\": %d, \"humidity\": %d }, \"gas\": { "           \
-  "\"level\": %d }, \"ldr\": { \"intensity\": %d }, \"co2\": { \"ppm\": %d, "  \
-  "\"temperature\": %d }, \"power\": { \"volts\": %d }}"
+#define CONFIG_TOPIC_TEMPLATE "device/%s/config"
+#define ALERT_TOPIC_TEMPLATE "device/%s/alert"
+#define OTA_REQUEST_TOPIC_TEMPLATE "device/%s/ota/get"
+#define OTA_CHUNK_TOPIC_TEMPLATE "device/%s/ota/chunk"
+#define NODES_TOPIC_TEMPLATE "device/%s/nodes"
+#define HISTORY_REQUEST_TOPIC_TEMPLATE "device/%s/history/get"
+#define HISTORY_TOPIC_TEMPLATE "device/%s/history"
+
+#define ACK_TIMEOUT_MS 5000
+#define BROKER_KEEP_ALIVE_S 20
+#define CONNECTED_KEEP_ALIVE_S 120
+#define CONNECTED_RETRY_MIN_MS 5000
+#define CONNECTED_RETRY_MAX_MS 300000
+#define CONNECTED_POLL_MS 1000
+#define GATEWAY_POLL_MS 100
+#define BACKLOG_PARTITION "backlog"
+// AWS IoT takes up to 100 publishes a second per connection.
+#define BACKLOG_SEND_INTERVAL_MS 10
+#define BACKLOG_POLL_MS 10
+#define HISTORY_PARTITION "history"
+#define CONFIG_WAIT_MS 300
+#define OTA_CHUNKS_PER_WAKE 32
+#define OTA_CHUNK_TIMEOUT_MS 2000
+#define TIME_SYNC_WAIT_MS 1000
+
+#define SENSOR_TASK_BITS                                                       \
+  (LDR_TASK_BIT | GAS_TASK_BIT | DHT_TASK_BIT | CO2_TASK_BIT | POWER_TASK_BIT)
 
 static const char *TAG = "MQTT";
 
+static const char *metric_names[METRIC_COUNT] = {
+    [METRIC_DHT_TEMPERATURE] = "dht.temperature",
+    [METRIC_DHT_HUMIDITY] = "dht.humidity",
+    [METRIC_GAS_LEVEL] = "gas.level",
+    [METRIC_GAS_PPM] = "gas.ppm",
+    [METRIC_LDR_LIGHT] = "ldr.intensity",
+    [METRIC_LDR_LUX] = "ldr.lux",
+    [METRIC_CO2_PPM] = "co2.ppm",
+    [METRIC_CO2_TEMPERATURE] = "co2.temperature",
+    [METRIC_POWER_VOLTS] = "power.volts",
+};
+
+static const char *sensor_names[SENSOR_COUNT] = {
+    [SENSOR_CO2] = "co2", [SENSOR_DHT] = "dht",     [SENSOR_GAS] = "gas",
+    [SENSOR_LDR] = "ldr", [SENSOR_POWER] = "power",
+};
+
+static const uint32_t sensor_groups[SENSOR_COUNT] = {
+    [SENSOR_CO2] = READING_MISSING(co2),
+    [SENSOR_DHT] = READING_MISSING(dht),
+    [SENSOR_GAS] = READING_MISSING(gas),
+    [SENSOR_LDR] = READING_MISSING(ldr),
+    [SENSOR_POWER] = READING_MISSING(power),
+};
+
+_Static_assert(HISTORY_VALUES == METRIC_COUNT, "a history value per metric");
+
+static const uint32_t metric_groups[METRIC_COUNT] = {
+    [METRIC_DHT_TEMPERATURE] = READING_MISSING(dht),
+    [METRIC_DHT_HUMIDITY] = READING_MISSING(dht),
+    [METRIC_GAS_LEVEL] = READING_MISSING(gas),
+    [METRIC_GAS_PPM] = READING_MISSING(gas),
+    [METRIC_LDR_LIGHT] = READING_MISSING(ldr),
+    [METRIC_LDR_LUX] = READING_MISSING(ldr),
+    [METRIC_CO2_PPM] = READING_MISSING(co2),
+    [METRIC_CO2_TEMPERATURE] = READING_MISSING(co2),
+    [METRIC_POWER_VOLTS] = READING_MISSING(power),
+};
+
+// History values are 16 bit, lux and gas ppm go up to 100000 and are filed
+// in units of 4 instead of being clamped.
+static const int32_t history_units[METRIC_COUNT] = {
+    [METRIC_DHT_TEMPERATURE] = 1, [METRIC_DHT_HUMIDITY] = 1,
+    [METRIC_GAS_LEVEL] = 1,       [METRIC_GAS_PPM] = 4,
+    [METRIC_LDR_LIGHT] = 1,       [METRIC_LDR_LUX] = 4,
+    [METRIC_CO2_PPM] = 1,         [METRIC_CO2_TEMPERATURE] = 1,
+    [METRIC_POWER_VOLTS] = 1,
+};
+_Static_assert(CALIBRATION_MAX_PPM / 4 <= INT16_MAX, "gas ppm history unit");
+_Static_assert(CALIBRATION_MAX_LUX / 4 <= INT16_MAX, "lux history unit");
+
 NetworkContext_t network_context = {0};
 MQTTContext_t mqtt_context = {0};
 static uint8_t mqtt_shared_buffer[NETWORK_BUFFER_SIZE];
@@ -20,48 +109,1221 @@ static MQTTFixedBuffer_t mqtt_buffer = {mqtt_shared_buffer,
 
 EventGroupHandle_t event_group;
 
+static volatile uint16_t acked_packet_id;
+
+static lz_encoder encoder;
+static uint8_t compressed_payload[RECORD_LOG_MAX_RECORD];
+// Sized to be stored as is in the backlog. Only one of the MQTT tasks runs.
+static char message[RECORD_LOG_MAX_RECORD];
+
+static char config_topic[128];
+static char alert_topic[128];
+static char ota_chunk_topic[128];
+static char nodes_topic[128];
+static char history_request_topic[128];
+static char history_topic[128];
+static espnow_batch node_batch;
+static const device_config *running_config;
+static cycle_budget *cycle;
+static bool config_received;
+static bool config_updated;
+static uint32_t session_commands;
+static uint32_t power_baseline[POWER_PHASE_COUNT];
+
+// Wake (or sample start) to PUBACK of the last published reading, reported
+// with the next one.
+static RTC_DATA_ATTR uint32_t last_latency_ms;
+
+// Heap taken from the broker connection through the last publish, also
+// reported with the next reading. The low-water mark counts from boot, so
+// this is an upper bound when Wi-Fi set up went lower still.
+static RTC_DATA_ATTR uint32_t last_heap_peak;
+static uint32_t heap_free_at_connect;
+
+// Mounted on first use, most cycles only add a sample to the RTC bucket.
+static flash_dev history_dev;
+static history history_store;
+static bool history_mounted;
+static history_request history_pending;
+static bool history_requested;
+// The bucket outlives deep sleep. Requests are retained, the id of the last
+// one served keeps it from being served again on every wake-up.
+static RTC_DATA_ATTR history_bucket history_minute;
+static RTC_DATA_ATTR uint32_t history_served_id;
+
+// Learned over the backlog drains of earlier cycles, a new connection starts
+// at the window size they settled on.
+static RTC_DATA_ATTR publish_window backlog_window;
+
+static void handle_config(const MQTTPublishInfo_t *info) {
+  device_config updated;
+  uint32_t commands;
+
+  config_received = true;
+
+  switch (device_config_parse(info->pPayload, info->payloadLength,
+                              running_config, &updated, &commands)) {
+  case DEVICE_CONFIG_UPDATED:
+    ESP_LOGI(TAG, "Configuration version %u received, commands 0x%x",
+             updated.version, commands);
+    updated.pending_commands |= commands & DEVICE_COMMAND_CALIBRATE_CO2_ZERO;
+    device_config_save(&updated);
+    session_commands |= commands;
+    config_updated = true;
+    break;
+  case DEVICE_CONFIG_INVALID:
+    ESP_LOGW(TAG, "Ignoring invalid configuration");
+    break;
+  default:
+    break;
+  }
+}
+
+static bool topic_matches(const MQTTPublishInfo_t *info, const char *topic) {
+  return info->topicNameLength == strlen(topic) &&
+         strncmp(info->pTopicName, topic, info->topicNameLength) == 0;
+}
+
+static void handle_history_request(const MQTTPublishInfo_t *info) {
+  history_request request;
+
+  if (!history_request_decode(info->pPayload, info->payloadLength,
+                              &request)) {
+    ESP_LOGW(TAG, "Ignoring invalid history request");
+    return;
+  }
+
+  if (request.id != history_served_id) {
+    history_pending = request;
+    history_requested = true;
+  }
+}
+
+static int64_t now_ms(void) { return esp_timer_get_time() / 1000; }
+
 static void event_callback(MQTTContext_t *pxMQTTContext,
                            MQTTPacketInfo_t *pxPacketInfo,
                            MQTTDeserializedInfo_t *pxDeserializedInfo) {
   ESP_LOGI(TAG, "Response [%d] received for packet Id [%u].",
            pxPacketInfo->type, pxDeserializedInfo->packetIdentifier);
 
-  xEventGroupSetBits(event_group, MQTT_TASK_BIT);
+  if (pxPacketInfo->type == MQTT_PACKET_TYPE_PUBACK) {
+    acked_packet_id = pxDeserializedInfo->packetIdentifier;
+    publish_window_ack(&backlog_window, acked_packet_id, (uint32_t)now_ms());
+  } else if ((pxPacketInfo->type & 0xf0U) == MQTT_PACKET_TYPE_PUBLISH) {
+    MQTTPublishInfo_t *info = pxDeserializedInfo->pPublishInfo;
+    if (topic_matches(info, config_topic)) {
+      handle_config(info);
+    } else if (topic_matches(info, history_request_topic)) {
+      handle_history_request(info);
+    } else if (topic_matches(info, ota_chunk_topic)) {
+      ota_update_write_chunk(info->pPayload, info->payloadLength);
+    }
+  }
+}
+
+static MQTTStatus_t wait_for_ack(uint16_t packet_id) {
+  TickType_t start = xTaskGetTickCount();
+
+  while (acked_packet_id != packet_id) {
+    if ((xTaskGetTickCount() - start) * portTICK_PERIOD_MS > ACK_TIMEOUT_MS) {
+      ESP_LOGW(TAG, "No PUBACK for packet Id [%u]", packet_id);
+      return MQTTRecvFailed;
+    }
+
+    MQTTStatus_t ret = MQTT_ProcessLoop(&mqtt_context, 100);
+    if (ret != MQTTSuccess) {
+      return ret;
+    }
+  }
+
+  return MQTTSuccess;
+}
+
+static MQTTStatus_t publish_and_wait(const char *topic, const void *payload,
+                                     size_t payload_length) {
+  uint16_t packet_id = 0;
+  MQTTStatus_t ret = publish_message(&mqtt_context, topic, payload,
+                                     payload_length, MQTTQoS1, &packet_id);
+
+  return ret == MQTTSuccess ? wait_for_ack(packet_id) : ret;
+}
+
+// Sends a reading without waiting, compressed when that makes it smaller. A
+// packet id other than 0 sends it again as a duplicate.
+static MQTTStatus_t send_reading(const char *topic, const void *payload,
+                                 size_t payload_length, uint16_t *packet_id) {
+  if (running_config->compress) {
+    int compressed_length =
+        lz_compress(&encoder, payload, payload_length, compressed_payload,
+                    sizeof(compressed_payload));
+
+    if (compressed_length > 0 && compressed_length < payload_length) {
+      ESP_LOGI(TAG, "Compressed reading from %u to %d bytes", payload_length,
+               compressed_length);
+      payload = compressed_payload;
+      payload_length = compressed_length;
+    }
+  }
+
+  if (*packet_id != 0) {
+    return republish_message(&mqtt_context, topic, payload, payload_length,
+                             MQTTQoS1, *packet_id);
+  }
+  return publish_message(&mqtt_context, topic, payload, payload_length,
+                         MQTTQoS1, packet_id);
+}
+
+static MQTTStatus_t publish_reading(const char *topic, const void *payload,
+                                    size_t payload_length) {
+  uint16_t packet_id = 0;
+  MQTTStatus_t ret = send_reading(topic, payload, payload_length, &packet_id);
+
+  return ret == MQTTSuccess ? wait_for_ack(packet_id) : ret;
+}
+
+// Feeds the circuit breakers. Sensors that failed, timed out or were
+// skipped are published as missing.
+static void check_sensors(task_results *results, EventBits_t bits) {
+  uint32_t waited_ms =
+      (uint32_t)((esp_timer_get_time() - results->sensors_started_us) / 1000);
+
+  results->reading.missing = 0;
+  results->reading.omitted = 0;
+  for (int i = 0; i < SENSOR_COUNT; i++) {
+    const sensor_run *run = &results->sensors[i];
+    bool done = (bits & SENSOR_TASK_BIT(i)) != 0;
+    bool success = run->started && done && run->success;
+
+    // A stuck sensor counts as failing, its breaker stays open until the
+    // task is gone. The time was counted when it timed out.
+    if (run->started || run->stuck) {
+      uint32_t lost_ms = run->stuck ? 0 : done ? run->elapsed_ms : waited_ms;
+      sensor_health_report(&results->health[i], success, lost_ms,
+                           results->config->sensor_probe_cycles);
+      if (!success && sensor_health_open(&results->health[i])) {
+        ESP_LOGW(TAG, "Sensor %s keeps failing, probing every %u cycles",
+                 sensor_names[i], results->config->sensor_probe_cycles);
+      }
+    }
+
+    if (!success) {
+      results->reading.missing |= sensor_groups[i];
+    }
+    if (!run->due) {
+      results->reading.omitted |= sensor_groups[i];
+    }
+  }
+}
+
+// Runs once the sensor tasks are done, compensation needs the DHT reading.
+static void calibrate(task_results *results) {
+  reading *value = &results->reading;
+  bool dht_present = !(value->missing & READING_MISSING(dht));
+  calibration cal;
+
+  calibration_init(&cal, results->config->gas_r0, results->config->ldr_r10);
+
+  if (!(value->missing & READING_MISSING(gas))) {
+    value->gas.ppm = calibration_gas_ppm(
+        &cal, value->gas.level,
+        dht_present ? value->dht.temperature : CALIBRATION_REFERENCE_T,
+        dht_present ? value->dht.humidity : CALIBRATION_REFERENCE_RH);
+    if (value->gas.stable) {
+      stats_add(&results->window->metrics[METRIC_GAS_PPM], value->gas.ppm);
+    }
+  }
+
+  if (!(value->missing & READING_MISSING(ldr))) {
+    value->ldr.lux = calibration_ldr_lux(&cal, value->ldr.light);
+    stats_add(&results->window->metrics[METRIC_LDR_LUX], value->ldr.lux);
+  }
+}
+
+void mqtt_reset_state(void) {
+  last_latency_ms = 0;
+  last_heap_peak = 0;
+  memset(&history_minute, 0, sizeof(history_minute));
+  history_served_id = 0;
+  memset(&backlog_window, 0, sizeof(backlog_window));
+}
+
+static bool open_history(void) {
+  if (!history_mounted) {
+    history_mounted =
+        flash_partition_open(HISTORY_PARTITION, &history_dev) &&
+        history_mount(&history_store, &history_dev) == HISTORY_OK;
+  }
+
+  return history_mounted;
+}
+
+// Needs the wall clock, samples are filed by their unix time. Unstable gas
+// readings are left out like in the window stats.
+static void record_history(const task_results *results) {
+  const reading *value = &results->reading;
+  int64_t unix_ms;
+  uint32_t uncertainty_ms;
+
+  if (!time_sync_now(&unix_ms, &uncertainty_ms) || !open_history()) {
+    return;
+  }
+
+  int32_t values[HISTORY_VALUES] = {
+      [METRIC_DHT_TEMPERATURE] = value->dht.temperature,
+      [METRIC_DHT_HUMIDITY] = value->dht.humidity,
+      [METRIC_GAS_LEVEL] = value->gas.level,
+      [METRIC_GAS_PPM] = value->gas.ppm,
+      [METRIC_LDR_LIGHT] = value->ldr.light,
+      [METRIC_LDR_LUX] = value->ldr.lux,
+      [METRIC_CO2_PPM] = value->co2.ppm,
+      [METRIC_CO2_TEMPERATURE] = value->co2.temperature,
+      [METRIC_POWER_VOLTS] = value->power.volts,
+  };
+  uint32_t missing = value->missing;
+  uint32_t present = 0;
+
+  if (!value->gas.stable) {
+    missing |= READING_MISSING(gas);
+  }
+  for (int i = 0; i < METRIC_COUNT; i++) {
+    if (!(missing & metric_groups[i])) {
+      present |= 1u << i;
+    }
+    values[i] = (values[i] + history_units[i] / 2) / history_units[i];
+  }
+
+  history_status ret = history_record(&history_store, &history_minute,
+                                      (uint32_t)(unix_ms / 1000), values,
+                                      present);
+  if (ret == HISTORY_IO_ERROR) {
+    ESP_LOGE(TAG, "Failed to write the history");
+  }
+}
+
+// Whatever has not come in by the deadline is published as missing, a
+// stalled sensor must not keep the device awake.
+void wait_for_sensors(task_results *results) {
+  EventBits_t bits = xEventGroupWaitBits(
+      results->tasks_event, SENSOR_TASK_BITS, pdTRUE, pdTRUE,
+      cycle_phase_left(results->cycle, CYCLE_PHASE_SENSORS, now_ms()) /
+          portTICK_PERIOD_MS);
+  bool complete = (bits & SENSOR_TASK_BITS) == SENSOR_TASK_BITS;
+  int64_t ended_ms = now_ms();
+
+  if (!complete) {
+    ESP_LOGE(TAG, "Sensors missed their deadline, missing bits 0x%x",
+             SENSOR_TASK_BITS & ~bits);
+  } else {
+    // A slow connect may only let us look after the deadline, the phase
+    // ended with the slowest sensor.
+    uint32_t slowest_ms = 0;
+    for (int i = 0; i < SENSOR_COUNT; i++) {
+      if (results->sensors[i].elapsed_ms > slowest_ms) {
+        slowest_ms = results->sensors[i].elapsed_ms;
+      }
+    }
+    ended_ms = results->sensors_started_us / 1000 + slowest_ms;
+  }
+  cycle_phase_end(results->cycle, CYCLE_PHASE_SENSORS, complete, ended_ms);
+  check_sensors(results, bits);
+  calibrate(results);
+  record_history(results);
+}
+
+// Returns the number of new alert events.
+static int check_alerts(task_results *results) {
+  alert_rule rules[ALERT_RULE_COUNT];
+  float values[ALERT_RULE_COUNT];
+
+  alert_rules_load(results->config, rules);
+  alert_values(&results->reading, values);
+  int events = alert_monitor_update(results->alerts, rules, values,
+                                    time_sync_uptime_ms());
+
+  for (uint32_t i = results->alerts->queued - events;
+       i < results->alerts->queued; i++) {
+    const alert_record *record = &results->alerts->queue[i];
+    ESP_LOGW(TAG, "Alert %s %s at %.0f", rules[record->rule].name,
+             record->event == ALERT_RAISED ? "raised" : "cleared",
+             record->value);
+  }
+
+  return events;
+}
+
+// Sends queued alert events oldest first, each waits for its PUBACK so the
+// latency covers the whole path from detection.
+static void publish_alerts(task_results *results) {
+  alert_monitor *alerts = results->alerts;
+  alert_rule rules[ALERT_RULE_COUNT];
+  char alert[160];
+
+  alert_rules_load(results->config, rules);
+  while (alerts->queued > 0) {
+    const alert_record *record = &alerts->queue[0];
+    int len = snprintf(
+        alert, sizeof(alert),
+        "{\"rule\":\"%s\",\"event\":\"%s\",\"value\":%.0f,"
+        "\"threshold\":%.0f,\"age_ms\":%lld}",
+        rules[record->rule].name,
+        record->event == ALERT_RAISED ? "raised" : "cleared", record->value,
+        rules[record->rule].threshold,
+        time_sync_uptime_ms() - record->detected_ms);
+
+    if (publish_and_wait(alert_topic, alert, len) != MQTTSuccess) {
+      ESP_LOGW(TAG, "Failed to send alert, %u queued", alerts->queued);
+      return;
+    }
+
+    alerts->last_latency_ms =
+        (uint32_t)(time_sync_uptime_ms() - record->detected_ms);
+    ESP_LOGI(TAG, "Alert %s delivered %ums after detection",
+             rules[record->rule].name, alerts->last_latency_ms);
+    alert_monitor_pop(alerts);
+  }
+}
+
+// Appends the extra fields of a reading. A field that does not fit is cut
+// back off and the ones after it are left out, the rest stays valid JSON.
+typedef struct {
+  char *buf;
+  size_t len;
+  size_t pos;
+  size_t field;
+  bool full;
+} extras_writer;
+
+static void begin_field(extras_writer *w) { w->field = w->pos; }
+
+static void append(extras_writer *w, const char *format, ...) {
+  va_list args;
+
+  if (w->full) {
+    return;
+  }
+
+  va_start(args, format);
+  int n = vsnprintf(w->buf + w->pos, w->len - w->pos, format, args);
+  va_end(args);
+
+  if (n < 0 || w->pos + n >= w->len) {
+    w->full = true;
+    w->pos = w->field;
+    w->buf[w->pos] = 0;
+    return;
+  }
+  w->pos += n;
+}
+
+// Time, power and latency fields shared by readings and summaries. The
+// timestamp is left out until the clock has been synchronized once.
+static void render_extras(const task_results *results, char *buf,
+                          size_t len) {
+  extras_writer w = {buf, len, 0, 0, false};
+  int64_t unix_ms;
+  uint32_t uncertainty_ms;
+  uint32_t ms[POWER_PHASE_COUNT];
+
+  buf[0] = 0;
+  if (time_sync_now(&unix_ms, &uncertainty_ms)) {
+    append(&w, ",\"ts\":%lld,\"ts_err\":%u", unix_ms, uncertainty_ms);
+  }
+
+  // Power phases since the previous reading, or since boot.
+  power_mode_times(ms);
+  for (int i = 0; i < POWER_PHASE_COUNT; i++) {
+    uint32_t total = ms[i];
+    ms[i] -= power_baseline[i];
+    power_baseline[i] = total;
+  }
+
+  const battery_state *battery = results->battery;
+  if (battery->changes > 0) {
+    begin_field(&w);
+    append(&w, ",\"battery\":{\"profile\":\"%s\",\"changes\":%u}",
+           battery_profile_name(battery->profile), battery->changes);
+  }
+
+  // The rest is left out by the battery profiles that save power.
+  if (!results->profile->diagnostics) {
+    return;
+  }
+
+  uint32_t mhz[POWER_PHASE_COUNT], clock_ms[POWER_PHASE_COUNT];
+  int clocks = power_mode_clock_times(ms, mhz, clock_ms);
+  begin_field(&w);
+  append(&w,
+         ",\"pm\":{\"idle_ms\":%u,\"sense_ms\":%u,\"network_ms\":%u,"
+         "\"mj\":%u,\"mhz_ms\":{",
+         ms[POWER_PHASE_IDLE], ms[POWER_PHASE_SENSE], ms[POWER_PHASE_NETWORK],
+         power_mode_energy_mj(ms));
+  for (int i = 0; i < clocks; i++) {
+    append(&w, "%s\"%u\":%u", i > 0 ? "," : "", mhz[i], clock_ms[i]);
+  }
+  append(&w, "}}");
+
+  if (last_latency_ms > 0) {
+    begin_field(&w);
+    append(&w, ",\"latency_ms\":%u", last_latency_ms);
+  }
+
+  if (last_heap_peak > 0) {
+    begin_field(&w);
+    append(&w, ",\"heap\":{\"peak\":%u,\"min\":%u}", last_heap_peak,
+           esp_get_minimum_free_heap_size());
+  }
+
+  // Mean time of the wakes the stub handled without booting.
+  if (results->stub_cycles > 0) {
+    begin_field(&w);
+    append(&w, ",\"stub\":{\"cycles\":%u,\"us\":%u}", results->stub_cycles,
+           results->stub_us);
+  }
+
+  // Heater on-time, when the heater is switched.
+  if (results->config->gas_preheat_s > 0) {
+    begin_field(&w);
+    append(&w, ",\"heater\":{\"on\":%s,\"on_s_per_h\":%u}",
+           results->heater->on ? "true" : "false",
+           gas_heater_on_per_hour_ms(results->heater) / 1000);
+  }
+
+  // How long the previous cycle was awake and which phases overran.
+  const cycle_history *history = results->history;
+  if (history->awake_ms > 0) {
+    begin_field(&w);
+    append(&w, ",\"cycle\":{\"awake_ms\":%u,\"overruns\":%u",
+           history->awake_ms, history->overrun_cycles);
+    const char *separator = ",\"overrun\":[\"";
+    for (int i = 0; i < CYCLE_PHASE_COUNT; i++) {
+      if (history->overrun & (1u << i)) {
+        append(&w, "%s%s", separator, cycle_phase_name(i));
+        separator = "\",\"";
+      }
+    }
+    append(&w, history->overrun ? "\"]}" : "}");
+  }
+
+  // Success rate and time lost, only for sensors that have failed.
+  const char *separator = ",\"health\":{";
+  begin_field(&w);
+  for (int i = 0; i < SENSOR_COUNT; i++) {
+    const sensor_health *health = &results->health[i];
+    if (health->successes == health->attempts) {
+      continue;
+    }
+
+    append(&w, "%s\"%s\":{\"ok_pct\":%u,\"lost_ms\":%u,\"open\":%s}",
+           separator, sensor_names[i], sensor_health_success_percent(health),
+           health->lost_ms, sensor_health_open(health) ? "true" : "false");
+    separator = ",";
+  }
+  if (separator[0] == ',' && separator[1] == 0) {
+    append(&w, "}");
+  }
+
+  const alert_monitor *alerts = results->alerts;
+  if (alerts->last_latency_ms > 0 || alerts->suppressed > 0 ||
+      alerts->dropped > 0) {
+    begin_field(&w);
+    append(&w,
+           ",\"alerts\":{\"latency_ms\":%u,\"suppressed\":%u,"
+           "\"dropped\":%u}",
+           alerts->last_latency_ms, alerts->suppressed, alerts->dropped);
+  }
+
+  // Node frames handled by a gateway since boot.
+  const espnow_stats *nodes = espnow_link_stats();
+  if (nodes->accepted > 0 || nodes->invalid > 0 || nodes->replayed > 0 ||
+      nodes->dropped > 0) {
+    begin_field(&w);
+    append(&w,
+           ",\"nodes\":{\"accepted\":%u,\"invalid\":%u,\"replayed\":%u,"
+           "\"dropped\":%u}",
+           nodes->accepted, nodes->invalid, nodes->replayed, nodes->dropped);
+  }
+
+  if (w.full) {
+    ESP_LOGW(TAG, "Diagnostics cut short at %u bytes", (unsigned)w.pos);
+  }
+}
+
+static int render_summary(const stats_window *window,
+                          const net_policy_state *net_state,
+                          const char *extras, char *buf, size_t len) {
+  int pos = snprintf(buf, len,
+                     "{\"window\":{\"cycles\":%u},\"net\":{\"skipped\":%u,"
+                     "\"failures\":%u}%s",
+                     window->cycles, net_state->skipped_total,
+                     net_state->failed_total, extras);
+
+  for (int i = 0; i < METRIC_COUNT && pos > 0 && pos < len; i++) {
+    const metric_stats *stats = &window->metrics[i];
+    if (stats->count == 0) {
+      continue;
+    }
+
+    pos += snprintf(buf + pos, len - pos,
+                    ",\"%s\":{\"n\":%u,\"mean\":%.2f,\"sd\":%.2f,\"min\":%.2f,"
+                    "\"max\":%.2f,\"ewma\":%.2f,\"p50\":%.2f,\"p90\":%.2f}",
+                    metric_names[i], stats->count, stats->mean,
+                    sqrtf(stats_variance(stats)), stats->min, stats->max,
+                    stats->ewma, stats_p50(stats), stats_p90(stats));
+  }
+
+  if (pos > 0 && pos < len) {
+    pos += snprintf(buf + pos, len - pos, "}");
+  }
+
+  return pos > 0 && pos < len ? pos : -1;
+}
+
+static void download_update(const char *thing_name,
+                            const char *public_key_pem) {
+  char topic[128];
+  char request[64];
+
+  if (!ota_update_begin(running_config)) {
+    return;
+  }
+
+  char *topics[] = {ota_chunk_topic};
+  if (subscribe_to_topic(&mqtt_context, topics, 1, MQTTQoS0) != MQTTSuccess) {
+    return;
+  }
+
+  sprintf(topic, OTA_REQUEST_TOPIC_TEMPLATE, thing_name);
+
+  const ota_progress *progress = ota_update_progress();
+  for (int i = 0; i < OTA_CHUNKS_PER_WAKE && !ota_progress_complete(progress) &&
+                  cycle_phase_left(cycle, CYCLE_PHASE_PUBLISH, now_ms()) >
+                      OTA_CHUNK_TIMEOUT_MS;
+       i++) {
+    uint32_t offset = progress->offset;
+    size_t len = ota_update_request(request, sizeof(request));
+
+    if (publish_message(&mqtt_context, topic, request, len, MQTTQoS0, NULL) !=
+        MQTTSuccess) {
+      break;
+    }
+
+    TickType_t start = xTaskGetTickCount();
+    while (progress->offset == offset &&
+           (xTaskGetTickCount() - start) * portTICK_PERIOD_MS <
+               OTA_CHUNK_TIMEOUT_MS) {
+      if (MQTT_ProcessLoop(&mqtt_context, 50) != MQTTSuccess) {
+        break;
+      }
+    }
+
+    if (progress->offset == offset) {
+      ESP_LOGW(TAG, "No update chunk for offset %u", offset);
+      break;
+    }
+  }
+
+  if (ota_progress_complete(progress)) {
+    ota_update_finish(public_key_pem);
+  } else {
+    ota_update_suspend();
+  }
+}
+
+static bool open_backlog(flash_dev *dev, record_log *backlog) {
+  if (!flash_partition_open(BACKLOG_PARTITION, dev) ||
+      record_log_mount(backlog, dev) != RECORD_LOG_OK) {
+    return false;
+  }
+
+  ESP_LOGI(TAG, "Backlog mounted with %u pending readings", backlog->pending);
+  return true;
+}
+
+static const mqtt_transport *select_transport(const char *name) {
+  const mqtt_transport *transport = mqtt_transport_find(name);
+
+  if (transport == NULL) {
+    ESP_LOGW(TAG, "Unknown transport [%s], using TLS", name);
+    transport = &mqtt_transport_tls;
+  }
+
+  return transport;
+}
+
+static bool connect_broker(const mqtt_params *params,
+                           const mqtt_transport *transport,
+                           uint16_t keep_alive_s) {
+  uint32_t timeout_ms = cycle_phase_begin(cycle, CYCLE_PHASE_CONNECT, now_ms());
+
+  heap_free_at_connect = esp_get_free_heap_size();
+  power_phase_begin(POWER_PHASE_NETWORK);
+  MQTTStatus_t ret = connect_to_broker(
+      &mqtt_context, &network_context, transport, event_callback, &mqtt_buffer,
+      params->mqtt_host, params->mqtt_port, params->root_ca, params->cert,
+      params->key, params->thing_name, keep_alive_s, timeout_ms);
+  power_phase_end(POWER_PHASE_NETWORK);
+  cycle_phase_end(cycle, CYCLE_PHASE_CONNECT, true, now_ms());
+
+  if (ret != MQTTSuccess) {
+    return false;
+  }
+
+  // Reaching the broker is enough to keep a new image, whether or not this
+  // cycle publishes.
+  ota_update_confirm();
+
+  char *topics[] = {config_topic, history_request_topic};
+  subscribe_to_topic(&mqtt_context, topics, 2, MQTTQoS0);
+  return true;
+}
+
+static void measure_heap(void) {
+  uint32_t lowest = esp_get_minimum_free_heap_size();
+
+  last_heap_peak = heap_free_at_connect - lowest;
+  ESP_LOGI(TAG, "TLS heap peak %u, lowest free %u, stack left %u",
+           last_heap_peak, lowest, uxTaskGetStackHighWaterMark(NULL));
+}
+
+static int render_reading(const mqtt_params *params, bool summary,
+                          char *message, size_t len) {
+  task_results *results = params->results;
+  // Static like the message, to keep it off the task stack.
+  static char extras[1024];
+  int message_len;
+
+  render_extras(results, extras, sizeof(extras));
+  if (summary) {
+    message_len = render_summary(results->window, params->net_state, extras,
+                                 message, len);
+  } else {
+    results->reading.net.skipped = params->net_state->skipped_total;
+    results->reading.net.failures = params->net_state->failed_total;
+    message_len =
+        results->config->payload_format == PAYLOAD_FORMAT_BINARY
+            ? reading_encode(&results->reading, (uint8_t *)message, len)
+            : reading_write_json(&results->reading, extras, message, len);
+  }
+
+  if (message_len < 0) {
+    ESP_LOGE(TAG, "Reading does not fit the message buffer");
+    message_len = 0;
+    message[0] = 0;
+  }
+
+  return message_len;
+}
+
+// Starts the next window once a rendered one was published or stored, until
+// then the samples keep adding up and go out with the next reading.
+static void reset_window(task_results *results) {
+  results->window->cycles = 0;
+  for (int i = 0; i < METRIC_COUNT; i++) {
+    stats_reset_window(&results->window->metrics[i]);
+  }
+  results->stub_cycles = 0;
+}
+
+// Publishes the reading, or stores it in the backlog when that fails. kept
+// tells whether it went either way.
+static MQTTStatus_t deliver(const char *topic, const char *message,
+                            int message_len, bool connected,
+                            record_log *backlog, int64_t sampled_us,
+                            bool *kept) {
+  MQTTStatus_t ret = MQTTIllegalState;
+
+  // Nothing rendered is no reason to drop the connection.
+  *kept = false;
+  if (message_len == 0) {
+    return MQTTSuccess;
+  }
+
+  if (connected) {
+    if (message[0] == '{') {
+      ESP_LOGI(TAG, "Publishing reading [%s]", message);
+    } else {
+      ESP_LOGI(TAG, "Publishing %d byte binary reading", message_len);
+    }
+    ret = publish_reading(topic, message, message_len);
+  }
+
+  if (ret != MQTTSuccess) {
+    ESP_LOGW(TAG, "Failed to send mqtt message: %d, storing reading", ret);
+    if (backlog == NULL) {
+      return ret;
+    }
+    *kept = record_log_append(backlog, message, message_len) == RECORD_LOG_OK;
+    if (!*kept) {
+      ESP_LOGE(TAG, "Failed to store reading in backlog");
+    }
+    return ret;
+  }
+
+  *kept = true;
+  last_latency_ms = (uint32_t)((esp_timer_get_time() - sampled_us) / 1000);
+  return ret;
+}
+
+// Keeps up to the window of backlog readings in flight. Records stay in
+// flash until their PUBACK and are consumed in order, so a retransmit reads
+// the record again and whatever is unacknowledged at the end stays pending.
+static uint32_t drain_window(record_log *backlog, const char *topic,
+                             uint32_t limit) {
+  // Static like the message, to keep it off the task stack.
+  static uint8_t record[RECORD_LOG_MAX_RECORD];
+  publish_window *window = &backlog_window;
+  uint32_t pos = record_log_tail(backlog);
+  uint32_t sent = 0, drained = 0;
+  int64_t send_at = 0;
+  bool more = true;
+  uint16_t len;
+
+  if (window->size == 0) {
+    publish_window_init(window);
+  } else {
+    publish_window_clear(window);
+  }
+
+  for (;;) {
+    while (publish_window_pop(window, NULL)) {
+      if (record_log_consume(backlog) != RECORD_LOG_OK) {
+        return drained;
+      }
+      drained++;
+    }
+
+    int64_t now = now_ms();
+    uint32_t left = cycle_phase_left(cycle, CYCLE_PHASE_PUBLISH, now);
+    bool sending = more && sent < limit && left >= ACK_TIMEOUT_MS;
+    if ((window->count == 0 && !sending) || left == 0) {
+      break;
+    }
+
+    publish_slot *late = publish_window_expired(window, (uint32_t)now);
+    if (late != NULL) {
+      uint32_t next;
+      if (late->attempts >= PUBLISH_WINDOW_ATTEMPTS) {
+        ESP_LOGW(TAG, "No PUBACK for packet Id [%u]", late->packet_id);
+        break;
+      }
+      if (record_log_read(backlog, late->ref, record, &len, &next) !=
+              RECORD_LOG_OK ||
+          send_reading(topic, record, len, &late->packet_id) != MQTTSuccess) {
+        break;
+      }
+      publish_window_resent(window, late, (uint32_t)now);
+      continue;
+    }
+
+    if (sending && publish_window_open(window) && now >= send_at) {
+      uint32_t at = pos;
+      uint16_t packet_id = 0;
+      record_log_status ret = record_log_read(backlog, at, record, &len, &pos);
+
+      if (ret == RECORD_LOG_CORRUPT) {
+        publish_window_skip(window, at);
+      } else if (ret != RECORD_LOG_OK) {
+        more = false;
+      } else if (send_reading(topic, record, len, &packet_id) ==
+                 MQTTSuccess) {
+        publish_window_sent(window, at, packet_id, (uint32_t)now);
+        sent++;
+        send_at = now + BACKLOG_SEND_INTERVAL_MS;
+      } else {
+        break;
+      }
+      continue;
+    }
+
+    if (MQTT_ProcessLoop(&mqtt_context, BACKLOG_POLL_MS) != MQTTSuccess) {
+      break;
+    }
+  }
+
+  return drained;
+}
+
+static void drain_backlog(record_log *backlog, const char *topic,
+                          uint32_t limit) {
+  if (backlog == NULL || backlog->pending == 0) {
+    return;
+  }
+
+  if (session_commands & DEVICE_COMMAND_FLUSH_BACKLOG) {
+    limit = UINT32_MAX;
+  }
+
+  uint32_t drained = drain_window(backlog, topic, limit);
+  ESP_LOGI(TAG,
+           "Drained %u backlog readings, %u left, window %u, round trip %u "
+           "ms, %u retransmits",
+           drained, backlog->pending, backlog_window.size,
+           backlog_window.srtt_ms, backlog_window.retransmits);
+}
+
+typedef struct {
+  history_frame frame;
+  uint16_t number;
+  bool stopped;
+} history_response;
+
+// Publishes every full frame. The final one is kept for serve_history,
+// time for it is left when stopping.
+static int add_history_point(const history_point *point, void *arg) {
+  history_response *response = arg;
+
+  if (history_frame_add(&response->frame, point)) {
+    return 0;
+  }
+
+  if (cycle_phase_left(cycle, CYCLE_PHASE_PUBLISH, now_ms()) <
+      2 * ACK_TIMEOUT_MS) {
+    response->stopped = true;
+    return -1;
+  }
+
+  history_frame_finish(&response->frame, 0);
+  if (publish_and_wait(history_topic, response->frame.buf,
+                       response->frame.len) != MQTTSuccess) {
+    response->stopped = true;
+    return -1;
+  }
+
+  history_frame_start(&response->frame, &history_pending, ++response->number);
+  history_frame_add(&response->frame, point);
+  return 0;
+}
+
+// Answers the pending history request. One that ran out of time is marked
+// truncated, the backend asks again from its last point.
+static void serve_history(void) {
+  // Static, a frame is close to a kilobyte.
+  static history_response response;
+
+  if (!history_requested || !open_history()) {
+    return;
+  }
+  history_requested = false;
+
+  response.number = 0;
+  response.stopped = false;
+  history_frame_start(&response.frame, &history_pending, 0);
+  uint32_t points = history_query(&history_store, history_pending.tier,
+                                  history_pending.from, history_pending.to,
+                                  add_history_point, &response);
+  history_frame_finish(&response.frame,
+                       HISTORY_FRAME_LAST |
+                           (response.stopped ? HISTORY_FRAME_TRUNCATED : 0));
+
+  if (publish_and_wait(history_topic, response.frame.buf,
+                       response.frame.len) == MQTTSuccess) {
+    history_served_id = history_pending.id;
+    ESP_LOGI(TAG, "History request %u served with %u points in %u frames",
+             history_pending.id, points, response.number + 1);
+  }
+}
+
+// On a gateway, moves node frames into the batch and publishes it once it
+// is due. A batch that could not be sent is kept, new frames wait in the
+// receive queue meanwhile.
+static void forward_node_readings(const mqtt_params *params, bool connected) {
+  if (params->espnow->role != ESPNOW_ROLE_GATEWAY) {
+    return;
+  }
+
+  int64_t now = now_ms();
+  espnow_link_collect(&node_batch, now);
+  if (!connected ||
+      !espnow_batch_due(&node_batch, running_config->espnow_batch_ms, now)) {
+    return;
+  }
+
+  ESP_LOGI(TAG, "Forwarding %u node readings in %u bytes", node_batch.count,
+           node_batch.len);
+  if (publish_reading(nodes_topic, node_batch.buf, node_batch.len) ==
+      MQTTSuccess) {
+    espnow_batch_reset(&node_batch);
+  }
+}
+
+// Renders the sample for the LAN collector, it is scraped from there.
+static void update_metrics(const task_results *results) {
+  size_t len;
+  char *buf = metrics_server_begin(&len);
+
+  if (buf != NULL) {
+    metrics_server_commit(prometheus_write(&results->reading,
+                                           results->window->metrics,
+                                           metric_names, METRIC_COUNT, buf,
+                                           len));
+  }
 }
 
 void mqtt_task(void *param) {
   mqtt_params *params = (mqtt_params *)param;
   task_results *results = params->results;
   event_group = results->tasks_event;
+  running_config = results->config;
+  cycle = results->cycle;
+
+  // New alerts are sent right away, by booting again straight into a
+  // connected cycle.
+  if (!params->publish_due && !params->online) {
+    wait_for_sensors(results);
+    results->alert_wake = check_alerts(results) > 0;
+    xEventGroupSetBits(event_group, MQTT_TASK_BIT);
+    vTaskDelete(NULL);
+  }
+
+  sprintf(config_topic, CONFIG_TOPIC_TEMPLATE, params->thing_name);
+  sprintf(alert_topic, ALERT_TOPIC_TEMPLATE, params->thing_name);
+  sprintf(ota_chunk_topic, OTA_CHUNK_TOPIC_TEMPLATE, params->thing_name);
+  sprintf(history_request_topic, HISTORY_REQUEST_TOPIC_TEMPLATE,
+          params->thing_name);
+  sprintf(history_topic, HISTORY_TOPIC_TEMPLATE, params->thing_name);
+
+  flash_dev backlog_dev;
+  record_log backlog;
+  bool backlog_ready = open_backlog(&backlog_dev, &backlog);
 
-  connect_to_broker(&mqtt_context, &network_context, event_callback,
-                    &mqtt_buffer, params->mqtt_host, params->mqtt_port,
-                    params->root_ca, params->cert, params->key,
-                    params->thing_name);
+  bool connected = false;
+  if (params->online) {
+    connected = connect_broker(params, select_transport(params->transport),
+                               BROKER_KEEP_ALIVE_S);
+    net_policy_report(params->net_state, connected);
+  }
+
+  // Alerts from the previous cycle don't wait for this one's sensors.
+  if (connected) {
+    publish_alerts(results);
+  }
+
+  wait_for_sensors(results);
+  if (check_alerts(results) > 0) {
+    if (connected) {
+      publish_alerts(results);
+    } else {
+      results->alert_wake = true;
+    }
+  }
 
-  xEventGroupWaitBits(event_group,
-                      LDR_TASK_BIT | GAS_TASK_BIT | DHT_TASK_BIT |
-                          CO2_TASK_BIT | POWER_TASK_BIT,
-                      pdTRUE, pdTRUE, portMAX_DELAY);
+  // Woken up for an alert while the window is still aggregating.
+  if (!params->publish_due) {
+    if (connected) {
+      disconnect_from_broker(&mqtt_context, &network_context);
+    }
+    xEventGroupSetBits(event_group, MQTT_TASK_BIT);
+    vTaskDelete(NULL);
+  }
+
+  cycle_phase_begin(cycle, CYCLE_PHASE_PUBLISH, now_ms());
+
+  // Normally long done by now, SNTP was started together with Wi-Fi.
+  if (params->online && !time_sync_wait(TIME_SYNC_WAIT_MS)) {
+    ESP_LOGW(TAG, "Time not synchronized, using the drift corrected clock");
+  }
 
   char topic[128];
-  char message[1024];
-  sprintf(message, PAYLOAD_TEMPLATE, results->dht.temperature,
-          results->dht.humidity, results->gas.level, results->ldr.light,
-          results->co2.ppm, results->co2.temperature, results->power.volts);
+  bool summary =
+      battery_policy_window(results->profile,
+                            results->config->aggregate_cycles) > 0;
+  int message_len = render_reading(params, summary, message, sizeof(message));
   sprintf(topic, TOPIC_TEMPLATE, params->thing_name);
 
-  ESP_LOGI(TAG, "Publishing reading [%s]", message);
+  // The wake-up is when this reading started.
+  bool kept;
+  MQTTStatus_t ret = deliver(topic, message, message_len, connected,
+                             backlog_ready ? &backlog : NULL, 0, &kept);
+  if (kept) {
+    reset_window(results);
+  }
 
-  MQTTStatus_t ret = publish_message(&mqtt_context, topic, message, MQTTQoS1);
-  if (ret != MQTTSuccess) {
-    ESP_LOGI(TAG, "Failed to send mqtt message: %d", ret);
+  if (connected && ret == MQTTSuccess) {
+    // The retained config normally arrives before the PUBACK, only wait for
+    // it briefly when nothing came in.
+    TickType_t start = xTaskGetTickCount();
+    while (!config_received &&
+           (xTaskGetTickCount() - start) * portTICK_PERIOD_MS <
+               CONFIG_WAIT_MS) {
+      MQTT_ProcessLoop(&mqtt_context, 50);
+    }
+
+    drain_backlog(backlog_ready ? &backlog : NULL, topic,
+                  params->flush_backlog ? UINT32_MAX
+                                        : results->config->backlog_drain);
+    serve_history();
+    download_update(params->thing_name, params->ota_public_key);
+  }
+  cycle_phase_end(cycle, CYCLE_PHASE_PUBLISH, true, now_ms());
+
+  if (connected) {
+    measure_heap();
+    disconnect_from_broker(&mqtt_context, &network_context);
+  }
+
+  xEventGroupSetBits(event_group, MQTT_TASK_BIT);
+  vTaskDelete(NULL);
+}
+
+// Keeps a single MQTT connection open and samples every sleep_seconds
+// instead of rebooting from deep sleep. Returns to the deep sleep cycle
+// (by setting MQTT_TASK_BIT) once run_mode is changed remotely.
+void mqtt_connected_task(void *param) {
+  mqtt_params *params = (mqtt_params *)param;
+  task_results *results = params->results;
+  event_group = results->tasks_event;
+
+  device_config config = *results->config;
+  running_config = &config;
+  results->config = &config;
+  cycle = results->cycle;
+
+  sprintf(config_topic, CONFIG_TOPIC_TEMPLATE, params->thing_name);
+  sprintf(alert_topic, ALERT_TOPIC_TEMPLATE, params->thing_name);
+  sprintf(ota_chunk_topic, OTA_CHUNK_TOPIC_TEMPLATE, params->thing_name);
+  sprintf(history_request_topic, HISTORY_REQUEST_TOPIC_TEMPLATE,
+          params->thing_name);
+  sprintf(history_topic, HISTORY_TOPIC_TEMPLATE, params->thing_name);
+
+  sprintf(nodes_topic, NODES_TOPIC_TEMPLATE, params->thing_name);
+  espnow_batch_reset(&node_batch);
+
+  char topic[128];
+  sprintf(topic, TOPIC_TEMPLATE, params->thing_name);
+
+  flash_dev backlog_dev;
+  record_log backlog;
+  bool backlog_ready = open_backlog(&backlog_dev, &backlog);
+  const mqtt_transport *transport = select_transport(params->transport);
+
+  bool connected = false;
+  bool confirmed = false;
+  uint32_t retry_ms = CONNECTED_RETRY_MIN_MS;
+  TickType_t retry_at = xTaskGetTickCount();
+
+  // A gateway stays connected whatever the run mode.
+  bool gateway = params->espnow->role == ESPNOW_ROLE_GATEWAY;
+  uint32_t poll_ms = gateway ? GATEWAY_POLL_MS : CONNECTED_POLL_MS;
+  while (config.run_mode == RUN_MODE_CONNECTED || gateway) {
+    TickType_t started = xTaskGetTickCount();
+    int64_t sampled_us = esp_timer_get_time();
+    cycle_budget_start(cycle, config.awake_budget_ms, sampled_us / 1000);
+
+    if (!connected && (int32_t)(started - retry_at) >= 0) {
+      connected = connect_broker(params, transport, CONNECTED_KEEP_ALIVE_S);
+      net_policy_report(params->net_state, connected);
+
+      if (connected) {
+        retry_ms = CONNECTED_RETRY_MIN_MS;
+      } else {
+        retry_at = started + retry_ms / portTICK_PERIOD_MS;
+        retry_ms *= 2;
+        if (retry_ms > CONNECTED_RETRY_MAX_MS) {
+          retry_ms = CONNECTED_RETRY_MAX_MS;
+        }
+      }
+    }
+
+    cycle_phase_begin(cycle, CYCLE_PHASE_SENSORS, now_ms());
+    start_sensor_tasks(results);
+    EventBits_t bits;
+    while (((bits = xEventGroupWaitBits(event_group, SENSOR_TASK_BITS, pdFALSE,
+                                        pdTRUE, 100 / portTICK_PERIOD_MS)) &
+            SENSOR_TASK_BITS) != SENSOR_TASK_BITS &&
+           cycle_phase_left(cycle, CYCLE_PHASE_SENSORS, now_ms()) > 0) {
+      if (connected && MQTT_ProcessLoop(&mqtt_context, 0) != MQTTSuccess) {
+        disconnect_from_broker(&mqtt_context, &network_context);
+        connected = false;
+      }
+      forward_node_readings(params, connected);
+    }
+    xEventGroupClearBits(event_group, SENSOR_TASK_BITS);
+    cycle_phase_end(cycle, CYCLE_PHASE_SENSORS,
+                    (bits & SENSOR_TASK_BITS) == SENSOR_TASK_BITS, now_ms());
+    check_sensors(results, bits);
+    calibrate(results);
+    record_history(results);
+    check_alerts(results);
+    if (connected) {
+      publish_alerts(results);
+    }
+
+    cycle_phase_begin(cycle, CYCLE_PHASE_PUBLISH, now_ms());
+    results->reading.uptime = time_sync_uptime();
+
+    // With a LAN collector scraping every sample, the uplink only carries a
+    // summary every aggregate_cycles samples.
+    bool lan = config.metrics_port > 0 && config.aggregate_cycles > 0;
+    if (config.metrics_port > 0 && metrics_server_start(config.metrics_port)) {
+      update_metrics(results);
+    } else if (config.metrics_port == 0) {
+      metrics_server_stop();
+    }
+
+    MQTTStatus_t ret = MQTTSuccess;
+    if (!lan || results->window->cycles >= config.aggregate_cycles) {
+      int message_len = render_reading(params, lan, message, sizeof(message));
+      bool kept;
+      ret = deliver(topic, message, message_len, connected,
+                    backlog_ready ? &backlog : NULL, sampled_us, &kept);
+      if (kept) {
+        reset_window(results);
+      }
+    }
+    // Counts the next sample, the first one was counted at boot.
+    results->window->cycles++;
+
+    if (connected && ret != MQTTSuccess) {
+      disconnect_from_broker(&mqtt_context, &network_context);
+      connected = false;
+    } else if (connected) {
+      drain_backlog(backlog_ready ? &backlog : NULL, topic,
+                    config.backlog_drain);
+      serve_history();
+      measure_heap();
+    }
+    session_commands = 0;
+
+    if (results->executed_commands) {
+      device_config_clear_commands(results->executed_commands);
+      results->executed_commands = 0;
+    }
+
+    if (config_updated) {
+      config_updated = false;
+      device_config_load(&config);
+      if (connected) {
+        download_update(params->thing_name, params->ota_public_key);
+      }
+    }
+    cycle_phase_end(cycle, CYCLE_PHASE_PUBLISH, true, now_ms());
+    cycle_budget_finish(cycle, results->history, sampled_us / 1000, now_ms());
+    // Like a finished deep sleep cycle, a round through is enough to keep a
+    // new image even without the broker.
+    if (!confirmed) {
+      ota_update_confirm();
+      confirmed = true;
+    }
+
+    TickType_t period = config.sleep_seconds * 1000 / portTICK_PERIOD_MS;
+    while (xTaskGetTickCount() - started < period) {
+      if (!connected) {
+        vTaskDelay(poll_ms / portTICK_PERIOD_MS);
+      } else if (MQTT_ProcessLoop(&mqtt_context, poll_ms) != MQTTSuccess) {
+        ESP_LOGW(TAG, "Connection lost, reconnecting");
+        disconnect_from_broker(&mqtt_context, &network_context);
+        connected = false;
+      }
+      forward_node_readings(params, connected);
+    }
   }
 
-  do {
-    ret = MQTT_ProcessLoop(&mqtt_context, 2000);
-    vTaskDelay(3000 / portTICK_PERIOD_MS);
-  } while (ret == MQTTSuccess);
+  ESP_LOGI(TAG, "Leaving always-connected mode");
+  if (connected) {
+    disconnect_from_broker(&mqtt_context, &network_context);
+  }
 
+  xEventGroupSetBits(event_group, MQTT_TASK_BIT);
   vTaskDelete(NULL);
-}
\ No newline at end of file
+}
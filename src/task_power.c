@@ -1,3 +1,4 @@
+#include "power_mode.h"
 #include "tasks.h"
 #include <math.h>
 
@@ -11,27 +12,38 @@
 #define ADC_ATTENUATION ADC_ATTEN_DB_0
 #define ADC_BIT_SIZE ADC_WIDTH_12Bit
 
+// Characterized once per boot, the always-connected mode runs this task
+// every cycle.
+static esp_adc_cal_characteristics_t adc_chars;
+static bool adc_characterized;
+
 void power_task(void *param) {
   task_results *results = (task_results *)param;
+  int64_t started_us = esp_timer_get_time();
 
   adc1_config_width(ADC_BIT_SIZE);
   adc1_config_channel_atten(POWER_PIN, ADC_ATTENUATION);
 
-  esp_adc_cal_characteristics_t *adc_chars = calloc(1, sizeof(esp_adc_cal_characteristics_t));
-  esp_adc_cal_characterize(ADC_UNIT, ADC_ATTENUATION, ADC_BIT_SIZE, DEFAULT_VREF, adc_chars);
+  if (!adc_characterized) {
+    esp_adc_cal_characterize(ADC_UNIT, ADC_ATTENUATION, ADC_BIT_SIZE,
+                             DEFAULT_VREF, &adc_chars);
+    adc_characterized = true;
+  }
 
   int power_sum = 0;
+  power_phase_begin(POWER_PHASE_SENSE);
   for (int i = 0; i < SAMPLES; i++) {
     power_sum += adc1_get_raw(POWER_PIN);
   }
+  power_phase_end(POWER_PHASE_SENSE);
 
   int voltage = (power_sum / SAMPLES);
-  voltage = esp_adc_cal_raw_to_voltage(voltage, adc_chars);
+  voltage = esp_adc_cal_raw_to_voltage(voltage, &adc_chars);
   voltage = voltage / REDUCTION_FACTOR;
   voltage = roundf(voltage * 100) / 100;
 
-  results->power.volts = voltage;
+  results->reading.power.volts = voltage;
+  stats_add(&results->window->metrics[METRIC_POWER_VOLTS], voltage);
 
-  xEventGroupSetBits(results->tasks_event, POWER_TASK_BIT);
-  vTaskDelete(NULL);
+  finish_sensor_task(results, SENSOR_POWER, voltage > 0, started_us);
 }
\ No newline at end of file
@@ -0,0 +1,121 @@
+#include <string.h>
+#include <sys/time.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_sntp.h"
+
+#include "clock_drift.h"
+#include "time_sync.h"
+
+static const char *TAG = "TIME";
+
+// The system clock keeps running from the RTC through deep sleep, but on the
+// internal RC oscillator it drifts by hundreds of ppm. Its drift is learnt
+// from the offsets seen at each sync so SNTP is only needed once the
+// uncertainty of the corrected time grows too large.
+static RTC_DATA_ATTR clock_drift drift;
+static RTC_DATA_ATTR bool origin_set;
+static RTC_DATA_ATTR int64_t origin_us;
+
+static bool started;
+
+static int64_t local_time_us(void) {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+// Replaces the weak lwIP hook, so the clock error can be measured before the
+// system clock is stepped.
+void sntp_sync_time(struct timeval *tv) {
+  int64_t local_us = local_time_us();
+  int64_t true_us = (int64_t)tv->tv_sec * 1000000 + tv->tv_usec;
+
+  clock_drift_sync(&drift, local_us, true_us);
+  settimeofday(tv, NULL);
+  origin_us += true_us - local_us;
+
+  ESP_LOGI(TAG, "Clock stepped by %lldms, drift %.1fppm (+-%.1f, %u samples)",
+           (true_us - local_us) / 1000, drift.drift_ppm, drift.spread_ppm,
+           drift.samples);
+  sntp_set_sync_status(SNTP_SYNC_STATUS_COMPLETED);
+}
+
+void time_sync_init(void) {
+  if (!origin_set) {
+    origin_us = local_time_us();
+    origin_set = true;
+  }
+}
+
+void time_sync_reset(void) {
+  memset(&drift, 0, sizeof(drift));
+  origin_set = false;
+}
+
+bool time_sync_due(void) {
+  int64_t local_us = local_time_us();
+  int64_t true_us;
+  uint32_t uncertainty_us;
+
+  if (!clock_drift_correct(&drift, local_us, &true_us, &uncertainty_us)) {
+    return true;
+  }
+
+  return uncertainty_us / 1000 > TIME_SYNC_MAX_UNCERTAINTY_MS ||
+         true_us - drift.sync_us > (int64_t)TIME_SYNC_MAX_AGE_S * 1000000;
+}
+
+void time_sync_start(void) {
+  ESP_LOGI(TAG, "Synchronizing time with %s", TIME_SYNC_SERVER);
+  sntp_setoperatingmode(SNTP_OPMODE_POLL);
+  sntp_setservername(0, TIME_SYNC_SERVER);
+  sntp_init();
+  started = true;
+}
+
+bool time_sync_wait(uint32_t timeout_ms) {
+  TickType_t start = xTaskGetTickCount();
+
+  while (started && sntp_get_sync_status() != SNTP_SYNC_STATUS_COMPLETED) {
+    if ((xTaskGetTickCount() - start) * portTICK_PERIOD_MS >= timeout_ms) {
+      return false;
+    }
+    vTaskDelay(50 / portTICK_PERIOD_MS);
+  }
+
+  return true;
+}
+
+void time_sync_stop(void) {
+  if (started) {
+    sntp_stop();
+    started = false;
+  }
+}
+
+bool time_sync_now(int64_t *unix_ms, uint32_t *uncertainty_ms) {
+  int64_t true_us;
+  uint32_t uncertainty_us;
+
+  if (!clock_drift_correct(&drift, local_time_us(), &true_us,
+                           &uncertainty_us)) {
+    return false;
+  }
+
+  *unix_ms = true_us / 1000;
+  *uncertainty_ms = (uncertainty_us + 999) / 1000;
+  return true;
+}
+
+uint32_t time_sync_uptime(void) {
+  return (uint32_t)(time_sync_uptime_ms() / 1000);
+}
+
+int64_t time_sync_uptime_ms(void) {
+  return (local_time_us() - origin_us) / 1000;
+}
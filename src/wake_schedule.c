@@ -0,0 +1,34 @@
+#include "wake_schedule.h"
+
+uint32_t wake_schedule_phase(const char *device_id, uint32_t period_ms) {
+  // FNV-1a, names of a fleet usually only differ in a few characters.
+  uint32_t hash = 2166136261u;
+
+  for (const char *c = device_id; *c; c++) {
+    hash = (hash ^ (uint8_t)*c) * 16777619u;
+  }
+
+  return period_ms ? hash % period_ms : 0;
+}
+
+uint32_t wake_schedule_delay(int64_t now_ms, bool aligned, uint32_t period_ms,
+                             uint32_t phase_ms, uint32_t jitter_ms,
+                             uint32_t random) {
+  uint32_t delay = period_ms;
+
+  // Only possible on a synchronized clock, otherwise every device has its
+  // own idea of where the period starts.
+  if (aligned && period_ms > 0) {
+    int64_t into_period = now_ms % period_ms;
+    delay = (uint32_t)((phase_ms + period_ms - into_period) % period_ms);
+    if (delay < WAKE_MIN_SLEEP_MS) {
+      delay += period_ms;
+    }
+  }
+
+  if (jitter_ms > 0) {
+    delay += random % (jitter_ms + 1);
+  }
+
+  return delay;
+}
@@ -0,0 +1,145 @@
+#include <string.h>
+
+#include "esp_attr.h"
+#include "esp_sleep.h"
+#include "rom/rtc.h"
+#include "soc/rtc.h"
+#include "soc/rtc_cntl_reg.h"
+#include "soc/sens_reg.h"
+#include "soc/uart_reg.h"
+
+#include "wake_stub.h"
+
+// MQ gas sensor on GPIO33, the only sensor that can be read with nothing
+// but the RTC SAR ADC registers.
+#define STUB_ADC_CHANNEL 5
+#define STUB_ADC_ATTEN_11DB 3
+#define STUB_ADC_READS 4
+
+typedef struct {
+  bool armed;
+  uint32_t max_cycles;
+  uint16_t gas_threshold;
+  uint64_t period_ticks;
+  uint32_t cycles;
+  uint32_t samples;
+  uint16_t values[WAKE_STUB_MAX_SAMPLES];
+  uint64_t awake_ticks;
+  bool threshold_hit;
+} stub_state;
+
+static RTC_DATA_ATTR stub_state stub;
+
+// Everything below runs from RTC fast memory before the flash cache is up:
+// no IDF calls, no flash constants and no 64 bit divisions (libgcc).
+static uint64_t RTC_IRAM_ATTR rtc_ticks(void) {
+  SET_PERI_REG_MASK(RTC_CNTL_TIME_UPDATE_REG, RTC_CNTL_TIME_UPDATE_M);
+  while (GET_PERI_REG_MASK(RTC_CNTL_TIME_UPDATE_REG, RTC_CNTL_TIME_VALID_M) ==
+         0) {
+  }
+
+  return READ_PERI_REG(RTC_CNTL_TIME0_REG) |
+         ((uint64_t)READ_PERI_REG(RTC_CNTL_TIME1_REG) << 32);
+}
+
+static uint16_t RTC_IRAM_ATTR read_gas(void) {
+  uint32_t sum = 0;
+
+  SET_PERI_REG_BITS(SENS_SAR_MEAS_WAIT2_REG, SENS_FORCE_XPD_SAR, 3,
+                    SENS_FORCE_XPD_SAR_S);
+  SET_PERI_REG_BITS(SENS_SAR_START_FORCE_REG, SENS_SAR1_BIT_WIDTH, 3,
+                    SENS_SAR1_BIT_WIDTH_S);
+  SET_PERI_REG_BITS(SENS_SAR_READ_CTRL_REG, SENS_SAR1_SAMPLE_BIT, 3,
+                    SENS_SAR1_SAMPLE_BIT_S);
+  SET_PERI_REG_MASK(SENS_SAR_READ_CTRL_REG, SENS_SAR1_DATA_INV);
+  SET_PERI_REG_BITS(SENS_SAR_ATTEN1_REG, 3, STUB_ADC_ATTEN_11DB,
+                    STUB_ADC_CHANNEL * 2);
+  SET_PERI_REG_MASK(SENS_SAR_MEAS_START1_REG,
+                    SENS_MEAS1_START_FORCE | SENS_SAR1_EN_PAD_FORCE);
+  SET_PERI_REG_BITS(SENS_SAR_MEAS_START1_REG, SENS_SAR1_EN_PAD,
+                    1 << STUB_ADC_CHANNEL, SENS_SAR1_EN_PAD_S);
+
+  for (int i = 0; i < STUB_ADC_READS; i++) {
+    CLEAR_PERI_REG_MASK(SENS_SAR_MEAS_START1_REG, SENS_MEAS1_START_SAR);
+    SET_PERI_REG_MASK(SENS_SAR_MEAS_START1_REG, SENS_MEAS1_START_SAR);
+    while (GET_PERI_REG_MASK(SENS_SAR_MEAS_START1_REG, SENS_MEAS1_DONE_SAR) ==
+           0) {
+    }
+    sum += GET_PERI_REG_BITS2(SENS_SAR_MEAS_START1_REG, SENS_MEAS1_DATA_SAR,
+                              SENS_MEAS1_DATA_SAR_S);
+  }
+
+  SET_PERI_REG_BITS(SENS_SAR_MEAS_WAIT2_REG, SENS_FORCE_XPD_SAR, 0,
+                    SENS_FORCE_XPD_SAR_S);
+  return (uint16_t)(sum >> 2);
+}
+
+void RTC_IRAM_ATTR esp_wake_deep_sleep(void) {
+  esp_default_wake_deep_sleep();
+
+  if (!stub.armed) {
+    return;
+  }
+
+  uint64_t start = rtc_ticks();
+  uint16_t gas = read_gas();
+
+  if (stub.samples < WAKE_STUB_MAX_SAMPLES) {
+    stub.values[stub.samples++] = gas;
+  }
+  stub.threshold_hit |= stub.gas_threshold > 0 && gas >= stub.gas_threshold;
+
+  // Boot the application for the heartbeat, once the buffer is full or as
+  // soon as the threshold is crossed.
+  if (stub.cycles + 1 >= stub.max_cycles ||
+      stub.samples == WAKE_STUB_MAX_SAMPLES || stub.threshold_hit) {
+    stub.armed = false;
+    return;
+  }
+
+  uint64_t wakeup = start + stub.period_ticks;
+  WRITE_PERI_REG(RTC_CNTL_SLP_TIMER0_REG, wakeup & UINT32_MAX);
+  WRITE_PERI_REG(RTC_CNTL_SLP_TIMER1_REG, wakeup >> 32);
+
+  // Let the ROM finish printing before the UART loses power.
+  while (REG_GET_FIELD(UART_STATUS_REG(0), UART_ST_UTX_OUT)) {
+  }
+
+  stub.cycles++;
+  stub.awake_ticks += rtc_ticks() - start;
+  REG_WRITE(RTC_ENTRY_ADDR_REG, (uint32_t)&esp_wake_deep_sleep);
+  CLEAR_PERI_REG_MASK(RTC_CNTL_STATE0_REG, RTC_CNTL_SLEEP_EN);
+  SET_PERI_REG_MASK(RTC_CNTL_STATE0_REG, RTC_CNTL_SLEEP_EN);
+  while (true) {
+  }
+}
+
+void wake_stub_arm(uint32_t period_ms, uint32_t max_cycles,
+                   uint16_t gas_threshold) {
+  stub.period_ticks = rtc_time_us_to_slowclk((uint64_t)period_ms * 1000,
+                                             REG_READ(RTC_SLOW_CLK_CAL_REG));
+  stub.max_cycles = max_cycles;
+  stub.gas_threshold = gas_threshold;
+  stub.armed = max_cycles > 1;
+
+  // Keeps the SAR ADC pad set up by gas_task alive through deep sleep.
+  if (stub.armed) {
+    esp_sleep_pd_config(ESP_PD_DOMAIN_RTC_PERIPH, ESP_PD_OPTION_ON);
+  }
+}
+
+void wake_stub_reset(void) { memset(&stub, 0, sizeof(stub)); }
+
+void wake_stub_collect(wake_stub_report *report) {
+  report->cycles = stub.cycles;
+  report->samples = stub.samples;
+  memcpy(report->values, stub.values, sizeof(report->values));
+  report->awake_us = (uint32_t)rtc_time_slowclk_to_us(
+      stub.awake_ticks, REG_READ(RTC_SLOW_CLK_CAL_REG));
+  report->threshold_hit = stub.threshold_hit;
+
+  stub.cycles = 0;
+  stub.samples = 0;
+  stub.awake_ticks = 0;
+  stub.threshold_hit = false;
+}
@@ -0,0 +1,304 @@
+// Host checks of the alert rules replayed against sensor traces.
+//
+//   cc -O2 -Iinclude -o alert_check tools/alert_check.c src/alert.c -lm
+//   ./alert_check
+//
+// Replays CO2 and gas traces through alert_monitor_update every 15 s like
+// the deep sleep cycle, and checks which events are raised and cleared,
+// and when: the hold time, the holdoff between raises, the hysteresis,
+// missing and unsettled readings and a full queue. Then prints how late a
+// breach is raised after its hold time, counted from the first reading that
+// saw it and from when it started, with and without the shortened sleep
+// from alert_monitor_next_ms.
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alert.h"
+#include "check.h"
+
+#define PERIOD_MS 15000
+#define ALERT_WAKE_MS 100
+#define HOLD_S 30
+#define HOLDOFF_S 300
+
+static alert_rule rules[ALERT_RULE_COUNT];
+
+static void load_rules(void) {
+  device_config config;
+
+  memset(&config, 0, sizeof(config));
+  config.co2_threshold_ppm = 2000;
+  config.alert_co2_rise = 300;
+  config.alert_gas_ppm = 500;
+  config.alert_hold_s = HOLD_S;
+  config.alert_holdoff_s = HOLDOFF_S;
+  alert_rules_load(&config, rules);
+}
+
+// A trace gives the CO2 and gas at a time, NAN when it is missing.
+typedef void (*trace)(int64_t ms, float *co2, float *gas);
+
+typedef struct {
+  alert_rule_id rule;
+  alert_event event;
+  // The detection time in seconds.
+  int64_t at_s;
+} expected;
+
+// Replays a trace for the given time every period and checks the events,
+// in order. Takes everything off the queue as it goes, like a connected
+// cycle would, unless keep is set.
+static void replay(const char *name, trace next, int64_t duration_s,
+                   const expected *expect, size_t count, bool keep,
+                   alert_monitor *monitor) {
+  size_t seen = 0;
+
+  memset(monitor, 0, sizeof(*monitor));
+  for (int64_t ms = 0; ms <= duration_s * 1000; ms += PERIOD_MS) {
+    float co2, gas, values[ALERT_RULE_COUNT];
+
+    next(ms, &co2, &gas);
+    values[ALERT_RULE_CO2] = co2;
+    values[ALERT_RULE_CO2_RISE] = co2;
+    values[ALERT_RULE_GAS] = gas;
+    int events = alert_monitor_update(monitor, rules, values, ms);
+
+    for (uint32_t i = monitor->queued - events; i < monitor->queued; i++) {
+      const alert_record *record = &monitor->queue[i];
+      bool match = seen < count && record->rule == expect[seen].rule &&
+                   record->event == expect[seen].event &&
+                   record->detected_ms == expect[seen].at_s * 1000;
+      if (!match) {
+        printf("%s: unexpected %s %s at %llds\n", name,
+               rules[record->rule].name,
+               record->event == ALERT_RAISED ? "raised" : "cleared",
+               (long long)(record->detected_ms / 1000));
+        failures++;
+      }
+      seen++;
+    }
+    while (!keep && monitor->queued > 0) {
+      alert_monitor_pop(monitor);
+    }
+  }
+
+  if (seen < count) {
+    printf("%s: %zu of %zu events missing\n", name, count - seen, count);
+    failures++;
+  }
+}
+
+// A meeting room filling up over half an hour, then a window opened.
+static void stuffy_room(int64_t ms, float *co2, float *gas) {
+  double minutes = ms / 60000.0;
+
+  *co2 = minutes < 30   ? 600 + 60 * minutes
+         : minutes < 40 ? 2400
+                        : 2400 - 250 * (minutes - 40);
+  *co2 = *co2 < 450 ? 450 : *co2;
+  *gas = 100;
+}
+
+// A minute over the threshold, then readings scattered around it that the
+// hysteresis keeps from clearing.
+static void hovering(int64_t ms, float *co2, float *gas) {
+  static const float offsets[] = {-40, 60, 10, -90, 30, -120, 80, -60};
+
+  *co2 = ms < 120000   ? 1000
+         : ms < 180000 ? 2100
+                       : 1950 + offsets[(ms / PERIOD_MS) % 8];
+  *gas = 100;
+}
+
+// Spikes shorter than the hold time.
+static void spikes(int64_t ms, float *co2, float *gas) {
+  int64_t cycle = ms / PERIOD_MS;
+
+  *co2 = cycle % 10 == 5 || cycle % 10 == 6 ? 2600 : 900;
+  *gas = cycle % 20 == 3 ? 900 : 120;
+}
+
+// Two breaches a few minutes apart, the second is held back until the
+// holdoff from the first raise has passed.
+static void repeated(int64_t ms, float *co2, float *gas) {
+  int64_t s = ms / 1000;
+
+  *co2 = (s >= 60 && s < 150) || (s >= 240 && s < 600) ? 2200 : 1200;
+  *gas = 100;
+}
+
+// CO2 climbing 400 ppm a minute for five minutes, well under the level
+// threshold for the first three.
+static void fast_rise(int64_t ms, float *co2, float *gas) {
+  double minutes = ms / 60000.0;
+
+  *co2 = minutes < 2 ? 500 : minutes < 7 ? 500 + 400 * (minutes - 2) : 2500;
+  *gas = 100;
+}
+
+// The CO2 sensor drops out during a breach, which neither clears nor
+// raises it; gas readings before the heater settled are missing too.
+static void dropouts(int64_t ms, float *co2, float *gas) {
+  int64_t s = ms / 1000;
+
+  *co2 = s >= 60 && s < 105 ? NAN : s < 300 ? 2300 : 800;
+  *gas = s < 120 ? NAN : 700;
+}
+
+static void check_traces(void) {
+  alert_monitor monitor;
+
+  const expected room[] = {
+      // 2000 ppm is crossed at 23:20 and first read at 23:30, raised one
+      // hold later.
+      {ALERT_RULE_CO2, ALERT_RAISED, 1440},
+      // Under 1800 at 42:24.
+      {ALERT_RULE_CO2, ALERT_CLEARED, 2550},
+  };
+  replay("stuffy room", stuffy_room, 3600, room, 2, false, &monitor);
+  CHECK(monitor.suppressed == 0 && monitor.dropped == 0);
+
+  const expected hover[] = {{ALERT_RULE_CO2, ALERT_RAISED, 150}};
+  replay("hovering", hovering, 1800, hover, 1, false, &monitor);
+
+  replay("spikes", spikes, 3600, NULL, 0, false, &monitor);
+  CHECK(monitor.suppressed == 0);
+
+  const expected twice[] = {
+      {ALERT_RULE_CO2, ALERT_RAISED, 90},
+      {ALERT_RULE_CO2, ALERT_CLEARED, 150},
+      // Breached again at 240, held to 270 but the holdoff runs to 390.
+      {ALERT_RULE_CO2, ALERT_RAISED, 390},
+      {ALERT_RULE_CO2, ALERT_CLEARED, 600},
+  };
+  replay("repeated", repeated, 900, twice, 4, false, &monitor);
+  // The readings from 270 to 375 were kept back by the holdoff.
+  CHECK(monitor.suppressed == 8);
+
+  const expected rise[] = {
+      // Rising from 120s, the first rate is known at 135s.
+      {ALERT_RULE_CO2_RISE, ALERT_RAISED, 165},
+      // 2000 ppm at 345s.
+      {ALERT_RULE_CO2, ALERT_RAISED, 375},
+      {ALERT_RULE_CO2_RISE, ALERT_CLEARED, 435},
+  };
+  replay("fast rise", fast_rise, 900, rise, 3, false, &monitor);
+
+  const expected gaps[] = {
+      {ALERT_RULE_CO2, ALERT_RAISED, 30},
+      {ALERT_RULE_GAS, ALERT_RAISED, 150},
+      {ALERT_RULE_CO2, ALERT_CLEARED, 300},
+  };
+  replay("dropouts", dropouts, 600, gaps, 3, false, &monitor);
+
+  // With nothing delivered, the queue keeps the newest events.
+  const expected many[] = {
+      {ALERT_RULE_CO2, ALERT_RAISED, 90},
+      {ALERT_RULE_CO2, ALERT_CLEARED, 150},
+      {ALERT_RULE_CO2, ALERT_RAISED, 390},
+      {ALERT_RULE_CO2, ALERT_CLEARED, 600},
+  };
+  replay("kept", repeated, 900, many, 4, true, &monitor);
+  CHECK(monitor.queued == 4 && monitor.dropped == 0);
+  for (int i = 0; i < 3; i++) {
+    int64_t ms = 1000000 + i * 400000;
+    alert_monitor_update(&monitor, rules, (float[]){2500, NAN, NAN}, ms);
+    alert_monitor_update(&monitor, rules, (float[]){2500, NAN, NAN},
+                         ms + HOLD_S * 1000);
+    alert_monitor_update(&monitor, rules, (float[]){1000, NAN, NAN},
+                         ms + 60000);
+  }
+  CHECK(monitor.queued == ALERT_QUEUE_SIZE && monitor.dropped == 2);
+  CHECK(monitor.queue[0].detected_ms == 390000);
+  CHECK(monitor.queue[ALERT_QUEUE_SIZE - 1].event == ALERT_CLEARED);
+}
+
+static void check_values(void) {
+  reading value = {.co2 = {1500, 21}, .gas = {2000, 640, 0}};
+  float values[ALERT_RULE_COUNT];
+
+  alert_values(&value, values);
+  CHECK(values[ALERT_RULE_CO2] == 1500 && values[ALERT_RULE_CO2_RISE] == 1500);
+  // The heater has not settled yet.
+  CHECK(isnan(values[ALERT_RULE_GAS]));
+  value.gas.stable = 1;
+  value.missing = READING_MISSING(co2);
+  alert_values(&value, values);
+  CHECK(isnan(values[ALERT_RULE_CO2]) && isnan(values[ALERT_RULE_CO2_RISE]));
+  CHECK(values[ALERT_RULE_GAS] == 640);
+
+  // A disabled rule never raises.
+  alert_rule off = rules[ALERT_RULE_CO2];
+  alert_state state = {0};
+  off.threshold = 0;
+  for (int i = 0; i < 100; i++) {
+    CHECK(alert_evaluate(&off, &state, 1e6f, i * 1000LL) == ALERT_NONE);
+  }
+}
+
+// Breaches starting at random points of the cycle, with and without the
+// sleep cut short at the end of the hold time. The hold is set to 40 s so
+// it does not end on a cycle.
+static void measure_latency(bool wake_early) {
+  alert_rule rule[ALERT_RULE_COUNT];
+  int64_t worst = 0, total = 0, worst_held = 0, total_held = 0;
+  const int breaches = 1000;
+
+  memcpy(rule, rules, sizeof(rule));
+  rule[ALERT_RULE_CO2].hold_ms = 40000;
+
+  srand(7);
+  for (int n = 0; n < breaches; n++) {
+    alert_monitor monitor = {0};
+    int64_t start_ms = 60000 + rand() % PERIOD_MS;
+    int64_t seen_ms = -1;
+    int64_t ms = 0;
+
+    for (;;) {
+      float co2 = ms >= start_ms ? 2500 : 900;
+      if (co2 > 2000 && seen_ms < 0) {
+        seen_ms = ms;
+      }
+      alert_monitor_update(&monitor, rule, (float[]){co2, NAN, NAN}, ms);
+      if (monitor.queued > 0) {
+        break;
+      }
+
+      int64_t sleep_ms = PERIOD_MS;
+      int64_t next_ms = alert_monitor_next_ms(&monitor, rule, ms);
+      if (wake_early && next_ms >= 0 && next_ms < sleep_ms) {
+        sleep_ms = next_ms < ALERT_WAKE_MS ? ALERT_WAKE_MS : next_ms;
+      }
+      ms += sleep_ms;
+    }
+
+    // Never before the hold has passed from the reading that saw it.
+    int64_t held = monitor.queue[0].detected_ms - (seen_ms + 40000);
+    int64_t late = monitor.queue[0].detected_ms - (start_ms + 40000);
+    CHECK(held >= 0);
+    total += late;
+    worst = late > worst ? late : worst;
+    total_held += held;
+    worst_held = held > worst_held ? held : worst_held;
+  }
+
+  printf("%-18s %9.1f %9.1f %11.1f %9.1f\n",
+         wake_early ? "waking at the hold" : "on the cycle",
+         total_held / 1000.0 / breaches, worst_held / 1000.0,
+         total / 1000.0 / breaches, worst / 1000.0);
+}
+
+int main(void) {
+  load_rules();
+  check_values();
+  check_traces();
+  printf("seconds raised after the 40 s hold, 15 s cycle\n");
+  printf("%-18s %9s %9s %11s %9s\n", "", "seen mean", "worst", "start mean",
+         "worst");
+  measure_latency(false);
+  measure_latency(true);
+
+  return check_result();
+}
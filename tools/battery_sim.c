@@ -0,0 +1,141 @@
+// Host simulation of a battery discharge under the battery profiles. It
+// runs the policy on a single Li-ion cell and prints the projected runtime
+// and the time spent in each profile for a few threshold sets.
+//
+//   cc -O2 -Iinclude -o battery_sim tools/battery_sim.c src/battery_policy.c
+//   ./battery_sim [capacity_mah] [sleep_seconds] [aggregate_cycles]
+//
+// The draw per cycle is a rough model of this board: the sensors it reads,
+// a Wi-Fi upload when the window is published and the deep sleep current in
+// between. The supply reading gets up to SUPPLY_NOISE_MV of noise, like the
+// ADC, to show how often the profile changes.
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "battery_policy.h"
+#include "power_mode.h"
+
+#define SLEEP_UA 150
+#define BOOT_MS 300
+#define UPLOAD_MS 3000
+#define SUPPLY_NOISE_MV 30
+#define CUTOFF_MV 3000
+
+// Time and current over the sense draw for each sensor read.
+static const struct {
+  uint32_t ms;
+  uint32_t ma;
+} sensor_draw[SENSOR_COUNT] = {
+    [SENSOR_CO2] = {1000, 60},  [SENSOR_DHT] = {2000, 1},
+    [SENSOR_GAS] = {1000, 150}, [SENSOR_LDR] = {50, 1},
+    [SENSOR_POWER] = {50, 0},
+};
+
+// Open circuit voltage of a Li-ion cell by charge left, in 10% steps.
+static const uint32_t cell_mv[11] = {3000, 3450, 3600, 3680, 3740, 3790,
+                                     3840, 3900, 3980, 4070, 4200};
+
+static uint32_t supply_mv(double charge) {
+  double at = charge * 10;
+  int step = (int)at;
+
+  if (step >= 10) {
+    return cell_mv[10];
+  }
+  return cell_mv[step] + (uint32_t)((at - step) *
+                                    (cell_mv[step + 1] - cell_mv[step]));
+}
+
+typedef struct {
+  const char *name;
+  uint32_t saving_mv;
+  uint32_t low_mv;
+  uint32_t brownout_mv;
+  uint32_t hysteresis_mv;
+} threshold_set;
+
+static const threshold_set sets[] = {
+    {"no policy", 0, 0, 0, 0},
+    {"brownout only", 0, 0, 3450, 100},
+    {"default", 3750, 3600, 3450, 100},
+    {"early", 3900, 3700, 3500, 100},
+    {"no hysteresis", 3750, 3600, 3450, 0},
+};
+
+static void simulate(const threshold_set *set, double capacity_mah,
+                     uint32_t sleep_seconds, uint32_t aggregate_cycles) {
+  // Only the battery thresholds are used by the policy.
+  device_config config = {0};
+  battery_state state = {0};
+  double used_mas = 0;
+  double capacity_mas = capacity_mah * 3600;
+  double seconds = 0;
+  double profile_s[BATTERY_PROFILE_COUNT] = {0};
+  uint32_t window = 0;
+  uint32_t uploads = 0;
+
+  config.battery_saving_mv = set->saving_mv;
+  config.battery_low_mv = set->low_mv;
+  config.battery_brownout_mv = set->brownout_mv;
+  config.battery_hysteresis_mv = set->hysteresis_mv;
+  srand(1);
+
+  for (;;) {
+    uint32_t mv = supply_mv(1 - used_mas / capacity_mas);
+    if (mv <= CUTOFF_MV) {
+      break;
+    }
+
+    const battery_settings *profile = battery_policy_settings(state.profile);
+    bool flush = state.flush_pending;
+    uint32_t cycles = battery_policy_window(profile, aggregate_cycles);
+    double awake_ms = BOOT_MS;
+    double cycle_mas = BOOT_MS * POWER_IDLE_MA;
+
+    for (int i = 0; i < SENSOR_COUNT; i++) {
+      if (profile->sensors & BATTERY_SENSOR(i)) {
+        cycle_mas += sensor_draw[i].ms *
+                     (double)(POWER_SENSE_MA + sensor_draw[i].ma);
+        awake_ms += sensor_draw[i].ms / 2.0;
+      }
+    }
+
+    window++;
+    if (flush || (profile->uploads && (cycles == 0 || window >= cycles))) {
+      cycle_mas += UPLOAD_MS * (double)POWER_NETWORK_MA;
+      awake_ms += UPLOAD_MS;
+      window = 0;
+      uploads++;
+    }
+    state.flush_pending = false;
+
+    double sleep_s = sleep_seconds * profile->sleep_factor;
+    used_mas += cycle_mas / 1000 + sleep_s * SLEEP_UA / 1000.0;
+    seconds += sleep_s + awake_ms / 1000;
+    profile_s[state.profile] += sleep_s + awake_ms / 1000;
+
+    int noise = rand() % (2 * SUPPLY_NOISE_MV + 1) - SUPPLY_NOISE_MV;
+    battery_policy_update(&state, &config, mv + noise);
+  }
+
+  printf("%-14s %7.1f days, %6u uploads, %4u changes |", set->name,
+         seconds / 86400, uploads, state.changes);
+  for (int i = 0; i < BATTERY_PROFILE_COUNT; i++) {
+    printf(" %s %.1f", battery_profile_name(i), profile_s[i] / 86400);
+  }
+  printf("\n");
+}
+
+int main(int argc, char **argv) {
+  double capacity_mah = argc > 1 ? atof(argv[1]) : 3000;
+  uint32_t sleep_seconds = argc > 2 ? atoi(argv[2]) : DEFAULT_SLEEP_SECONDS;
+  uint32_t aggregate_cycles =
+      argc > 3 ? atoi(argv[3]) : DEFAULT_AGGREGATE_CYCLES;
+
+  printf("%.0f mAh, sleeping %us, publishing every %u cycles\n", capacity_mah,
+         sleep_seconds, aggregate_cycles);
+  for (size_t i = 0; i < sizeof(sets) / sizeof(sets[0]); i++) {
+    simulate(&sets[i], capacity_mah, sleep_seconds, aggregate_cycles);
+  }
+  return 0;
+}
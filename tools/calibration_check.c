@@ -0,0 +1,157 @@
+// Host checks and benchmark of the gas and light calibration.
+//
+//   cc -O2 -Iinclude -o calibration_check tools/calibration_check.c
+//      src/calibration.c -lm
+//   ./calibration_check
+//
+// Compares calibration_gas_ppm and calibration_ldr_lux with the power laws
+// tools/gen_calibration.py samples, evaluated in double, over every ADC
+// value, a range of reference resistances and the temperature and humidity
+// grid, and prints the worst relative error.
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "calibration.h"
+#include "check.h"
+
+// The same curves as tools/gen_calibration.py.
+#define GAS_A 116.6020682
+#define GAS_B -2.769034857
+#define LDR_GAMMA 0.7
+#define ADC_MAX 4095
+
+// Tables are fitted to 0.5%, the compensation grid adds to that between its
+// points. Values are rounded to integers, so small ones are allowed half a
+// unit more.
+#define MAX_GAS_ERROR 0.02
+#define MAX_LUX_ERROR 0.01
+
+static double divider_ratio(int raw) {
+  return (ADC_MAX - raw) / (double)raw;
+}
+
+static double reference_ppm(int raw, uint32_t gas_r0, int temperature,
+                            int humidity) {
+  // The grid covers -10C to 50C, beyond it the edge is used.
+  double t = temperature < -10 ? -10 : temperature > 50 ? 50 : temperature;
+  double h = humidity < 0 ? 0 : humidity > 100 ? 100 : humidity;
+  double factor = 0.00035 * t * t - 0.02718 * t + 1.39538 - (h - 33) * 0.0018;
+
+  return GAS_A * pow(divider_ratio(raw) * CALIBRATION_UNIT / gas_r0 / factor,
+                     GAS_B);
+}
+
+static double reference_lux(int raw, uint32_t ldr_r10) {
+  return 10 * pow(divider_ratio(raw) * CALIBRATION_UNIT / ldr_r10,
+                  -1 / LDR_GAMMA);
+}
+
+// Relative error, or 0 where the reference is outside what is reported.
+static double error_of(int value, double expect, int max) {
+  if (expect < 1 || expect > max * 0.99) {
+    CHECK(value >= 0 && value <= max);
+    return 0;
+  }
+  double error = fabs(value - expect) - 0.5;
+  return error > 0 ? error / expect : 0;
+}
+
+static void check_gas(void) {
+  static const uint32_t r0s[] = {300, 1000, 2500, 5000};
+  double worst = 0;
+  int worst_raw = 0, worst_t = 0, worst_h = 0;
+  uint32_t worst_r0 = 0;
+
+  for (size_t i = 0; i < sizeof(r0s) / sizeof(r0s[0]); i++) {
+    calibration cal;
+    calibration_init(&cal, r0s[i], CALIBRATION_UNIT);
+
+    for (int t = -20; t <= 60; t += 3) {
+      for (int h = 0; h <= 100; h += 7) {
+        int last = 0;
+        for (int raw = 1; raw < ADC_MAX; raw++) {
+          int ppm = calibration_gas_ppm(&cal, raw, t, h);
+          double expect = reference_ppm(raw, r0s[i], t, h);
+          double error = error_of(ppm, expect, CALIBRATION_MAX_PPM);
+
+          // More gas lowers the sensor resistance and raises the reading.
+          CHECK(ppm >= last);
+          last = ppm;
+          if (error > worst) {
+            worst = error;
+            worst_raw = raw;
+            worst_t = t;
+            worst_h = h;
+            worst_r0 = r0s[i];
+          }
+        }
+      }
+    }
+  }
+
+  printf("gas ppm: worst error %.2f%% (raw %d, %dC, %d%% RH, r0 %u)\n",
+         worst * 100, worst_raw, worst_t, worst_h, worst_r0);
+  CHECK(worst <= MAX_GAS_ERROR);
+}
+
+static void check_lux(void) {
+  static const uint32_t r10s[] = {200, 800, 1000, 3000};
+  double worst = 0;
+  int worst_raw = 0;
+  uint32_t worst_r10 = 0;
+
+  for (size_t i = 0; i < sizeof(r10s) / sizeof(r10s[0]); i++) {
+    calibration cal;
+    calibration_init(&cal, CALIBRATION_UNIT, r10s[i]);
+
+    int last = 0;
+    for (int raw = 1; raw < ADC_MAX; raw++) {
+      int lux = calibration_ldr_lux(&cal, raw);
+      double error =
+          error_of(lux, reference_lux(raw, r10s[i]), CALIBRATION_MAX_LUX);
+
+      CHECK(lux >= last);
+      last = lux;
+      if (error > worst) {
+        worst = error;
+        worst_raw = raw;
+        worst_r10 = r10s[i];
+      }
+    }
+  }
+
+  printf("ldr lux: worst error %.2f%% (raw %d, r10 %u)\n", worst * 100,
+         worst_raw, worst_r10);
+  CHECK(worst <= MAX_LUX_ERROR);
+}
+
+static void check_edges(void) {
+  calibration cal;
+
+  calibration_init(&cal, 2500, 800);
+  CHECK(calibration_gas_ppm(&cal, 0, 20, 33) >= 0);
+  CHECK(calibration_gas_ppm(&cal, ADC_MAX, 20, 33) == CALIBRATION_MAX_PPM);
+  CHECK(calibration_gas_ppm(&cal, 2000, -40, 150) > 0);
+  CHECK(calibration_ldr_lux(&cal, 0) >= 0);
+  CHECK(calibration_ldr_lux(&cal, ADC_MAX) == CALIBRATION_MAX_LUX);
+  // Without the DHT the reference conditions are used, on the grid the only
+  // error left is the table's.
+  calibration_init(&cal, CALIBRATION_UNIT, CALIBRATION_UNIT);
+  for (int raw = 1000; raw < 3500; raw += 100) {
+    int ppm = calibration_gas_ppm(&cal, raw, 20, 30);
+    double expect = reference_ppm(raw, CALIBRATION_UNIT, 20, 30);
+    CHECK(fabs(ppm - expect) <= 0.005 * expect + 0.5);
+  }
+  CHECK(calibration_gas_ppm(&cal, 2000, CALIBRATION_REFERENCE_T,
+                            CALIBRATION_REFERENCE_RH) ==
+        calibration_gas_ppm(&cal, 2000, 20, 33));
+}
+
+int main(void) {
+  check_edges();
+  check_gas();
+  check_lux();
+
+  return check_result();
+}
@@ -0,0 +1,49 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+// Shared by the host checks in tools/. Each check is a single translation
+// unit that includes this once, so everything here is static.
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+static int failures;
+
+#define CHECK(cond)                                                            \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      printf("%s:%d: %s\n", __FILE__, __LINE__, #cond);                        \
+      failures++;                                                              \
+    }                                                                          \
+  } while (0)
+
+// xorshift32 with a fixed seed, every run sees the same data.
+static uint32_t check_rng_state = 1;
+
+static inline uint32_t check_random(void) {
+  check_rng_state ^= check_rng_state << 13;
+  check_rng_state ^= check_rng_state >> 17;
+  check_rng_state ^= check_rng_state << 5;
+  return check_rng_state;
+}
+
+// Uniform in (0, 1), never 0 so it can go into log().
+static inline double check_uniform(void) {
+  return ((check_random() >> 8) + 0.5) / 16777216.0;
+}
+
+// Monotonic seconds, for the benchmarks.
+static inline double check_seconds(void) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// Prints the verdict and returns the exit status.
+static inline int check_result(void) {
+  printf("%s\n", failures == 0 ? "OK" : "FAILED");
+  return failures == 0 ? 0 : 1;
+}
+
+#endif
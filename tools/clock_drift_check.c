@@ -0,0 +1,169 @@
+// Host checks of the RTC drift estimator on synthetic clock traces.
+//
+//   cc -O2 -Iinclude -o clock_drift_check tools/clock_drift_check.c
+//      src/clock_drift.c -lm
+//   ./clock_drift_check [days]
+//
+// Runs a device clock with a known skew, a daily temperature swing on top
+// and jumps of its own through the given number of days (default 14) of
+// 15 s cycles. SNTP answers with jitter up to the given bound and is only
+// asked when time_sync_due would, on the cycles that go online. Every cycle
+// the corrected time must be within its uncertainty of the true time,
+// except between a clock jump and the next sync, and the uncertainty may
+// only stay past TIME_SYNC_MAX_UNCERTAINTY_MS until the next online cycle,
+// or longer while the syncs fail.
+#include <math.h>
+#include <stdlib.h>
+
+#include "check.h"
+#include "clock_drift.h"
+#include "time_sync.h"
+
+#define PERIOD_US (15LL * 1000000)
+#define DAY_US (86400LL * 1000000)
+// Only every fourth cycle publishes, and one sync in ten fails.
+#define ONLINE_EVERY 4
+#define SYNC_FAILURE_PCT 10
+
+typedef struct {
+  const char *name;
+  float skew_ppm;
+  // Daily swing around the skew, like a room warming up and cooling down.
+  float swing_ppm;
+  // SNTP error, uniform in [-jitter, jitter].
+  int64_t jitter_us;
+  // Steps of the device clock, e.g. a brownout losing the RTC's fraction.
+  int64_t jump_us;
+  uint32_t jump_every_days;
+} trace;
+
+static const trace traces[] = {
+    {"steady", -150, 0, 20000, 0, 0},
+    {"fast", 400, 0, 20000, 0, 0},
+    {"warm days", 250, 40, 20000, 0, 0},
+    {"noisy sntp", 50, 10, 45000, 0, 0},
+    {"jumps ahead", -150, 20, 20000, 3000000, 3},
+    {"jumps back", 300, 20, 20000, -10000000, 4},
+};
+
+static bool sync_due(const clock_drift *drift, int64_t local_us) {
+  int64_t true_us;
+  uint32_t uncertainty_us;
+
+  if (!clock_drift_correct(drift, local_us, &true_us, &uncertainty_us)) {
+    return true;
+  }
+  return uncertainty_us / 1000 > TIME_SYNC_MAX_UNCERTAINTY_MS ||
+         true_us - drift->sync_us > (int64_t)TIME_SYNC_MAX_AGE_S * 1000000;
+}
+
+static void run(const trace *t, uint32_t days) {
+  clock_drift drift = {0};
+  // The true time and the device clock, which starts out unset.
+  int64_t true_us = 1700000000LL * 1000000, local_us = 0;
+  uint32_t cycles = days * (DAY_US / PERIOD_US);
+  uint32_t syncs = 0, outside = 0, jumped_cycles = 0, over_limit = 0;
+  int64_t worst_error = 0, worst_uncertainty = 0;
+  bool jumped = false, failed = false;
+
+  for (uint32_t cycle = 0; cycle < cycles; cycle++) {
+    double day = (double)cycle * PERIOD_US / DAY_US;
+    double ppm = t->skew_ppm + t->swing_ppm * sin(2 * M_PI * day);
+
+    true_us += PERIOD_US;
+    local_us += PERIOD_US + (int64_t)(PERIOD_US * ppm / 1e6);
+    if (t->jump_every_days > 0 && cycle > 0 &&
+        cycle % (t->jump_every_days * (DAY_US / PERIOD_US)) == 0) {
+      local_us += t->jump_us;
+      jumped = true;
+    }
+
+    bool due = cycle % ONLINE_EVERY == 0 && sync_due(&drift, local_us);
+    if (due && check_random() % 100 < SYNC_FAILURE_PCT) {
+      failed = true;
+    } else if (due) {
+      int64_t jitter =
+          (int64_t)(check_random() % (2 * t->jitter_us + 1)) - t->jitter_us;
+      // Like sntp_sync_time, the clock is stepped to what the server said.
+      clock_drift_sync(&drift, local_us, true_us + jitter);
+      local_us = true_us + jitter;
+      syncs++;
+      jumped = false;
+      failed = false;
+    }
+
+    int64_t corrected_us;
+    uint32_t uncertainty_us;
+    if (!clock_drift_correct(&drift, local_us, &corrected_us,
+                             &uncertainty_us)) {
+      continue;
+    }
+
+    int64_t error = llabs(corrected_us - true_us);
+    if (jumped) {
+      jumped_cycles++;
+      continue;
+    }
+    outside += error > uncertainty_us;
+    if (uncertainty_us / 1000 > TIME_SYNC_MAX_UNCERTAINTY_MS) {
+      over_limit++;
+      CHECK(over_limit < ONLINE_EVERY || failed);
+    } else {
+      over_limit = 0;
+      failed = false;
+    }
+    worst_error = error > worst_error ? error : worst_error;
+    worst_uncertainty =
+        uncertainty_us > worst_uncertainty ? uncertainty_us : worst_uncertainty;
+  }
+
+  printf("%-12s %6.1f %6u %8.0f %8.0f %6.1f %6u %6u\n", t->name,
+         (double)syncs / days, syncs, worst_error / 1000.0,
+         worst_uncertainty / 1000.0, drift.drift_ppm, outside, jumped_cycles);
+  CHECK(outside == 0);
+  // The learnt drift keeps SNTP to a few syncs a day.
+  CHECK(syncs <= 4 * days);
+  CHECK(fabsf(drift.drift_ppm - t->skew_ppm) <= 3 * t->swing_ppm + 20);
+}
+
+static void check_basics(void) {
+  clock_drift drift = {0};
+  int64_t true_us;
+  uint32_t uncertainty_us;
+
+  CHECK(!clock_drift_correct(&drift, 0, &true_us, &uncertainty_us));
+
+  // Before a drift is learnt the default bound applies.
+  clock_drift_sync(&drift, 1000000000, 1000000000);
+  CHECK(clock_drift_correct(&drift, 1000000000 + 100000000, &true_us,
+                            &uncertainty_us));
+  CHECK(true_us == 1100000000);
+  CHECK(uncertainty_us == CLOCK_SYNC_ERROR_US + 100 * CLOCK_DEFAULT_PPM);
+
+  // Syncs closer than CLOCK_MIN_INTERVAL_US teach nothing.
+  clock_drift_sync(&drift, 1000000000 + 30000000, 1000000000 + 29000000);
+  CHECK(drift.samples == 0);
+
+  // 100 ppm fast over an hour.
+  int64_t start = 1000000000 + 29000000;
+  clock_drift_sync(&drift, start + 3600000000LL + 360000, start + 3600000000LL);
+  CHECK(drift.samples == 1 && fabsf(drift.drift_ppm - 100) < 0.5f);
+  start += 3600000000LL;
+  CHECK(clock_drift_correct(&drift, start + 1000000000 + 100000, &true_us,
+                            &uncertainty_us));
+  CHECK(llabs(true_us - (start + 1000000000)) <= 1000);
+  CHECK(uncertainty_us >= CLOCK_SYNC_ERROR_US + 1000 * CLOCK_MIN_PPM);
+}
+
+int main(int argc, char **argv) {
+  uint32_t days = argc > 1 ? atoi(argv[1]) : 14;
+
+  check_basics();
+  printf("%-12s %6s %6s %8s %8s %6s %6s %6s\n", "trace", "sync/d", "syncs",
+         "err ms", "bound ms", "ppm", "out", "jumped");
+  for (size_t i = 0; i < sizeof(traces) / sizeof(traces[0]); i++) {
+    run(&traces[i], days);
+  }
+
+  return check_result();
+}
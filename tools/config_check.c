@@ -0,0 +1,146 @@
+// Host checks of the stored configuration and of remote commands.
+//
+//   cc -Iinclude -I$CORE_JSON/source/include -o config_check
+//      tools/config_check.c src/remote_config.c $CORE_JSON/source/core_json.c
+//   ./config_check
+//
+// CORE_JSON is coreJSON from the AWS IoT device SDK, as in the firmware
+// build. The settings are stored by name: a build must load what an older
+// or newer one saved, keeping its defaults for what it does not find.
+#include <stdio.h>
+#include <string.h>
+
+#include "check.h"
+#include "device_config.h"
+
+// The firmware takes these from device_config.c.
+void device_config_defaults(device_config *config) {
+  memset(config, 0, sizeof(*config));
+  config->sleep_seconds = DEFAULT_SLEEP_SECONDS;
+  config->read_samples = DEFAULT_READ_SAMPLES;
+  config->gas_r0 = DEFAULT_GAS_R0;
+  config->gas_cool_s = DEFAULT_GAS_COOL_S;
+}
+
+static size_t put(uint8_t *buf, size_t pos, const char *key, const void *value,
+                  size_t size) {
+  buf[pos++] = strlen(key);
+  memcpy(buf + pos, key, strlen(key));
+  pos += strlen(key);
+  buf[pos++] = size;
+  memcpy(buf + pos, value, size);
+  return pos + size;
+}
+
+static void check_round_trip(void) {
+  device_config config, loaded;
+  uint8_t buf[2048];
+
+  device_config_defaults(&config);
+  config.version = 7;
+  config.sleep_seconds = 600;
+  config.schedule[SENSOR_GAS].phase = 3;
+  config.command_id = 12;
+  config.pending_commands = DEVICE_COMMAND_CALIBRATE_CO2_ZERO;
+  config.ota_build = 99;
+  memset(config.ota_sha256, 0xab, sizeof(config.ota_sha256));
+  memset(config.ota_signature, 0xcd, 70);
+  config.ota_signature_len = 70;
+
+  size_t len = device_config_encode(&config, buf, sizeof(buf));
+  printf("stored settings: %zu bytes, struct %zu bytes\n", len,
+         sizeof(config));
+  CHECK(len > 0);
+
+  device_config_defaults(&loaded);
+  CHECK(device_config_decode(buf, len, &loaded));
+  CHECK(memcmp(&config, &loaded, sizeof(config)) == 0);
+
+  CHECK(device_config_encode(&config, buf, len - 1) == 0);
+  CHECK(!device_config_decode(buf, len - 1, &loaded));
+}
+
+static void check_other_builds(void) {
+  device_config config;
+  uint8_t buf[256];
+  uint32_t value;
+  size_t pos = 4;
+
+  memcpy(buf, "CFG\1", 4);
+  // A newer build's setting, and one this build allows less of.
+  value = 5;
+  pos = put(buf, pos, "fan_speed", &value, sizeof(value));
+  value = 100000;
+  pos = put(buf, pos, "sleep_seconds", &value, sizeof(value));
+  value = 42;
+  pos = put(buf, pos, "version", &value, sizeof(value));
+  value = 2000;
+  pos = put(buf, pos, "gas_r0", &value, sizeof(value));
+
+  device_config_defaults(&config);
+  CHECK(device_config_decode(buf, pos, &config));
+  CHECK(config.version == 42);
+  CHECK(config.gas_r0 == 2000);
+  CHECK(config.sleep_seconds == DEFAULT_SLEEP_SECONDS);
+  CHECK(config.read_samples == DEFAULT_READ_SAMPLES);
+
+  device_config_defaults(&config);
+  CHECK(!device_config_decode((const uint8_t *)"CFG\2", 4, &config));
+}
+
+static uint32_t parse(const char *json, device_config *current,
+                      device_config_status expect) {
+  device_config updated;
+  uint32_t commands = 0;
+
+  CHECK(device_config_parse(json, strlen(json), current, &updated,
+                            &commands) == expect);
+  if (expect == DEVICE_CONFIG_UPDATED) {
+    *current = updated;
+  }
+  return commands;
+}
+
+static void check_commands(void) {
+  device_config config;
+
+  device_config_defaults(&config);
+  CHECK(parse("{\"version\":1,\"command\":\"calibrate_co2_zero\","
+              "\"command_id\":1}",
+              &config, DEVICE_CONFIG_UPDATED) ==
+        DEVICE_COMMAND_CALIBRATE_CO2_ZERO);
+  CHECK(config.command_id == 1);
+
+  // The retained message again, then a new version still carrying it.
+  CHECK(parse("{\"version\":1,\"command\":\"calibrate_co2_zero\","
+              "\"command_id\":1}",
+              &config, DEVICE_CONFIG_UNCHANGED) == 0);
+  CHECK(parse("{\"version\":2,\"sleep_seconds\":60,"
+              "\"command\":\"calibrate_co2_zero\",\"command_id\":1}",
+              &config, DEVICE_CONFIG_UPDATED) == 0);
+  CHECK(config.sleep_seconds == 60);
+
+  // Settings lost and back at version 0, the command id is stored with
+  // them.
+  uint8_t buf[2048];
+  size_t len = device_config_encode(&config, buf, sizeof(buf));
+  device_config_defaults(&config);
+  CHECK(device_config_decode(buf, len, &config));
+  CHECK(parse("{\"version\":3,\"command\":\"calibrate_co2_zero\","
+              "\"command_id\":1}",
+              &config, DEVICE_CONFIG_UPDATED) == 0);
+
+  CHECK(parse("{\"version\":4,\"command\":\"flush_backlog\","
+              "\"command_id\":2}",
+              &config, DEVICE_CONFIG_UPDATED) == DEVICE_COMMAND_FLUSH_BACKLOG);
+  CHECK(parse("{\"version\":5,\"command\":\"flush_backlog\"}", &config,
+              DEVICE_CONFIG_INVALID) == 0);
+}
+
+int main(void) {
+  check_round_trip();
+  check_other_builds();
+  check_commands();
+
+  return check_result();
+}
@@ -0,0 +1,152 @@
+// Host checks of the awake budget with the phases stalled.
+//
+//   cc -O2 -Iinclude -o cycle_budget_check tools/cycle_budget_check.c
+//      src/cycle_budget.c src/wake_schedule.c
+//   ./cycle_budget_check
+//
+// Runs the phases of a wake cycle the way main and mqtt_task do, on a
+// simulated clock, with every combination of stalled phases. A stalled
+// phase takes all the time it is given, a hung publish never returns. The
+// cycle must end within the budget with the stalled phases flagged and
+// the next wake scheduled.
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "check.h"
+#include "cycle_budget.h"
+#include "device_config.h"
+#include "wake_schedule.h"
+
+#define BOOT_MS 300
+#define WIFI_MS 1500
+#define SENSORS_MS 1200
+#define CONNECT_MS 2000
+#define PUBLISH_MS 1500
+#define STORE_MS 50
+#define UNIX_MS 1760880000000LL
+
+enum {
+  STALL_WIFI = 1 << CYCLE_PHASE_WIFI,
+  STALL_SENSORS = 1 << CYCLE_PHASE_SENSORS,
+  STALL_CONNECT = 1 << CYCLE_PHASE_CONNECT,
+  STALL_PUBLISH = 1 << CYCLE_PHASE_PUBLISH,
+  // The publish blocks for good, main abandons mqtt_task.
+  HANG_PUBLISH = 1 << CYCLE_PHASE_COUNT,
+};
+
+// Returns when the cycle ended, fills in the history like main.
+static int64_t simulate(uint32_t stalls, cycle_history *history) {
+  cycle_budget cycle;
+  int64_t now = BOOT_MS, task_done;
+  bool online = true, connected = false;
+
+  cycle_budget_start(&cycle, DEFAULT_AWAKE_BUDGET_MS, 0);
+
+  uint32_t wifi_ms = cycle_phase_begin(&cycle, CYCLE_PHASE_WIFI, now);
+  now += stalls & STALL_WIFI ? wifi_ms : WIFI_MS;
+  online = !(stalls & STALL_WIFI);
+  cycle_phase_end(&cycle, CYCLE_PHASE_WIFI, online, now);
+
+  // The sensors read in parallel with mqtt_task from here on, main waits
+  // for it no longer than the budget.
+  cycle_phase_begin(&cycle, CYCLE_PHASE_SENSORS, now);
+  int64_t given_up = now + cycle_budget_left(&cycle, now);
+  int64_t sensors_done =
+      stalls & STALL_SENSORS ? INT64_MAX : now + SENSORS_MS;
+
+  if (online) {
+    uint32_t timeout_ms = cycle_phase_begin(&cycle, CYCLE_PHASE_CONNECT, now);
+    now += stalls & STALL_CONNECT ? timeout_ms : CONNECT_MS;
+    cycle_phase_end(&cycle, CYCLE_PHASE_CONNECT, true, now);
+    connected = !(stalls & STALL_CONNECT);
+  }
+
+  // wait_for_sensors, which ends the phase with the slowest sensor.
+  int64_t sensors_by =
+      now + cycle_phase_left(&cycle, CYCLE_PHASE_SENSORS, now);
+  bool complete = sensors_done <= sensors_by;
+  if (complete) {
+    now = sensors_done > now ? sensors_done : now;
+  } else {
+    now = sensors_by;
+  }
+  cycle_phase_end(&cycle, CYCLE_PHASE_SENSORS, complete,
+                  complete ? sensors_done : now);
+
+  // Without a connection the reading only goes into the backlog.
+  cycle_phase_begin(&cycle, CYCLE_PHASE_PUBLISH, now);
+  if (connected && (stalls & HANG_PUBLISH)) {
+    task_done = INT64_MAX;
+  } else {
+    if (!connected) {
+      now += STORE_MS;
+    } else if (stalls & STALL_PUBLISH) {
+      // The drains stop when the phase runs out.
+      now += cycle_phase_left(&cycle, CYCLE_PHASE_PUBLISH, now);
+    } else {
+      now += PUBLISH_MS;
+    }
+    cycle_phase_end(&cycle, CYCLE_PHASE_PUBLISH, true, now);
+    task_done = now;
+  }
+
+  int64_t end = task_done < given_up ? task_done : given_up;
+  cycle_budget_finish(&cycle, history, 0, end);
+  return end;
+}
+
+// The phases that must come out flagged.
+static uint32_t expected(uint32_t stalls) {
+  uint32_t overrun = stalls & (STALL_WIFI | STALL_SENSORS);
+
+  // Offline the reading only goes into the backlog.
+  if (stalls & STALL_WIFI) {
+    return overrun;
+  }
+  // Without a connection nothing is published.
+  if (stalls & STALL_CONNECT) {
+    return overrun | STALL_CONNECT;
+  }
+  if (stalls & (STALL_PUBLISH | HANG_PUBLISH)) {
+    overrun |= STALL_PUBLISH;
+  }
+  return overrun;
+}
+
+static void check_sleep(int64_t end) {
+  uint32_t period_ms = DEFAULT_SLEEP_SECONDS * 1000;
+  uint32_t phase_ms = wake_schedule_phase("sensor-00042", period_ms);
+
+  for (int aligned = 0; aligned < 2; aligned++) {
+    uint32_t sleep_ms = wake_schedule_delay(UNIX_MS + end, aligned, period_ms,
+                                            phase_ms, 2000, check_random());
+    CHECK(sleep_ms >= WAKE_MIN_SLEEP_MS);
+    CHECK(sleep_ms <= period_ms + WAKE_MIN_SLEEP_MS + 2000);
+  }
+}
+
+int main(void) {
+  cycle_history history = {0};
+
+  printf("%-8s %9s %s\n", "stalls", "awake ms", "overrun");
+  for (uint32_t stalls = 0; stalls < 2u << CYCLE_PHASE_COUNT; stalls++) {
+    int64_t end = simulate(stalls, &history);
+
+    printf("0x%02x     %9u", stalls, history.awake_ms);
+    for (int i = 0; i < CYCLE_PHASE_COUNT; i++) {
+      if (history.overrun & (1u << i)) {
+        printf(" %s", cycle_phase_name(i));
+      }
+    }
+    printf("\n");
+
+    CHECK(history.awake_ms <= DEFAULT_AWAKE_BUDGET_MS);
+    CHECK(history.overrun == expected(stalls));
+    check_sleep(end);
+  }
+
+  // Every cycle but the one without stalls counted.
+  CHECK(history.overrun_cycles == (2u << CYCLE_PHASE_COUNT) - 1);
+
+  return check_result();
+}
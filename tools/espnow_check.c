@@ -0,0 +1,276 @@
+// Host checks and benchmark of the ESP-NOW framing, replay table and
+// gateway batches.
+//
+//   cc -O2 -Iinclude -o espnow_check tools/espnow_check.c
+//      src/espnow_frame.c src/espnow_batch.c src/sha256.c
+//   ./espnow_check [frames]
+//
+// Checks that frames round-trip and that damaged, forged, foreign and
+// replayed ones are refused, also across a gateway restart that resumes
+// from the last stored table. Then runs the given number of frames
+// (default 200000) from ESPNOW_MAX_PEERS nodes through decode, the replay
+// check and the batch like espnow_link_collect, and prints the rate.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "check.h"
+#include "espnow_batch.h"
+#include "espnow_frame.h"
+
+static const uint8_t key[ESPNOW_KEY_SIZE] = "0123456789abcdef";
+static const uint8_t node_mac[ESPNOW_MAC_SIZE] = {0x24, 0x0a, 0xc4,
+                                                  0x01, 0x02, 0x03};
+
+static void check_frames(void) {
+  uint8_t frame[ESPNOW_FRAME_MAX + 1], payload[ESPNOW_PAYLOAD_MAX + 1];
+  const uint8_t *data;
+  uint32_t seq;
+
+  for (size_t i = 0; i < sizeof(payload); i++) {
+    payload[i] = (uint8_t)(i * 7);
+  }
+
+  for (size_t len = 0; len <= ESPNOW_PAYLOAD_MAX; len++) {
+    int frame_len =
+        espnow_frame_encode(key, node_mac, 0x00020001 + len, payload, len,
+                            frame);
+    CHECK(frame_len == (int)(ESPNOW_HEADER_SIZE + len + ESPNOW_TAG_SIZE));
+    CHECK(espnow_frame_decode(key, node_mac, frame, frame_len, &seq, &data) ==
+          (int)len);
+    CHECK(seq == 0x00020001 + len && memcmp(data, payload, len) == 0);
+  }
+  CHECK(espnow_frame_encode(key, node_mac, 1, payload, ESPNOW_PAYLOAD_MAX + 1,
+                            frame) == ESPNOW_FRAME_MALFORMED);
+
+  int frame_len = espnow_frame_encode(key, node_mac, 77, payload, 40, frame);
+
+  // Any flipped bit is caught, in the header, payload or tag.
+  for (int bit = 8; bit < frame_len * 8; bit++) {
+    frame[bit / 8] ^= 1 << (bit % 8);
+    CHECK(espnow_frame_decode(key, node_mac, frame, frame_len, &seq, &data) ==
+          ESPNOW_FRAME_FORGED);
+    frame[bit / 8] ^= 1 << (bit % 8);
+  }
+
+  // Another node's MAC, or another key.
+  uint8_t other_mac[ESPNOW_MAC_SIZE];
+  memcpy(other_mac, node_mac, sizeof(other_mac));
+  other_mac[5] ^= 1;
+  CHECK(espnow_frame_decode(key, other_mac, frame, frame_len, &seq, &data) ==
+        ESPNOW_FRAME_FORGED);
+  uint8_t other_key[ESPNOW_KEY_SIZE];
+  memcpy(other_key, key, sizeof(other_key));
+  other_key[0] ^= 0x80;
+  CHECK(espnow_frame_decode(other_key, node_mac, frame, frame_len, &seq,
+                            &data) == ESPNOW_FRAME_FORGED);
+
+  // Truncated, too long or another version.
+  for (int len = 0; len < ESPNOW_HEADER_SIZE + ESPNOW_TAG_SIZE; len++) {
+    CHECK(espnow_frame_decode(key, node_mac, frame, len, &seq, &data) ==
+          ESPNOW_FRAME_MALFORMED);
+  }
+  CHECK(espnow_frame_decode(key, node_mac, frame, frame_len - 1, &seq,
+                            &data) == ESPNOW_FRAME_FORGED);
+  CHECK(espnow_frame_decode(key, node_mac, frame, ESPNOW_FRAME_MAX + 1, &seq,
+                            &data) == ESPNOW_FRAME_MALFORMED);
+  frame[0]++;
+  CHECK(espnow_frame_decode(key, node_mac, frame, frame_len, &seq, &data) ==
+        ESPNOW_FRAME_MALFORMED);
+}
+
+static void mac_of(uint32_t node, uint8_t *mac) {
+  memcpy(mac, node_mac, ESPNOW_MAC_SIZE);
+  mac[4] = (uint8_t)(node >> 8);
+  mac[5] = (uint8_t)node;
+}
+
+// What the gateway keeps in NVS, written whenever the table is dirty.
+typedef struct {
+  espnow_peer peers[ESPNOW_MAX_PEERS];
+  uint32_t count;
+  uint32_t writes;
+} stored_table;
+
+static espnow_frame_status accept(espnow_replay *replay, stored_table *nvs,
+                                  const uint8_t *mac, uint32_t seq) {
+  espnow_frame_status status = espnow_replay_check(replay, mac, seq);
+
+  if (status == ESPNOW_FRAME_OK && replay->dirty) {
+    memcpy(nvs->peers, replay->peers, sizeof(nvs->peers));
+    nvs->count = replay->count;
+    nvs->writes++;
+    replay->dirty = false;
+  }
+  return status;
+}
+
+static void restart(espnow_replay *replay, const stored_table *nvs) {
+  espnow_replay_init(replay);
+  memcpy(replay->peers, nvs->peers, sizeof(replay->peers));
+  espnow_replay_resume(replay, nvs->count);
+}
+
+static void check_replay(void) {
+  espnow_replay replay;
+  stored_table nvs = {0};
+  uint8_t mac[ESPNOW_MAC_SIZE];
+
+  espnow_replay_init(&replay);
+  mac_of(1, mac);
+  CHECK(accept(&replay, &nvs, mac, 0x10005) == ESPNOW_FRAME_OK);
+  CHECK(accept(&replay, &nvs, mac, 0x10005) == ESPNOW_FRAME_REPLAYED);
+  CHECK(accept(&replay, &nvs, mac, 0x10004) == ESPNOW_FRAME_REPLAYED);
+  // A gap from lost frames is fine.
+  CHECK(accept(&replay, &nvs, mac, 0x10009) == ESPNOW_FRAME_OK);
+  // Another node has its own numbers.
+  mac_of(2, mac);
+  CHECK(accept(&replay, &nvs, mac, 0x10005) == ESPNOW_FRAME_OK);
+  CHECK(nvs.writes == 2);
+
+  // A node sending every cycle costs at most a store per lease.
+  mac_of(1, mac);
+  uint32_t writes = nvs.writes;
+  for (uint32_t seq = 0x1000a; seq < 0x1000a + 10 * ESPNOW_REPLAY_LEASE;
+       seq++) {
+    CHECK(accept(&replay, &nvs, mac, seq) == ESPNOW_FRAME_OK);
+  }
+  CHECK(nvs.writes - writes <= 10 && nvs.writes > writes);
+  uint32_t last = 0x1000a + 10 * ESPNOW_REPLAY_LEASE - 1;
+
+  // After a restart nothing seen before passes, nor anything within the
+  // lease. Past it the node is back, and its next cold boot epoch is too.
+  restart(&replay, &nvs);
+  for (uint32_t seq = 0x10000; seq <= last; seq++) {
+    CHECK(accept(&replay, &nvs, mac, seq) == ESPNOW_FRAME_REPLAYED);
+  }
+  uint32_t lost = 0;
+  uint32_t seq = last + 1;
+  while (accept(&replay, &nvs, mac, seq) != ESPNOW_FRAME_OK) {
+    lost++;
+    seq++;
+  }
+  CHECK(lost <= ESPNOW_REPLAY_LEASE);
+  CHECK(accept(&replay, &nvs, mac, 0x20001) == ESPNOW_FRAME_OK);
+  mac_of(2, mac);
+  CHECK(accept(&replay, &nvs, mac, 0x10005) == ESPNOW_FRAME_REPLAYED);
+
+  // A restart before anything was stored, then one with nothing in NVS.
+  stored_table empty = {0};
+  restart(&replay, &empty);
+  CHECK(replay.count == 0);
+  CHECK(accept(&replay, &nvs, mac, 1) == ESPNOW_FRAME_OK);
+
+  // A full table keeps the nodes it has.
+  espnow_replay_init(&replay);
+  for (uint32_t node = 0; node < ESPNOW_MAX_PEERS; node++) {
+    mac_of(100 + node, mac);
+    CHECK(accept(&replay, &nvs, mac, 10) == ESPNOW_FRAME_OK);
+  }
+  mac_of(999, mac);
+  CHECK(accept(&replay, &nvs, mac, 10) == ESPNOW_FRAME_UNKNOWN);
+  mac_of(100, mac);
+  CHECK(accept(&replay, &nvs, mac, 10) == ESPNOW_FRAME_REPLAYED);
+  CHECK(accept(&replay, &nvs, mac, 11) == ESPNOW_FRAME_OK);
+
+  // Near the top of the numbers the lease stops at the last one.
+  CHECK(accept(&replay, &nvs, mac, UINT32_MAX - 3) == ESPNOW_FRAME_OK);
+  CHECK(replay.peers[0].saved_seq == UINT32_MAX);
+  CHECK(accept(&replay, &nvs, mac, UINT32_MAX) == ESPNOW_FRAME_OK);
+}
+
+static void check_batch(void) {
+  espnow_batch batch;
+  uint8_t payload[ESPNOW_PAYLOAD_MAX], mac[ESPNOW_MAC_SIZE];
+  uint32_t added = 0;
+
+  memset(payload, 0xab, sizeof(payload));
+  espnow_batch_reset(&batch);
+  CHECK(!espnow_batch_due(&batch, 5000, 1000000));
+
+  mac_of(7, mac);
+  CHECK(espnow_batch_add(&batch, mac, payload, 30, 1000));
+  CHECK(!espnow_batch_due(&batch, 5000, 5999));
+  CHECK(espnow_batch_due(&batch, 5000, 6000));
+  CHECK(batch.buf[0] == ESPNOW_BATCH_VERSION && batch.buf[1] == 1);
+  CHECK(memcmp(batch.buf + 2, mac, ESPNOW_MAC_SIZE) == 0);
+  CHECK(batch.buf[2 + ESPNOW_MAC_SIZE] == 30);
+  CHECK(batch.len == ESPNOW_BATCH_HEADER_SIZE + ESPNOW_MAC_SIZE + 1 + 30);
+
+  // Full frames until the next one would not fit, then it is due.
+  while (espnow_batch_add(&batch, mac, payload, ESPNOW_PAYLOAD_MAX, 1500)) {
+    added++;
+  }
+  CHECK(batch.len <= ESPNOW_BATCH_MAX);
+  CHECK(!espnow_batch_fits(&batch, ESPNOW_PAYLOAD_MAX));
+  CHECK(espnow_batch_due(&batch, 5000, 1500));
+  CHECK(batch.first_ms == 1000 && batch.buf[1] == added + 1);
+
+  // Walk the entries back.
+  size_t pos = ESPNOW_BATCH_HEADER_SIZE;
+  for (uint32_t i = 0; i < batch.count; i++) {
+    CHECK(pos + ESPNOW_MAC_SIZE + 1 <= batch.len);
+    pos += ESPNOW_MAC_SIZE + 1 + batch.buf[pos + ESPNOW_MAC_SIZE];
+  }
+  CHECK(pos == batch.len);
+}
+
+static void bench(uint32_t frames) {
+  enum { PAYLOAD = 27 };
+  uint8_t (*wire)[ESPNOW_FRAME_MAX] = malloc(frames * ESPNOW_FRAME_MAX);
+  uint8_t (*macs)[ESPNOW_MAC_SIZE] = malloc(frames * ESPNOW_MAC_SIZE);
+  int *lens = malloc(frames * sizeof(int));
+  uint8_t payload[PAYLOAD] = {0xb5, 4};
+  espnow_replay replay;
+  stored_table nvs = {0};
+  espnow_batch batch;
+  uint32_t accepted = 0, batches = 0;
+
+  // Every node sends in turn, as if each woke once per cycle.
+  for (uint32_t i = 0; i < frames; i++) {
+    mac_of(i % ESPNOW_MAX_PEERS, macs[i]);
+    lens[i] = espnow_frame_encode(key, macs[i], 0x10000 + i / ESPNOW_MAX_PEERS,
+                                  payload, PAYLOAD, wire[i]);
+  }
+
+  espnow_replay_init(&replay);
+  espnow_batch_reset(&batch);
+  double start = check_seconds();
+  for (uint32_t i = 0; i < frames; i++) {
+    const uint8_t *data;
+    uint32_t seq;
+    int len = espnow_frame_decode(key, macs[i], wire[i], lens[i], &seq, &data);
+
+    if (len >= 0 && !espnow_batch_fits(&batch, len)) {
+      espnow_batch_reset(&batch);
+      batches++;
+    }
+    if (len >= 0 && accept(&replay, &nvs, macs[i], seq) == ESPNOW_FRAME_OK) {
+      espnow_batch_add(&batch, macs[i], data, len, i);
+      accepted++;
+    }
+  }
+  double s = check_seconds() - start;
+
+  CHECK(accepted == frames);
+  printf("%u frames of %d bytes from %d nodes: %.0f frames/s, %u batches, "
+         "%u table stores\n",
+         frames, PAYLOAD, ESPNOW_MAX_PEERS, frames / s, batches, nvs.writes);
+
+  free(lens);
+  free(macs);
+  free(wire);
+}
+
+int main(int argc, char **argv) {
+  uint32_t frames = argc > 1 ? atoi(argv[1]) : 200000;
+
+  check_frames();
+  check_replay();
+  check_batch();
+  if (frames > 0) {
+    bench(frames);
+  }
+
+  return check_result();
+}
@@ -0,0 +1,200 @@
+// Host checks of the MQ heater duty cycle over a day of wake cycles.
+//
+//   cc -O2 -Iinclude -o gas_heater_check tools/gas_heater_check.c
+//      src/gas_heater.c src/sensor_schedule.c -lm
+//   ./gas_heater_check [sleep_seconds] [preheat_seconds] [cool_seconds]
+//
+// Runs the heater the way the gas task and plan_gas_heater do, on a
+// simulated clock: the gas task switches a cold heater on and waits out
+// up to GAS_PREHEAT_WAIT_MS of preheat, and before every sleep the heater
+// is planned for the next scheduled gas reading. Once the element first
+// had the time to preheat from cold, every reading must find it stable.
+// The heater's own on-time per hour must match the time it was actually
+// on, and at the defaults the duty cycle must be the one quoted in the
+// commit that added the heater control.
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "check.h"
+#include "device_config.h"
+#include "gas_heater.h"
+#include "sensor_schedule.h"
+
+#define DAY_MS 86400000LL
+// From the wake to the gas task, and the rest of the cycle.
+#define SENSORS_AT_MS 1800
+#define AWAKE_MS 2500
+// As in tasks.h.
+#define GAS_PREHEAT_WAIT_MS 3000
+
+typedef struct {
+  uint32_t readings;
+  uint32_t unstable;
+  int64_t last_unstable_ms;
+  int64_t on_ms;
+  int64_t ms;
+} day;
+
+// Tracks the on-time independently of the model.
+static void advance(gas_heater_state *heater, const gas_heater_params *params,
+                    int64_t *now, int64_t to, day *day) {
+  if (heater->on) {
+    day->on_ms += to - *now;
+  }
+  *now = to;
+  gas_heater_update(heater, params, to);
+}
+
+// plan_gas_heater in main, sensor_cycle already counts this cycle.
+static bool plan(const device_config *config, const gas_heater_state *heater,
+                 const gas_heater_params *params, uint32_t sensor_cycle,
+                 uint32_t sleep_ms, uint32_t awake_ms) {
+  const sensor_schedule *schedule = &config->schedule[SENSOR_GAS];
+
+  if (!schedule->period) {
+    return false;
+  }
+  if (config->stub_cycles > 1) {
+    return true;
+  }
+  for (uint32_t k = 0; k < schedule->period; k++) {
+    if (sensor_schedule_due(schedule, sensor_cycle + k)) {
+      uint64_t read_ms = sleep_ms + (uint64_t)k * sleep_ms + SENSORS_AT_MS;
+      uint64_t next_ms = k > 0 ? sleep_ms + awake_ms : read_ms;
+      return gas_heater_plan(heater, params,
+                             read_ms < UINT32_MAX ? read_ms : UINT32_MAX,
+                             next_ms < UINT32_MAX ? next_ms : UINT32_MAX,
+                             GAS_PREHEAT_WAIT_MS);
+    }
+  }
+  return false;
+}
+
+static day simulate(const device_config *config, uint32_t sleep_ms) {
+  gas_heater_state heater = {0};
+  gas_heater_params params;
+  day day = {0};
+  int64_t now = 0;
+
+  gas_heater_params_load(config, &params);
+  for (uint32_t cycle = 0; now < DAY_MS; cycle++) {
+    int64_t wake = now;
+
+    advance(&heater, &params, &now, wake + SENSORS_AT_MS, &day);
+    if (sensor_schedule_due(&config->schedule[SENSOR_GAS], cycle)) {
+      // The gas task.
+      gas_heater_switch(&heater, true);
+      uint32_t wait_ms = gas_heater_preheat_ms(&heater, &params);
+      if (wait_ms > GAS_PREHEAT_WAIT_MS) {
+        wait_ms = GAS_PREHEAT_WAIT_MS;
+      }
+      advance(&heater, &params, &now, now + wait_ms, &day);
+
+      bool stable = gas_heater_stable(&heater);
+      if (!stable) {
+        day.unstable++;
+        day.last_unstable_ms = now;
+      }
+      day.readings++;
+    }
+
+    int64_t end = now > wake + AWAKE_MS ? now : wake + AWAKE_MS;
+    advance(&heater, &params, &now, end, &day);
+    gas_heater_switch(&heater, plan(config, &heater, &params, cycle + 1,
+                                    sleep_ms, (uint32_t)(end - wake)));
+    advance(&heater, &params, &now, end + sleep_ms, &day);
+  }
+
+  // Whole hours only, the last one is compared as far as it got.
+  double measured = (double)gas_heater_on_per_hour_ms(&heater) /
+                    GAS_HEATER_HOUR_MS;
+  double actual = (double)day.on_ms / now;
+  CHECK(heater.hours >= 23);
+  CHECK(measured > actual - 0.05 && measured < actual + 0.05);
+  day.ms = now;
+  return day;
+}
+
+static void check_off(void) {
+  device_config config = {0};
+  gas_heater_state heater = {0};
+  gas_heater_params params;
+
+  // Without a preheat time the heater is left wired on, nothing is planned.
+  gas_heater_params_load(&config, &params);
+  CHECK(params.preheat_ms == 0);
+
+  // Already stable, nothing to wait for; cold, the whole preheat.
+  config.gas_preheat_s = 60;
+  config.gas_cool_s = 120;
+  gas_heater_params_load(&config, &params);
+  heater.warmth = 1;
+  CHECK(gas_heater_stable(&heater));
+  CHECK(gas_heater_preheat_ms(&heater, &params) == 0);
+  heater.warmth = 0;
+  uint32_t preheat_ms = gas_heater_preheat_ms(&heater, &params);
+  CHECK(preheat_ms >= 59999 && preheat_ms <= 60001);
+
+  // Heated for exactly the preheat time from cold, it is stable.
+  gas_heater_switch(&heater, true);
+  gas_heater_update(&heater, &params, 60000);
+  CHECK(heater.warmth > GAS_HEATER_STABLE - 0.001f);
+
+  // A reading far off leaves it off, one within the preheat keeps it on.
+  heater.warmth = 0;
+  CHECK(!gas_heater_plan(&heater, &params, 600000, 15000, 0));
+  CHECK(gas_heater_plan(&heater, &params, 30000, 15000, 0));
+}
+
+int main(int argc, char **argv) {
+  uint32_t sleep_seconds = argc > 1 ? atoi(argv[1]) : 15;
+  uint32_t preheat_seconds = argc > 2 ? atoi(argv[2]) : 60;
+  uint32_t cool_seconds = argc > 3 ? atoi(argv[3]) : 120;
+  static const uint32_t periods[] = {1, 4, 10, 40, 0};
+  // Percent on at a 15 s sleep, 60 s preheat and 120 s cooling.
+  static const int quoted[] = {100, 75, 39, 9, 0};
+  bool defaults = sleep_seconds == 15 && preheat_seconds == 60 &&
+                  cool_seconds == 120;
+
+  if (sleep_seconds == 0 || preheat_seconds == 0) {
+    fprintf(stderr, "Need a sleep and a preheat time\n");
+    return 2;
+  }
+
+  check_off();
+  printf("sleep %us, preheat %us, cooling %us\n", sleep_seconds,
+         preheat_seconds, cool_seconds);
+  printf("%-10s %8s %8s %9s\n", "gas every", "readings", "unstable",
+         "on/hour");
+  for (int stub = 0; stub < 2; stub++) {
+    for (size_t i = 0; i < sizeof(periods) / sizeof(periods[0]); i++) {
+      device_config config = {0};
+
+      config.gas_preheat_s = preheat_seconds;
+      config.gas_cool_s = cool_seconds;
+      config.stub_cycles = stub ? 4 : 0;
+      config.schedule[SENSOR_GAS].period = periods[i];
+
+      day day = simulate(&config, sleep_seconds * 1000);
+      double duty = (double)day.on_ms / day.ms;
+      printf("%-4u%-6s %8u %8u %8.0f%%\n", periods[i], stub ? " stub" : "",
+             day.readings, day.unstable, duty * 100);
+
+      // Only the readings while it first heats up from cold may be early.
+      CHECK(day.unstable == 0 ||
+            day.last_unstable_ms < preheat_seconds * 1000 + SENSORS_AT_MS +
+                                       GAS_PREHEAT_WAIT_MS);
+      CHECK(preheat_seconds * 1000 > GAS_PREHEAT_WAIT_MS ||
+            day.unstable == 0);
+      if (!stub && defaults) {
+        CHECK(duty * 100 > quoted[i] - 2 && duty * 100 < quoted[i] + 2);
+      }
+      // The wake stub samples gas on every wake.
+      CHECK(!stub || periods[i] == 0 || duty > 0.99);
+      CHECK(periods[i] != 0 || day.on_ms == 0);
+    }
+  }
+
+  return check_result();
+}
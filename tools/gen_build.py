@@ -0,0 +1,43 @@
+"""Sets FIRMWARE_BUILD for the OTA updates.
+
+An update is only taken when its build number is higher than the running
+one, and the RTC state is dropped when the build changes, so every image
+needs its own increasing number. It is the FIRMWARE_BUILD environment
+variable when set (for release builds), the number of commits otherwise.
+
+Runs as a PlatformIO pre script. Run by hand it prints the number:
+python3 tools/gen_build.py
+"""
+
+import os
+import subprocess
+import sys
+
+
+def build_number(root):
+    if os.environ.get("FIRMWARE_BUILD"):
+        return int(os.environ["FIRMWARE_BUILD"])
+
+    count = subprocess.check_output(["git", "rev-list", "--count", "HEAD"],
+                                    cwd=root)
+    return int(count)
+
+
+def main(root):
+    try:
+        number = build_number(root)
+    except (OSError, ValueError, subprocess.CalledProcessError) as error:
+        sys.exit("No build number, set FIRMWARE_BUILD: %s" % error)
+    if not 0 < number < 2 ** 32:
+        sys.exit("FIRMWARE_BUILD must fit in 32 bits")
+    return number
+
+
+try:
+    Import("env")  # noqa: F821, only defined in PlatformIO scripts
+except NameError:
+    print(main(os.path.join(os.path.dirname(os.path.abspath(__file__)), "..")))
+else:
+    build = main(env.subst("$PROJECT_DIR"))  # noqa: F821
+    env.Append(BUILD_FLAGS=["-DFIRMWARE_BUILD=%du" % build])  # noqa: F821
+    print("Firmware build %d" % build)
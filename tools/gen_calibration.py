@@ -0,0 +1,169 @@
+"""Generates include/calibration_tables.h.
+
+The sensor curves are power laws. They are evaluated here in double and
+sampled into piecewise linear tables, so every device converts a reading
+the same way whatever its powf rounds to, and the ends of the ADC range,
+where the curves run off to zero or infinity, stop at the table's ends.
+Breakpoints are placed where the curve bends, keeping the interpolation
+error under MAX_ERROR.
+
+Runs as a PlatformIO pre script and only rewrites the header when its
+contents change. It can also be run by hand: python3 tools/gen_calibration.py
+"""
+
+import os
+
+ADC_MAX = 4095
+MAX_ERROR = 0.005
+
+# MQ-135 CO2 curve from the datasheet sensitivity chart, ppm = A * (Rs/R0)^B
+# at 20C and 33% RH.
+GAS_A = 116.6020682
+GAS_B = -2.769034857
+
+# Rs/R0 changes with the air around the heater, fitted to the same chart.
+# Valid from -10C to 50C.
+GAS_COMP_A = 0.00035
+GAS_COMP_B = 0.02718
+GAS_COMP_C = 1.39538
+GAS_COMP_D = 0.0018
+GAS_COMP_TEMPERATURES = range(-10, 51, 5)
+GAS_COMP_HUMIDITIES = range(0, 101, 10)
+
+# GL5528 photoresistor, R = R10 * (lux / 10)^-gamma.
+LDR_GAMMA = 0.7
+
+
+def divider_ratio(raw):
+    """Sensor resistance over the load resistance for a high side sensor."""
+    return (ADC_MAX - raw) / raw
+
+
+def gas_ppm(raw):
+    return GAS_A * divider_ratio(raw) ** GAS_B
+
+
+def ldr_lux(raw):
+    return 10.0 * divider_ratio(raw) ** (-1.0 / LDR_GAMMA)
+
+
+def gas_compensation(temperature, humidity):
+    """Factor for the ppm at R0, so the tables stay at reference conditions."""
+    factor = (GAS_COMP_A * temperature * temperature -
+              GAS_COMP_B * temperature + GAS_COMP_C -
+              (humidity - 33) * GAS_COMP_D)
+    return factor ** -GAS_B
+
+
+def breakpoints(curve):
+    """Greedy piecewise linear fit over every ADC value.
+
+    The whole range is kept because each device scales the curve by its own
+    reference resistance, which can bring either end into what it reports.
+    """
+    raws = list(range(1, ADC_MAX))
+    points = [raws[0]]
+
+    start = 0
+    while start < len(raws) - 1:
+        end = start + 1
+        while end + 1 < len(raws) and fits(curve, raws[start], raws[end + 1]):
+            end += 1
+        points.append(raws[end])
+        start = end
+
+    return [(raw, curve(raw)) for raw in points]
+
+
+def fits(curve, first, last):
+    y0, y1 = curve(first), curve(last)
+    for raw in range(first + 1, last):
+        expected = curve(raw)
+        value = y0 + (y1 - y0) * (raw - first) / (last - first)
+        if abs(value - expected) > MAX_ERROR * expected:
+            return False
+    return True
+
+
+def float_literal(value):
+    text = "%.7g" % value
+    if "." not in text and "e" not in text:
+        text += ".0"
+    return text + "f"
+
+
+def render_curve(name, points):
+    lines = ["static const calibration_point %s[] = {" % name]
+    for raw, value in points:
+        lines.append("    {%d, %s}," % (raw, float_literal(value)))
+    lines.append("};")
+    return lines
+
+
+def render():
+    lines = [
+        "// Generated by tools/gen_calibration.py, do not edit.",
+        "#ifndef CALIBRATION_TABLES_H",
+        "#define CALIBRATION_TABLES_H",
+        "",
+        "#include <stdint.h>",
+        "",
+        "typedef struct {",
+        "  uint16_t raw;",
+        "  float value;",
+        "} calibration_point;",
+        "",
+        "#define CALIBRATION_GAS_B %sf" % repr(GAS_B),
+        "#define CALIBRATION_LDR_GAMMA %sf" % repr(LDR_GAMMA),
+        "#define CALIBRATION_COMP_T0 %d" % GAS_COMP_TEMPERATURES[0],
+        "#define CALIBRATION_COMP_T_STEP %d" % GAS_COMP_TEMPERATURES.step,
+        "#define CALIBRATION_COMP_T_COUNT %d" % len(GAS_COMP_TEMPERATURES),
+        "#define CALIBRATION_COMP_RH0 %d" % GAS_COMP_HUMIDITIES[0],
+        "#define CALIBRATION_COMP_RH_STEP %d" % GAS_COMP_HUMIDITIES.step,
+        "#define CALIBRATION_COMP_RH_COUNT %d" % len(GAS_COMP_HUMIDITIES),
+        "",
+        "// ppm with R0 equal to the load resistor, at 20C and 33% RH.",
+    ]
+    lines += render_curve("gas_ppm_curve",
+                          breakpoints(gas_ppm))
+    lines += ["", "// lux with R10 equal to the fixed resistor."]
+    lines += render_curve("ldr_lux_curve",
+                          breakpoints(ldr_lux))
+    lines += [
+        "",
+        "// ppm multiplier by temperature (rows) and relative humidity.",
+        "static const float",
+        "    gas_compensation[CALIBRATION_COMP_T_COUNT]"
+        "[CALIBRATION_COMP_RH_COUNT] = {",
+    ]
+    for temperature in GAS_COMP_TEMPERATURES:
+        row = [float_literal(gas_compensation(temperature, humidity))
+               for humidity in GAS_COMP_HUMIDITIES]
+        lines.append("    {" + ", ".join(row[:6]) + ",")
+        lines.append("     " + ", ".join(row[6:]) + "},")
+    lines += ["};", "", "#endif", ""]
+    return "\n".join(lines)
+
+
+def main(root):
+    path = os.path.join(root, "include", "calibration_tables.h")
+    contents = render()
+
+    try:
+        with open(path) as current:
+            if current.read() == contents:
+                return
+    except OSError:
+        pass
+
+    with open(path, "w") as header:
+        header.write(contents)
+    print("Generated " + os.path.normpath(path))
+
+
+try:
+    Import("env")  # noqa: F821, only defined in PlatformIO scripts
+except NameError:
+    main(os.path.join(os.path.dirname(os.path.abspath(__file__)), ".."))
+else:
+    main(env.subst("$PROJECT_DIR"))  # noqa: F821
@@ -0,0 +1,204 @@
+// Host benchmark of the flash history over a file backed NOR flash model.
+//
+//   cc -O2 -Iinclude -o bench tools/history_bench.c src/history.c src/crc32.c
+//   ./bench [image] [days]
+//
+// Fills the history with a minute point per minute for the given number of
+// days (default 31), then times appends, compactions (the appends that start
+// a quarter hour), mounts and range queries. Next to the host time it counts
+// the flash operations, which is what dominates on the device. The image
+// (default history.bin) is the size of the history partition and is kept,
+// so it can be flashed for testing.
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "history.h"
+
+#define PARTITION_SIZE 0x20000
+#define SECTOR_SIZE 4096
+// On a quarter hour.
+#define START_TS 1699999200u
+
+typedef struct {
+  int fd;
+  uint32_t reads;
+  uint32_t read_bytes;
+  uint32_t writes;
+  uint32_t erases;
+} file_flash;
+
+static int file_read(void *ctx, uint32_t addr, void *buf, uint32_t len) {
+  file_flash *flash = ctx;
+
+  flash->reads++;
+  flash->read_bytes += len;
+  return pread(flash->fd, buf, len, addr) == (ssize_t)len ? 0 : -1;
+}
+
+// NOR flash only clears bits.
+static int file_write(void *ctx, uint32_t addr, const void *buf,
+                      uint32_t len) {
+  file_flash *flash = ctx;
+  uint8_t current[SECTOR_SIZE];
+
+  flash->writes++;
+  for (uint32_t done = 0; done < len;) {
+    uint32_t n = len - done < sizeof(current) ? len - done : sizeof(current);
+    if (pread(flash->fd, current, n, addr + done) != (ssize_t)n) {
+      return -1;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+      current[i] &= ((const uint8_t *)buf)[done + i];
+    }
+    if (pwrite(flash->fd, current, n, addr + done) != (ssize_t)n) {
+      return -1;
+    }
+    done += n;
+  }
+
+  return 0;
+}
+
+static int file_erase(void *ctx, uint32_t addr, uint32_t len) {
+  file_flash *flash = ctx;
+  uint8_t erased[SECTOR_SIZE];
+
+  flash->erases++;
+  memset(erased, 0xff, sizeof(erased));
+  for (uint32_t done = 0; done < len; done += SECTOR_SIZE) {
+    if (pwrite(flash->fd, erased, SECTOR_SIZE, addr + done) != SECTOR_SIZE) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+static double now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void reset_counts(file_flash *flash) {
+  flash->reads = flash->read_bytes = flash->writes = flash->erases = 0;
+}
+
+static void report(const char *step, uint32_t runs, double us,
+                   const file_flash *flash) {
+  printf("%-22s %8.2f us %7.1f reads %8.0f bytes %6.2f writes %6.3f erases\n",
+         step, us / runs, (double)flash->reads / runs,
+         (double)flash->read_bytes / runs, (double)flash->writes / runs,
+         (double)flash->erases / runs);
+}
+
+static int count_point(const history_point *point, void *arg) {
+  (void)point;
+  (*(uint32_t *)arg)++;
+  return 0;
+}
+
+static void bench_query(history *store, file_flash *flash, const char *step,
+                        uint32_t tier, uint32_t from, uint32_t to) {
+  uint32_t points = 0;
+  const int runs = 200;
+
+  reset_counts(flash);
+  double start = now_us();
+  for (int i = 0; i < runs; i++) {
+    history_query(store, tier, from, to, count_point, &points);
+  }
+  report(step, runs, now_us() - start, flash);
+  printf("%-22s %8u points\n", "", points / runs);
+}
+
+int main(int argc, char **argv) {
+  const char *image = argc > 1 ? argv[1] : "history.bin";
+  uint32_t days = argc > 2 ? atoi(argv[2]) : 31;
+  file_flash flash = {0};
+
+  flash.fd = open(image, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (flash.fd < 0 || ftruncate(flash.fd, PARTITION_SIZE) != 0) {
+    perror(image);
+    return 1;
+  }
+
+  flash_dev dev = {&flash,     PARTITION_SIZE, SECTOR_SIZE,
+                   file_read,  file_write,     file_erase};
+  if (file_erase(&flash, 0, PARTITION_SIZE) != 0) {
+    return 1;
+  }
+
+  history store;
+  if (history_mount(&store, &dev) != HISTORY_OK) {
+    fprintf(stderr, "Partition too small\n");
+    return 1;
+  }
+  printf("%u slots per sector, %u minute and %u quarter hour sectors\n",
+         store.slots, store.tiers[HISTORY_TIER_MINUTES].sectors,
+         store.tiers[HISTORY_TIER_QUARTERS].sectors);
+
+  // Readings every 15 s, like the default sleep.
+  history_bucket bucket = {0};
+  uint32_t end = START_TS + days * 86400;
+  double append_us = 0, compact_us = 0;
+  uint32_t appends = 0, compacts = 0;
+  file_flash append_ops = {0}, compact_ops = {0};
+
+  for (uint32_t ts = START_TS; ts < end; ts += 15) {
+    int32_t values[HISTORY_VALUES];
+    for (int i = 0; i < HISTORY_VALUES; i++) {
+      values[i] = (int32_t)((ts / 60 + i * 7) % 1000);
+    }
+
+    bool closes = ts % 60 == 0 && ts > START_TS;
+    // Closing the first minute of a quarter hour compacts the previous one.
+    bool compacts_now = closes && (ts - 60) % 900 == 0;
+    reset_counts(&flash);
+    double start = now_us();
+    history_record(&store, &bucket, ts, values, (1u << HISTORY_VALUES) - 1);
+    double took = now_us() - start;
+
+    file_flash *ops = compacts_now ? &compact_ops : &append_ops;
+    if (closes) {
+      ops->reads += flash.reads;
+      ops->read_bytes += flash.read_bytes;
+      ops->writes += flash.writes;
+      ops->erases += flash.erases;
+      if (compacts_now) {
+        compact_us += took;
+        compacts++;
+      } else {
+        append_us += took;
+        appends++;
+      }
+    }
+  }
+  report("append", appends, append_us, &append_ops);
+  report("append and compact", compacts, compact_us, &compact_ops);
+
+  const int mounts = 200;
+  reset_counts(&flash);
+  double start = now_us();
+  for (int i = 0; i < mounts; i++) {
+    history_mount(&store, &dev);
+  }
+  report("mount", mounts, now_us() - start, &flash);
+
+  uint32_t last = store.tiers[HISTORY_TIER_MINUTES].last_ts;
+  bench_query(&store, &flash, "minutes, last hour", HISTORY_TIER_MINUTES,
+              last - 3599, last);
+  bench_query(&store, &flash, "minutes, last day", HISTORY_TIER_MINUTES,
+              last - 86399, last);
+  bench_query(&store, &flash, "quarters, a day a week ago",
+              HISTORY_TIER_QUARTERS, last - 7 * 86400, last - 6 * 86400 - 1);
+  bench_query(&store, &flash, "quarters, 30 days", HISTORY_TIER_QUARTERS,
+              last - 30 * 86400, last);
+
+  close(flash.fd);
+  return 0;
+}
@@ -0,0 +1,8 @@
+#ifndef ESP_SYSTEM_H
+#define ESP_SYSTEM_H
+
+#include <stdint.h>
+
+uint32_t esp_random(void);
+
+#endif
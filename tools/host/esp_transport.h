@@ -0,0 +1,13 @@
+#ifndef ESP_TRANSPORT_H
+#define ESP_TRANSPORT_H
+
+// Only the loopback transport runs on the host, TCP and TLS fail to
+// connect.
+typedef struct esp_transport_item_t *esp_transport_handle_t;
+
+int esp_transport_connect(esp_transport_handle_t transport, const char *host,
+                          int port, int timeout_ms);
+int esp_transport_close(esp_transport_handle_t transport);
+int esp_transport_destroy(esp_transport_handle_t transport);
+
+#endif
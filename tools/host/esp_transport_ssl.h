@@ -0,0 +1,6 @@
+#ifndef ESP_TRANSPORT_SSL_H
+#define ESP_TRANSPORT_SSL_H
+
+#include "esp_transport.h"
+
+#endif
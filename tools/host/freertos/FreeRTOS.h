@@ -0,0 +1,19 @@
+#ifndef FREERTOS_H
+#define FREERTOS_H
+
+// Host stand-in with only what the MQTT client and its transports use. A
+// tick is a millisecond of the simulated clock in host.c. The ESP-IDF
+// headers bring in stdlib and unistd, so does this.
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "freertos/FreeRTOSConfig.h"
+
+typedef uint32_t TickType_t;
+typedef long BaseType_t;
+
+#define portTICK_PERIOD_MS 1
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef TASK_H
+#define TASK_H
+
+#include "freertos/FreeRTOS.h"
+
+TickType_t xTaskGetTickCount(void);
+// Moves the simulated clock on, nothing else runs meanwhile.
+void vTaskDelay(TickType_t ticks);
+
+#endif
@@ -0,0 +1,67 @@
+#include "esp_system.h"
+#include "esp_transport_tcp.h"
+#include "freertos/task.h"
+#include "host.h"
+
+#define KEEP_ALIVE_S 60
+
+uint32_t host_clock_ms;
+
+static uint8_t buffer[LOOPBACK_BUFFER_SIZE];
+static MQTTFixedBuffer_t mqtt_buffer = {buffer, sizeof(buffer)};
+static char thing_name[] = "bench";
+static uint32_t random_state = 1;
+
+TickType_t xTaskGetTickCount(void) { return host_clock_ms; }
+
+void vTaskDelay(TickType_t ticks) { host_clock_ms += ticks; }
+
+// xorshift32 with a fixed seed, the loopback's losses repeat every run.
+uint32_t esp_random(void) {
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 17;
+  random_state ^= random_state << 5;
+  return random_state;
+}
+
+esp_transport_handle_t esp_transport_tcp_init(void) { return NULL; }
+
+int esp_transport_connect(esp_transport_handle_t transport, const char *host,
+                          int port, int timeout_ms) {
+  return -1;
+}
+
+int esp_transport_close(esp_transport_handle_t transport) { return -1; }
+
+int esp_transport_destroy(esp_transport_handle_t transport) { return -1; }
+
+TlsTransportStatus_t TLS_FreeRTOS_Connect(
+    NetworkContext_t *network_context, const char *host, uint16_t port,
+    const NetworkCredentials_t *credentials, uint32_t receive_timeout_ms,
+    uint32_t send_timeout_ms) {
+  return TLS_TRANSPORT_CONNECT_FAILURE;
+}
+
+void TLS_FreeRTOS_Disconnect(NetworkContext_t *network_context) {}
+
+int32_t TLS_FreeRTOS_recv(NetworkContext_t *network_context, void *buffer,
+                          size_t bytes_to_recv) {
+  return -1;
+}
+
+int32_t TLS_FreeRTOS_send(NetworkContext_t *network_context,
+                          const void *buffer, size_t bytes_to_send) {
+  return -1;
+}
+
+MQTTStatus_t host_connect(MQTTContext_t *mqtt_context,
+                          NetworkContext_t *network_context,
+                          const loopback_faults *faults,
+                          MQTTEventCallback_t event_callback,
+                          uint32_t timeout_ms) {
+  mqtt_transport_set_faults(faults);
+  return connect_to_broker(mqtt_context, network_context,
+                           &mqtt_transport_loopback, event_callback,
+                           &mqtt_buffer, "loopback", 1883, NULL, NULL, NULL,
+                           thing_name, KEEP_ALIVE_S, timeout_ms);
+}
@@ -0,0 +1,22 @@
+#ifndef HOST_H
+#define HOST_H
+
+// Runs the firmware's MQTT client from components/aws-iot on the host:
+// connect_to_broker, publish_message and republish_message over the
+// loopback transport of mqtt_transport.c, with coreMQTT underneath. The
+// FreeRTOS tick is a millisecond of a simulated clock that only moves while
+// the client waits, so a benchmark takes as long as the link it simulates.
+#include "freertos/FreeRTOS.h"
+
+#include "aws_mqtt.h"
+
+extern uint32_t host_clock_ms;
+
+// A new loopback connection with the given link faults.
+MQTTStatus_t host_connect(MQTTContext_t *mqtt_context,
+                          NetworkContext_t *network_context,
+                          const loopback_faults *faults,
+                          MQTTEventCallback_t event_callback,
+                          uint32_t timeout_ms);
+
+#endif
@@ -0,0 +1,171 @@
+// Host benchmark of QoS1 publishing over the loopback transport.
+//
+//   SDK=components/aws-iot/aws-iot-device-sdk-embedded-C/libraries/standard
+//   cc -O2 -DLIBRARY_LOG_LEVEL=LOG_NONE -Itools/host
+//      -Icomponents/aws-iot/include -I$SDK/coreMQTT/source/include
+//      -I$SDK/coreMQTT/source/interface
+//      -I$SDK/backoffAlgorithm/source/include -o loopback_bench
+//      tools/loopback_bench.c tools/host/host.c
+//      components/aws-iot/source/aws_mqtt.c
+//      components/aws-iot/source/mqtt_transport.c
+//      components/aws-iot/source/loopback_transport.c
+//      $SDK/coreMQTT/source/*.c $SDK/backoffAlgorithm/source/*.c
+//   ./loopback_bench [messages] [payload bytes]
+//
+// Publishes the given number of messages (default 500 of 300 bytes) one at
+// a time through the firmware's client, like publish_reading: each waits
+// for its PUBACK, is sent again with republish_message after the ack
+// timeout and is given up after the retries. A dropped connection is
+// reconnected right away with connect_to_broker. Every link condition is
+// run with a few ack timeouts on a simulated clock, and the publish-to-ack
+// latency percentiles, throughput, resends and losses are printed.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "host.h"
+
+#define TOPIC "device/bench/data"
+#define RETRIES 2
+
+typedef struct {
+  const char *name;
+  loopback_faults faults;
+} condition;
+
+static const condition conditions[] = {
+    {"lan", {5, 0, 0, 0}},
+    {"50 ms", {50, 0, 0, 0}},
+    {"200 ms", {200, 0, 0, 0}},
+    {"2 kB/s", {50, 2000, 0, 0}},
+    {"5% loss", {50, 0, 50, 0}},
+    {"20% loss", {50, 0, 200, 0}},
+    {"drop/100", {50, 0, 0, 100}},
+    {"2G-ish", {400, 1000, 20, 0}},
+};
+
+static const uint32_t ack_timeouts_ms[] = {500, 1000, 2000, 5000};
+
+static MQTTContext_t mqtt_context;
+static NetworkContext_t network_context;
+static uint16_t acked_packet_id;
+static char payload[LOOPBACK_BUFFER_SIZE];
+
+static void event_callback(MQTTContext_t *context, MQTTPacketInfo_t *packet,
+                           MQTTDeserializedInfo_t *info) {
+  if (packet->type == MQTT_PACKET_TYPE_PUBACK) {
+    acked_packet_id = info->packetIdentifier;
+  }
+}
+
+// wait_for_ack in task_mqtt, polling by the millisecond so the latency is
+// not rounded up to the poll.
+static bool wait_for_ack(uint16_t packet_id, uint32_t timeout_ms) {
+  uint32_t start = host_clock_ms;
+
+  while (acked_packet_id != packet_id) {
+    if (host_clock_ms - start > timeout_ms ||
+        MQTT_ProcessLoop(&mqtt_context, 1) != MQTTSuccess) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool reconnect(const loopback_faults *faults, uint32_t timeout_ms,
+                      uint32_t *reconnects) {
+  for (int attempt = 0; attempt <= RETRIES; attempt++) {
+    (*reconnects)++;
+    // Packet ids start over with the new session.
+    acked_packet_id = 0;
+    if (host_connect(&mqtt_context, &network_context, faults, event_callback,
+                     timeout_ms) == MQTTSuccess) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static int compare(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+static void run(const condition *condition, uint32_t ack_timeout_ms,
+                uint32_t messages, size_t payload_len) {
+  uint32_t *latency = calloc(messages, sizeof(uint32_t));
+  uint32_t delivered = 0, resends = 0, reconnects = 0, lost = 0;
+
+  host_clock_ms = 0;
+  // The first connect is not counted as a reconnect.
+  reconnect(&condition->faults, ack_timeout_ms, &reconnects);
+  reconnects = 0;
+
+  for (uint32_t i = 0; i < messages; i++) {
+    uint32_t sent_ms = host_clock_ms;
+    uint16_t packet_id = 0;
+    bool acked = false;
+
+    for (int attempt = 0; attempt <= RETRIES && !acked; attempt++) {
+      MQTTStatus_t ret;
+
+      if (!network_context.loopback->connected) {
+        // A new session, the message goes out as a new one.
+        packet_id = 0;
+        if (!reconnect(&condition->faults, ack_timeout_ms, &reconnects)) {
+          break;
+        }
+      }
+      if (packet_id == 0) {
+        ret = publish_message(&mqtt_context, TOPIC, payload, payload_len,
+                              MQTTQoS1, &packet_id);
+      } else {
+        ret = republish_message(&mqtt_context, TOPIC, payload, payload_len,
+                                MQTTQoS1, packet_id);
+        resends++;
+      }
+      acked = ret == MQTTSuccess && wait_for_ack(packet_id, ack_timeout_ms);
+    }
+
+    if (acked) {
+      latency[delivered++] = host_clock_ms - sent_ms;
+    } else {
+      lost++;
+    }
+  }
+
+  qsort(latency, delivered, sizeof(uint32_t), compare);
+  printf("%-9s %6u %8.1f %7u %7u %7u %7u %6u %4u\n", condition->name,
+         ack_timeout_ms,
+         host_clock_ms ? delivered * 1000.0 / host_clock_ms : 0,
+         delivered ? latency[delivered / 2] : 0,
+         delivered ? latency[delivered * 99 / 100] : 0, resends, reconnects,
+         lost, network_context.loopback->dropped);
+  disconnect_from_broker(&mqtt_context, &network_context);
+  free(latency);
+}
+
+int main(int argc, char **argv) {
+  uint32_t messages = argc > 1 ? atoi(argv[1]) : 500;
+  size_t payload_len = argc > 2 ? atoi(argv[2]) : 300;
+
+  if (messages == 0 || payload_len + 64 > LOOPBACK_BUFFER_SIZE) {
+    fprintf(stderr, "Need messages and a payload that fits the loopback\n");
+    return 2;
+  }
+  memset(payload, 'x', payload_len);
+
+  printf("%u messages of %zu bytes, %d retries\n", messages, payload_len,
+         RETRIES);
+  printf("%-9s %6s %8s %7s %7s %7s %7s %6s %4s\n", "link", "ack ms", "msg/s",
+         "p50 ms", "p99 ms", "resends", "reconn", "lost", "drop");
+
+  for (size_t i = 0; i < sizeof(conditions) / sizeof(conditions[0]); i++) {
+    for (size_t j = 0; j < sizeof(ack_timeouts_ms) / sizeof(ack_timeouts_ms[0]);
+         j++) {
+      run(&conditions[i], ack_timeouts_ms[j], messages, payload_len);
+    }
+  }
+
+  return 0;
+}
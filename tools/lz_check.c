@@ -0,0 +1,225 @@
+// Host checks and benchmark of the payload compression.
+//
+//   cc -O2 -Iinclude -o lz_check tools/lz_check.c src/lz_codec.c
+//      src/reading.c
+//   ./lz_check [payloads]
+//
+// Round-trips edge cases, random data and damaged streams, then compresses
+// the given number of raw readings and window summaries (default 1000)
+// shaped like the ones task_mqtt publishes and prints their sizes, the time
+// to compress and decompress one and the encoder's working memory.
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "check.h"
+#include "lz_codec.h"
+#include "reading.h"
+
+// Nothing grows by more than a flag bit per byte.
+#define LZ_BOUND(len) (LZ_HEADER_SIZE + (len) + (len) / 8 + 1)
+#define GUARD 0x5a
+
+static lz_encoder encoder;
+static uint8_t packed[LZ_BOUND(LZ_MAX_INPUT) + 1];
+static uint8_t unpacked[LZ_MAX_INPUT + 1];
+
+// Compresses and decompresses, false when anything is off.
+static bool round_trip(const uint8_t *in, size_t len, int *packed_len) {
+  *packed_len = lz_compress(&encoder, in, len, packed, sizeof(packed) - 1);
+  if (*packed_len < LZ_HEADER_SIZE || *packed_len > (int)LZ_BOUND(len)) {
+    return false;
+  }
+
+  memset(unpacked, GUARD, sizeof(unpacked));
+  return lz_decompress(packed, *packed_len, unpacked, len) == (int)len &&
+         memcmp(unpacked, in, len) == 0 && unpacked[len] == GUARD;
+}
+
+static void check_edges(void) {
+  static uint8_t in[LZ_MAX_INPUT + 1];
+  int len;
+
+  CHECK(lz_compress(&encoder, in, 0, packed, sizeof(packed)) < 0);
+  CHECK(lz_compress(&encoder, in, LZ_MAX_INPUT + 1, packed, sizeof(packed)) <
+        0);
+  CHECK(lz_compress(&encoder, (const uint8_t *)"{}", 2, packed, 3) < 0);
+
+  CHECK(round_trip((const uint8_t *)"{", 1, &len));
+  CHECK(round_trip((const uint8_t *)"{}", 2, &len));
+  memset(in, '0', sizeof(in));
+  CHECK(round_trip(in, LZ_MAX_INPUT, &len));
+  printf("%d zeros: %d bytes\n", LZ_MAX_INPUT, len);
+  // Straight out of the dictionary.
+  const char *keys = "\"dht\":{\"temperature\":\"humidity\":";
+  CHECK(round_trip((const uint8_t *)keys, strlen(keys), &len));
+  CHECK(len < 12);
+
+  // Random data, of every size up to a few hundred and some larger.
+  for (size_t size = 1; size <= LZ_MAX_INPUT; size += size < 300 ? 1 : 97) {
+    for (size_t i = 0; i < size; i++) {
+      in[i] = (uint8_t)(check_random() % (size % 3 ? 256 : 4));
+    }
+    CHECK(round_trip(in, size, &len));
+  }
+
+  // The output buffer too small by a byte is refused, not overrun.
+  for (size_t i = 0; i < 600; i++) {
+    in[i] = (uint8_t)check_random();
+  }
+  CHECK(round_trip(in, 600, &len));
+  memset(packed, GUARD, sizeof(packed));
+  CHECK(lz_compress(&encoder, in, 600, packed, len - 1) < 0);
+  CHECK(packed[len - 1] == GUARD);
+}
+
+static void check_damaged(const uint8_t *in, size_t len) {
+  uint8_t stream[LZ_BOUND(LZ_MAX_INPUT)];
+  int packed_len;
+
+  CHECK(round_trip(in, len, &packed_len));
+  memcpy(stream, packed, packed_len);
+
+  // Cut short, flipped bits, a wrong header or a smaller output buffer
+  // fail or stay within the buffer, they never write past it.
+  for (int cut = 0; cut < packed_len; cut++) {
+    memset(unpacked, GUARD, sizeof(unpacked));
+    int n = lz_decompress(stream, cut, unpacked, len);
+    CHECK(n < 0 || n <= (int)len);
+    CHECK(unpacked[len] == GUARD);
+  }
+  for (int bit = LZ_HEADER_SIZE * 8; bit < packed_len * 8; bit++) {
+    stream[bit / 8] ^= 1 << (bit % 8);
+    memset(unpacked, GUARD, sizeof(unpacked));
+    int n = lz_decompress(stream, packed_len, unpacked, len);
+    CHECK(n < 0 || n == (int)len);
+    CHECK(unpacked[len] == GUARD);
+    stream[bit / 8] ^= 1 << (bit % 8);
+  }
+  stream[0] ^= 1;
+  CHECK(lz_decompress(stream, packed_len, unpacked, len) < 0);
+  stream[0] ^= 1;
+  stream[1]++;
+  CHECK(lz_decompress(stream, packed_len, unpacked, len) < 0);
+  stream[1]--;
+  memset(unpacked, GUARD, sizeof(unpacked));
+  CHECK(lz_decompress(stream, packed_len, unpacked, len - 1) < 0);
+  CHECK(unpacked[len - 1] == GUARD);
+}
+
+static int random_between(int low, int high) {
+  return low + (int)(check_random() % (uint32_t)(high - low + 1));
+}
+
+// A raw reading with the extras render_extras adds on a typical cycle.
+static int make_reading(uint32_t i, char *buf, size_t len) {
+  reading value = {
+      .dht = {random_between(180, 260), random_between(300, 650)},
+      .gas = {random_between(200, 2500), random_between(5, 400), 1},
+      .ldr = {random_between(0, 4095), random_between(0, 30000)},
+      .co2 = {random_between(400, 2000), random_between(18, 30)},
+      .power = {random_between(3300, 4200)},
+      .net = {0, 0},
+      .uptime = (int)(i * 15),
+  };
+  char extras[256];
+
+  snprintf(extras, sizeof(extras),
+           ",\"ts\":%lld,\"ts_err\":%u,\"latency_ms\":%u,"
+           "\"heap\":{\"peak\":%u,\"min\":%u}",
+           1760880000000LL + i * 15000LL + random_between(0, 999),
+           random_between(2, 40), random_between(150, 900),
+           random_between(38000, 42000), random_between(80000, 90000));
+  return reading_write_json(&value, extras, buf, len);
+}
+
+// The window summary from render_summary, every metric present.
+static int make_summary(char *buf, size_t len) {
+  static const char *const names[] = {
+      "dht.temperature", "dht.humidity", "gas.level",
+      "gas.ppm",         "ldr.intensity", "ldr.lux",
+      "co2.ppm",         "co2.temperature", "power.volts",
+  };
+  static const float ranges[][2] = {
+      {18, 26}, {30, 65}, {200, 2500}, {5, 400}, {0, 4095},
+      {0, 30000}, {400, 2000}, {18, 30}, {3.3f, 4.2f},
+  };
+  int pos = snprintf(buf, len,
+                     "{\"window\":{\"cycles\":20},\"net\":{\"skipped\":0,"
+                     "\"failures\":%u}",
+                     check_random() % 3);
+
+  for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+    float low = ranges[i][0], span = ranges[i][1] - ranges[i][0];
+    float at = (check_random() % 1000) / 1000.0f;
+    float mean = low + span * at;
+    float sd = span * (check_random() % 100) / 2000.0f;
+
+    pos += snprintf(buf + pos, len - pos,
+                    ",\"%s\":{\"n\":20,\"mean\":%.2f,\"sd\":%.2f,\"min\":%.2f,"
+                    "\"max\":%.2f,\"ewma\":%.2f,\"p50\":%.2f,\"p90\":%.2f}",
+                    names[i], mean, sd, mean - 2 * sd, mean + 2 * sd,
+                    mean + sd / 3, mean - sd / 10, mean + 1.3f * sd);
+  }
+  pos += snprintf(buf + pos, len - pos, "}");
+  return pos;
+}
+
+static void bench(const char *name, bool summary, uint32_t payloads) {
+  static char message[LZ_MAX_INPUT];
+  uint64_t raw = 0, compressed = 0;
+  double smallest = 1, largest = 0, encode_ns = 0, decode_ns = 0;
+
+  for (uint32_t i = 0; i < payloads; i++) {
+    int len = summary ? make_summary(message, sizeof(message))
+                      : make_reading(i, message, sizeof(message));
+    int packed_len;
+
+    CHECK(len > 0 && len <= LZ_MAX_INPUT);
+    if (i < 3) {
+      check_damaged((const uint8_t *)message, len);
+    }
+
+    double start = check_seconds();
+    packed_len = lz_compress(&encoder, (const uint8_t *)message, len, packed,
+                             sizeof(packed));
+    encode_ns += (check_seconds() - start) * 1e9;
+    CHECK(packed_len > 0);
+
+    start = check_seconds();
+    int n = lz_decompress(packed, packed_len, unpacked, sizeof(unpacked));
+    decode_ns += (check_seconds() - start) * 1e9;
+    CHECK(n == len && memcmp(unpacked, message, len) == 0);
+
+    double ratio = (double)packed_len / len;
+    smallest = ratio < smallest ? ratio : smallest;
+    largest = ratio > largest ? ratio : largest;
+    raw += len;
+    compressed += packed_len;
+  }
+
+  printf("%-8s %8.1f %8.1f %6.2f %6.2f %6.2f %9.1f %9.1f\n", name,
+         (double)raw / payloads, (double)compressed / payloads,
+         (double)compressed / raw, smallest, largest,
+         encode_ns / payloads / 1000, decode_ns / payloads / 1000);
+}
+
+int main(int argc, char **argv) {
+  uint32_t payloads = argc > 1 ? atoi(argv[1]) : 1000;
+
+  if (payloads == 0) {
+    fprintf(stderr, "Need at least one payload\n");
+    return 2;
+  }
+
+  check_edges();
+
+  printf("%-8s %8s %8s %6s %6s %6s %9s %9s\n", "payload", "bytes", "packed",
+         "ratio", "best", "worst", "encode us", "decode us");
+  bench("reading", false, payloads);
+  bench("summary", true, payloads);
+  printf("encoder state %zu bytes, decoder state none\n", sizeof(lz_encoder));
+
+  return check_result();
+}
@@ -0,0 +1,82 @@
+// Host checks of the connectivity backoff.
+//
+//   cc -Iinclude -o net_policy_check tools/net_policy_check.c
+//      src/net_policy.c
+//   ./net_policy_check [outage cycles]
+//
+// Checks the skip lengths against the policy, then runs a network outage of
+// the given number of wake cycles (default 200) and prints on which cycles
+// the device tried to connect, and how many it skipped.
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "check.h"
+#include "net_policy.h"
+
+static uint32_t skips_after(net_policy_state *state) {
+  uint32_t skipped = 0;
+
+  while (!net_policy_should_connect(state)) {
+    skipped++;
+  }
+  return skipped;
+}
+
+static void check_backoff(void) {
+  net_policy_state state = {0};
+
+  // The first failures are free, then 1, 2, 4... cycles up to the cap.
+  for (uint32_t i = 0; i < NET_POLICY_FREE_FAILURES; i++) {
+    CHECK(net_policy_should_connect(&state));
+    net_policy_report(&state, false);
+    CHECK(state.skip_remaining == 0);
+  }
+
+  uint32_t expect = 1;
+  for (int i = 0; i < 10; i++) {
+    CHECK(net_policy_should_connect(&state));
+    net_policy_report(&state, false);
+    CHECK(skips_after(&state) == expect);
+    expect = expect * 2 > NET_POLICY_MAX_SKIP ? NET_POLICY_MAX_SKIP
+                                              : expect * 2;
+  }
+  CHECK(state.failed_total == NET_POLICY_FREE_FAILURES + 10);
+
+  // One success starts over.
+  net_policy_report(&state, true);
+  CHECK(state.failures == 0 && state.skip_remaining == 0);
+  net_policy_report(&state, false);
+  CHECK(net_policy_should_connect(&state));
+}
+
+static void run_outage(uint32_t outage) {
+  net_policy_state state = {0};
+  uint32_t attempts = 0;
+
+  printf("outage of %u cycles, attempts on cycle:", outage);
+  for (uint32_t cycle = 0; cycle < outage + 40; cycle++) {
+    if (!net_policy_should_connect(&state)) {
+      continue;
+    }
+    attempts++;
+    bool up = cycle >= outage;
+    net_policy_report(&state, up);
+    if (up) {
+      printf(", back on %u (%u cycles late)\n", cycle, cycle - outage);
+      break;
+    }
+    printf(" %u", cycle);
+  }
+  printf("%u attempts, %u cycles skipped, %u failed\n", attempts,
+         state.skipped_total, state.failed_total);
+}
+
+int main(int argc, char **argv) {
+  uint32_t outage = argc > 1 ? atoi(argv[1]) : 200;
+
+  check_backoff();
+  if (failures == 0) {
+    run_outage(outage);
+  }
+  return check_result();
+}
@@ -0,0 +1,265 @@
+// Host checks of the chunked OTA download and its running hash.
+//
+//   cc -O2 -Iinclude -o ota_chunk_check tools/ota_chunk_check.c
+//      src/ota_chunk.c src/sha256.c
+//   ./ota_chunk_check [image bytes]
+//
+// Checks SHA-256 against the FIPS 180-2 vectors, then downloads an image
+// (default 300000 bytes) over a simulated backend like ota_update does: up
+// to 32 chunks a wake, replies that get lost, duplicated, delayed or sent
+// for an older build, and power cuts mid-wake that go back to the offset
+// saved at the end of the last wake and rebuild the hash from the "flash"
+// below it. The reassembled image and the final hash must match the
+// original.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "check.h"
+#include "ota_chunk.h"
+#include "sha256.h"
+
+#define CHUNKS_PER_WAKE 32
+#define BUILD 42
+
+static void digest_of(const void *data, size_t len,
+                      uint8_t digest[SHA256_DIGEST_SIZE]) {
+  sha256_context ctx;
+
+  sha256_init(&ctx);
+  sha256_update(&ctx, data, len);
+  sha256_final(&ctx, digest);
+}
+
+static bool digest_is(const uint8_t *digest, const char *hex) {
+  char text[2 * SHA256_DIGEST_SIZE + 1];
+
+  for (int i = 0; i < SHA256_DIGEST_SIZE; i++) {
+    sprintf(text + 2 * i, "%02x", digest[i]);
+  }
+  return strcmp(text, hex) == 0;
+}
+
+static void check_sha256(void) {
+  uint8_t digest[SHA256_DIGEST_SIZE];
+  sha256_context ctx;
+
+  digest_of("", 0, digest);
+  CHECK(digest_is(digest, "e3b0c44298fc1c149afbf4c8996fb924"
+                          "27ae41e4649b934ca495991b7852b855"));
+  digest_of("abc", 3, digest);
+  CHECK(digest_is(digest, "ba7816bf8f01cfea414140de5dae2223"
+                          "b00361a396177a9cb410ff61f20015ad"));
+  const char *two_blocks =
+      "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+  digest_of(two_blocks, strlen(two_blocks), digest);
+  CHECK(digest_is(digest, "248d6a61d20638b8e5c026930c3e6039"
+                          "a33ce45964ff2167f6ecedd419db06c1"));
+
+  // A million 'a' in odd pieces, like chunks straddling the blocks.
+  char piece[997];
+  memset(piece, 'a', sizeof(piece));
+  sha256_init(&ctx);
+  for (size_t done = 0; done < 1000000;) {
+    size_t n = 1000000 - done < sizeof(piece) ? 1000000 - done : sizeof(piece);
+    sha256_update(&ctx, piece, n);
+    done += n;
+  }
+  sha256_final(&ctx, digest);
+  CHECK(digest_is(digest, "cdc76e5c9914fb9281a1c7e284d73e67"
+                          "f1809a48a497200e046d39ccc7112cd0"));
+}
+
+static void check_parse(void) {
+  ota_progress progress = {BUILD, 1000, 512};
+  uint8_t frame[OTA_CHUNK_HEADER_SIZE + OTA_CHUNK_SIZE + 1] = {0};
+  const uint8_t *data;
+  size_t data_len;
+  char request[96];
+
+  frame[0] = BUILD;
+  frame[5] = 2; // offset 512
+  CHECK(ota_chunk_parse(&progress, frame, OTA_CHUNK_HEADER_SIZE + 488, &data,
+                        &data_len) == OTA_CHUNK_ACCEPTED);
+  CHECK(data == frame + OTA_CHUNK_HEADER_SIZE && data_len == 488);
+  // Past the end of the image, or larger than a chunk.
+  CHECK(ota_chunk_parse(&progress, frame, OTA_CHUNK_HEADER_SIZE + 489, &data,
+                        &data_len) == OTA_CHUNK_REJECTED);
+  progress.size = 4096;
+  CHECK(ota_chunk_parse(&progress, frame, sizeof(frame), &data, &data_len) ==
+        OTA_CHUNK_REJECTED);
+  CHECK(ota_chunk_parse(&progress, frame, OTA_CHUNK_HEADER_SIZE, &data,
+                        &data_len) == OTA_CHUNK_REJECTED);
+  // Ahead of the offset is rejected, behind it or another build is stale.
+  frame[5] = 4;
+  CHECK(ota_chunk_parse(&progress, frame, 100, &data, &data_len) ==
+        OTA_CHUNK_REJECTED);
+  frame[5] = 0;
+  CHECK(ota_chunk_parse(&progress, frame, 100, &data, &data_len) ==
+        OTA_CHUNK_STALE);
+  frame[0] = BUILD - 1;
+  frame[5] = 2;
+  CHECK(ota_chunk_parse(&progress, frame, 100, &data, &data_len) ==
+        OTA_CHUNK_STALE);
+
+  progress.offset = 4000;
+  CHECK(ota_chunk_request(&progress, request, sizeof(request)) > 0);
+  CHECK(strcmp(request,
+               "{\"build\": 42, \"offset\": 4000, \"length\": 96}") == 0);
+  CHECK(ota_chunk_request(&progress, request, 10) == 0);
+  CHECK(!ota_progress_complete(&progress));
+  progress.offset = 4096;
+  CHECK(ota_progress_complete(&progress));
+}
+
+static size_t make_frame(uint32_t build, uint32_t offset, const uint8_t *image,
+                         uint32_t size, uint8_t *frame) {
+  uint32_t len = size - offset;
+
+  if (len > OTA_CHUNK_SIZE) {
+    len = OTA_CHUNK_SIZE;
+  }
+
+  for (int i = 0; i < 4; i++) {
+    frame[i] = (uint8_t)(build >> (8 * i));
+    frame[4 + i] = (uint8_t)(offset >> (8 * i));
+  }
+  memcpy(frame + OTA_CHUNK_HEADER_SIZE, image + offset, len);
+  return OTA_CHUNK_HEADER_SIZE + len;
+}
+
+// What ota_update keeps in RTC memory, the offset it saves to NVS when the
+// wake ends and the slot it writes.
+typedef struct {
+  ota_progress progress;
+  sha256_context sha;
+  uint32_t saved_offset;
+  uint8_t *flash;
+} device;
+
+// After a power cut only the offset saved in NVS is left, the hash is
+// rebuilt from the flash written below it, in blocks like ota_update reads.
+static void power_cut(device *dev) {
+  dev->progress.offset = dev->saved_offset;
+  sha256_init(&dev->sha);
+  for (uint32_t offset = 0; offset < dev->progress.offset; offset += 4096) {
+    uint32_t len = dev->progress.offset - offset;
+    sha256_update(&dev->sha, dev->flash + offset, len > 4096 ? 4096 : len);
+  }
+}
+
+static void check_download(uint32_t size) {
+  uint8_t *image = malloc(size);
+  uint8_t frame[OTA_CHUNK_HEADER_SIZE + OTA_CHUNK_SIZE];
+  uint8_t expect[SHA256_DIGEST_SIZE], digest[SHA256_DIGEST_SIZE];
+  device dev = {.progress = {BUILD, size, 0}, .flash = calloc(size, 1)};
+  uint32_t wakes = 0, accepted = 0, stale = 0, rejected = 0, cuts = 0;
+  // A reply held back into the next request.
+  uint32_t late_offset = UINT32_MAX;
+
+  for (uint32_t i = 0; i < size; i++) {
+    image[i] = (uint8_t)check_random();
+  }
+  // Garbage in the slot from whatever was there before.
+  memset(dev.flash, 0xa5, size);
+  digest_of(image, size, expect);
+  sha256_init(&dev.sha);
+
+  while (!ota_progress_complete(&dev.progress) && wakes < 100000) {
+    // The power goes before this many requests, or not at all.
+    uint32_t cut_at = check_random() % 4 == 0 ? check_random() % CHUNKS_PER_WAKE
+                                              : UINT32_MAX;
+    wakes++;
+
+    for (uint32_t request = 0; request < CHUNKS_PER_WAKE &&
+                               !ota_progress_complete(&dev.progress);
+         request++) {
+      char text[96];
+      unsigned build, offset, length;
+
+      if (request == cut_at) {
+        break;
+      }
+      CHECK(ota_chunk_request(&dev.progress, text, sizeof(text)) > 0);
+      CHECK(sscanf(text, "{\"build\": %u, \"offset\": %u, \"length\": %u}",
+                   &build, &offset, &length) == 3);
+      CHECK(offset == dev.progress.offset && length > 0 &&
+            length <= OTA_CHUNK_SIZE);
+
+      // The backend's replies: the one asked for, lost, held back, sent
+      // twice or for an older build, after a late one from before.
+      uint32_t builds[3], offsets[3];
+      size_t count = 0;
+      if (late_offset != UINT32_MAX) {
+        builds[count] = build;
+        offsets[count++] = late_offset;
+        late_offset = UINT32_MAX;
+      }
+      uint32_t fate = check_random() % 100;
+      if (fate < 3) {
+        late_offset = offset;
+      } else if (fate >= 8) {
+        builds[count] = fate < 10 ? build - 1 : build;
+        offsets[count++] = offset;
+        if (fate < 14) {
+          builds[count] = build;
+          offsets[count++] = offset;
+        }
+      }
+
+      for (size_t r = 0; r < count; r++) {
+        size_t len = make_frame(builds[r], offsets[r], image, size, frame);
+        const uint8_t *data;
+        size_t data_len;
+
+        switch (ota_chunk_parse(&dev.progress, frame, len, &data, &data_len)) {
+        case OTA_CHUNK_ACCEPTED:
+          CHECK(builds[r] == BUILD && offsets[r] == dev.progress.offset);
+          memcpy(dev.flash + dev.progress.offset, data, data_len);
+          sha256_update(&dev.sha, data, data_len);
+          dev.progress.offset += data_len;
+          accepted++;
+          break;
+        case OTA_CHUNK_STALE:
+          stale++;
+          break;
+        case OTA_CHUNK_REJECTED:
+          rejected++;
+          break;
+        }
+      }
+    }
+
+    if (cut_at != UINT32_MAX) {
+      power_cut(&dev);
+      late_offset = UINT32_MAX;
+      cuts++;
+    } else {
+      dev.saved_offset = dev.progress.offset;
+    }
+  }
+
+  sha256_final(&dev.sha, digest);
+  CHECK(ota_progress_complete(&dev.progress));
+  CHECK(memcmp(dev.flash, image, size) == 0);
+  CHECK(memcmp(digest, expect, sizeof(digest)) == 0);
+  printf("%u bytes (%u chunks) in %u wakes: %u chunks accepted, %u stale, "
+         "%u rejected, %u power cuts\n",
+         size, (size + OTA_CHUNK_SIZE - 1) / OTA_CHUNK_SIZE, wakes, accepted,
+         stale, rejected, cuts);
+
+  free(dev.flash);
+  free(image);
+}
+
+int main(int argc, char **argv) {
+  uint32_t size = argc > 1 ? atoi(argv[1]) : 300000;
+
+  check_sha256();
+  check_parse();
+  if (size > 0) {
+    check_download(size);
+  }
+
+  return check_result();
+}
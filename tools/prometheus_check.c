@@ -0,0 +1,238 @@
+// Host checks and benchmark of the Prometheus exposition.
+//
+//   cc -O2 -Iinclude -o prometheus_check tools/prometheus_check.c
+//      src/prometheus.c src/stats.c -lm
+//   ./prometheus_check [renders]
+//
+// Renders a reading and a window of statistics like update_metrics does and
+// checks the text line by line: every sample follows the TYPE line of its
+// gauge, names are valid Prometheus names, values read back to the fields
+// and statistics, missing groups and empty metrics are left out, and a short
+// buffer gives -1. Then times the given number of renders (default 100000).
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "check.h"
+#include "metrics_server.h"
+#include "prometheus.h"
+
+// The metrics of the window, as task_mqtt names them.
+static const char *metric_names[] = {
+    "dht.temperature", "dht.humidity", "gas.level",
+    "gas.ppm",         "ldr.intensity", "ldr.lux",
+    "co2.ppm",         "co2.temperature", "power.volts",
+};
+#define METRICS (int)(sizeof(metric_names) / sizeof(metric_names[0]))
+
+static void make_reading(reading *value) {
+  memset(value, 0, sizeof(*value));
+  value->dht.temperature = -45;
+  value->dht.humidity = 61;
+  value->gas.level = 2211;
+  value->gas.ppm = 418;
+  value->gas.stable = 1;
+  value->ldr.light = 3990;
+  value->ldr.lux = 65000;
+  value->co2.ppm = 812;
+  value->co2.temperature = 24;
+  value->power.volts = 3712;
+  value->net.skipped = 3;
+  value->net.failures = 17;
+  value->uptime = 123456789;
+}
+
+static void make_window(metric_stats *metrics, uint32_t samples) {
+  for (int i = 0; i < METRICS; i++) {
+    stats_init(&metrics[i]);
+    // The CO2 sensor had nothing this window.
+    for (uint32_t s = 0; i != 6 && s < samples; s++) {
+      stats_add(&metrics[i], 100.0f * i + (s * 37 % 11) - 0.125f * s);
+    }
+  }
+}
+
+static bool valid_name(const char *name, size_t len) {
+  if (len == 0 || !(isalpha((unsigned char)name[0]) || name[0] == '_')) {
+    return false;
+  }
+  for (size_t i = 1; i < len; i++) {
+    if (!isalnum((unsigned char)name[i]) && name[i] != '_') {
+      return false;
+    }
+  }
+  return true;
+}
+
+// The value of a sample line, or NAN when the text has no such line.
+static double sample_value(const char *text, const char *sample) {
+  char line[128];
+  const char *at;
+
+  snprintf(line, sizeof(line), "\n%s ", sample);
+  at = strstr(text, line);
+  return at ? strtod(at + strlen(line), NULL) : NAN;
+}
+
+static bool close_to(double value, double expect) {
+  return fabs(value - expect) <= 1e-5 * (fabs(expect) + 1);
+}
+
+static void check_window_stats(const char *text, const char *name,
+                               const metric_stats *stats) {
+  char metric[40], sample[128];
+  const struct {
+    const char *stat;
+    double value;
+  } stats_of[] = {
+      {"n", stats->count},
+      {"mean", stats->mean},
+      {"sd", sqrt(stats_variance(stats))},
+      {"min", stats->min},
+      {"max", stats->max},
+      {"ewma", stats->ewma},
+      {"p50", stats_p50(stats)},
+      {"p90", stats_p90(stats)},
+  };
+
+  snprintf(metric, sizeof(metric), "%s", name);
+  *strchr(metric, '.') = '_';
+  for (size_t i = 0; i < sizeof(stats_of) / sizeof(stats_of[0]); i++) {
+    snprintf(sample, sizeof(sample), "aq_window{metric=\"%s\",stat=\"%s\"}",
+             metric, stats_of[i].stat);
+    double value = sample_value(text, sample);
+    CHECK(stats->count == 0 ? isnan(value)
+                            : close_to(value, stats_of[i].value));
+  }
+}
+
+// Every line is a TYPE line or a sample of the gauge declared last, and no
+// gauge is declared twice.
+static void check_lines(const char *text, int len) {
+  char declared[64][48];
+  int gauges = 0, samples = 0;
+  const char *gauge = NULL;
+
+  CHECK(len > 0 && text[len - 1] == '\n' && strlen(text) == (size_t)len);
+  for (const char *line = text; *line;) {
+    const char *end = strchr(line, '\n');
+    size_t name_len = strcspn(line, "{ \n");
+
+    if (strncmp(line, "# TYPE ", 7) == 0) {
+      const char *name = line + 7;
+      name_len = strcspn(name, " ");
+      CHECK(valid_name(name, name_len));
+      CHECK(strncmp(name + name_len, " gauge\n", 7) == 0);
+      CHECK(gauges < 64 && name_len < sizeof(declared[0]));
+      for (int i = 0; i < gauges; i++) {
+        CHECK(strlen(declared[i]) != name_len ||
+              strncmp(declared[i], name, name_len) != 0);
+      }
+      snprintf(declared[gauges++], sizeof(declared[0]), "%.*s", (int)name_len,
+               name);
+      gauge = declared[gauges - 1];
+    } else {
+      char *value_end;
+      const char *value = line + name_len;
+
+      CHECK(gauge != NULL && strlen(gauge) == name_len &&
+            strncmp(line, gauge, name_len) == 0);
+      if (*value == '{') {
+        value = strchr(value, '}') + 1;
+      }
+      CHECK(*value == ' ');
+      strtod(value + 1, &value_end);
+      CHECK(value_end == end && value_end > value + 1);
+      samples++;
+    }
+    line = end + 1;
+  }
+  CHECK(samples > 0);
+}
+
+static void check_render(void) {
+  static char text[METRICS_SERVER_MAX];
+  reading value;
+  metric_stats metrics[METRICS];
+
+  make_reading(&value);
+  make_window(metrics, 20);
+  int len = prometheus_write(&value, metrics, metric_names, METRICS, text,
+                             sizeof(text));
+  check_lines(text, len);
+
+#define CHECK_FIELD(name, key)                                                 \
+  snprintf(sample, sizeof(sample), "aq_%s_" key, group_name);                  \
+  CHECK(sample_value(text, sample) == group->name);
+#define CHECK_GROUP(name, type, fields)                                        \
+  {                                                                            \
+    const char *group_name = #name;                                            \
+    const type *group = &value.name;                                           \
+    char sample[64];                                                           \
+    fields(CHECK_FIELD)                                                        \
+  }
+  READING_GROUPS(CHECK_GROUP)
+#undef CHECK_GROUP
+#undef CHECK_FIELD
+  CHECK(sample_value(text, "aq_uptime") == value.uptime);
+
+  for (int i = 0; i < METRICS; i++) {
+    check_window_stats(text, metric_names[i], &metrics[i]);
+  }
+
+  // Every length short of the text plus its terminator is refused.
+  for (int short_len = 0; short_len <= len; short_len++) {
+    char *buf = malloc(short_len);
+    CHECK(prometheus_write(&value, metrics, metric_names, METRICS, buf,
+                           short_len) == -1);
+    free(buf);
+  }
+  CHECK(prometheus_write(&value, metrics, metric_names, METRICS, text,
+                         len + 1) == len);
+  printf("full render: %d of %d bytes\n", len, METRICS_SERVER_MAX);
+
+  // Groups without data and an empty window leave their gauges out.
+  value.missing = READING_MISSING(gas) | READING_MISSING(co2);
+  make_window(metrics, 0);
+  len = prometheus_write(&value, metrics, metric_names, METRICS, text,
+                         sizeof(text));
+  check_lines(text, len);
+  CHECK(strstr(text, "aq_gas_") == NULL && strstr(text, "aq_co2_") == NULL);
+  CHECK(sample_value(text, "aq_dht_humidity") == value.dht.humidity);
+  CHECK(strstr(text, "aq_window{") == NULL);
+}
+
+static void bench(uint32_t renders) {
+  static char text[METRICS_SERVER_MAX];
+  reading value;
+  metric_stats metrics[METRICS];
+  int len = 0;
+
+  make_reading(&value);
+  make_window(metrics, 60);
+
+  double start = check_seconds();
+  for (uint32_t i = 0; i < renders; i++) {
+    value.uptime = i;
+    len = prometheus_write(&value, metrics, metric_names, METRICS, text,
+                           sizeof(text));
+  }
+  double s = check_seconds() - start;
+
+  CHECK(len > 0);
+  printf("%u renders of %d bytes: %.0f renders/s, %.1f us each\n", renders,
+         len, renders / s, s * 1e6 / renders);
+}
+
+int main(int argc, char **argv) {
+  uint32_t renders = argc > 1 ? atoi(argv[1]) : 100000;
+
+  check_render();
+  if (renders > 0) {
+    bench(renders);
+  }
+
+  return check_result();
+}
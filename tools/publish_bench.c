@@ -0,0 +1,170 @@
+// Host benchmark of the windowed backlog drain against the loopback broker.
+//
+//   SDK=components/aws-iot/aws-iot-device-sdk-embedded-C/libraries/standard
+//   cc -O2 -DLIBRARY_LOG_LEVEL=LOG_NONE -Iinclude -Itools/host
+//      -Icomponents/aws-iot/include -I$SDK/coreMQTT/source/include
+//      -I$SDK/coreMQTT/source/interface
+//      -I$SDK/backoffAlgorithm/source/include -o publish_bench
+//      tools/publish_bench.c tools/host/host.c src/publish_window.c
+//      components/aws-iot/source/aws_mqtt.c
+//      components/aws-iot/source/mqtt_transport.c
+//      components/aws-iot/source/loopback_transport.c
+//      $SDK/coreMQTT/source/*.c $SDK/backoffAlgorithm/source/*.c
+//   ./publish_bench [messages] [payload bytes]
+//
+// Drains the given number of QoS1 publishes (default 200 of 300 bytes)
+// through the firmware's client over the loopback transport, for a range
+// of injected latencies, link speeds and loss, on a simulated clock. The
+// old drain, one publish per PUBACK with a 100 ms gap, is run next to the
+// window for comparison.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/task.h"
+#include "host.h"
+#include "publish_window.h"
+
+#define TOPIC "device/bench/data"
+#define SEND_INTERVAL_MS 10
+#define POLL_MS 10
+#define OLD_INTERVAL_MS 100
+#define ACK_TIMEOUT_MS 5000
+#define GIVE_UP_MS 3600000
+
+static MQTTContext_t mqtt_context;
+static NetworkContext_t network_context;
+static publish_window *acking;
+static uint16_t acked_packet_id;
+static char payload[LOOPBACK_BUFFER_SIZE];
+static size_t payload_len;
+
+static void event_callback(MQTTContext_t *context, MQTTPacketInfo_t *packet,
+                           MQTTDeserializedInfo_t *info) {
+  if (packet->type != MQTT_PACKET_TYPE_PUBACK) {
+    return;
+  }
+  acked_packet_id = info->packetIdentifier;
+  if (acking != NULL) {
+    publish_window_ack(acking, acked_packet_id, host_clock_ms);
+  }
+}
+
+static void connect(const loopback_faults *faults, publish_window *window) {
+  host_clock_ms = 0;
+  acked_packet_id = 0;
+  acking = window;
+  host_connect(&mqtt_context, &network_context, faults, event_callback,
+               ACK_TIMEOUT_MS);
+}
+
+// Returns the time taken, the window is kept like in RTC memory.
+static uint32_t run_window(const loopback_faults *faults, uint32_t messages,
+                           publish_window *window, uint32_t *retransmits) {
+  uint32_t sent = 0, drained = 0, send_at = 0;
+
+  connect(faults, window);
+  publish_window_clear(window);
+
+  // In the order of drain_window.
+  while (drained < messages && host_clock_ms < GIVE_UP_MS) {
+    while (publish_window_pop(window, NULL)) {
+      drained++;
+    }
+
+    publish_slot *late = publish_window_expired(window, host_clock_ms);
+    if (late != NULL) {
+      republish_message(&mqtt_context, TOPIC, payload, payload_len, MQTTQoS1,
+                        late->packet_id);
+      publish_window_resent(window, late, host_clock_ms);
+      continue;
+    }
+
+    if (sent < messages && publish_window_open(window) &&
+        host_clock_ms >= send_at) {
+      uint16_t packet_id;
+      if (publish_message(&mqtt_context, TOPIC, payload, payload_len,
+                          MQTTQoS1, &packet_id) != MQTTSuccess) {
+        break;
+      }
+      publish_window_sent(window, sent++, packet_id, host_clock_ms);
+      send_at = host_clock_ms + SEND_INTERVAL_MS;
+      continue;
+    }
+
+    if (MQTT_ProcessLoop(&mqtt_context, POLL_MS) != MQTTSuccess) {
+      break;
+    }
+  }
+
+  disconnect_from_broker(&mqtt_context, &network_context);
+  *retransmits = window->retransmits;
+  return host_clock_ms;
+}
+
+static uint32_t run_stop_and_wait(const loopback_faults *faults,
+                                  uint32_t messages) {
+  connect(faults, NULL);
+
+  for (uint32_t i = 0; i < messages && host_clock_ms < GIVE_UP_MS; i++) {
+    uint16_t packet_id;
+
+    vTaskDelay(OLD_INTERVAL_MS);
+    publish_message(&mqtt_context, TOPIC, payload, payload_len, MQTTQoS1,
+                    &packet_id);
+    uint32_t sent_ms = host_clock_ms;
+    while (acked_packet_id != packet_id &&
+           MQTT_ProcessLoop(&mqtt_context, 1) == MQTTSuccess) {
+      if (host_clock_ms - sent_ms > ACK_TIMEOUT_MS) {
+        // The old drain gave up until the next wake-up, count it as sent
+        // again right away.
+        republish_message(&mqtt_context, TOPIC, payload, payload_len,
+                          MQTTQoS1, packet_id);
+        sent_ms = host_clock_ms;
+      }
+    }
+  }
+
+  disconnect_from_broker(&mqtt_context, &network_context);
+  return host_clock_ms;
+}
+
+int main(int argc, char **argv) {
+  uint32_t messages = argc > 1 ? atoi(argv[1]) : 200;
+  static const loopback_faults cases[] = {
+      {0, 0, 0, 0},       {20, 0, 0, 0},      {50, 0, 0, 0},
+      {100, 0, 0, 0},     {200, 0, 0, 0},     {50, 20000, 0, 0},
+      {100, 5000, 0, 0},  {50, 0, 10, 0},     {100, 0, 50, 0},
+  };
+
+  payload_len = argc > 2 ? atoi(argv[2]) : 300;
+  if (payload_len + 64 > LOOPBACK_BUFFER_SIZE) {
+    fprintf(stderr, "Payload too large for the loopback\n");
+    return 2;
+  }
+  memset(payload, 'x', payload_len);
+
+  printf("%u messages of %zu bytes\n", messages, payload_len);
+  printf("%7s %7s %5s %12s %12s %6s %6s %8s\n", "latency", "bytes/s", "loss",
+         "old msg/s", "window msg/s", "window", "srtt", "resends");
+
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    const loopback_faults *faults = &cases[i];
+    publish_window window;
+    uint32_t retransmits;
+
+    publish_window_init(&window);
+    // The first drain learns the window, the second starts from it.
+    run_window(faults, messages, &window, &retransmits);
+    uint32_t window_ms = run_window(faults, messages, &window, &retransmits);
+    uint32_t old_ms = run_stop_and_wait(faults, messages);
+
+    printf("%5u ms %7u %4u%% %12.1f %12.1f %6u %3u ms %8u\n",
+           faults->latency_ms, faults->bytes_per_second,
+           faults->loss_per_mille / 10, messages * 1000.0 / old_ms,
+           messages * 1000.0 / window_ms, window.size, window.srtt_ms,
+           retransmits);
+  }
+
+  return 0;
+}
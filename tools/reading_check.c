@@ -0,0 +1,106 @@
+// Host checks and benchmark of the reading codecs.
+//
+//   cc -O2 -Iinclude -o reading_check tools/reading_check.c src/reading.c
+//   ./reading_check [iterations]
+//
+// Round-trips readings through the binary encoding, then prints the JSON
+// and binary sizes and how fast each is written and read (default 1000000
+// times).
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "check.h"
+#include "reading.h"
+
+static const reading sample = {
+    .dht = {215, 452},
+    .gas = {1234, 87, 1},
+    .ldr = {3012, 45000},
+    .co2 = {812, -3},
+    .power = {4950},
+    .net = {1, 2},
+    .uptime = 123456,
+};
+
+static void check_round_trip(void) {
+  uint8_t buf[READING_BINARY_MAX];
+  reading value = sample, decoded;
+
+  int len = reading_encode(&value, buf, sizeof(buf));
+  CHECK(len > 0 && reading_decode(buf, len, &decoded) == len);
+  CHECK(memcmp(&value, &decoded, sizeof(value)) == 0);
+
+  // Missing groups are not sent, and only their bit comes back.
+  value.missing = READING_MISSING(dht) | READING_MISSING(co2);
+  len = reading_encode(&value, buf, sizeof(buf));
+  CHECK(len > 0 && reading_decode(buf, len, &decoded) == len);
+  value.dht = (dht_level){0};
+  value.co2 = (co2_level){0};
+  CHECK(memcmp(&value, &decoded, sizeof(value)) == 0);
+
+  // Extremes of the varints.
+  value = sample;
+  value.dht.temperature = -2147483647 - 1;
+  value.uptime = 2147483647;
+  len = reading_encode(&value, buf, sizeof(buf));
+  CHECK(len > 0 && reading_decode(buf, len, &decoded) == len);
+  CHECK(memcmp(&value, &decoded, sizeof(value)) == 0);
+  CHECK(len <= READING_BINARY_MAX);
+
+  for (int cut = 0; cut < len; cut++) {
+    CHECK(reading_decode(buf, cut, &decoded) == -1);
+  }
+  CHECK(reading_encode(&value, buf, len - 1) == -1);
+
+  buf[1] = READING_FORMAT_VERSION + 1;
+  CHECK(reading_decode(buf, len, &decoded) == -1);
+  buf[1] = READING_FORMAT_VERSION - 1;
+  CHECK(reading_decode(buf, len, &decoded) == -1);
+}
+
+static void bench(long iterations) {
+  uint8_t buf[READING_BINARY_MAX];
+  char json[512];
+  reading value = sample, decoded;
+  volatile int sink = 0;
+
+  int json_len = reading_write_json(&value, "", json, sizeof(json));
+  int binary_len = reading_encode(&value, buf, sizeof(buf));
+  printf("JSON %d bytes, binary %d bytes\n", json_len, binary_len);
+
+  double start = check_seconds();
+  for (long i = 0; i < iterations; i++) {
+    value.uptime = (int)i;
+    sink += reading_write_json(&value, "", json, sizeof(json));
+  }
+  double json_s = check_seconds() - start;
+
+  start = check_seconds();
+  for (long i = 0; i < iterations; i++) {
+    value.uptime = (int)i;
+    sink += reading_encode(&value, buf, sizeof(buf));
+  }
+  double encode_s = check_seconds() - start;
+
+  start = check_seconds();
+  for (long i = 0; i < iterations; i++) {
+    buf[binary_len - 1] = (uint8_t)(i & 0x7f);
+    sink += reading_decode(buf, binary_len, &decoded);
+  }
+  double decode_s = check_seconds() - start;
+
+  printf("JSON write %.0f/s, encode %.0f/s, decode %.0f/s\n",
+         iterations / json_s, iterations / encode_s, iterations / decode_s);
+  (void)sink;
+}
+
+int main(int argc, char **argv) {
+  long iterations = argc > 1 ? atol(argv[1]) : 1000000;
+
+  check_round_trip();
+  if (failures == 0) {
+    bench(iterations);
+  }
+  return check_result();
+}
@@ -0,0 +1,430 @@
+// Power-cut tests and throughput of the record log over a file backed NOR
+// flash model.
+//
+//   cc -O2 -Iinclude -o record_log_sim tools/record_log_sim.c
+//      src/record_log.c src/crc32.c
+//   ./record_log_sim [image]
+//
+// The image (default record_log.bin) stands in for the backlog partition.
+// The power-cut test runs the same appends and drains once per flash write
+// or erase, and cuts the power in the middle of that one: a write only
+// clears part of its bytes, an erase only gets through part of the sector,
+// and every access after it fails. The log is then mounted again and must
+// hold every record that was appended and not consumed before the cut, in
+// order and intact, plus at most the record being appended. Only the record
+// whose consume was cut may come back. The throughput test times appends
+// and drains and counts the flash operations and erases per sector.
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "record_log.h"
+
+#define SECTOR_SIZE 4096
+#define CUT_SECTORS 8
+#define CUT_RECORDS 300
+#define BENCH_SECTORS 64
+#define BENCH_RECORDS 50000
+#define BENCH_RECORD_LEN 100
+
+typedef struct {
+  int fd;
+  // Writes and erases left before the power is cut, negative for never.
+  int32_t cut_in;
+  bool off;
+  uint32_t seed;
+  uint32_t reads;
+  uint32_t writes;
+  uint32_t erases;
+  uint32_t sector_erases[BENCH_SECTORS];
+} file_flash;
+
+static uint32_t next_random(file_flash *flash) {
+  flash->seed = flash->seed * 1664525u + 1013904223u;
+  return flash->seed >> 8;
+}
+
+// True for the operation the power is cut in.
+static bool cut_now(file_flash *flash) {
+  if (flash->cut_in < 0) {
+    return false;
+  }
+  if (flash->cut_in-- > 0) {
+    return false;
+  }
+  flash->off = true;
+  return true;
+}
+
+static int file_read(void *ctx, uint32_t addr, void *buf, uint32_t len) {
+  file_flash *flash = ctx;
+
+  flash->reads++;
+  if (flash->off) {
+    return -1;
+  }
+  return pread(flash->fd, buf, len, addr) == (ssize_t)len ? 0 : -1;
+}
+
+// NOR flash only clears bits. A cut write gets through a part of the bytes.
+static int file_write(void *ctx, uint32_t addr, const void *buf,
+                      uint32_t len) {
+  file_flash *flash = ctx;
+  uint8_t current[SECTOR_SIZE];
+
+  flash->writes++;
+  if (flash->off) {
+    return -1;
+  }
+  if (cut_now(flash)) {
+    len = next_random(flash) % len;
+  }
+
+  for (uint32_t done = 0; done < len;) {
+    uint32_t n = len - done < sizeof(current) ? len - done : sizeof(current);
+    if (pread(flash->fd, current, n, addr + done) != (ssize_t)n) {
+      return -1;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+      current[i] &= ((const uint8_t *)buf)[done + i];
+    }
+    if (pwrite(flash->fd, current, n, addr + done) != (ssize_t)n) {
+      return -1;
+    }
+    done += n;
+  }
+
+  return flash->off ? -1 : 0;
+}
+
+static int file_erase(void *ctx, uint32_t addr, uint32_t len) {
+  file_flash *flash = ctx;
+  uint8_t erased[SECTOR_SIZE];
+
+  flash->erases++;
+  if (flash->off) {
+    return -1;
+  }
+  memset(erased, 0xff, sizeof(erased));
+  for (uint32_t done = 0; done < len; done += SECTOR_SIZE) {
+    uint32_t n = SECTOR_SIZE;
+    if (cut_now(flash)) {
+      n = next_random(flash) % SECTOR_SIZE;
+    }
+    if (pwrite(flash->fd, erased, n, addr + done) != (ssize_t)n) {
+      return -1;
+    }
+    if (flash->off) {
+      return -1;
+    }
+    if ((addr + done) / SECTOR_SIZE < BENCH_SECTORS) {
+      flash->sector_erases[(addr + done) / SECTOR_SIZE]++;
+    }
+  }
+
+  return 0;
+}
+
+static void open_flash(file_flash *flash, flash_dev *dev, int fd,
+                       uint32_t sectors) {
+  memset(flash, 0, sizeof(*flash));
+  flash->fd = fd;
+  flash->cut_in = -1;
+  *dev = (flash_dev){flash,      sectors * SECTOR_SIZE, SECTOR_SIZE,
+                     file_read,  file_write,            file_erase};
+}
+
+// Records carry their sequence number and a pattern derived from it.
+static uint16_t make_record(uint32_t seq, uint8_t *buf) {
+  uint16_t len = 8 + (seq * 37) % 300;
+
+  memcpy(buf, &seq, sizeof(seq));
+  for (uint16_t i = sizeof(seq); i < len; i++) {
+    buf[i] = (uint8_t)(seq * 7 + i);
+  }
+  return len;
+}
+
+static bool check_record(const uint8_t *buf, uint16_t len, uint32_t *seq) {
+  uint8_t expect[RECORD_LOG_MAX_RECORD];
+
+  if (len < sizeof(*seq)) {
+    return false;
+  }
+  memcpy(seq, buf, sizeof(*seq));
+  return make_record(*seq, expect) == len && memcmp(buf, expect, len) == 0;
+}
+
+typedef struct {
+  int64_t delivered;
+  int64_t consumed;
+  uint32_t calls;
+  bool bad;
+} drain_state;
+
+// The drain only asks for the next record once the last one is consumed.
+static int check_sink(const void *data, uint16_t len, void *arg) {
+  drain_state *state = arg;
+  uint32_t seq;
+
+  if (!check_record(data, len, &seq)) {
+    state->bad = true;
+    return -1;
+  }
+  if (state->calls++ > 0) {
+    state->consumed = state->delivered;
+  }
+  state->delivered = seq;
+  return 0;
+}
+
+// What the writer knew when the power went: the last append that
+// returned OK, the next one, the last record consumed and the one whose
+// consume was cut, which may or may not come back.
+typedef struct {
+  int64_t appended;
+  uint32_t next;
+  int64_t consumed;
+  int64_t consuming;
+} cut_state;
+
+static void run_until_cut(const flash_dev *dev, cut_state *state) {
+  uint8_t buf[RECORD_LOG_MAX_RECORD];
+  record_log log;
+
+  state->appended = -1;
+  state->next = 0;
+  state->consumed = -1;
+  state->consuming = -1;
+  if (record_log_mount(&log, dev) != RECORD_LOG_OK) {
+    return;
+  }
+
+  for (uint32_t seq = 0; seq < CUT_RECORDS; seq++) {
+    state->next = seq;
+    if (record_log_append(&log, buf, make_record(seq, buf)) !=
+        RECORD_LOG_OK) {
+      return;
+    }
+    state->appended = seq;
+
+    // Drains two of every three, so the ring wraps with records pending.
+    if (seq % 3 == 2) {
+      drain_state drain = {-1, state->consumed, 0, false};
+      uint32_t drained = record_log_drain(&log, 2, check_sink, &drain);
+      if (drain.bad) {
+        printf("corrupt record drained before the cut\n");
+        exit(1);
+      }
+      if (drained == drain.calls) {
+        drain.consumed = drain.calls > 0 ? drain.delivered : drain.consumed;
+      }
+      state->consumed = drain.consumed;
+      if (drained < 2 && log.pending > 0) {
+        if (drained < drain.calls) {
+          state->consuming = drain.delivered;
+        }
+        return;
+      }
+    }
+  }
+}
+
+// Returns the number of problems found after the remount.
+static int check_after_cut(const flash_dev *dev, const cut_state *state,
+                           uint32_t *recovered) {
+  uint8_t buf[RECORD_LOG_MAX_RECORD];
+  record_log log;
+  int64_t expect = state->consumed + 1;
+  uint16_t len;
+  int problems = 0;
+
+  *recovered = 0;
+  if (record_log_mount(&log, dev) != RECORD_LOG_OK) {
+    return 1;
+  }
+
+  for (;;) {
+    uint32_t seq;
+    record_log_status ret = record_log_peek(&log, buf, &len);
+
+    if (ret == RECORD_LOG_EMPTY) {
+      break;
+    }
+    if (ret == RECORD_LOG_OK) {
+      if (!check_record(buf, len, &seq)) {
+        problems++;
+      } else if (seq < expect) {
+        problems++;
+      } else if (seq > expect && !(seq == expect + 1 &&
+                                   expect == state->consuming)) {
+        printf("records %lld to %u lost\n", (long long)expect, seq - 1);
+        problems++;
+        expect = seq + 1;
+      } else {
+        expect = seq + 1;
+      }
+      (*recovered)++;
+    } else if (ret != RECORD_LOG_CORRUPT) {
+      return problems + 1;
+    }
+    if (record_log_consume(&log) != RECORD_LOG_OK) {
+      return problems + 1;
+    }
+  }
+
+  // Everything appended must be back, the record being appended may be.
+  if (expect <= state->appended) {
+    printf("records %lld to %lld lost\n", (long long)expect,
+           (long long)state->appended);
+    problems++;
+  }
+  if (expect > (int64_t)state->next + 1) {
+    problems++;
+  }
+
+  // And the log takes new records.
+  if (record_log_append(&log, buf, make_record(CUT_RECORDS, buf)) !=
+          RECORD_LOG_OK ||
+      record_log_mount(&log, dev) != RECORD_LOG_OK ||
+      record_log_peek(&log, buf, &len) != RECORD_LOG_OK) {
+    problems++;
+  }
+
+  return problems;
+}
+
+static int power_cut_test(int fd) {
+  file_flash flash;
+  flash_dev dev;
+  uint8_t erased[SECTOR_SIZE];
+  cut_state state;
+  uint32_t ops, failed = 0, recovered_total = 0;
+
+  memset(erased, 0xff, sizeof(erased));
+  for (uint32_t s = 0; s < CUT_SECTORS; s++) {
+    pwrite(fd, erased, SECTOR_SIZE, s * SECTOR_SIZE);
+  }
+  open_flash(&flash, &dev, fd, CUT_SECTORS);
+  run_until_cut(&dev, &state);
+  ops = flash.writes + flash.erases;
+
+  for (uint32_t cut = 0; cut < ops; cut++) {
+    uint32_t recovered;
+
+    for (uint32_t s = 0; s < CUT_SECTORS; s++) {
+      pwrite(fd, erased, SECTOR_SIZE, s * SECTOR_SIZE);
+    }
+    open_flash(&flash, &dev, fd, CUT_SECTORS);
+    flash.cut_in = cut;
+    flash.seed = cut + 1;
+    run_until_cut(&dev, &state);
+
+    open_flash(&flash, &dev, fd, CUT_SECTORS);
+    int problems = check_after_cut(&dev, &state, &recovered);
+    if (problems > 0) {
+      printf("cut at operation %u: %d problems\n", cut, problems);
+      failed++;
+    }
+    recovered_total += recovered;
+  }
+
+  printf("power cuts: %u points, %u failed, %.1f records pending on "
+         "average\n",
+         ops, failed, ops ? (double)recovered_total / ops : 0);
+  return failed == 0 ? 0 : 1;
+}
+
+static double seconds(void) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static int null_sink(const void *data, uint16_t len, void *arg) {
+  (void)data;
+  (void)len;
+  (*(uint32_t *)arg)++;
+  return 0;
+}
+
+static void throughput_test(int fd) {
+  file_flash flash;
+  flash_dev dev;
+  record_log log;
+  uint8_t erased[SECTOR_SIZE], buf[BENCH_RECORD_LEN];
+  uint32_t sunk = 0;
+
+  memset(erased, 0xff, sizeof(erased));
+  for (uint32_t s = 0; s < BENCH_SECTORS; s++) {
+    pwrite(fd, erased, SECTOR_SIZE, s * SECTOR_SIZE);
+  }
+  open_flash(&flash, &dev, fd, BENCH_SECTORS);
+  record_log_mount(&log, &dev);
+  memset(buf, 0x5a, sizeof(buf));
+
+  // Rounds of appends and drains, a few times round the ring.
+  double append_s = 0, drain_s = 0;
+  uint32_t appended = 0;
+  uint32_t append_writes = 0, append_erases = 0, drain_reads = 0,
+           drain_writes = 0;
+  while (appended < BENCH_RECORDS) {
+    uint32_t writes = flash.writes, erases = flash.erases;
+    double start = seconds();
+    for (int i = 0; i < 1000; i++, appended++) {
+      record_log_append(&log, buf, sizeof(buf));
+    }
+    append_s += seconds() - start;
+    append_writes += flash.writes - writes;
+    append_erases += flash.erases - erases;
+
+    uint32_t reads = flash.reads;
+    writes = flash.writes;
+    start = seconds();
+    record_log_drain(&log, UINT32_MAX, null_sink, &sunk);
+    drain_s += seconds() - start;
+    drain_reads += flash.reads - reads;
+    drain_writes += flash.writes - writes;
+  }
+
+  double start = seconds();
+  record_log_mount(&log, &dev);
+  double mount_s = seconds() - start;
+
+  uint32_t least = UINT32_MAX, most = 0;
+  for (uint32_t s = 0; s < BENCH_SECTORS; s++) {
+    least = flash.sector_erases[s] < least ? flash.sector_erases[s] : least;
+    most = flash.sector_erases[s] > most ? flash.sector_erases[s] : most;
+  }
+
+  printf("%u records of %d bytes on %d sectors\n", appended, BENCH_RECORD_LEN,
+         BENCH_SECTORS);
+  printf("append: %.0f records/s, %.2f writes and %.4f erases per record\n",
+         appended / append_s, (double)append_writes / appended,
+         (double)append_erases / appended);
+  printf("drain:  %.0f records/s, %.2f reads and %.2f writes per record\n",
+         sunk / drain_s, (double)drain_reads / sunk,
+         (double)drain_writes / sunk);
+  printf("mount:  %.2f ms, erases per sector %u to %u\n", mount_s * 1000,
+         least, most);
+}
+
+int main(int argc, char **argv) {
+  const char *image = argc > 1 ? argv[1] : "record_log.bin";
+  int fd = open(image, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+  if (fd < 0) {
+    perror(image);
+    return 2;
+  }
+
+  int ret = power_cut_test(fd);
+  throughput_test(fd);
+  close(fd);
+
+  return ret;
+}
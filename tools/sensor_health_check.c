@@ -0,0 +1,135 @@
+// Host checks of the sensor circuit breaker.
+//
+//   cc -O2 -Iinclude -o sensor_health_check tools/sensor_health_check.c
+//      src/sensor_health.c
+//   ./sensor_health_check [outage cycles] [timeout ms]
+//
+// Runs a sensor through healthy, flaky and dead spells like
+// start_sensor_tasks and check_sensors do, and checks when the breaker
+// opens, how often it probes and that it closes on the first good probe.
+// Then prints, for a few probe intervals, the time lost to a sensor that
+// times out for the given number of cycles (default 400 of 2000 ms), or up
+// to a probe interval more, and how many cycles it stays unread after it is
+// back.
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "check.h"
+#include "sensor_health.h"
+
+// One due cycle, true when the sensor was read.
+static bool run_cycle(sensor_health *health, bool works, uint32_t elapsed_ms,
+                      uint32_t probe_cycles) {
+  if (!sensor_health_should_read(health)) {
+    return false;
+  }
+  sensor_health_report(health, works, elapsed_ms, probe_cycles);
+  return true;
+}
+
+static void check_breaker(void) {
+  sensor_health health = {0};
+
+  CHECK(sensor_health_success_percent(&health) == 100);
+  for (int i = 0; i < 100; i++) {
+    CHECK(run_cycle(&health, true, 50, 10));
+  }
+  CHECK(!sensor_health_open(&health) && health.lost_ms == 0);
+  CHECK(sensor_health_success_percent(&health) == 100);
+
+  // Failing two cycles in three never opens it.
+  for (int i = 0; i < 300; i++) {
+    CHECK(run_cycle(&health, i % 3 == 0, 100, 10));
+    CHECK(!sensor_health_open(&health));
+  }
+  CHECK(health.attempts == 400 && health.successes == 200);
+  CHECK(health.lost_ms == 200 * 100);
+  CHECK(sensor_health_success_percent(&health) == 50);
+
+  // Three in a row open it, then only every tenth cycle is a probe.
+  health = (sensor_health){0};
+  for (int i = 0; i < 3; i++) {
+    CHECK(run_cycle(&health, false, 2000, 10));
+  }
+  CHECK(sensor_health_open(&health));
+  for (int probe = 0; probe < 5; probe++) {
+    for (int i = 0; i < 9; i++) {
+      CHECK(!run_cycle(&health, false, 2000, 10));
+    }
+    CHECK(run_cycle(&health, false, 2000, 10));
+    CHECK(sensor_health_open(&health));
+  }
+  CHECK(health.attempts == 8 && health.lost_ms == 8 * 2000);
+
+  // The first good probe closes it and reading goes back to every cycle.
+  for (int i = 0; i < 9; i++) {
+    CHECK(!run_cycle(&health, true, 50, 10));
+  }
+  CHECK(run_cycle(&health, true, 50, 10));
+  CHECK(!sensor_health_open(&health));
+  CHECK(run_cycle(&health, true, 50, 10));
+  // A single failure after that does not open it again.
+  CHECK(run_cycle(&health, false, 2000, 10));
+  CHECK(run_cycle(&health, true, 50, 10));
+
+  // Probing every cycle, or not configured, never skips.
+  for (uint32_t probe = 0; probe <= 1; probe++) {
+    health = (sensor_health){0};
+    for (int i = 0; i < 20; i++) {
+      CHECK(run_cycle(&health, false, 2000, probe));
+    }
+    CHECK(sensor_health_open(&health) && health.attempts == 20);
+  }
+}
+
+// A sensor that times out from cycle 100 for the given number of cycles,
+// with the outage ending at each point of the probe interval.
+static void measure(uint32_t probe_cycles, uint32_t outage,
+                    uint32_t timeout_ms) {
+  uint32_t worst_lost_ms = 0, worst_unread = 0;
+  uint64_t total_lost_ms = 0;
+
+  for (uint32_t shift = 0; shift < probe_cycles; shift++) {
+    sensor_health health = {0};
+    uint32_t back = 100 + outage + shift, unread = 0;
+
+    for (uint32_t cycle = 0; cycle < back + 2 * probe_cycles + 10; cycle++) {
+      bool works = cycle < 100 || cycle >= back;
+      bool read = run_cycle(&health, works, works ? 50 : timeout_ms,
+                            probe_cycles);
+      if (cycle >= back && !read && unread == cycle - back) {
+        unread++;
+      }
+    }
+
+    CHECK(!sensor_health_open(&health));
+    CHECK(unread < (probe_cycles > 0 ? probe_cycles : 1));
+    worst_lost_ms =
+        health.lost_ms > worst_lost_ms ? health.lost_ms : worst_lost_ms;
+    worst_unread = unread > worst_unread ? unread : worst_unread;
+    total_lost_ms += health.lost_ms;
+  }
+
+  printf("%6u %12.1f %12.1f %12.1f %12u\n", probe_cycles,
+         outage * timeout_ms / 1000.0,
+         total_lost_ms / 1000.0 / probe_cycles, worst_lost_ms / 1000.0,
+         worst_unread);
+}
+
+int main(int argc, char **argv) {
+  uint32_t outage = argc > 1 ? atoi(argv[1]) : 400;
+  uint32_t timeout_ms = argc > 2 ? atoi(argv[2]) : 2000;
+
+  check_breaker();
+
+  printf("outage of %u cycles, each failed read takes %u ms\n", outage,
+         timeout_ms);
+  printf("%6s %12s %12s %12s %12s\n", "probe", "no breaker s", "lost mean s",
+         "lost worst s", "unread after");
+  static const uint32_t probes[] = {1, 5, 10, 30};
+  for (size_t i = 0; i < sizeof(probes) / sizeof(probes[0]); i++) {
+    measure(probes[i], outage, timeout_ms);
+  }
+
+  return check_result();
+}
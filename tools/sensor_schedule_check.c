@@ -0,0 +1,122 @@
+// Host checks of the per-sensor read schedules over a day of wake cycles.
+//
+//   cc -O2 -Iinclude -o sensor_schedule_check tools/sensor_schedule_check.c
+//      src/sensor_schedule.c src/wake_schedule.c
+//   ./sensor_schedule_check [sleep_seconds]
+//
+// Wakes the device for a day on the wake schedule, with and without
+// staggering, and counts a cycle on every wake like start_sensor_tasks.
+// Every sensor must be read exactly on the cycles of its period and phase,
+// the right number of times for the wakes there were, and the wakes must
+// keep to the reporting period.
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "check.h"
+#include "sensor_schedule.h"
+#include "wake_schedule.h"
+
+#define DAY_MS 86400000LL
+#define AWAKE_MS 2500
+#define UNIX_MS 1760880000000LL
+
+static const char *const names[SENSOR_COUNT] = {
+    [SENSOR_CO2] = "co2",   [SENSOR_DHT] = "dht", [SENSOR_GAS] = "gas",
+    [SENSOR_LDR] = "ldr",   [SENSOR_POWER] = "power",
+};
+
+typedef struct {
+  const char *name;
+  sensor_schedule schedule[SENSOR_COUNT];
+} plan;
+
+static const plan plans[] = {
+    {"defaults", {{1, 0, 0}, {1, 0, 1}, {1, 0, 0}, {1, 0, 0}, {1, 0, 0}}},
+    {"mixed", {{4, 1, 0}, {2, 0, 2}, {20, 3, 0}, {1, 0, 5}, {240, 7, 0}}},
+    // A phase past the period wraps, a period of 0 is off.
+    {"edges", {{3, 5, 0}, {0, 0, 0}, {1000, 999, 0}, {7, 6, 0}, {0, 3, 0}}},
+};
+
+// The cycles of a day where cycle % period == phase % period.
+static uint32_t due_count(const sensor_schedule *s, uint32_t cycles) {
+  if (s->period == 0) {
+    return 0;
+  }
+  uint32_t first = s->phase % s->period;
+  return cycles > first ? (cycles - 1 - first) / s->period + 1 : 0;
+}
+
+static void simulate(const plan *plan, bool stagger, uint32_t period_ms) {
+  uint32_t reads[SENSOR_COUNT] = {0};
+  uint32_t last[SENSOR_COUNT];
+  uint32_t cycle = 0;
+  int64_t now = 0, previous = -1;
+  uint32_t phase_ms = wake_schedule_phase("sensor-00042", period_ms);
+
+  while (now < DAY_MS) {
+    for (int i = 0; i < SENSOR_COUNT; i++) {
+      if (!sensor_schedule_due(&plan->schedule[i], cycle)) {
+        continue;
+      }
+      // Exactly one period of cycles since the last read.
+      CHECK(reads[i] == 0 || cycle - last[i] == plan->schedule[i].period);
+      CHECK(reads[i] > 0 ||
+            cycle == plan->schedule[i].phase % plan->schedule[i].period);
+      last[i] = cycle;
+      reads[i]++;
+    }
+    cycle++;
+
+    // Staggered, every wake after the boot is on the device's offset and a
+    // period after the last.
+    if (stagger && cycle > 1) {
+      CHECK((UNIX_MS + now) % period_ms == phase_ms);
+      CHECK(cycle == 2 || now - previous == period_ms);
+    }
+    previous = now;
+    now += AWAKE_MS;
+    now += wake_schedule_delay(UNIX_MS + now, stagger, period_ms, phase_ms, 0,
+                               check_random());
+  }
+
+  // Staggered the device wakes once per period, otherwise the awake time
+  // is added to each.
+  uint32_t wakes = stagger ? (uint32_t)(DAY_MS / period_ms)
+                           : (uint32_t)(DAY_MS / (period_ms + AWAKE_MS));
+  CHECK(cycle >= wakes && cycle <= wakes + 1);
+
+  printf("%-9s %-8s %6u", plan->name, stagger ? "stagger" : "none", cycle);
+  for (int i = 0; i < SENSOR_COUNT; i++) {
+    CHECK(reads[i] == due_count(&plan->schedule[i], cycle));
+    printf(" %s %u", names[i], reads[i]);
+  }
+  printf("\n");
+}
+
+static void check_samples(void) {
+  sensor_schedule schedule = {1, 0, 0};
+
+  CHECK(sensor_schedule_samples(&schedule, 10) == 10);
+  schedule.samples = 3;
+  CHECK(sensor_schedule_samples(&schedule, 10) == 3);
+}
+
+int main(int argc, char **argv) {
+  uint32_t sleep_seconds = argc > 1 ? atoi(argv[1]) : 15;
+
+  // Staggered wakes skip a period when the cycle does not fit in it.
+  if (sleep_seconds * 1000 < AWAKE_MS + WAKE_MIN_SLEEP_MS) {
+    fprintf(stderr, "Need a sleep of at least 4 seconds\n");
+    return 2;
+  }
+
+  check_samples();
+  printf("%-9s %-8s %6s reads\n", "plan", "wake", "wakes");
+  for (size_t i = 0; i < sizeof(plans) / sizeof(plans[0]); i++) {
+    simulate(&plans[i], false, sleep_seconds * 1000);
+    simulate(&plans[i], true, sleep_seconds * 1000);
+  }
+
+  return check_result();
+}
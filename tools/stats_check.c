@@ -0,0 +1,220 @@
+// Host checks of the window statistics against reference implementations.
+//
+//   cc -O2 -Iinclude -o stats_check tools/stats_check.c src/stats.c -lm
+//   ./stats_check [samples per window]
+//
+// Feeds sensor-like traces through stats_add and compares the mean and
+// variance with a two-pass computation in double, min, max and the EWMA
+// with a direct recursion, and the p50 and p90 of the sketch with the exact
+// quantile of the sorted samples. The sketch's error is printed as the
+// rank error: the share of samples below the estimate minus the quantile.
+// Then times stats_add per sample.
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "check.h"
+#include "stats.h"
+
+// Rank error allowed on every trace once the sketch has had to compact,
+// below 1000 samples and from 1000 on.
+#define MAX_RANK_ERROR 0.1
+#define MAX_RANK_ERROR_LARGE 0.15
+
+static double normal(void) {
+  return sqrt(-2 * log(check_uniform())) * cos(2 * M_PI * check_uniform());
+}
+
+typedef enum {
+  TRACE_NOISE,
+  TRACE_TEMPERATURE,
+  TRACE_CO2,
+  TRACE_LUX,
+  TRACE_GAS,
+  TRACE_RISING,
+  TRACE_COUNT,
+} trace;
+
+static const char *const trace_names[] = {
+    "noise", "temperature", "co2", "lux", "gas", "rising",
+};
+
+// A sample of each trace: independent noise, a slow room temperature, CO2
+// near its 400 ppm floor, light switched between two levels, gas with rare
+// spikes and a steady ramp.
+static float sample(trace t, uint32_t i) {
+  switch (t) {
+  case TRACE_NOISE:
+    return (float)(100 + 10 * normal());
+  case TRACE_TEMPERATURE:
+    return (float)(21.5 + 0.5 * sin(i / 50.0) + 0.05 * normal());
+  case TRACE_CO2:
+    return (float)(420 + 15 * normal() + i % 200);
+  case TRACE_LUX:
+    return (float)((i / 37) % 2 ? 650 + 20 * normal() : 3 + check_uniform());
+  case TRACE_GAS:
+    return (float)(check_uniform() < 0.05 ? 800 + 200 * check_uniform()
+                                    : 40 - 10 * log(check_uniform()));
+  case TRACE_RISING:
+  default:
+    return (float)i * 0.25f;
+  }
+}
+
+static int compare(const void *a, const void *b) {
+  float x = *(const float *)a, y = *(const float *)b;
+  return x < y ? -1 : x > y;
+}
+
+static double rank_error(const float *sorted, uint32_t count, float value,
+                         double p) {
+  uint32_t below = 0;
+
+  while (below < count && sorted[below] < value) {
+    below++;
+  }
+  // Anywhere inside a run of equal samples is exact.
+  uint32_t upto = below;
+  while (upto < count && sorted[upto] == value) {
+    upto++;
+  }
+  double lo = (double)below / count, hi = (double)upto / count;
+  return p < lo ? lo - p : p > hi ? p - hi : 0;
+}
+
+static void check_window(trace t, uint32_t offset, uint32_t count,
+                         double *worst50, double *worst90) {
+  float *values = malloc(count * sizeof(float));
+  metric_stats stats;
+  double sum = 0, ewma = 0;
+
+  stats_init(&stats);
+  for (uint32_t i = 0; i < count; i++) {
+    values[i] = sample(t, offset + i);
+    stats_add(&stats, values[i]);
+    sum += values[i];
+    ewma = i == 0 ? values[i] : ewma + STATS_EWMA_ALPHA * (values[i] - ewma);
+  }
+
+  double mean = sum / count, m2 = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    m2 += (values[i] - mean) * (values[i] - mean);
+  }
+  double variance = count > 1 ? m2 / (count - 1) : 0;
+  double scale = fabs(mean) + sqrt(variance) + 1;
+
+  CHECK(stats.count == count);
+  CHECK(fabs(stats.mean - mean) <= 1e-5 * scale);
+  CHECK(fabs(stats_variance(&stats) - variance) <=
+        1e-4 * variance + 1e-6 * scale * scale);
+  CHECK(fabs(stats.ewma - ewma) <= 1e-5 * scale);
+
+  qsort(values, count, sizeof(float), compare);
+  CHECK(stats.min == values[0] && stats.max == values[count - 1]);
+
+  double e50 = rank_error(values, count, stats_p50(&stats), 0.5);
+  double e90 = rank_error(values, count, stats_p90(&stats), 0.9);
+  if (e50 > *worst50) {
+    *worst50 = e50;
+  }
+  if (e90 > *worst90) {
+    *worst90 = e90;
+  }
+
+  free(values);
+}
+
+static double rank_limit(uint32_t count) {
+  return count <= STATS_SKETCH_SIZE ? 0
+         : count < 1000             ? MAX_RANK_ERROR
+                                    : MAX_RANK_ERROR_LARGE;
+}
+
+static void check_accuracy(uint32_t window) {
+  uint32_t sizes[] = {1,   5,   window, STATS_SKETCH_SIZE,
+                      STATS_SKETCH_SIZE + 1, 100, 300, 1000, 5000, 20000};
+  const size_t columns = sizeof(sizes) / sizeof(sizes[0]);
+
+  printf("worst rank error of p50 / p90 over 50 windows\n");
+  printf("%-12s", "samples");
+  for (size_t s = 0; s < columns; s++) {
+    printf(" %11u", sizes[s]);
+  }
+  printf("\n");
+
+  for (trace t = 0; t < TRACE_COUNT; t++) {
+    double worst50[sizeof(sizes) / sizeof(sizes[0])] = {0};
+    double worst90[sizeof(sizes) / sizeof(sizes[0])] = {0};
+
+    printf("%-12s", trace_names[t]);
+    for (size_t s = 0; s < columns; s++) {
+      for (uint32_t w = 0; w < 50; w++) {
+        check_window(t, w * 977, sizes[s], &worst50[s], &worst90[s]);
+      }
+      printf(" %.3f/%.3f", worst50[s], worst90[s]);
+    }
+    printf("\n");
+
+    for (size_t s = 0; s < columns; s++) {
+      CHECK(worst50[s] <= rank_limit(sizes[s]));
+      CHECK(worst90[s] <= rank_limit(sizes[s]));
+    }
+  }
+}
+
+static void check_reset(void) {
+  metric_stats stats;
+
+  stats_init(&stats);
+  CHECK(stats.count == 0 && stats_p50(&stats) == 0);
+  for (int i = 0; i < 10; i++) {
+    stats_add(&stats, 100);
+  }
+  stats_reset_window(&stats);
+  CHECK(stats.count == 0 && isinf(stats.min) && isinf(stats.max));
+  CHECK(stats.ewma_ready && stats.ewma == 100);
+  stats_add(&stats, 0);
+  CHECK(stats.mean == 0 && stats_variance(&stats) == 0);
+  CHECK(fabsf(stats.ewma - 90) < 1e-4f);
+  CHECK(stats_p50(&stats) == 0 && stats_p90(&stats) == 0);
+}
+
+static void bench(void) {
+  enum { SAMPLES = 1 << 16, ROUNDS = 100 };
+  static float values[SAMPLES];
+  metric_stats stats;
+  volatile float sink;
+
+  for (uint32_t i = 0; i < SAMPLES; i++) {
+    values[i] = sample(TRACE_CO2, i);
+  }
+
+  double start = check_seconds();
+  for (int round = 0; round < ROUNDS; round++) {
+    stats_init(&stats);
+    for (uint32_t i = 0; i < SAMPLES; i++) {
+      stats_add(&stats, values[i]);
+    }
+    sink = stats.mean;
+  }
+  double ns = (check_seconds() - start) * 1e9;
+  (void)sink;
+
+  printf("stats_add: %.1f ns per sample, %zu bytes per metric\n",
+         ns / ((double)SAMPLES * ROUNDS), sizeof(metric_stats));
+}
+
+int main(int argc, char **argv) {
+  uint32_t window = argc > 1 ? atoi(argv[1]) : 20;
+
+  if (window == 0) {
+    fprintf(stderr, "Need at least one sample per window\n");
+    return 2;
+  }
+
+  check_reset();
+  check_accuracy(window);
+  bench();
+
+  return check_result();
+}
@@ -0,0 +1,293 @@
+// Host measurement of the heap a TLS connection to the broker takes, and
+// check that the broker accepts the max fragment length extension.
+//
+//   cc -O2 -o tls_heap tools/tls_heap.c -lmbedtls -lmbedx509 -lmbedcrypto
+//   ./tls_heap <host> <port> <root_ca> <cert> <key> <thing_name> [mfl]
+//
+// mfl is 512, 1024, 2048 or 4096, leave it out to not negotiate. The tool
+// connects, sends an MQTT CONNECT and a 200 byte QoS0 PUBLISH to
+// device/<thing_name>/probe and prints the peak heap of each step. Every
+// allocation goes through the wrappers below, so this works with any
+// mbedtls build on glibc.
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <mbedtls/ctr_drbg.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/net_sockets.h>
+#include <mbedtls/ssl.h>
+
+#define PAYLOAD_SIZE 200
+#define KEEP_ALIVE_S 20
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static size_t heap_now;
+static size_t heap_peak;
+
+static void *track(void *ptr) {
+  if (ptr != NULL) {
+    heap_now += malloc_usable_size(ptr);
+    if (heap_now > heap_peak) {
+      heap_peak = heap_now;
+    }
+  }
+  return ptr;
+}
+
+void *malloc(size_t size) { return track(__libc_malloc(size)); }
+
+void *calloc(size_t count, size_t size) {
+  return track(__libc_calloc(count, size));
+}
+
+void *realloc(void *ptr, size_t size) {
+  size_t old = ptr != NULL ? malloc_usable_size(ptr) : 0;
+  void *grown = __libc_realloc(ptr, size);
+
+  if (grown == NULL) {
+    return NULL;
+  }
+  heap_now -= old;
+  return track(grown);
+}
+
+void free(void *ptr) {
+  if (ptr != NULL) {
+    heap_now -= malloc_usable_size(ptr);
+  }
+  __libc_free(ptr);
+}
+
+// Peak above the heap in use when the step started.
+static size_t step_begin(void) {
+  heap_peak = heap_now;
+  return heap_now;
+}
+
+static void step_end(const char *step, size_t start) {
+  printf("%-10s peak %6zu, kept %6zu\n", step, heap_peak - start,
+         heap_now - start);
+}
+
+static int mfl_code(int bytes) {
+  switch (bytes) {
+  case 512:
+    return MBEDTLS_SSL_MAX_FRAG_LEN_512;
+  case 1024:
+    return MBEDTLS_SSL_MAX_FRAG_LEN_1024;
+  case 2048:
+    return MBEDTLS_SSL_MAX_FRAG_LEN_2048;
+  case 4096:
+    return MBEDTLS_SSL_MAX_FRAG_LEN_4096;
+  default:
+    return -1;
+  }
+}
+
+static size_t put_length(uint8_t *buf, size_t len) {
+  size_t pos = 0;
+
+  do {
+    buf[pos] = len % 128;
+    len /= 128;
+    buf[pos++] |= len > 0 ? 0x80 : 0;
+  } while (len > 0);
+
+  return pos;
+}
+
+static size_t put_string(uint8_t *buf, const char *str) {
+  size_t len = strlen(str);
+
+  buf[0] = len >> 8;
+  buf[1] = len & 0xff;
+  memcpy(buf + 2, str, len);
+  return len + 2;
+}
+
+static int write_all(mbedtls_ssl_context *ssl, const uint8_t *buf,
+                     size_t len) {
+  while (len > 0) {
+    int ret = mbedtls_ssl_write(ssl, buf, len);
+    if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+      continue;
+    }
+    if (ret < 0) {
+      return ret;
+    }
+    buf += ret;
+    len -= ret;
+  }
+
+  return 0;
+}
+
+static int mqtt_connect(mbedtls_ssl_context *ssl, const char *client_id) {
+  uint8_t packet[160];
+  uint8_t body[150] = {0, 4, 'M', 'Q', 'T', 'T', 4, 0x02, 0, KEEP_ALIVE_S};
+  size_t body_len = 10;
+  uint8_t connack[4];
+
+  if (strlen(client_id) > sizeof(body) - body_len - 2) {
+    return -1;
+  }
+  body_len += put_string(body + body_len, client_id);
+
+  packet[0] = 0x10;
+  size_t len = 1 + put_length(packet + 1, body_len);
+  memcpy(packet + len, body, body_len);
+  if (write_all(ssl, packet, len + body_len) != 0) {
+    return -1;
+  }
+
+  for (size_t got = 0; got < sizeof(connack);) {
+    int ret = mbedtls_ssl_read(ssl, connack + got, sizeof(connack) - got);
+    if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+      continue;
+    }
+    if (ret <= 0) {
+      return -1;
+    }
+    got += ret;
+  }
+
+  return connack[0] == 0x20 && connack[3] == 0 ? 0 : -1;
+}
+
+static int mqtt_publish(mbedtls_ssl_context *ssl, const char *thing_name) {
+  uint8_t packet[PAYLOAD_SIZE + 200];
+  uint8_t body[PAYLOAD_SIZE + 190];
+  char topic[160];
+  size_t body_len;
+
+  if (snprintf(topic, sizeof(topic), "device/%s/probe", thing_name) >=
+      (int)sizeof(topic)) {
+    return -1;
+  }
+  body_len = put_string(body, topic);
+  memset(body + body_len, 'x', PAYLOAD_SIZE);
+  body_len += PAYLOAD_SIZE;
+
+  packet[0] = 0x30;
+  size_t len = 1 + put_length(packet + 1, body_len);
+  memcpy(packet + len, body, body_len);
+  if (write_all(ssl, packet, len + body_len) != 0) {
+    return -1;
+  }
+
+  const uint8_t disconnect[] = {0xe0, 0};
+  return write_all(ssl, disconnect, sizeof(disconnect));
+}
+
+int main(int argc, char **argv) {
+  if (argc < 7) {
+    fprintf(stderr,
+            "usage: %s <host> <port> <root_ca> <cert> <key> <thing_name> "
+            "[mfl]\n",
+            argv[0]);
+    return 2;
+  }
+
+  int mfl = argc > 7 ? mfl_code(atoi(argv[7])) : -1;
+  if (argc > 7 && mfl < 0) {
+    fprintf(stderr, "mfl must be 512, 1024, 2048 or 4096\n");
+    return 2;
+  }
+
+  mbedtls_net_context net;
+  mbedtls_ssl_context ssl;
+  mbedtls_ssl_config conf;
+  mbedtls_x509_crt ca, cert;
+  mbedtls_pk_context key;
+  mbedtls_entropy_context entropy;
+  mbedtls_ctr_drbg_context drbg;
+  int ret;
+
+  size_t start = step_begin();
+  mbedtls_net_init(&net);
+  mbedtls_ssl_init(&ssl);
+  mbedtls_ssl_config_init(&conf);
+  mbedtls_x509_crt_init(&ca);
+  mbedtls_x509_crt_init(&cert);
+  mbedtls_pk_init(&key);
+  mbedtls_entropy_init(&entropy);
+  mbedtls_ctr_drbg_init(&drbg);
+
+  if ((ret = mbedtls_ctr_drbg_seed(&drbg, mbedtls_entropy_func, &entropy,
+                                   NULL, 0)) != 0 ||
+      (ret = mbedtls_x509_crt_parse_file(&ca, argv[3])) != 0 ||
+      (ret = mbedtls_x509_crt_parse_file(&cert, argv[4])) != 0 ||
+      (ret = mbedtls_pk_parse_keyfile(&key, argv[5], NULL)) != 0 ||
+      (ret = mbedtls_ssl_config_defaults(&conf, MBEDTLS_SSL_IS_CLIENT,
+                                         MBEDTLS_SSL_TRANSPORT_STREAM,
+                                         MBEDTLS_SSL_PRESET_DEFAULT)) != 0) {
+    fprintf(stderr, "Setup failed: -0x%04x\n", -ret);
+    return 1;
+  }
+
+  mbedtls_ssl_conf_authmode(&conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+  mbedtls_ssl_conf_ca_chain(&conf, &ca, NULL);
+  mbedtls_ssl_conf_rng(&conf, mbedtls_ctr_drbg_random, &drbg);
+  if ((ret = mbedtls_ssl_conf_own_cert(&conf, &cert, &key)) != 0 ||
+      (mfl >= 0 && (ret = mbedtls_ssl_conf_max_frag_len(&conf, mfl)) != 0) ||
+      (ret = mbedtls_ssl_setup(&ssl, &conf)) != 0 ||
+      (ret = mbedtls_ssl_set_hostname(&ssl, argv[1])) != 0) {
+    fprintf(stderr, "TLS setup failed: -0x%04x\n", -ret);
+    return 1;
+  }
+  step_end("setup", start);
+
+  start = step_begin();
+  if ((ret = mbedtls_net_connect(&net, argv[1], argv[2],
+                                 MBEDTLS_NET_PROTO_TCP)) != 0) {
+    fprintf(stderr, "Connect failed: -0x%04x\n", -ret);
+    return 1;
+  }
+  mbedtls_ssl_set_bio(&ssl, &net, mbedtls_net_send, mbedtls_net_recv, NULL);
+
+  while ((ret = mbedtls_ssl_handshake(&ssl)) != 0) {
+    if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
+      fprintf(stderr, "Handshake failed: -0x%04x%s\n", -ret,
+              mfl >= 0 ? ", the broker may not accept max fragment length"
+                       : "");
+      return 1;
+    }
+  }
+  step_end("handshake", start);
+  printf("%s, fragments in %zu out %zu\n", mbedtls_ssl_get_ciphersuite(&ssl),
+         mbedtls_ssl_get_input_max_frag_len(&ssl),
+         mbedtls_ssl_get_output_max_frag_len(&ssl));
+
+  start = step_begin();
+  if (mqtt_connect(&ssl, argv[6]) != 0) {
+    fprintf(stderr, "MQTT connect refused\n");
+    return 1;
+  }
+  step_end("connect", start);
+
+  start = step_begin();
+  if (mqtt_publish(&ssl, argv[6]) != 0) {
+    fprintf(stderr, "MQTT publish failed\n");
+    return 1;
+  }
+  step_end("publish", start);
+  printf("total in use %zu\n", heap_now);
+
+  mbedtls_ssl_close_notify(&ssl);
+  mbedtls_net_free(&net);
+  mbedtls_ssl_free(&ssl);
+  mbedtls_ssl_config_free(&conf);
+  mbedtls_x509_crt_free(&ca);
+  mbedtls_x509_crt_free(&cert);
+  mbedtls_pk_free(&key);
+  mbedtls_ctr_drbg_free(&drbg);
+  mbedtls_entropy_free(&entropy);
+  return 0;
+}
@@ -0,0 +1,210 @@
+// Host simulation of how the wake policies spread a fleet's connections
+// over the reporting period, with and without staggering and jitter.
+//
+//   cc -O2 -Iinclude -o wake_schedule_sim tools/wake_schedule_sim.c
+//      src/wake_schedule.c
+//   ./wake_schedule_sim [devices] [sleep_seconds] [connects_per_second]
+//      [hours]
+//
+// Only the scheduling is the firmware's: the sleep comes from
+// wake_schedule_delay. The rest is a model. Nothing goes over a network,
+// the MQTT client, TLS and the payloads are not run, and the broker is a
+// queue that takes one connect at a time at the given rate.
+//
+// Every device boots within BOOT_SPREAD_MS of the others, as after a power
+// cut, then wakes, joins Wi-Fi and connects once a cycle. Connects still
+// queued after CONNECT_TIMEOUT_MS give up like the connect phase.
+// Staggering needs the clock, which a device only has after its first
+// connection.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wake_schedule.h"
+
+#define BOOT_SPREAD_MS 2000
+#define BOOT_MS 300
+#define WIFI_MIN_MS 400
+#define WIFI_SPREAD_MS 400
+#define PUBLISH_MS 150
+#define CONNECT_TIMEOUT_MS 15000
+// The devices' clocks, and so their periods, are up to this far apart.
+#define DRIFT_PPM 100
+
+typedef struct {
+  const char *name;
+  bool stagger;
+  uint32_t jitter_ms;
+} policy;
+
+static const policy policies[] = {
+    {"none", false, 0},
+    {"jitter 2s", false, 2000},
+    {"jitter 10s", false, 10000},
+    {"stagger", true, 0},
+    {"stagger + jitter 2s", true, 2000},
+};
+
+typedef struct {
+  char name[24];
+  int64_t arrive_ms;
+  int64_t clock_offset_ms;
+  int32_t drift_ppm;
+  bool synced;
+} device;
+
+static uint32_t rng_state;
+
+static uint32_t next_random(void) {
+  rng_state = rng_state * 1664525u + 1013904223u;
+  return rng_state;
+}
+
+// The latency with a share p of the connects at or below it.
+static uint32_t percentile(const uint32_t *latencies, uint64_t count,
+                           double p) {
+  uint64_t seen = 0;
+
+  for (uint32_t ms = 0; ms < CONNECT_TIMEOUT_MS; ms++) {
+    seen += latencies[ms];
+    if (seen > p * count) {
+      return ms;
+    }
+  }
+  return CONNECT_TIMEOUT_MS;
+}
+
+// Min-heap of the devices by their next arrival at the broker.
+static void sift_down(device **heap, size_t count, size_t i) {
+  for (;;) {
+    size_t smallest = i, left = 2 * i + 1, right = left + 1;
+    if (left < count && heap[left]->arrive_ms < heap[smallest]->arrive_ms) {
+      smallest = left;
+    }
+    if (right < count && heap[right]->arrive_ms < heap[smallest]->arrive_ms) {
+      smallest = right;
+    }
+    if (smallest == i) {
+      return;
+    }
+    device *swap = heap[i];
+    heap[i] = heap[smallest];
+    heap[smallest] = swap;
+    i = smallest;
+  }
+}
+
+static int64_t to_arrival(int64_t wake_ms) {
+  return wake_ms + BOOT_MS + WIFI_MIN_MS + next_random() % WIFI_SPREAD_MS;
+}
+
+static void simulate(const policy *policy, uint32_t devices,
+                     uint32_t period_ms, uint32_t connect_ms, double hours) {
+  device *fleet = calloc(devices, sizeof(device));
+  device **heap = calloc(devices, sizeof(device *));
+  int64_t end_ms = (int64_t)(hours * 3600000);
+  uint32_t seconds = (uint32_t)(end_ms / 1000) + 1;
+  uint32_t *per_second = calloc(seconds, sizeof(uint32_t));
+  // Connects by their latency in milliseconds.
+  uint32_t *latencies = calloc(CONNECT_TIMEOUT_MS + 1, sizeof(uint32_t));
+  uint64_t connects = 0, timeouts = 0;
+  int64_t broker_free_ms = 0;
+  // Skip the first cycles, the boot storm is the same for every policy.
+  int64_t settled_ms = (int64_t)period_ms * 10;
+
+  rng_state = 12345;
+
+  for (uint32_t i = 0; i < devices; i++) {
+    snprintf(fleet[i].name, sizeof(fleet[i].name), "sensor-%05u", i);
+    // The wall clock is only known after a connection, it is right to the
+    // time sync's few tens of milliseconds.
+    fleet[i].clock_offset_ms = next_random() % 50;
+    fleet[i].drift_ppm = (int32_t)(next_random() % (2 * DRIFT_PPM + 1)) -
+                         DRIFT_PPM;
+    fleet[i].arrive_ms = to_arrival(next_random() % BOOT_SPREAD_MS);
+    heap[i] = &fleet[i];
+  }
+  for (size_t i = devices / 2 + 1; i-- > 0;) {
+    sift_down(heap, devices, i);
+  }
+
+  while (heap[0]->arrive_ms < end_ms) {
+    device *d = heap[0];
+    int64_t start_ms = d->arrive_ms > broker_free_ms ? d->arrive_ms
+                                                     : broker_free_ms;
+    int64_t done_ms;
+    bool settled = d->arrive_ms >= settled_ms;
+
+    per_second[d->arrive_ms / 1000]++;
+    if (start_ms + connect_ms - d->arrive_ms > CONNECT_TIMEOUT_MS) {
+      // Gave up, the broker never starts on it.
+      timeouts += settled;
+      done_ms = d->arrive_ms + CONNECT_TIMEOUT_MS;
+    } else {
+      broker_free_ms = start_ms + connect_ms;
+      if (settled) {
+        latencies[broker_free_ms - d->arrive_ms]++;
+        connects++;
+      }
+      d->synced = true;
+      done_ms = broker_free_ms + PUBLISH_MS;
+    }
+
+    uint32_t sleep_ms = wake_schedule_delay(
+        done_ms + d->clock_offset_ms, policy->stagger && d->synced,
+        period_ms, wake_schedule_phase(d->name, period_ms), policy->jitter_ms,
+        next_random());
+    sleep_ms += (int64_t)sleep_ms * d->drift_ppm / 1000000;
+    d->arrive_ms = to_arrival(done_ms + sleep_ms);
+    sift_down(heap, devices, 0);
+  }
+
+  uint32_t from = (uint32_t)(settled_ms / 1000);
+  uint32_t peak = 0, busy = 0, counted = 0;
+  uint64_t sum = 0;
+  for (uint32_t s = from; s < seconds - 1; s++) {
+    sum += per_second[s];
+    counted++;
+    if (per_second[s] > peak) {
+      peak = per_second[s];
+    }
+    if (per_second[s] * connect_ms > 1000) {
+      busy++;
+    }
+  }
+
+  printf("%-20s %8.1f %6u %8.1f%% %8u %8u %8.2f%%\n", policy->name,
+         counted ? (double)sum / counted : 0, peak,
+         counted ? busy * 100.0 / counted : 0,
+         percentile(latencies, connects, 0.5),
+         percentile(latencies, connects, 0.99),
+         connects + timeouts ? timeouts * 100.0 / (connects + timeouts) : 0);
+
+  free(latencies);
+  free(per_second);
+  free(heap);
+  free(fleet);
+}
+
+int main(int argc, char **argv) {
+  uint32_t devices = argc > 1 ? atoi(argv[1]) : 2000;
+  uint32_t sleep_seconds = argc > 2 ? atoi(argv[2]) : 15;
+  uint32_t rate = argc > 3 ? atoi(argv[3]) : 500;
+  double hours = argc > 4 ? atof(argv[4]) : 1;
+
+  if (devices == 0 || sleep_seconds == 0 || rate == 0 || rate > 1000) {
+    fprintf(stderr, "Need devices, sleep seconds and 1-1000 connects/s\n");
+    return 2;
+  }
+
+  printf("%u devices every %us, broker takes %u connects/s, %.1f h\n",
+         devices, sleep_seconds, rate, hours);
+  printf("%-20s %8s %6s %9s %8s %8s %9s\n", "policy", "mean/s", "peak/s",
+         "over rate", "p50 ms", "p99 ms", "timeouts");
+
+  for (size_t i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+    simulate(&policies[i], devices, sleep_seconds * 1000, 1000 / rate, hours);
+  }
+
+  return 0;
+}